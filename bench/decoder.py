@@ -0,0 +1,227 @@
+"""Wire replay benchmark for the protocol decoder.
+
+Feeds backend wire streams through BaseProt.get_buffer/buffer_updated
+without a socket and prints one JSON object per stream:
+
+    python -m bench.decoder [--scenario NAME]... [--file FILE]...
+                            [--result-format tuples|arrow]
+                            [--decode-threads N]
+                            [--row-factory tuple|record|dict]
+
+Streams are either generated (see bench.wire.SCENARIOS) or recorded from a
+live server:
+
+    python -m bench.decoder --record FILE --query SQL [--database DB] ...
+
+Reported are the best rows/s and MB/s over the repeats and the number of
+memory blocks that a result keeps allocated per decoded row
+(sys.getallocatedblocks), which is a measure for the objects it holds per
+row. Temporary allocations during decoding are not counted. For the replication
+stream the rows are the decoded changes.
+"""
+import argparse
+import asyncio
+import concurrent.futures
+import gc
+import json
+import platform
+import statistics
+import sys
+import time
+
+import poqaio
+from poqaio._poqaio import (
+    RESULT_ARROW, RESULT_TUPLES, ROW_DICT, ROW_RECORD, ROW_TUPLE)
+from poqaio.protocol import PGProtocol
+
+from .wire import SCENARIOS, parameter_status, record_stream
+
+RESULT_FORMATS = {'tuples': RESULT_TUPLES, 'arrow': RESULT_ARROW}
+ROW_FACTORIES = {'tuple': ROW_TUPLE, 'record': ROW_RECORD, 'dict': ROW_DICT}
+
+
+class ReplayTransport:
+
+    def write(self, data):
+        pass
+
+    def is_closing(self):
+        return False
+
+    def close(self):
+        pass
+
+
+def feed(protocol, stream, chunk_size):
+    view = memoryview(stream)
+    pos = 0
+    end = len(stream)
+    while pos < end:
+        buf = protocol.get_buffer(-1)
+        nbytes = min(len(buf), chunk_size, end - pos)
+        buf[:nbytes] = view[pos:pos + nbytes]
+        protocol.buffer_updated(nbytes)
+        pos += nbytes
+
+
+def make_protocol(chunk_size, decode_pool=None, row_factory='tuple'):
+    protocol = PGProtocol()
+    protocol.connection_made(ReplayTransport())
+    if decode_pool is not None:
+        protocol.set_decode_pool(decode_pool.submit)
+    protocol.set_row_factory(ROW_FACTORIES[row_factory])
+    feed(protocol, parameter_status('client_encoding', 'UTF8'), chunk_size)
+    return protocol
+
+
+def replay(protocol, stream, chunk_size, result_format=RESULT_TUPLES):
+    if stream[:1] == b'W':
+        # replication stream, the result is the list of batches
+        batches = []
+        fut = protocol.start_replication(
+            "replay", lambda changes, lsn: batches.append(changes), 0, 0.0)
+        feed(protocol, stream, chunk_size)
+        if not fut.done():
+            raise RuntimeError("Stream does not end with ReadyForQuery")
+        return fut.exception() or batches
+    fut = protocol.execute("replay", None, None, result_format)
+    feed(protocol, stream, chunk_size)
+    if not fut.done():
+        raise RuntimeError("Stream does not end with ReadyForQuery")
+    if fut.exception() is not None:
+        return fut.exception()
+    return fut.result()
+
+
+def measure(name, stream, repeat, chunk_size, min_time,
+            result_format='tuples', decode_threads=0, row_factory='tuple'):
+    decode_pool = None
+    if decode_threads:
+        decode_pool = concurrent.futures.ThreadPoolExecutor(decode_threads)
+    protocol = make_protocol(chunk_size, decode_pool, row_factory)
+    format_name, result_format = result_format, RESULT_FORMATS[result_format]
+
+    # warm up and count rows
+    rows = protocol.stats.rows
+    result = replay(protocol, stream, chunk_size, result_format)
+    rows = protocol.stats.rows - rows
+    if stream[:1] == b'W':
+        # decoded changes
+        rows = sum(len(changes) for changes in result)
+    del result
+
+    # calibrate number of replays per sample
+    loops = 1
+    while True:
+        start = time.perf_counter()
+        for _ in range(loops):
+            replay(protocol, stream, chunk_size, result_format)
+        if time.perf_counter() - start >= min_time:
+            break
+        loops *= 2
+
+    timings = []
+    for _ in range(repeat):
+        start = time.perf_counter()
+        for _ in range(loops):
+            replay(protocol, stream, chunk_size, result_format)
+        timings.append((time.perf_counter() - start) / loops)
+
+    # blocks kept alive by a single result
+    gc.collect()
+    blocks = sys.getallocatedblocks()
+    result = replay(protocol, stream, chunk_size, result_format)
+    blocks = sys.getallocatedblocks() - blocks
+    del result
+
+    if decode_pool is not None:
+        decode_pool.shutdown()
+
+    best = min(timings)
+    return {
+        "benchmark": name,
+        "bytes": len(stream),
+        "rows": rows,
+        "chunk_size": chunk_size,
+        "result_format": format_name,
+        "decode_threads": decode_threads,
+        "row_factory": row_factory,
+        "seconds": best,
+        "seconds_median": statistics.median(timings),
+        "rows_per_s": rows / best,
+        "mb_per_s": len(stream) / best / 1e6,
+        "retained_blocks_per_row": blocks / rows if rows else None,
+        "python": platform.python_version(),
+        "poqaio": poqaio.__version__,
+    }
+
+
+async def run(args):
+    streams = []
+    for name in args.scenario or ([] if args.file else list(SCENARIOS)):
+        streams.append((name, SCENARIOS[name]()))
+    for path in args.file:
+        with open(path, 'rb') as f:
+            streams.append((path, f.read()))
+
+    out = open(args.output, 'w') if args.output else sys.stdout
+    try:
+        for name, stream in streams:
+            res = measure(
+                name, stream, args.repeat, args.chunk_size, args.min_time,
+                args.result_format, args.decode_threads, args.row_factory)
+            print(json.dumps(res, sort_keys=True), file=out, flush=True)
+    finally:
+        if args.output:
+            out.close()
+
+
+async def record(args):
+    stream = await record_stream(
+        args.query, host=args.host, port=args.port, database=args.database,
+        user=args.user, password=args.password)
+    with open(args.record, 'wb') as f:
+        f.write(stream)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    parser.add_argument(
+        '--scenario', action='append', choices=sorted(SCENARIOS),
+        help="generated stream to replay, all when no files are given")
+    parser.add_argument(
+        '--file', action='append', default=[],
+        help="recorded stream to replay")
+    parser.add_argument('--repeat', type=int, default=5)
+    parser.add_argument('--min-time', type=float, default=0.2,
+                        help="minimum duration of a sample in seconds")
+    parser.add_argument('--chunk-size', type=int, default=65536,
+                        help="maximum number of bytes per buffer_updated")
+    parser.add_argument('--result-format', choices=RESULT_FORMATS,
+                        default='tuples')
+    parser.add_argument('--decode-threads', type=int, default=0,
+                        help="decode data rows in a pool of N threads")
+    parser.add_argument('--row-factory', choices=ROW_FACTORIES,
+                        default='tuple')
+    parser.add_argument('--output', help="file for the JSON lines")
+
+    parser.add_argument('--record', metavar='FILE',
+                        help="record the response to --query into FILE")
+    parser.add_argument('--query')
+    parser.add_argument('--host')
+    parser.add_argument('--port', type=int)
+    parser.add_argument('--database')
+    parser.add_argument('--user')
+    parser.add_argument('--password')
+    args = parser.parse_args()
+
+    if args.record:
+        if not args.query:
+            parser.error("--record requires --query")
+        asyncio.run(record(args))
+    else:
+        asyncio.run(run(args))
+
+
+if __name__ == '__main__':
+    main()
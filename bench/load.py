@@ -0,0 +1,135 @@
+"""End to end load harness.
+
+Drives concurrent coroutines through Connection.execute against the in
+process mock server, or an external server, and prints a JSON object with
+throughput and latency percentiles:
+
+    python -m bench.load [--connections N] [--concurrency C] [--queries Q]
+                         [--rows R] [--latency SECONDS] [--params]
+                         [--server HOST:PORT] [--direct] [--shards K]
+"""
+import argparse
+import asyncio
+import json
+import platform
+import time
+
+import poqaio
+from poqaio import connect, create_pool
+
+from .mockserver import MockServer, rows_response
+
+
+def percentile(latencies, fraction):
+    # latencies must be sorted
+    return latencies[min(len(latencies) - 1, int(fraction * len(latencies)))]
+
+
+async def run_load(host, port, connections=4, concurrency=16, queries=10000,
+                   query="SELECT id, name FROM items", params=None,
+                   shards=None, **connect_kwargs):
+    """Execute queries and return throughput and latency statistics.
+
+    With shards, the connections are spread over a pool with that many event
+    loop threads.
+    """
+    if shards:
+        pool = await create_pool(
+            shards, max(1, connections // shards), host=host, port=port,
+            **connect_kwargs)
+        conns = [await pool.acquire() for _ in range(connections)]
+    else:
+        pool = None
+        conns = [
+            await connect(host=host, port=port, **connect_kwargs)
+            for _ in range(connections)]
+    idle = asyncio.Queue()
+    for cn in conns:
+        idle.put_nowait(cn)
+
+    latencies = []
+    remaining = queries
+
+    async def worker():
+        nonlocal remaining
+        while remaining > 0:
+            remaining -= 1
+            cn = await idle.get()
+            try:
+                start = time.perf_counter()
+                await cn.execute(query, params)
+                latencies.append(time.perf_counter() - start)
+            finally:
+                idle.put_nowait(cn)
+
+    start = time.perf_counter()
+    await asyncio.gather(*[worker() for _ in range(concurrency)])
+    duration = time.perf_counter() - start
+
+    if pool is None:
+        for cn in conns:
+            await cn.close()
+    else:
+        for cn in conns:
+            pool.release(cn)
+        await pool.close()
+
+    latencies.sort()
+    ms = 1000
+    return {
+        "queries": len(latencies),
+        "connections": connections,
+        "concurrency": concurrency,
+        "seconds": duration,
+        "queries_per_s": len(latencies) / duration,
+        "mean_ms": sum(latencies) / len(latencies) * ms,
+        "p50_ms": percentile(latencies, 0.5) * ms,
+        "p99_ms": percentile(latencies, 0.99) * ms,
+        "p999_ms": percentile(latencies, 0.999) * ms,
+        "max_ms": latencies[-1] * ms,
+    }
+
+
+async def run(args):
+    params = [1, 'name'] if args.params else None
+    kwargs = dict(
+        connections=args.connections, concurrency=args.concurrency,
+        queries=args.queries, params=params, direct=args.direct,
+        shards=args.shards)
+    if args.server:
+        host, _, port = args.server.rpartition(':')
+        res = await run_load(host, int(port), **kwargs)
+    else:
+        server = MockServer(
+            default=lambda query, params: rows_response(args.rows),
+            latency=args.latency)
+        async with server:
+            res = await run_load(server.host, server.port, **kwargs)
+        res.update(rows=args.rows, latency_s=args.latency)
+    res.update(direct=args.direct, shards=args.shards)
+    res.update(python=platform.python_version(), poqaio=poqaio.__version__)
+    print(json.dumps(res, sort_keys=True))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    parser.add_argument('--connections', type=int, default=4)
+    parser.add_argument('--concurrency', type=int, default=16)
+    parser.add_argument('--queries', type=int, default=10000)
+    parser.add_argument('--rows', type=int, default=1,
+                        help="rows per result of the mock server")
+    parser.add_argument('--latency', type=float, default=0.0,
+                        help="injected mock server latency in seconds")
+    parser.add_argument('--params', action='store_true',
+                        help="use the extended query protocol")
+    parser.add_argument('--server', metavar='HOST:PORT',
+                        help="use an external server instead of the mock")
+    parser.add_argument('--direct', action='store_true',
+                        help="let the protocol do the socket I/O itself")
+    parser.add_argument('--shards', type=int, metavar='K',
+                        help="spread the connections over K event loops")
+    asyncio.run(run(parser.parse_args()))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,558 @@
+"""In-process stand-in for a PostgreSQL server.
+
+Speaks the subset of the protocol that poqaio uses: startup with trust, md5
+or SCRAM-SHA-256 authentication, the simple query protocol and the unnamed
+statement/portal part of the extended query protocol, besides named
+statements that are prepared and executed. Responses are scripted:
+
+    server = MockServer({
+        "SELECT 1": Response([('col', INT4OID)], [('1',)]),
+        "UPDATE t SET a = 1": Response(tag="UPDATE 3", latency=0.002),
+    })
+    await server.start()
+    cn = await connect(host=server.host, port=server.port)
+
+Queries that are not scripted are passed to the default responder, which
+answers with an empty command tag. It runs as a script as well:
+
+    python -m bench.mockserver [--port PORT] [--rows N] [--latency SECONDS]
+                               [--auth md5|scram-sha-256 --password PWD]
+                               [--standby]
+
+Several servers, some with standby=True, stand in for a primary with its
+standbys.
+
+START_REPLICATION streams the (lsn, pgoutput message) tuples of the
+replication argument, see bench.wire.replication_changes, followed by a
+keepalive that asks for a reply, until the client ends the stream. The
+standby status updates of the client are kept in feedback.
+"""
+import argparse
+import asyncio
+import base64
+import hashlib
+import hmac
+import os
+import re
+import struct
+
+from poqaio.public_const import INT4OID, TEXTOID
+
+from . import wire
+
+
+class Response:
+
+    def __init__(
+            self, fields=None, rows=(), tag=None, error=None, latency=None,
+            notices=(), param_types=None, syntax_error=False):
+        self.fields = fields
+        self.rows = rows
+        self.tag = tag
+        self.error = error  # (sqlstate, message) tuple
+        self.latency = latency
+        self.notices = notices  # (sqlstate, message) tuples
+        # described parameter type oids, text for every $n by default
+        self.param_types = param_types
+        # the error is raised when a simple query string is parsed, before
+        # any of its statements runs
+        self.syntax_error = syntax_error
+
+    def describe(self):
+        if self.fields is None or self.error:
+            return wire.message(b'n', b'')
+        return wire.row_description(self.fields)
+
+    def describe_statement(self, query):
+        param_types = self.param_types
+        if param_types is None:
+            numbers = re.findall(r'\$(\d+)', query)
+            param_types = [TEXTOID] * max(map(int, numbers), default=0)
+        return wire.parameter_description(param_types) + self.describe()
+
+    def simple_query(self):
+        if self.fields is None or self.error:
+            return self.execute()
+        return wire.row_description(self.fields) + self.execute()
+
+    def execute(self):
+        if self.error:
+            return wire.error_response(*self.error)
+        data = [wire.error_response(code, text, 'NOTICE', b'N')
+                for code, text in self.notices]
+        data.extend(wire.data_row(row) for row in self.rows)
+        tag = self.tag
+        if tag is None:
+            tag = f"SELECT {len(self.rows)}" if self.fields else "SET"
+        data.append(wire.command_complete(tag))
+        return b''.join(data)
+
+
+def rows_response(num_rows, latency=None):
+    fields = [('id', INT4OID), ('name', TEXTOID)]
+    rows = [(str(i), f"name {i}") for i in range(num_rows)]
+    return Response(fields, rows, latency=latency)
+
+
+class MockServer:
+
+    def __init__(self, script=None, default=None, latency=0.0,
+                 parameters=None, auth=None, password=None,
+                 scram_iterations=4096, standby=False, replication=()):
+        self.script = dict(script or {})
+        self.auth = auth  # None (trust), 'md5' or 'scram-sha-256'
+        self.password = password
+        self.scram_iterations = scram_iterations
+        self.scram_salt = os.urandom(16)
+        self.default = default or (lambda query, params: Response())
+        self.latency = latency
+        self.parameters = {
+            "server_version": "14.0",
+            "server_encoding": "UTF8",
+            "client_encoding": "UTF8",
+            "DateStyle": "ISO, MDY",
+            "integer_datetimes": "on",
+            "is_superuser": "on",
+            "standard_conforming_strings": "on",
+            "TimeZone": "UTC",
+            # a standby is read only
+            "in_hot_standby": "on" if standby else "off",
+            "default_transaction_read_only": "on" if standby else "off",
+        }
+        self.parameters.update(parameters or {})
+        self.queries = []  # (query, params) log
+        self.replication = list(replication)
+        # whether a keepalive asking for a reply follows the changes
+        self.keepalive = True
+        # (written, flushed, applied, client time, reply) per status update
+        self.feedback = []
+        self.server = None
+        self.host = None
+        self.port = None
+        self._next_pid = 1000
+        self._handlers = set()
+        self._listening = {}  # writer -> (process id, set of channels)
+
+    def respond(self, query, params):
+        self.queries.append((query, params))
+        return self._response(query, params)
+
+    def _response(self, query, params):
+        response = self.script.get(query)
+        if response is None:
+            keywords = query.split(None, 1)
+            keyword = keywords[0].upper() if keywords else ''
+            if keyword in _command_keywords:
+                # no rows, whatever the default
+                return Response(tag=keyword)
+            response = self.default(query, params)
+        return response
+
+    def notify(self, channel, payload='', pid=0):
+        """Send a notification to the connections listening on channel."""
+        message = wire.notification_response(pid, channel, payload)
+        for writer, (_, channels) in self._listening.items():
+            if channel in channels:
+                writer.write(message)
+
+    def _listen(self, query, writer):
+        # Handles LISTEN, UNLISTEN and NOTIFY statements
+        words = query.replace(',', ' ').split(None, 2)
+        if len(words) < 2:
+            return
+        keyword, channel = words[0].upper(), words[1].strip('"')
+        pid, channels = self._listening.get(writer, (0, set()))
+        if keyword == 'LISTEN':
+            channels.add(channel)
+        elif keyword == 'UNLISTEN':
+            channels.discard(channel)
+        elif keyword == 'NOTIFY':
+            payload = words[2].strip().strip("'") if len(words) > 2 else ''
+            self.notify(channel, payload, pid)
+
+    @property
+    def connections(self):
+        """Number of open client connections."""
+        return len(self._listening)
+
+    async def start(self, host='127.0.0.1', port=0):
+        self.server = await asyncio.start_server(self._serve, host, port)
+        self.host, self.port = self.server.sockets[0].getsockname()[:2]
+        return self
+
+    async def close(self):
+        if self.server is not None:
+            self.server.close()
+            for handler in self._handlers:
+                handler.cancel()
+            await asyncio.gather(*self._handlers, return_exceptions=True)
+            await self.server.wait_closed()
+            self.server = None
+
+    async def __aenter__(self):
+        if self.server is None:
+            await self.start()
+        return self
+
+    async def __aexit__(self, *exc):
+        await self.close()
+
+    async def _delay(self, response):
+        latency = self.latency if response.latency is None else \
+            response.latency
+        if latency:
+            await asyncio.sleep(latency)
+
+    async def _startup(self, reader, writer):
+        while True:
+            length, = struct.unpack('!i', await reader.readexactly(4))
+            body = await reader.readexactly(length - 4)
+            code, = struct.unpack_from('!i', body)
+            if code == 80877103:
+                # SSLRequest, not supported
+                writer.write(b'N')
+                continue
+            if code != 196608:
+                return None
+            items = body[4:].split(b'\0')
+            return {
+                k.decode(): v.decode()
+                for k, v in zip(items[0::2], items[1::2]) if k}
+
+    async def _serve(self, reader, writer):
+        handler = asyncio.current_task()
+        self._handlers.add(handler)
+        try:
+            startup = await self._startup(reader, writer)
+            if startup is None:
+                return
+            if self.auth and not await self._authenticate(
+                    reader, writer, startup.get("user", "")):
+                writer.write(wire.error_response(
+                    "28P01", "password authentication failed", "FATAL"))
+                return
+            out = [wire.message(b'R', b'\0\0\0\0')]
+            parameters = dict(self.parameters)
+            for name, value in _parse_options(
+                    startup.get("options", "")).items():
+                if name in parameters:
+                    # reported setting
+                    parameters[name] = value
+            parameters["application_name"] = startup.get(
+                "application_name", "")
+            for name, value in parameters.items():
+                if value is not None:
+                    # None leaves it out, like older servers do
+                    out.append(wire.parameter_status(name, value))
+            self._next_pid += 1
+            self._listening[writer] = (self._next_pid, set())
+            out.append(wire.message(
+                b'K', struct.pack('!ii', self._next_pid, 12345)))
+            out.append(wire.ready_for_query())
+            writer.write(b''.join(out))
+            await self._serve_queries(reader, writer)
+        except (asyncio.IncompleteReadError, ConnectionError,
+                asyncio.CancelledError):
+            pass
+        finally:
+            self._handlers.discard(handler)
+            self._listening.pop(writer, None)
+            writer.close()
+
+    async def _read_password(self, reader):
+        identifier, length = struct.unpack('!ci', await reader.readexactly(5))
+        body = await reader.readexactly(length - 4)
+        if identifier != b'p':
+            raise ConnectionError("Expected password message")
+        return body
+
+    async def _authenticate(self, reader, writer, user):
+        if self.auth == 'md5':
+            salt = os.urandom(4)
+            writer.write(wire.message(b'R', struct.pack('!i', 5) + salt))
+            inner = hashlib.md5(
+                self.password.encode() + user.encode()).hexdigest()
+            expected = b'md5' + hashlib.md5(
+                inner.encode() + salt).hexdigest().encode() + b'\0'
+            return await self._read_password(reader) == expected
+
+        # SCRAM-SHA-256, RFC 5802 and 7677
+        writer.write(wire.message(
+            b'R', struct.pack('!i', 10) + b'SCRAM-SHA-256\0\0'))
+        body = await self._read_password(reader)
+        mechanism, _, rest = body.partition(b'\0')
+        client_first = rest[4:].decode()
+        client_bare = client_first.split(',', 2)[2]
+        client_nonce = dict(
+            attr.split('=', 1) for attr in client_bare.split(','))['r']
+        nonce = client_nonce + base64.b64encode(os.urandom(18)).decode()
+        server_first = (
+            f"r={nonce},s={base64.b64encode(self.scram_salt).decode()},"
+            f"i={self.scram_iterations}")
+        writer.write(wire.message(
+            b'R', struct.pack('!i', 11) + server_first.encode()))
+
+        client_final = (await self._read_password(reader)).decode()
+        without_proof, _, proof = client_final.rpartition(',p=')
+        auth_message = ','.join(
+            [client_bare, server_first, without_proof]).encode()
+        salted = hashlib.pbkdf2_hmac(
+            'sha256', self.password.encode(), self.scram_salt,
+            self.scram_iterations)
+        client_key = hmac.digest(salted, b'Client Key', 'sha256')
+        stored_key = hashlib.sha256(client_key).digest()
+        signature = hmac.digest(stored_key, auth_message, 'sha256')
+        recovered = bytes(
+            a ^ b for a, b in zip(base64.b64decode(proof), signature))
+        if (mechanism != b'SCRAM-SHA-256' or
+                without_proof != f"c=biws,r={nonce}" or
+                hashlib.sha256(recovered).digest() != stored_key):
+            return False
+        server_key = hmac.digest(salted, b'Server Key', 'sha256')
+        server_signature = hmac.digest(server_key, auth_message, 'sha256')
+        writer.write(wire.message(
+            b'R', struct.pack('!i', 12) + b'v=' +
+            base64.b64encode(server_signature)))
+        return True
+
+    async def _replicate(self, reader, writer):
+        # Streams the scripted changes in CopyBoth mode until the client
+        # sends CopyDone. Returns False when the client terminated.
+        writer.write(wire.copy_both_response())
+        wal_end = 0
+        for lsn, payload in self.replication:
+            writer.write(wire.xlog_data(lsn, payload))
+            wal_end = max(wal_end, lsn + len(payload))
+            await writer.drain()
+        if self.keepalive:
+            writer.write(wire.keepalive(wal_end, reply=True))
+        while True:
+            identifier, body = await _read_message(reader)
+            if identifier == b'X':
+                return False
+            if identifier == b'd' and body[:1] == b'r':
+                self.feedback.append(struct.unpack_from('!QQQq?', body, 1))
+            elif identifier == b'c':
+                writer.write(
+                    wire.copy_done() +
+                    wire.command_complete("START_REPLICATION") +
+                    wire.ready_for_query())
+                return True
+
+    async def _serve_queries(self, reader, writer):
+        status = b'I'
+        out = []
+        statements = {}  # name -> query, '' for the unnamed statement
+        statement = None
+        response = None
+        failed = False
+
+        while True:
+            identifier = await reader.readexactly(1)
+            length, = struct.unpack('!i', await reader.readexactly(4))
+            body = await reader.readexactly(length - 4)
+
+            if identifier == b'X':
+                return
+            if identifier == b'Q':
+                if body[:17].upper() == b'START_REPLICATION':
+                    self.queries.append((body[:-1].decode(), None))
+                    if not await self._replicate(reader, writer):
+                        return
+                    continue
+                # statements separated by semicolons, naively
+                queries = body[:-1].decode().split(';')
+                response = next((
+                    self.script[query.strip()] for query in queries
+                    if getattr(self.script.get(query.strip()),
+                               'syntax_error', False)), None)
+                if response is not None:
+                    self.queries.append((body[:-1].decode(), None))
+                    status = _transaction_status(status, '', response)
+                    writer.write(
+                        response.simple_query() +
+                        wire.ready_for_query(status))
+                    continue
+                data = []
+                for query in queries:
+                    query = query.strip()
+                    if not query and data:
+                        continue
+                    self._listen(query, writer)
+                    if query[:10].upper() == 'DEALLOCATE':
+                        statements.pop(query[10:].strip().strip('"'), None)
+                    response = self.respond(query, None)
+                    await self._delay(response)
+                    status = _transaction_status(status, query, response)
+                    data.append(response.simple_query())
+                    if response.error:
+                        break
+                writer.write(b''.join(data) + wire.ready_for_query(status))
+                continue
+            if identifier == b'S':
+                # Sync
+                if response is not None:
+                    await self._delay(response)
+                out.append(wire.ready_for_query(status))
+                writer.write(b''.join(out))
+                out = []
+                response = None
+                failed = False
+                continue
+            if failed:
+                # skip until sync after an error
+                continue
+            if identifier == b'P':
+                name, rest = body.split(b'\0', 1)
+                query, rest = rest.split(b'\0', 1)
+                statements[name.decode()] = query.decode()
+                out.append(wire.message(b'1', b''))
+            elif identifier == b'B':
+                name, params = _parse_bind(body)
+                statement = statements.get(name)
+                if statement is None:
+                    out.append(_unknown_statement(name))
+                    failed = True
+                    continue
+                self._listen(statement, writer)
+                response = self.respond(statement, params)
+                out.append(wire.message(b'2', b''))
+            elif identifier == b'D' and body[:1] == b'S':
+                name = body[1:-1].decode()
+                query = statements.get(name)
+                if query is None:
+                    out.append(_unknown_statement(name))
+                    failed = True
+                    continue
+                out.append(
+                    self._response(query, None).describe_statement(query))
+            elif identifier == b'D':
+                out.append(response.describe())
+            elif identifier == b'E':
+                out.append(response.execute())
+                status = _transaction_status(status, statement, response)
+                failed = bool(response.error)
+            elif identifier == b'H':
+                writer.write(b''.join(out))
+                out = []
+            else:
+                out.append(wire.error_response(
+                    '08P01', f"unsupported message {identifier!r}"))
+                failed = True
+
+
+async def _read_message(reader):
+    identifier = await reader.readexactly(1)
+    length, = struct.unpack('!i', await reader.readexactly(4))
+    return identifier, await reader.readexactly(length - 4)
+
+
+def _parse_options(options):
+    # "-c name=value" words of the options startup parameter
+    words, word, escaped = [], '', False
+    for char in options:
+        if escaped:
+            word += char
+            escaped = False
+        elif char == '\\':
+            escaped = True
+        elif char == ' ':
+            if word:
+                words.append(word)
+            word = ''
+        else:
+            word += char
+    if word:
+        words.append(word)
+    settings = {}
+    for flag, setting in zip(words[0::2], words[1::2]):
+        if flag == '-c':
+            name, _, value = setting.partition('=')
+            settings[name] = value
+    return settings
+
+
+_command_keywords = (
+    'BEGIN', 'START', 'COMMIT', 'END', 'ROLLBACK', 'ABORT', 'SAVEPOINT',
+    'RELEASE', 'LISTEN', 'UNLISTEN', 'NOTIFY', 'DEALLOCATE')
+
+
+def _transaction_status(status, query, response):
+    keywords = query.split(None, 1)
+    keyword = keywords[0].rstrip(';').upper() if keywords else ''
+    if response.error:
+        return b'I' if status == b'I' else b'E'
+    if keyword in ('BEGIN', 'START'):
+        return b'T'
+    if keyword == 'ROLLBACK' and keywords[1:] and \
+            keywords[1].upper().startswith('TO'):
+        # to savepoint
+        return b'T'
+    if keyword in ('COMMIT', 'ROLLBACK', 'END', 'ABORT'):
+        return b'I'
+    return status
+
+
+def _unknown_statement(name):
+    return wire.error_response(
+        '26000', f'prepared statement "{name}" does not exist')
+
+
+def _parse_bind(body):
+    # Returns the statement name and the parameters
+    pos = body.index(b'\0') + 1  # portal
+    end = body.index(b'\0', pos)
+    name = body[pos:end].decode()
+    pos = end + 1
+    num_formats, = struct.unpack_from('!h', body, pos)
+    formats = struct.unpack_from(f'!{num_formats}h', body, pos + 2)
+    pos += 2 + 2 * num_formats
+    num_params, = struct.unpack_from('!h', body, pos)
+    pos += 2
+    params = []
+    for i in range(num_params):
+        size, = struct.unpack_from('!i', body, pos)
+        pos += 4
+        if size == -1:
+            params.append(None)
+            continue
+        val = body[pos:pos + size]
+        pos += size
+        fmt = formats[i] if num_formats > 1 else (
+            formats[0] if num_formats else 0)
+        params.append(val if fmt else val.decode())
+    return name, params
+
+
+async def serve(args):
+    server = MockServer(
+        default=lambda query, params: rows_response(args.rows),
+        latency=args.latency, auth=args.auth, password=args.password,
+        standby=args.standby)
+    await server.start(args.host, args.port)
+    print(f"listening on {server.host}:{server.port}", flush=True)
+    await server.server.serve_forever()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    parser.add_argument('--host', default='127.0.0.1')
+    parser.add_argument('--port', type=int, default=0)
+    parser.add_argument('--rows', type=int, default=1,
+                        help="number of rows returned for every query")
+    parser.add_argument('--latency', type=float, default=0.0,
+                        help="delay in seconds before every response")
+    parser.add_argument('--auth', choices=['md5', 'scram-sha-256'],
+                        help="password authentication method")
+    parser.add_argument('--password', default='')
+    parser.add_argument('--standby', action='store_true',
+                        help="report to be a read only standby server")
+    args = parser.parse_args()
+    try:
+        asyncio.run(serve(args))
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,291 @@
+"""Building blocks for PostgreSQL backend wire streams.
+
+Streams are plain bytes as the server sends them after the client sent a
+query, ending in a ReadyForQuery message. They are either generated here or
+recorded from a live server with record_stream().
+"""
+import struct
+
+from poqaio.public_const import (
+    BOOLOID, FLOAT8OID, INT4OID, INT8OID, TEXTOID)
+
+
+def message(identifier, body):
+    return identifier + struct.pack('!i', len(body) + 4) + body
+
+
+def parameter_status(name, value):
+    return message(b'S', name.encode() + b'\0' + value.encode() + b'\0')
+
+
+def row_description(fields):
+    """Fields is a sequence of (name, type_oid) tuples."""
+    body = [struct.pack('!h', len(fields))]
+    for name, oid in fields:
+        body.append(name.encode() + b'\0')
+        body.append(struct.pack('!IhIhih', 0, 0, oid, -1, -1, 0))
+    return message(b'T', b''.join(body))
+
+
+def parameter_description(oids):
+    return message(
+        b't', struct.pack(f'!h{len(oids)}I', len(oids), *oids))
+
+
+def data_row(values):
+    """Values are bytes, str or None, in text format."""
+    body = [struct.pack('!h', len(values))]
+    for val in values:
+        if val is None:
+            body.append(b'\xff\xff\xff\xff')
+            continue
+        if isinstance(val, str):
+            val = val.encode()
+        body.append(struct.pack('!i', len(val)))
+        body.append(val)
+    return message(b'D', b''.join(body))
+
+
+def command_complete(tag):
+    return message(b'C', tag.encode() + b'\0')
+
+
+def error_response(code, text, severity='ERROR', identifier=b'E'):
+    fields = [
+        b'S' + severity.encode(), b'V' + severity.encode(),
+        b'C' + code.encode(), b'M' + text.encode()]
+    return message(identifier, b'\0'.join(fields) + b'\0\0')
+
+
+def notification_response(pid, channel, payload=''):
+    return message(b'A', struct.pack('!i', pid) + channel.encode() + b'\0' +
+                   payload.encode() + b'\0')
+
+
+def ready_for_query(status=b'I'):
+    return message(b'Z', status)
+
+
+def copy_both_response():
+    return message(b'W', struct.pack('!bh', 0, 0))
+
+
+def copy_data(body):
+    return message(b'd', body)
+
+
+def copy_done():
+    return message(b'c', b'')
+
+
+def xlog_data(lsn, payload, send_time=0):
+    """CopyData with a pgoutput message that starts at WAL position lsn."""
+    return copy_data(
+        b'w' + struct.pack('!QQq', lsn, lsn + len(payload), send_time) +
+        payload)
+
+
+def keepalive(wal_end, reply=False, send_time=0):
+    return copy_data(b'k' + struct.pack('!Qq?', wal_end, send_time, reply))
+
+
+# pgoutput messages, the payload of xlog_data. Times are in microseconds
+# since 2000-01-01.
+
+def pgoutput_begin(final_lsn, xid, commit_time=0):
+    return b'B' + struct.pack('!QqI', final_lsn, commit_time, xid)
+
+
+def pgoutput_commit(commit_lsn, end_lsn, commit_time=0):
+    return b'C' + struct.pack('!bQQq', 0, commit_lsn, end_lsn, commit_time)
+
+
+def pgoutput_relation(oid, namespace, name, columns, replica_identity=b'd'):
+    """Columns is a sequence of (name, type_oid, is_key) tuples."""
+    body = [
+        b'R', struct.pack('!I', oid), namespace.encode(), b'\0',
+        name.encode(), b'\0', replica_identity,
+        struct.pack('!h', len(columns))]
+    for col_name, oid, is_key in columns:
+        body.append(struct.pack('!b', 1 if is_key else 0))
+        body.append(col_name.encode() + b'\0')
+        body.append(struct.pack('!Ii', oid, -1))
+    return b''.join(body)
+
+
+def pgoutput_tuple(values):
+    """Values are bytes, str or None in text format, or ... for an
+    unchanged TOASTed value."""
+    body = [struct.pack('!h', len(values))]
+    for val in values:
+        if val is None:
+            body.append(b'n')
+        elif val is ...:
+            body.append(b'u')
+        else:
+            if isinstance(val, str):
+                val = val.encode()
+            body.append(b't' + struct.pack('!i', len(val)) + val)
+    return b''.join(body)
+
+
+def pgoutput_insert(oid, values):
+    return b'I' + struct.pack('!I', oid) + b'N' + pgoutput_tuple(values)
+
+
+def pgoutput_update(oid, values, old=None, key=True):
+    body = b'U' + struct.pack('!I', oid)
+    if old is not None:
+        body += (b'K' if key else b'O') + pgoutput_tuple(old)
+    return body + b'N' + pgoutput_tuple(values)
+
+
+def pgoutput_delete(oid, old, key=True):
+    return (b'D' + struct.pack('!I', oid) + (b'K' if key else b'O') +
+            pgoutput_tuple(old))
+
+
+def pgoutput_truncate(oids, options=0):
+    return b'T' + struct.pack(f'!Ib{len(oids)}I', len(oids), options, *oids)
+
+
+def replication_changes(num_rows, rows_per_transaction=100, oid=16384,
+                        lsn=0x1000000):
+    """Returns the (lsn, pgoutput message) tuples of transactions that
+    insert num_rows rows and update every tenth of them."""
+    fields = [('id', INT4OID), ('name', TEXTOID), ('amount', FLOAT8OID)]
+    messages = [(lsn, pgoutput_relation(
+        oid, 'public', 'items',
+        [(name, type_oid, name == 'id') for name, type_oid in fields]))]
+    rows = _rows(fields, num_rows)
+    xid = 1000
+    for start in range(0, num_rows, rows_per_transaction):
+        xid += 1
+        changes = []
+        for row in rows[start:start + rows_per_transaction]:
+            changes.append(pgoutput_insert(oid, row))
+            if int(row[0]) % 10 == 0:
+                changes.append(pgoutput_update(oid, row[:2] + ('0',)))
+        end_lsn = lsn + 100 * (len(changes) + 2)
+        messages.append((lsn, pgoutput_begin(end_lsn - 100, xid)))
+        for change in changes:
+            lsn += 100
+            messages.append((lsn, change))
+        messages.append((lsn + 100, pgoutput_commit(end_lsn - 100, end_lsn)))
+        lsn = end_lsn
+    return messages
+
+
+def replication(num_rows=100000):
+    """Replication stream from CopyBothResponse to the end of the command."""
+    return b''.join([
+        copy_both_response(),
+        b''.join(
+            xlog_data(lsn, payload)
+            for lsn, payload in replication_changes(num_rows)),
+        copy_done(),
+        command_complete("START_REPLICATION"),
+        ready_for_query(),
+    ])
+
+
+def select_result(fields, rows):
+    return b''.join([
+        row_description(fields),
+        b''.join(data_row(row) for row in rows),
+        command_complete(f"SELECT {len(rows)}"),
+    ])
+
+
+_VALUES = {
+    INT4OID: lambda i: str(i),
+    INT8OID: lambda i: str(i * 1000003),
+    FLOAT8OID: lambda i: str(i * 1.25),
+    BOOLOID: lambda i: 't' if i % 2 else 'f',
+    TEXTOID: lambda i: f"value {i}",
+}
+
+
+def _rows(fields, num_rows):
+    return [
+        tuple(_VALUES[oid](i) for _, oid in fields) for i in range(num_rows)]
+
+
+def small_rows(num_rows=100000):
+    fields = [('id', INT4OID), ('name', TEXTOID)]
+    return select_result(fields, _rows(fields, num_rows)) + ready_for_query()
+
+
+def wide_rows(num_rows=5000, num_columns=60):
+    oids = [INT4OID, INT8OID, FLOAT8OID, BOOLOID, TEXTOID]
+    fields = [(f"col{i}", oids[i % len(oids)]) for i in range(num_columns)]
+    return select_result(fields, _rows(fields, num_rows)) + ready_for_query()
+
+
+def large_values(num_rows=200, size=200000):
+    fields = [('id', INT4OID), ('doc', TEXTOID)]
+    rows = [(str(i), 'x' * size) for i in range(num_rows)]
+    return select_result(fields, rows) + ready_for_query()
+
+
+def multi_statement(num_results=200, num_rows=50):
+    fields = [('id', INT4OID), ('amount', FLOAT8OID), ('flag', BOOLOID)]
+    result = select_result(fields, _rows(fields, num_rows))
+    return result * num_results + ready_for_query()
+
+
+def errors(num_rows=100000):
+    # a query that fails after sending rows, which are discarded
+    fields = [('id', INT4OID), ('name', TEXTOID)]
+    return b''.join([
+        row_description(fields),
+        b''.join(data_row(row) for row in _rows(fields, num_rows)),
+        error_response('22012', 'division by zero'),
+        ready_for_query(),
+    ])
+
+
+SCENARIOS = {
+    'small_rows': small_rows,
+    'wide_rows': wide_rows,
+    'large_values': large_values,
+    'multi_statement': multi_statement,
+    'errors': errors,
+    'replication': replication,
+}
+
+
+async def record_stream(query, **connect_kwargs):
+    """Execute query on a live server and return the raw response bytes."""
+    from poqaio import connect
+
+    cn = await connect(**connect_kwargs)
+    protocol = cn._protocol
+    get_buffer = protocol.get_buffer
+    buffer_updated = protocol.buffer_updated
+    chunks = []
+    view = None
+
+    # instance attributes shadow the methods called by the transport
+    def recording_get_buffer(sizehint):
+        nonlocal view
+        view = get_buffer(sizehint)
+        return view
+
+    def recording_buffer_updated(nbytes):
+        chunks.append(bytes(view[:nbytes]))
+        return buffer_updated(nbytes)
+
+    protocol.get_buffer = recording_get_buffer
+    protocol.buffer_updated = recording_buffer_updated
+    try:
+        try:
+            await cn.execute(query)
+        except Exception:
+            # error responses are valid recordings too
+            pass
+    finally:
+        del protocol.get_buffer
+        del protocol.buffer_updated
+        await cn.close()
+    return b''.join(chunks)
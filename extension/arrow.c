@@ -0,0 +1,1105 @@
+#include <errno.h>
+
+#include "poqaio.h"
+#include "state.h"
+#include "arrow.h"
+#include "types.h"
+
+
+static const char *col_formats[] = {
+    "s",    // COL_INT16
+    "i",    // COL_INT32
+    "l",    // COL_INT64
+    "I",    // COL_UINT32
+    "f",    // COL_FLOAT32
+    "g",    // COL_FLOAT64
+    "b",    // COL_BOOL
+    "u",    // COL_UTF8
+    "z",    // COL_BINARY
+};
+
+static const int col_widths[] = {2, 4, 8, 4, 4, 8, 0, 0, 0};
+
+
+col_type
+get_col_type(uint32_t oid)
+{
+    switch(oid) {
+        case INT2OID:
+            return COL_INT16;
+        case INT4OID:
+            return COL_INT32;
+        case INT8OID:
+            return COL_INT64;
+        case OIDOID:
+        case XIDOID:
+        case CIDOID:
+            return COL_UINT32;
+        case FLOAT4OID:
+            return COL_FLOAT32;
+        case FLOAT8OID:
+            return COL_FLOAT64;
+        case BOOLOID:
+            return COL_BOOL;
+        case BYTEAOID:
+            return COL_BINARY;
+        default:
+            return COL_UTF8;
+    }
+}
+
+
+// ===== Column building, without GIL =========================================
+
+static int
+colbuf_reserve(ColBuf *buf, Py_ssize_t extra)
+{
+    Py_ssize_t new_size;
+    char *data;
+
+    if (buf->len + extra <= buf->size) {
+        return COL_OK;
+    }
+    new_size = buf->size ? buf->size : 64;
+    while (new_size < buf->len + extra) {
+        new_size *= 2;
+    }
+    data = PyMem_RawRealloc(buf->data, new_size);
+    if (data == NULL) {
+        return COL_NO_MEMORY;
+    }
+    buf->data = data;
+    buf->size = new_size;
+    return COL_OK;
+}
+
+
+static int
+bitmap_append(ColBuf *buf, int64_t index, int bit)
+{
+    if ((index & 7) == 0) {
+        if (colbuf_reserve(buf, 1) == COL_NO_MEMORY) {
+            return COL_NO_MEMORY;
+        }
+        buf->data[buf->len++] = 0;
+    }
+    if (bit) {
+        buf->data[index >> 3] |= (char)(1 << (index & 7));
+    }
+    return COL_OK;
+}
+
+
+static int
+offset_append(ArrowColumn *col)
+{
+    int32_t offset;
+
+    if (col->values.len > INT32_MAX) {
+        return COL_TOO_LARGE;
+    }
+    if (colbuf_reserve(&col->offsets, sizeof(int32_t)) == COL_NO_MEMORY) {
+        return COL_NO_MEMORY;
+    }
+    offset = (int32_t)col->values.len;
+    memcpy(col->offsets.data + col->offsets.len, &offset, sizeof(int32_t));
+    col->offsets.len += sizeof(int32_t);
+    return COL_OK;
+}
+
+
+int
+column_init(ArrowColumn *col, col_type type, const char *name)
+{
+    memset(col, 0, sizeof(ArrowColumn));
+    col->type = type;
+    col->name = PyMem_RawMalloc(strlen(name) + 1);
+    if (col->name == NULL) {
+        return COL_NO_MEMORY;
+    }
+    strcpy(col->name, name);
+    if (type == COL_UTF8 || type == COL_BINARY) {
+        // offsets start with 0
+        return offset_append(col);
+    }
+    return COL_OK;
+}
+
+
+void
+column_free(ArrowColumn *col)
+{
+    PyMem_RawFree(col->name);
+    PyMem_RawFree(col->validity.data);
+    PyMem_RawFree(col->values.data);
+    PyMem_RawFree(col->offsets.data);
+    memset(col, 0, sizeof(ArrowColumn));
+}
+
+
+static int
+append_value(ArrowColumn *col, char *data, int32_t size)
+{
+    ColBuf *values = &col->values;
+    char *dest;
+    int64_t ival;
+    double dval;
+    char bval;
+
+    if (col->type == COL_BOOL) {
+        if (parse_bool(data, size, &bval) == -1) {
+            return COL_INVALID;
+        }
+        return bitmap_append(values, col->length, bval);
+    }
+    if (col->type == COL_UTF8) {
+        if (colbuf_reserve(values, size) == COL_NO_MEMORY) {
+            return COL_NO_MEMORY;
+        }
+        memcpy(values->data + values->len, data, size);
+        values->len += size;
+        return offset_append(col);
+    }
+    if (col->type == COL_BINARY) {
+        if (colbuf_reserve(values, size / 2) == COL_NO_MEMORY) {
+            return COL_NO_MEMORY;
+        }
+        if (parse_bytea_hex(data, size, values->data + values->len) == -1) {
+            return COL_INVALID;
+        }
+        values->len += (size - 2) / 2;
+        return offset_append(col);
+    }
+
+    // fixed width
+    if (colbuf_reserve(values, 8) == COL_NO_MEMORY) {
+        return COL_NO_MEMORY;
+    }
+    dest = values->data + values->len;
+    switch (col->type) {
+        case COL_FLOAT32:
+        case COL_FLOAT64:
+            if (parse_double(data, size, &dval) == -1) {
+                return COL_INVALID;
+            }
+            if (col->type == COL_FLOAT32) {
+                float fval = (float)dval;
+                memcpy(dest, &fval, sizeof(float));
+            }
+            else {
+                memcpy(dest, &dval, sizeof(double));
+            }
+            break;
+        default:
+            if (parse_int64(data, size, &ival) == -1) {
+                return COL_INVALID;
+            }
+            if (col->type == COL_INT16) {
+                int16_t val = (int16_t)ival;
+                if (val != ival) {
+                    return COL_INVALID;
+                }
+                memcpy(dest, &val, sizeof(int16_t));
+            }
+            else if (col->type == COL_INT32) {
+                int32_t val = (int32_t)ival;
+                if (val != ival) {
+                    return COL_INVALID;
+                }
+                memcpy(dest, &val, sizeof(int32_t));
+            }
+            else if (col->type == COL_UINT32) {
+                uint32_t val = (uint32_t)ival;
+                if (ival < 0 || val != ival) {
+                    return COL_INVALID;
+                }
+                memcpy(dest, &val, sizeof(uint32_t));
+            }
+            else {
+                memcpy(dest, &ival, sizeof(int64_t));
+            }
+    }
+    values->len += col_widths[col->type];
+    return COL_OK;
+}
+
+
+static int
+append_null(ArrowColumn *col)
+{
+    col->null_count++;
+    if (col->type == COL_BOOL) {
+        return bitmap_append(&col->values, col->length, 0);
+    }
+    if (col->type == COL_UTF8 || col->type == COL_BINARY) {
+        return offset_append(col);
+    }
+    if (colbuf_reserve(&col->values, 8) == COL_NO_MEMORY) {
+        return COL_NO_MEMORY;
+    }
+    memset(col->values.data + col->values.len, 0, col_widths[col->type]);
+    col->values.len += col_widths[col->type];
+    return COL_OK;
+}
+
+
+int
+column_append(ArrowColumn *col, char *data, int32_t size)
+{
+    // Appends a text value, or null when size is -1.
+    int ret;
+
+    if (size == -1) {
+        ret = append_null(col);
+    }
+    else {
+        ret = append_value(col, data, size);
+    }
+    if (ret != COL_OK) {
+        return ret;
+    }
+    ret = bitmap_append(&col->validity, col->length, size != -1);
+    if (ret != COL_OK) {
+        return ret;
+    }
+    col->length++;
+    return COL_OK;
+}
+
+
+int
+append_data_row(ArrowColumn *cols, int ncolumns, char *pos, char *end,
+                int *col_index)
+{
+    // Appends the values of a DataRow message body to the columns. On failure
+    // col_index is set to the column of the failing value, or -1 for an
+    // invalid message.
+    uint16_t nfields;
+    uint32_t val_size;
+    int i, ret;
+
+    *col_index = -1;
+    if (end - pos < 2) {
+        return COL_BAD_MESSAGE;
+    }
+    memcpy(&nfields, pos, 2);
+    pos += 2;
+    if ((int16_t)be16toh(nfields) != ncolumns) {
+        return COL_BAD_MESSAGE;
+    }
+    for (i = 0; i < ncolumns; i++) {
+        int32_t size;
+
+        if (end - pos < 4) {
+            return COL_BAD_MESSAGE;
+        }
+        memcpy(&val_size, pos, 4);
+        pos += 4;
+        size = (int32_t)be32toh(val_size);
+        if (size < -1 || (size != -1 && end - pos < size)) {
+            return COL_BAD_MESSAGE;
+        }
+        ret = column_append(cols + i, pos, size);
+        if (ret != COL_OK) {
+            *col_index = i;
+            return ret;
+        }
+        if (size != -1) {
+            pos += size;
+        }
+    }
+    if (pos != end) {
+        return COL_BAD_MESSAGE;
+    }
+    return COL_OK;
+}
+
+
+static int
+bitmap_extend(ColBuf *dest, int64_t dest_bits, ColBuf *src, int64_t src_bits)
+{
+    // Appends the bits of src to the bitmap of dest_bits bits
+    Py_ssize_t nbytes = (Py_ssize_t)((src_bits + 7) / 8);
+    unsigned char *to, *from;
+    int shift = dest_bits & 7;
+    Py_ssize_t i;
+
+    if (colbuf_reserve(dest, nbytes) == COL_NO_MEMORY) {
+        return COL_NO_MEMORY;
+    }
+    if (shift == 0) {
+        memcpy(dest->data + dest->len, src->data, nbytes);
+    }
+    else {
+        // continue in last partially filled byte, unused bits are zero
+        to = (unsigned char *)dest->data + dest->len - 1;
+        from = (unsigned char *)src->data;
+        for (i = 0; i < nbytes; i++) {
+            to[i] |= (unsigned char)(from[i] << shift);
+            to[i + 1] = (unsigned char)(from[i] >> (8 - shift));
+        }
+    }
+    dest->len = (Py_ssize_t)((dest_bits + src_bits + 7) / 8);
+    return COL_OK;
+}
+
+
+static void
+colbuf_swap(ColBuf *a, ColBuf *b)
+{
+    ColBuf tmp = *a;
+    *a = *b;
+    *b = tmp;
+}
+
+
+int
+column_extend(ArrowColumn *dest, ArrowColumn *src)
+{
+    // Appends the values of src, a column of the same type, to dest
+    int ret;
+
+    if (src->length == 0) {
+        return COL_OK;
+    }
+    if (dest->length == 0) {
+        // just take over the buffers
+        colbuf_swap(&dest->validity, &src->validity);
+        colbuf_swap(&dest->values, &src->values);
+        colbuf_swap(&dest->offsets, &src->offsets);
+    }
+    else {
+        ret = bitmap_extend(
+            &dest->validity, dest->length, &src->validity, src->length);
+        if (ret != COL_OK) {
+            return ret;
+        }
+        if (dest->type == COL_BOOL) {
+            ret = bitmap_extend(
+                &dest->values, dest->length, &src->values, src->length);
+            if (ret != COL_OK) {
+                return ret;
+            }
+        }
+        else {
+            if (dest->type == COL_UTF8 || dest->type == COL_BINARY) {
+                int32_t *to, *from, base = (int32_t)dest->values.len;
+                int64_t i;
+
+                if (dest->values.len + src->values.len > INT32_MAX) {
+                    return COL_TOO_LARGE;
+                }
+                if (colbuf_reserve(&dest->offsets, src->offsets.len) ==
+                        COL_NO_MEMORY) {
+                    return COL_NO_MEMORY;
+                }
+                // skip the leading zero offset of src
+                to = (int32_t *)(dest->offsets.data + dest->offsets.len);
+                from = (int32_t *)src->offsets.data + 1;
+                for (i = 0; i < src->length; i++) {
+                    to[i] = from[i] + base;
+                }
+                dest->offsets.len += src->length * sizeof(int32_t);
+            }
+            if (colbuf_reserve(&dest->values, src->values.len) ==
+                    COL_NO_MEMORY) {
+                return COL_NO_MEMORY;
+            }
+            memcpy(dest->values.data + dest->values.len, src->values.data,
+                   src->values.len);
+            dest->values.len += src->values.len;
+        }
+    }
+    dest->length += src->length;
+    dest->null_count += src->null_count;
+    src->length = 0;
+    src->null_count = 0;
+    return COL_OK;
+}
+
+
+PyObject *
+column_value(ArrowColumn *col, int64_t i)
+{
+    // Returns the value at index i as Python object
+    char *values = col->values.data;
+    int32_t start, end;
+
+    if (!(col->validity.data[i >> 3] & (1 << (i & 7)))) {
+        Py_RETURN_NONE;
+    }
+    switch (col->type) {
+        case COL_INT16: {
+            int16_t val;
+            memcpy(&val, values + i * 2, 2);
+            return PyLong_FromLong(val);
+        }
+        case COL_INT32: {
+            int32_t val;
+            memcpy(&val, values + i * 4, 4);
+            return PyLong_FromLong(val);
+        }
+        case COL_INT64: {
+            int64_t val;
+            memcpy(&val, values + i * 8, 8);
+            return PyLong_FromLongLong(val);
+        }
+        case COL_UINT32: {
+            uint32_t val;
+            memcpy(&val, values + i * 4, 4);
+            return PyLong_FromUnsignedLong(val);
+        }
+        case COL_FLOAT32: {
+            float val;
+            memcpy(&val, values + i * 4, 4);
+            return PyFloat_FromDouble(val);
+        }
+        case COL_FLOAT64: {
+            double val;
+            memcpy(&val, values + i * 8, 8);
+            return PyFloat_FromDouble(val);
+        }
+        case COL_BOOL:
+            return PyBool_FromLong(values[i >> 3] & (1 << (i & 7)));
+        default:
+            memcpy(&start, col->offsets.data + i * 4, 4);
+            memcpy(&end, col->offsets.data + i * 4 + 4, 4);
+            if (col->type == COL_BINARY) {
+                return PyBytes_FromStringAndSize(values + start, end - start);
+            }
+            return PyUnicode_FromStringAndSize(values + start, end - start);
+    }
+}
+
+
+int
+column_set_error(PoqaioState *state, int code, ArrowColumn *col)
+{
+    // Sets the Python exception for a column result code
+    switch (code) {
+        case COL_NO_MEMORY:
+            PyErr_NoMemory();
+            break;
+        case COL_BAD_MESSAGE:
+            PyErr_SetString(
+                state->ProtocolError, "Invalid data row message.");
+            break;
+        case COL_TOO_LARGE:
+            PyErr_Format(
+                state->ProtocolError, "Too much data for column '%s'",
+                col->name);
+            break;
+        default:
+            PyErr_Format(
+                state->ProtocolError, "Invalid value for column '%s'",
+                col->name);
+    }
+    return -1;
+}
+
+
+// ===== Export through the C data interface ==================================
+
+typedef struct {
+    struct ArrowSchema *children;
+    struct ArrowSchema **child_ptrs;
+} SchemaPrivate;
+
+
+static void
+release_child_schema(struct ArrowSchema *schema)
+{
+    PyMem_RawFree((void *)schema->name);
+    schema->release = NULL;
+}
+
+
+static void
+release_schema(struct ArrowSchema *schema)
+{
+    SchemaPrivate *priv = schema->private_data;
+    int64_t i;
+
+    for (i = 0; i < schema->n_children; i++) {
+        struct ArrowSchema *child = priv->child_ptrs[i];
+
+        if (child->release) {
+            child->release(child);
+        }
+    }
+    PyMem_RawFree(priv->children);
+    PyMem_RawFree(priv->child_ptrs);
+    PyMem_RawFree(priv);
+    schema->release = NULL;
+}
+
+
+static int
+export_schema(RecordBatch *batch, struct ArrowSchema *schema)
+{
+    // Exports the schema as a struct with a child per column
+    SchemaPrivate *priv;
+    int i;
+
+    priv = PyMem_RawCalloc(1, sizeof(SchemaPrivate));
+    if (priv == NULL) {
+        return -1;
+    }
+    priv->children = PyMem_RawCalloc(
+        batch->ncolumns + 1, sizeof(struct ArrowSchema));
+    priv->child_ptrs = PyMem_RawCalloc(
+        batch->ncolumns + 1, sizeof(struct ArrowSchema *));
+    if (priv->children == NULL || priv->child_ptrs == NULL) {
+        goto error;
+    }
+    for (i = 0; i < batch->ncolumns; i++) {
+        struct ArrowSchema *child = priv->children + i;
+        ArrowColumn *col = batch->columns + i;
+        char *name;
+
+        name = PyMem_RawMalloc(strlen(col->name) + 1);
+        if (name == NULL) {
+            goto error;
+        }
+        strcpy(name, col->name);
+        child->format = col_formats[col->type];
+        child->name = name;
+        child->flags = ARROW_FLAG_NULLABLE;
+        child->release = release_child_schema;
+        priv->child_ptrs[i] = child;
+    }
+
+    memset(schema, 0, sizeof(struct ArrowSchema));
+    schema->format = "+s";
+    schema->name = "";
+    schema->n_children = batch->ncolumns;
+    schema->children = priv->child_ptrs;
+    schema->private_data = priv;
+    schema->release = release_schema;
+    return 0;
+
+error:
+    if (priv->children) {
+        for (i = 0; i < batch->ncolumns; i++) {
+            PyMem_RawFree((void *)priv->children[i].name);
+        }
+    }
+    PyMem_RawFree(priv->children);
+    PyMem_RawFree(priv->child_ptrs);
+    PyMem_RawFree(priv);
+    return -1;
+}
+
+
+typedef struct {
+    PyThreadState *prev;     // detached thread state of other interpreter
+    PyThreadState *temp;     // created for the interpreter
+    PyGILState_STATE gstate;
+    int gilstate;
+} InterpGuard;
+
+
+static int
+interp_enter(PyInterpreterState *interp, InterpGuard *guard)
+{
+    // Attaches the current thread to the interpreter of an exported batch.
+    // Release callbacks can run in any thread, with or without the GIL of
+    // any interpreter. The GILState API only supports the main interpreter,
+    // so for subinterpreters a temporary thread state is used.
+    PyThreadState *tstate = PyThreadState_GetUnchecked();
+
+    memset(guard, 0, sizeof(InterpGuard));
+    if (tstate && PyThreadState_GetInterpreter(tstate) == interp) {
+        return 0;
+    }
+    if (tstate) {
+        guard->prev = PyEval_SaveThread();
+    }
+    if (interp == PyInterpreterState_Main()) {
+        guard->gstate = PyGILState_Ensure();
+        guard->gilstate = 1;
+        return 0;
+    }
+    guard->temp = PyThreadState_New(interp);
+    if (guard->temp == NULL) {
+        if (guard->prev) {
+            PyEval_RestoreThread(guard->prev);
+        }
+        return -1;
+    }
+    PyEval_RestoreThread(guard->temp);
+    return 0;
+}
+
+
+static void
+interp_leave(InterpGuard *guard)
+{
+    if (guard->gilstate) {
+        PyGILState_Release(guard->gstate);
+    }
+    else if (guard->temp) {
+        PyThreadState_Clear(guard->temp);
+        PyThreadState_DeleteCurrent();
+    }
+    if (guard->prev) {
+        PyEval_RestoreThread(guard->prev);
+    }
+}
+
+
+typedef struct {
+    PyObject *batch;         // owner of the buffers
+    PyInterpreterState *interp;
+    const void *buffers[3];
+    struct ArrowArray *children;
+    struct ArrowArray **child_ptrs;
+} ArrayPrivate;
+
+
+static void
+release_array(struct ArrowArray *array)
+{
+    // Might be called from any thread, without the GIL
+    ArrayPrivate *priv = array->private_data;
+    InterpGuard guard;
+    int64_t i;
+
+    for (i = 0; i < array->n_children; i++) {
+        struct ArrowArray *child = priv->child_ptrs[i];
+
+        if (child->release) {
+            child->release(child);
+        }
+    }
+    if (priv->batch && interp_enter(priv->interp, &guard) == 0) {
+        Py_DECREF(priv->batch);
+        interp_leave(&guard);
+    }
+    PyMem_RawFree(priv->children);
+    PyMem_RawFree(priv->child_ptrs);
+    PyMem_RawFree(priv);
+    array->release = NULL;
+}
+
+
+static int
+export_column(RecordBatch *batch, ArrowColumn *col, struct ArrowArray *array)
+{
+    ArrayPrivate *priv;
+
+    priv = PyMem_RawCalloc(1, sizeof(ArrayPrivate));
+    if (priv == NULL) {
+        return -1;
+    }
+    // each child keeps the batch alive, children can be moved and
+    // released on their own
+    priv->batch = (PyObject *)batch;
+    priv->interp = PyInterpreterState_Get();
+    Py_INCREF(batch);
+
+    priv->buffers[0] = col->null_count ? col->validity.data : NULL;
+    if (col->type == COL_UTF8 || col->type == COL_BINARY) {
+        priv->buffers[1] = col->offsets.data;
+        priv->buffers[2] = col->values.data;
+        array->n_buffers = 3;
+    }
+    else {
+        priv->buffers[1] = col->values.data;
+        array->n_buffers = 2;
+    }
+    array->length = col->length;
+    array->null_count = col->null_count;
+    array->offset = 0;
+    array->n_children = 0;
+    array->buffers = priv->buffers;
+    array->children = NULL;
+    array->dictionary = NULL;
+    array->private_data = priv;
+    array->release = release_array;
+    return 0;
+}
+
+
+static int
+export_array(RecordBatch *batch, struct ArrowArray *array)
+{
+    // Exports the batch as a struct array with a child per column
+    ArrayPrivate *priv;
+    int i;
+
+    priv = PyMem_RawCalloc(1, sizeof(ArrayPrivate));
+    if (priv == NULL) {
+        return -1;
+    }
+    priv->children = PyMem_RawCalloc(
+        batch->ncolumns + 1, sizeof(struct ArrowArray));
+    priv->child_ptrs = PyMem_RawCalloc(
+        batch->ncolumns + 1, sizeof(struct ArrowArray *));
+    if (priv->children == NULL || priv->child_ptrs == NULL) {
+        goto error;
+    }
+    memset(array, 0, sizeof(struct ArrowArray));
+    array->length = batch->num_rows;
+    array->n_buffers = 1;
+    array->buffers = priv->buffers;  // no validity bitmap
+    array->n_children = batch->ncolumns;
+    array->children = priv->child_ptrs;
+    array->private_data = priv;
+    array->release = release_array;
+
+    for (i = 0; i < batch->ncolumns; i++) {
+        priv->child_ptrs[i] = priv->children + i;
+        if (export_column(
+                batch, batch->columns + i, priv->children + i) == -1) {
+            array->n_children = i;
+            release_array(array);
+            return -1;
+        }
+    }
+    return 0;
+
+error:
+    PyMem_RawFree(priv->children);
+    PyMem_RawFree(priv->child_ptrs);
+    PyMem_RawFree(priv);
+    return -1;
+}
+
+
+typedef struct {
+    PyObject *batch;
+    PyInterpreterState *interp;
+    int done;
+} StreamPrivate;
+
+
+static int
+stream_get_schema(struct ArrowArrayStream *stream, struct ArrowSchema *out)
+{
+    StreamPrivate *priv = stream->private_data;
+
+    return export_schema((RecordBatch *)priv->batch, out) ? ENOMEM : 0;
+}
+
+
+static int
+stream_get_next(struct ArrowArrayStream *stream, struct ArrowArray *out)
+{
+    StreamPrivate *priv = stream->private_data;
+    InterpGuard guard;
+    int ret;
+
+    if (priv->done) {
+        // end of stream
+        out->release = NULL;
+        return 0;
+    }
+    if (interp_enter(priv->interp, &guard) == -1) {
+        return ENOMEM;
+    }
+    ret = export_array((RecordBatch *)priv->batch, out);
+    interp_leave(&guard);
+    if (ret == -1) {
+        return ENOMEM;
+    }
+    priv->done = 1;
+    return 0;
+}
+
+
+static const char *
+stream_get_last_error(struct ArrowArrayStream *stream)
+{
+    return NULL;
+}
+
+
+static void
+stream_release(struct ArrowArrayStream *stream)
+{
+    StreamPrivate *priv = stream->private_data;
+    InterpGuard guard;
+
+    if (interp_enter(priv->interp, &guard) == 0) {
+        Py_DECREF(priv->batch);
+        interp_leave(&guard);
+    }
+    PyMem_RawFree(priv);
+    stream->release = NULL;
+}
+
+
+static void
+schema_capsule_destructor(PyObject *capsule)
+{
+    struct ArrowSchema *schema = PyCapsule_GetPointer(
+        capsule, "arrow_schema");
+
+    if (schema->release) {
+        schema->release(schema);
+    }
+    PyMem_RawFree(schema);
+}
+
+
+static void
+array_capsule_destructor(PyObject *capsule)
+{
+    struct ArrowArray *array = PyCapsule_GetPointer(capsule, "arrow_array");
+
+    if (array->release) {
+        array->release(array);
+    }
+    PyMem_RawFree(array);
+}
+
+
+static void
+stream_capsule_destructor(PyObject *capsule)
+{
+    struct ArrowArrayStream *stream = PyCapsule_GetPointer(
+        capsule, "arrow_array_stream");
+
+    if (stream->release) {
+        stream->release(stream);
+    }
+    PyMem_RawFree(stream);
+}
+
+
+static PyObject *
+schema_capsule(RecordBatch *self)
+{
+    struct ArrowSchema *schema;
+    PyObject *capsule;
+
+    schema = PyMem_RawMalloc(sizeof(struct ArrowSchema));
+    if (schema == NULL) {
+        return PyErr_NoMemory();
+    }
+    schema->release = NULL;
+    capsule = PyCapsule_New(
+        schema, "arrow_schema", schema_capsule_destructor);
+    if (capsule == NULL) {
+        PyMem_RawFree(schema);
+        return NULL;
+    }
+    if (export_schema(self, schema) == -1) {
+        Py_DECREF(capsule);
+        return PyErr_NoMemory();
+    }
+    return capsule;
+}
+
+
+// ===== RecordBatch type =====================================================
+
+RecordBatch *
+RecordBatch_create(PoqaioState *state, int ncolumns)
+{
+    RecordBatch *self;
+
+    self = (RecordBatch *)state->RecordBatchType->tp_alloc(
+        state->RecordBatchType, 0);
+    if (self == NULL) {
+        return NULL;
+    }
+    self->columns = PyMem_RawCalloc(ncolumns + 1, sizeof(ArrowColumn));
+    if (self->columns == NULL) {
+        Py_DECREF(self);
+        PyErr_NoMemory();
+        return NULL;
+    }
+    self->ncolumns = ncolumns;
+    return self;
+}
+
+
+static void
+RecordBatch_dealloc(RecordBatch *self)
+{
+    PyTypeObject *tp = Py_TYPE(self);
+    int i;
+
+    if (self->columns) {
+        for (i = 0; i < self->ncolumns; i++) {
+            column_free(self->columns + i);
+        }
+        PyMem_RawFree(self->columns);
+    }
+    tp->tp_free((PyObject *)self);
+    Py_DECREF(tp);
+}
+
+
+static Py_ssize_t
+RecordBatch_length(RecordBatch *self)
+{
+    return (Py_ssize_t)self->num_rows;
+}
+
+
+static PyObject *
+RecordBatch_arrow_c_schema(RecordBatch *self, PyObject *unused)
+{
+    return schema_capsule(self);
+}
+
+
+static PyObject *
+RecordBatch_arrow_c_array(
+        RecordBatch *self, PyObject *args, PyObject *kwds)
+{
+    // The requested schema is not supported, the types are fixed by the
+    // type oids of the result
+    static char *kwlist[] = {"requested_schema", NULL};
+    struct ArrowArray *array;
+    PyObject *requested_schema=Py_None, *py_schema, *py_array;
+
+    if (!PyArg_ParseTupleAndKeywords(
+            args, kwds, "|O", kwlist, &requested_schema)) {
+        return NULL;
+    }
+    py_schema = schema_capsule(self);
+    if (py_schema == NULL) {
+        return NULL;
+    }
+    array = PyMem_RawMalloc(sizeof(struct ArrowArray));
+    if (array == NULL) {
+        Py_DECREF(py_schema);
+        return PyErr_NoMemory();
+    }
+    array->release = NULL;
+    py_array = PyCapsule_New(array, "arrow_array", array_capsule_destructor);
+    if (py_array == NULL) {
+        PyMem_RawFree(array);
+        Py_DECREF(py_schema);
+        return NULL;
+    }
+    if (export_array(self, array) == -1) {
+        Py_DECREF(py_array);
+        Py_DECREF(py_schema);
+        return PyErr_NoMemory();
+    }
+    return Py_BuildValue("NN", py_schema, py_array);
+}
+
+
+static PyObject *
+RecordBatch_arrow_c_stream(
+        RecordBatch *self, PyObject *args, PyObject *kwds)
+{
+    static char *kwlist[] = {"requested_schema", NULL};
+    struct ArrowArrayStream *stream;
+    StreamPrivate *priv;
+    PyObject *requested_schema=Py_None, *capsule;
+
+    if (!PyArg_ParseTupleAndKeywords(
+            args, kwds, "|O", kwlist, &requested_schema)) {
+        return NULL;
+    }
+    stream = PyMem_RawMalloc(sizeof(struct ArrowArrayStream));
+    priv = PyMem_RawCalloc(1, sizeof(StreamPrivate));
+    if (stream == NULL || priv == NULL) {
+        PyMem_RawFree(stream);
+        PyMem_RawFree(priv);
+        return PyErr_NoMemory();
+    }
+    priv->batch = (PyObject *)self;
+    priv->interp = PyInterpreterState_Get();
+    Py_INCREF(self);
+    stream->get_schema = stream_get_schema;
+    stream->get_next = stream_get_next;
+    stream->get_last_error = stream_get_last_error;
+    stream->private_data = priv;
+    stream->release = stream_release;
+
+    capsule = PyCapsule_New(
+        stream, "arrow_array_stream", stream_capsule_destructor);
+    if (capsule == NULL) {
+        stream_release(stream);
+        PyMem_RawFree(stream);
+    }
+    return capsule;
+}
+
+
+static PyObject *
+RecordBatch_get_column_names(RecordBatch *self, void *closure)
+{
+    PyObject *names;
+    int i;
+
+    names = PyTuple_New(self->ncolumns);
+    if (names == NULL) {
+        return NULL;
+    }
+    for (i = 0; i < self->ncolumns; i++) {
+        PyObject *name = PyUnicode_FromString(self->columns[i].name);
+
+        if (name == NULL) {
+            Py_DECREF(names);
+            return NULL;
+        }
+        PyTuple_SET_ITEM(names, i, name);
+    }
+    return names;
+}
+
+
+static PyObject *
+RecordBatch_repr(RecordBatch *self)
+{
+    return PyUnicode_FromFormat(
+        "<poqaio.RecordBatch with %lld rows and %d columns>",
+        (long long)self->num_rows, self->ncolumns);
+}
+
+
+static PyMethodDef RecordBatch_methods[] = {
+    {"__arrow_c_schema__", (PyCFunction)RecordBatch_arrow_c_schema,
+     METH_NOARGS, "export schema as arrow_schema capsule"},
+    {"__arrow_c_array__", (PyCFunction)RecordBatch_arrow_c_array,
+     METH_VARARGS | METH_KEYWORDS,
+     "export as arrow_schema and arrow_array capsules"},
+    {"__arrow_c_stream__", (PyCFunction)RecordBatch_arrow_c_stream,
+     METH_VARARGS | METH_KEYWORDS,
+     "export as arrow_array_stream capsule"},
+    {NULL}
+};
+
+
+static PyMemberDef RecordBatch_members[] = {
+    {"num_rows", T_LONGLONG, offsetof(RecordBatch, num_rows), READONLY,
+     "number of rows"},
+    {NULL}
+};
+
+
+static PyGetSetDef RecordBatch_getset[] = {
+    {"column_names", (getter)RecordBatch_get_column_names, NULL,
+     "names of the columns", NULL},
+    {NULL}
+};
+
+
+static PyType_Slot RecordBatch_slots[] = {
+    {Py_tp_dealloc, RecordBatch_dealloc},
+    {Py_tp_repr, RecordBatch_repr},
+    {Py_sq_length, RecordBatch_length},
+    {Py_tp_doc, PyDoc_STR("Columnar result, Arrow PyCapsule interface")},
+    {Py_tp_methods, RecordBatch_methods},
+    {Py_tp_members, RecordBatch_members},
+    {Py_tp_getset, RecordBatch_getset},
+    {0, NULL}
+};
+
+
+PyType_Spec RecordBatchSpec = {
+    "poqaio.RecordBatch",
+    sizeof(RecordBatch),
+    0,
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_DISALLOW_INSTANTIATION,
+    RecordBatch_slots
+};
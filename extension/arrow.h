@@ -0,0 +1,125 @@
+#ifndef POQAIO_ARROW_H
+#define POQAIO_ARROW_H
+
+#include "poqaio.h"
+
+
+// Arrow C data interface, as defined by
+// https://arrow.apache.org/docs/format/CDataInterface.html
+
+#ifndef ARROW_C_DATA_INTERFACE
+#define ARROW_C_DATA_INTERFACE
+
+#define ARROW_FLAG_DICTIONARY_ORDERED 1
+#define ARROW_FLAG_NULLABLE 2
+#define ARROW_FLAG_MAP_KEYS_SORTED 4
+
+struct ArrowSchema {
+    // Array type description
+    const char* format;
+    const char* name;
+    const char* metadata;
+    int64_t flags;
+    int64_t n_children;
+    struct ArrowSchema** children;
+    struct ArrowSchema* dictionary;
+
+    // Release callback
+    void (*release)(struct ArrowSchema*);
+    // Opaque producer-specific data
+    void* private_data;
+};
+
+struct ArrowArray {
+    // Array data description
+    int64_t length;
+    int64_t null_count;
+    int64_t offset;
+    int64_t n_buffers;
+    int64_t n_children;
+    const void** buffers;
+    struct ArrowArray** children;
+    struct ArrowArray* dictionary;
+
+    // Release callback
+    void (*release)(struct ArrowArray*);
+    // Opaque producer-specific data
+    void* private_data;
+};
+
+#endif  // ARROW_C_DATA_INTERFACE
+
+#ifndef ARROW_C_STREAM_INTERFACE
+#define ARROW_C_STREAM_INTERFACE
+
+struct ArrowArrayStream {
+    int (*get_schema)(struct ArrowArrayStream*, struct ArrowSchema* out);
+    int (*get_next)(struct ArrowArrayStream*, struct ArrowArray* out);
+    const char* (*get_last_error)(struct ArrowArrayStream*);
+
+    void (*release)(struct ArrowArrayStream*);
+    void* private_data;
+};
+
+#endif  // ARROW_C_STREAM_INTERFACE
+
+
+// Column types, a value is decoded from text into one of these
+typedef enum {
+    COL_INT16,
+    COL_INT32,
+    COL_INT64,
+    COL_UINT32,
+    COL_FLOAT32,
+    COL_FLOAT64,
+    COL_BOOL,
+    COL_UTF8,
+    COL_BINARY,
+} col_type;
+
+// Result codes of appending a value. The column functions do not need the
+// GIL and do not set Python exceptions.
+#define COL_OK 0
+#define COL_NO_MEMORY -1
+#define COL_INVALID -2
+#define COL_TOO_LARGE -3
+#define COL_BAD_MESSAGE -4
+
+typedef struct {
+    char *data;
+    Py_ssize_t len;
+    Py_ssize_t size;
+} ColBuf;
+
+typedef struct {
+    col_type type;
+    char *name;              // utf-8
+    int64_t length;
+    int64_t null_count;
+    ColBuf validity;         // bitmap, bit set for non null value
+    ColBuf values;           // fixed width values, bitmap or string data
+    ColBuf offsets;          // int32 offsets in values, for strings
+} ArrowColumn;
+
+typedef struct {
+    PyObject_HEAD
+    int64_t num_rows;
+    int ncolumns;
+    ArrowColumn *columns;
+} RecordBatch;
+
+extern PyType_Spec RecordBatchSpec;
+
+col_type get_col_type(uint32_t oid);
+int column_init(ArrowColumn *, col_type, const char *name);
+void column_free(ArrowColumn *);
+int column_append(ArrowColumn *, char *data, int32_t size);
+int column_extend(ArrowColumn *dest, ArrowColumn *src);
+int append_data_row(ArrowColumn *, int ncolumns, char *pos, char *end,
+                    int *col_index);
+PyObject *column_value(ArrowColumn *, int64_t index);
+int column_set_error(PoqaioState *, int code, ArrowColumn *);
+
+RecordBatch *RecordBatch_create(PoqaioState *, int ncolumns);
+
+#endif
@@ -0,0 +1,672 @@
+#include "auth.h"
+#include "state.h"
+
+
+// Message digests. SHA-256 and MD5 share the padding and block handling,
+// they differ in compression function and byte order.
+
+typedef void (*compress_func)(uint32_t *h, const unsigned char *block);
+
+typedef struct {
+    uint32_t h[8];
+    uint64_t length;             // number of hashed bytes
+    unsigned char block[64];
+    compress_func compress;
+    int big_endian;
+    int size;                    // size of digest in bytes
+} Digest;
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define ROTL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+
+static void
+sha256_compress(uint32_t *h, const unsigned char *p)
+{
+    uint32_t w[64], a, b, c, d, e, f, g, k, t1, t2;
+    int i;
+
+    for (i = 0; i < 16; i++, p += 4) {
+        w[i] = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+               ((uint32_t)p[2] << 8) | p[3];
+    }
+    for (; i < 64; i++) {
+        w[i] = w[i - 16] + w[i - 7] +
+            (ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3)) +
+            (ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10));
+    }
+    a = h[0]; b = h[1]; c = h[2]; d = h[3];
+    e = h[4]; f = h[5]; g = h[6]; k = h[7];
+    for (i = 0; i < 64; i++) {
+        t1 = k + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) +
+            ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+        t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) +
+            ((a & b) ^ (a & c) ^ (b & c));
+        k = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+    h[0] += a; h[1] += b; h[2] += c; h[3] += d;
+    h[4] += e; h[5] += f; h[6] += g; h[7] += k;
+}
+
+
+static void
+sha256_init(Digest *dg)
+{
+    static const uint32_t init[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+
+    memcpy(dg->h, init, sizeof(init));
+    dg->length = 0;
+    dg->compress = sha256_compress;
+    dg->big_endian = 1;
+    dg->size = SHA256_SIZE;
+}
+
+
+static const uint32_t md5_k[64] = {
+    0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a,
+    0xa8304613, 0xfd469501, 0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+    0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821, 0xf61e2562, 0xc040b340,
+    0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+    0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8,
+    0x676f02d9, 0x8d2a4c8a, 0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
+    0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70, 0x289b7ec6, 0xeaa127fa,
+    0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+    0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92,
+    0xffeff47d, 0x85845dd1, 0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+    0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391,
+};
+
+static const int md5_shift[16] = {
+    7, 12, 17, 22, 5, 9, 14, 20, 4, 11, 16, 23, 6, 10, 15, 21,
+};
+
+
+static void
+md5_compress(uint32_t *h, const unsigned char *p)
+{
+    uint32_t m[16], a, b, c, d, f, t;
+    int i, g;
+
+    for (i = 0; i < 16; i++, p += 4) {
+        m[i] = ((uint32_t)p[3] << 24) | ((uint32_t)p[2] << 16) |
+               ((uint32_t)p[1] << 8) | p[0];
+    }
+    a = h[0]; b = h[1]; c = h[2]; d = h[3];
+    for (i = 0; i < 64; i++) {
+        if (i < 16) {
+            f = (b & c) | (~b & d);
+            g = i;
+        }
+        else if (i < 32) {
+            f = (d & b) | (~d & c);
+            g = (5 * i + 1) % 16;
+        }
+        else if (i < 48) {
+            f = b ^ c ^ d;
+            g = (3 * i + 5) % 16;
+        }
+        else {
+            f = c ^ (b | ~d);
+            g = (7 * i) % 16;
+        }
+        t = d;
+        d = c;
+        c = b;
+        b += ROTL(a + f + md5_k[i] + m[g], md5_shift[(i / 16) * 4 + i % 4]);
+        a = t;
+    }
+    h[0] += a; h[1] += b; h[2] += c; h[3] += d;
+}
+
+
+static void
+md5_init(Digest *dg)
+{
+    dg->h[0] = 0x67452301;
+    dg->h[1] = 0xefcdab89;
+    dg->h[2] = 0x98badcfe;
+    dg->h[3] = 0x10325476;
+    dg->length = 0;
+    dg->compress = md5_compress;
+    dg->big_endian = 0;
+    dg->size = 16;
+}
+
+
+static void
+digest_update(Digest *dg, const void *data, size_t len)
+{
+    const unsigned char *p = data;
+    size_t used = dg->length % 64, n;
+
+    dg->length += len;
+    if (used) {
+        n = 64 - used;
+        if (len < n) {
+            memcpy(dg->block + used, p, len);
+            return;
+        }
+        memcpy(dg->block + used, p, n);
+        dg->compress(dg->h, dg->block);
+        p += n;
+        len -= n;
+    }
+    for (; len >= 64; p += 64, len -= 64) {
+        dg->compress(dg->h, p);
+    }
+    memcpy(dg->block, p, len);
+}
+
+
+static void
+digest_final(Digest *dg, unsigned char *out)
+{
+    uint64_t bits = dg->length * 8;
+    size_t used = dg->length % 64;
+    int i;
+
+    dg->block[used++] = 0x80;
+    if (used > 56) {
+        memset(dg->block + used, 0, 64 - used);
+        dg->compress(dg->h, dg->block);
+        used = 0;
+    }
+    memset(dg->block + used, 0, 56 - used);
+    for (i = 0; i < 8; i++) {
+        dg->block[dg->big_endian ? 63 - i : 56 + i] =
+            (unsigned char)(bits >> (8 * i));
+    }
+    dg->compress(dg->h, dg->block);
+
+    for (i = 0; i < dg->size; i++) {
+        int shift = dg->big_endian ? 24 - 8 * (i % 4) : 8 * (i % 4);
+        out[i] = (unsigned char)(dg->h[i / 4] >> shift);
+    }
+}
+
+
+static void
+sha256(const void *data, size_t len, unsigned char *out)
+{
+    Digest dg;
+
+    sha256_init(&dg);
+    digest_update(&dg, data, len);
+    digest_final(&dg, out);
+}
+
+
+// HMAC-SHA-256, the digests with the padded key absorbed are kept so
+// repeated use of the same key costs two compressions per short message
+typedef struct {
+    Digest inner;
+    Digest outer;
+} Hmac;
+
+
+static void
+hmac_init(Hmac *hm, const void *key, size_t key_len)
+{
+    unsigned char pad[64], hashed_key[SHA256_SIZE];
+    size_t i;
+
+    if (key_len > 64) {
+        sha256(key, key_len, hashed_key);
+        key = hashed_key;
+        key_len = SHA256_SIZE;
+    }
+    memset(pad, 0x36, 64);
+    for (i = 0; i < key_len; i++) {
+        pad[i] ^= ((const unsigned char *)key)[i];
+    }
+    sha256_init(&hm->inner);
+    digest_update(&hm->inner, pad, 64);
+
+    for (i = 0; i < 64; i++) {
+        pad[i] ^= 0x36 ^ 0x5c;
+    }
+    sha256_init(&hm->outer);
+    digest_update(&hm->outer, pad, 64);
+}
+
+
+static void
+hmac_digest(Hmac *hm, const void *data, size_t len, unsigned char *out)
+{
+    Digest dg = hm->inner;
+    unsigned char inner[SHA256_SIZE];
+
+    digest_update(&dg, data, len);
+    digest_final(&dg, inner);
+    dg = hm->outer;
+    digest_update(&dg, inner, SHA256_SIZE);
+    digest_final(&dg, out);
+}
+
+
+static void
+hmac(const void *key, size_t key_len, const void *data, size_t len,
+     unsigned char *out)
+{
+    Hmac hm;
+
+    hmac_init(&hm, key, key_len);
+    hmac_digest(&hm, data, len, out);
+}
+
+
+// PBKDF2 with HMAC-SHA-256 and a single block of output, "Hi" in RFC 5802
+static void
+salted_password(
+    const char *password, const unsigned char *salt, size_t salt_len,
+    int iterations, unsigned char *out)
+{
+    Hmac hm;
+    Digest dg;
+    unsigned char u[SHA256_SIZE];
+    int i, j;
+
+    hmac_init(&hm, password, strlen(password));
+    dg = hm.inner;
+    digest_update(&dg, salt, salt_len);
+    digest_update(&dg, "\0\0\0\1", 4);
+    digest_final(&dg, u);
+    dg = hm.outer;
+    digest_update(&dg, u, SHA256_SIZE);
+    digest_final(&dg, u);
+    memcpy(out, u, SHA256_SIZE);
+
+    for (i = 1; i < iterations; i++) {
+        hmac_digest(&hm, u, SHA256_SIZE, u);
+        for (j = 0; j < SHA256_SIZE; j++) {
+            out[j] ^= u[j];
+        }
+    }
+}
+
+
+static const char b64_chars[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+
+static Py_ssize_t
+b64_encode(const unsigned char *src, Py_ssize_t len, char *out)
+{
+    // out needs room for 4 * ((len + 2) / 3) characters
+    char *pos = out;
+    Py_ssize_t i;
+    uint32_t v;
+
+    for (i = 0; i + 2 < len; i += 3) {
+        v = ((uint32_t)src[i] << 16) | (src[i + 1] << 8) | src[i + 2];
+        *pos++ = b64_chars[v >> 18];
+        *pos++ = b64_chars[(v >> 12) & 63];
+        *pos++ = b64_chars[(v >> 6) & 63];
+        *pos++ = b64_chars[v & 63];
+    }
+    if (i < len) {
+        v = (uint32_t)src[i] << 16;
+        if (i + 1 < len) {
+            v |= src[i + 1] << 8;
+        }
+        *pos++ = b64_chars[v >> 18];
+        *pos++ = b64_chars[(v >> 12) & 63];
+        *pos++ = i + 1 < len ? b64_chars[(v >> 6) & 63] : '=';
+        *pos++ = '=';
+    }
+    return pos - out;
+}
+
+
+static Py_ssize_t
+b64_decode(const char *src, Py_ssize_t len, unsigned char *out)
+{
+    // Returns decoded length or -1 for invalid input. out needs room for
+    // 3 * len / 4 bytes.
+    unsigned char *pos = out;
+    uint32_t v = 0;
+    Py_ssize_t i;
+    int bits = 0;
+    const char *c;
+
+    if (len % 4) {
+        return -1;
+    }
+    while (len && src[len - 1] == '=' && bits < 2) {
+        // padding
+        len--;
+        bits++;
+    }
+    bits = 0;
+    for (i = 0; i < len; i++) {
+        if (src[i] == '\0' || (c = strchr(b64_chars, src[i])) == NULL) {
+            return -1;
+        }
+        v = (v << 6) | (uint32_t)(c - b64_chars);
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            *pos++ = (unsigned char)(v >> bits);
+        }
+    }
+    return pos - out;
+}
+
+
+static void
+hex_digest(const unsigned char *digest, int size, char *out)
+{
+    static const char hex[] = "0123456789abcdef";
+    int i;
+
+    for (i = 0; i < size; i++) {
+        *out++ = hex[digest[i] >> 4];
+        *out++ = hex[digest[i] & 15];
+    }
+}
+
+
+void
+md5_password(
+    const char *user, const char *password, const char *salt, char *out)
+{
+    // "md5" + md5(md5(password + user) + salt) in hex, zero terminated
+    Digest dg;
+    unsigned char digest[16];
+    char hex[32];
+
+    md5_init(&dg);
+    digest_update(&dg, password, strlen(password));
+    digest_update(&dg, user, strlen(user));
+    digest_final(&dg, digest);
+    hex_digest(digest, 16, hex);
+
+    md5_init(&dg);
+    digest_update(&dg, hex, 32);
+    digest_update(&dg, salt, 4);
+    digest_final(&dg, digest);
+
+    memcpy(out, "md5", 3);
+    hex_digest(digest, 16, out + 3);
+    out[MD5_PASSWORD_SIZE - 1] = '\0';
+}
+
+
+#ifdef Py_GIL_DISABLED
+#define CACHE_LOCK(c) PyMutex_Lock(&(c)->mutex)
+#define CACHE_UNLOCK(c) PyMutex_Unlock(&(c)->mutex)
+#else
+// the GIL is held while using the cache
+#define CACHE_LOCK(c)
+#define CACHE_UNLOCK(c)
+#endif
+
+
+static void
+scram_keys(
+    ScramKeyCache *cache, const char *password, const unsigned char *salt,
+    size_t salt_len, int iterations, unsigned char *client_key,
+    unsigned char *server_key)
+{
+    // Derives the keys from the password or gets them from the cache. The
+    // salted password takes thousands of hashes on purpose, which adds up
+    // when many connections are opened at once.
+    unsigned char id[SHA256_SIZE], salted[SHA256_SIZE];
+    ScramKeys *entry, *oldest;
+    Digest dg;
+    int i;
+
+    sha256_init(&dg);
+    digest_update(&dg, password, strlen(password) + 1);
+    digest_update(&dg, salt, salt_len);
+    digest_final(&dg, id);
+
+    CACHE_LOCK(cache);
+    for (i = 0; i < SCRAM_KEY_CACHE_SIZE; i++) {
+        entry = cache->entries + i;
+        if (entry->last_used && entry->iterations == iterations &&
+                memcmp(entry->id, id, SHA256_SIZE) == 0) {
+            entry->last_used = ++cache->clock;
+            memcpy(client_key, entry->client_key, SHA256_SIZE);
+            memcpy(server_key, entry->server_key, SHA256_SIZE);
+            CACHE_UNLOCK(cache);
+            return;
+        }
+    }
+    CACHE_UNLOCK(cache);
+
+    Py_BEGIN_ALLOW_THREADS
+    salted_password(password, salt, salt_len, iterations, salted);
+    hmac(salted, SHA256_SIZE, "Client Key", 10, client_key);
+    hmac(salted, SHA256_SIZE, "Server Key", 10, server_key);
+    memset(salted, 0, SHA256_SIZE);
+    Py_END_ALLOW_THREADS
+
+    CACHE_LOCK(cache);
+    oldest = cache->entries;
+    for (i = 1; i < SCRAM_KEY_CACHE_SIZE; i++) {
+        if (cache->entries[i].last_used < oldest->last_used) {
+            oldest = cache->entries + i;
+        }
+    }
+    memcpy(oldest->id, id, SHA256_SIZE);
+    oldest->iterations = iterations;
+    memcpy(oldest->client_key, client_key, SHA256_SIZE);
+    memcpy(oldest->server_key, server_key, SHA256_SIZE);
+    oldest->last_used = ++cache->clock;
+    CACHE_UNLOCK(cache);
+}
+
+
+ScramState *
+scram_new(void)
+{
+    // Creates the state with the client-first-message
+    ScramState *scram;
+    PyObject *os, *random;
+    char *pos;
+
+    os = PyImport_ImportModule("os");
+    if (os == NULL) {
+        return NULL;
+    }
+    random = PyObject_CallMethod(os, "urandom", "i", 18);
+    Py_DECREF(os);
+    if (random == NULL) {
+        return NULL;
+    }
+    scram = PyMem_Calloc(1, sizeof(ScramState));
+    if (scram == NULL) {
+        Py_DECREF(random);
+        PyErr_NoMemory();
+        return NULL;
+    }
+    b64_encode((unsigned char *)PyBytes_AS_STRING(random), 18, scram->nonce);
+    Py_DECREF(random);
+
+    // gs2 header without channel binding and empty user name, the server
+    // uses the user of the startup message
+    scram->message_len = 8 + SCRAM_NONCE_SIZE;
+    scram->message = PyMem_Malloc(scram->message_len);
+    if (scram->message == NULL) {
+        scram_free(scram);
+        PyErr_NoMemory();
+        return NULL;
+    }
+    pos = scram->message;
+    memcpy(pos, "n,,n=,r=", 8);
+    memcpy(pos + 8, scram->nonce, SCRAM_NONCE_SIZE);
+    return scram;
+}
+
+
+int
+scram_continue(
+    PoqaioState *state, ScramState *scram, const char *password,
+    const char *data, Py_ssize_t len)
+{
+    // Handles the server-first-message and creates the
+    // client-final-message
+    const char *pos = data, *end = data + len, *attr_end, *attr;
+    const char *nonce = NULL, *salt = NULL;
+    Py_ssize_t nonce_len = 0, salt_len = 0, bare_len, final_len;
+    long iterations = 0;
+    unsigned char *salt_bytes, client_key[SHA256_SIZE];
+    unsigned char server_key[SHA256_SIZE], stored_key[SHA256_SIZE];
+    unsigned char proof[SHA256_SIZE];
+    char *auth, *final;
+    int i;
+
+    while (pos < end) {
+        attr_end = memchr(pos, ',', end - pos);
+        if (attr_end == NULL) {
+            attr_end = end;
+        }
+        if (attr_end - pos >= 2 && pos[1] == '=') {
+            if (pos[0] == 'r') {
+                nonce = pos + 2;
+                nonce_len = attr_end - nonce;
+            }
+            else if (pos[0] == 's') {
+                salt = pos + 2;
+                salt_len = attr_end - salt;
+            }
+            else if (pos[0] == 'i') {
+                // the message is not zero terminated, no strtol
+                for (attr = pos + 2; attr < attr_end; attr++) {
+                    if (*attr < '0' || *attr > '9' || iterations > INT_MAX) {
+                        iterations = 0;
+                        break;
+                    }
+                    iterations = iterations * 10 + (*attr - '0');
+                }
+            }
+        }
+        pos = attr_end + 1;
+    }
+    if (nonce == NULL || nonce_len <= SCRAM_NONCE_SIZE ||
+            memcmp(nonce, scram->nonce, SCRAM_NONCE_SIZE) != 0) {
+        PyErr_SetString(state->ProtocolError, "Invalid SCRAM server nonce");
+        return -1;
+    }
+    if (salt == NULL || iterations <= 0 || iterations > INT_MAX) {
+        PyErr_SetString(
+            state->ProtocolError, "Invalid SCRAM server-first-message");
+        return -1;
+    }
+
+    salt_bytes = PyMem_Malloc(salt_len / 4 * 3 + 1);
+    if (salt_bytes == NULL) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    salt_len = b64_decode(salt, salt_len, salt_bytes);
+    if (salt_len == -1) {
+        PyMem_Free(salt_bytes);
+        PyErr_SetString(state->ProtocolError, "Invalid SCRAM salt");
+        return -1;
+    }
+    scram_keys(
+        &state->scram_keys, password, salt_bytes, salt_len, (int)iterations,
+        client_key, server_key);
+    PyMem_Free(salt_bytes);
+
+    // client-final-message-without-proof: base64 of gs2 header and nonce
+    final_len = 9 + nonce_len;
+    final = PyMem_Malloc(final_len + 3 + 44);
+    if (final == NULL) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    memcpy(final, "c=biws,r=", 9);
+    memcpy(final + 9, nonce, nonce_len);
+
+    // AuthMessage: client-first-message-bare, server-first-message and
+    // client-final-message-without-proof
+    bare_len = scram->message_len - 3;
+    scram->auth_message_len = bare_len + 1 + len + 1 + final_len;
+    auth = PyMem_Malloc(scram->auth_message_len);
+    if (auth == NULL) {
+        PyMem_Free(final);
+        PyErr_NoMemory();
+        return -1;
+    }
+    memcpy(auth, scram->message + 3, bare_len);
+    auth[bare_len] = ',';
+    memcpy(auth + bare_len + 1, data, len);
+    auth[bare_len + 1 + len] = ',';
+    memcpy(auth + bare_len + 2 + len, final, final_len);
+    scram->auth_message = auth;
+
+    sha256(client_key, SHA256_SIZE, stored_key);
+    hmac(stored_key, SHA256_SIZE, auth, scram->auth_message_len, proof);
+    for (i = 0; i < SHA256_SIZE; i++) {
+        proof[i] ^= client_key[i];
+    }
+    hmac(server_key, SHA256_SIZE, auth, scram->auth_message_len,
+         scram->server_signature);
+    memset(client_key, 0, SHA256_SIZE);
+    memset(server_key, 0, SHA256_SIZE);
+
+    memcpy(final + final_len, ",p=", 3);
+    final_len += 3;
+    final_len += b64_encode(proof, SHA256_SIZE, final + final_len);
+    PyMem_Free(scram->message);
+    scram->message = final;
+    scram->message_len = final_len;
+    return 0;
+}
+
+
+int
+scram_finish(
+    PoqaioState *state, ScramState *scram, const char *data, Py_ssize_t len)
+{
+    // Verifies the server signature of the server-final-message
+    unsigned char signature[SHA256_SIZE + 2];
+    unsigned char diff = 0;
+    int i;
+
+    if (scram->auth_message == NULL || len != 46 || memcmp(data, "v=", 2) ||
+            b64_decode(data + 2, 44, signature) != SHA256_SIZE) {
+        PyErr_SetString(
+            state->ProtocolError, "Invalid SCRAM server-final-message");
+        return -1;
+    }
+    for (i = 0; i < SHA256_SIZE; i++) {
+        diff |= signature[i] ^ scram->server_signature[i];
+    }
+    if (diff) {
+        PyErr_SetString(
+            state->ProtocolError, "Invalid SCRAM server signature");
+        return -1;
+    }
+    return 0;
+}
+
+
+void
+scram_free(ScramState *scram)
+{
+    PyMem_Free(scram->message);
+    PyMem_Free(scram->auth_message);
+    PyMem_Free(scram);
+}
@@ -0,0 +1,51 @@
+#ifndef POQAIO_AUTH_H
+#define POQAIO_AUTH_H
+
+#include "poqaio.h"
+
+#define SHA256_SIZE 32
+#define MD5_PASSWORD_SIZE 36       // "md5", 32 hex digits and terminator
+#define SCRAM_NONCE_SIZE 24        // base64 of 18 random bytes
+#define SCRAM_KEY_CACHE_SIZE 16
+
+// Derived keys of a password, for reuse when connecting again with the same
+// salt and iteration count
+typedef struct {
+    unsigned char id[SHA256_SIZE];    // hash of password and salt
+    int iterations;
+    unsigned char client_key[SHA256_SIZE];
+    unsigned char server_key[SHA256_SIZE];
+    uint64_t last_used;               // 0 for an unused entry
+} ScramKeys;
+
+typedef struct {
+    ScramKeys entries[SCRAM_KEY_CACHE_SIZE];
+    uint64_t clock;
+#ifdef Py_GIL_DISABLED
+    PyMutex mutex;
+#endif
+} ScramKeyCache;
+
+// Client side of a SCRAM-SHA-256 exchange
+typedef struct _ScramState {
+    char *message;                     // next message for the server
+    Py_ssize_t message_len;
+    char *auth_message;                // exchanged messages, for signatures
+    Py_ssize_t auth_message_len;
+    char nonce[SCRAM_NONCE_SIZE + 1];
+    unsigned char server_signature[SHA256_SIZE];
+} ScramState;
+
+void md5_password(
+    const char *user, const char *password, const char *salt, char *out);
+
+ScramState *scram_new(void);
+int scram_continue(
+    PoqaioState *state, ScramState *scram, const char *password,
+    const char *data, Py_ssize_t len);
+int scram_finish(
+    PoqaioState *state, ScramState *scram, const char *data,
+    Py_ssize_t len);
+void scram_free(ScramState *scram);
+
+#endif
@@ -0,0 +1,604 @@
+#include "poqaio.h"
+#include "state.h"
+#include "columns.h"
+#include "types.h"
+
+
+static int
+sink_column_kind(SinkColumn *col)
+{
+    // Determines kind and width of the values from the buffer format.
+    // A bytes buffer ("B") gets the values in the width of the column type.
+    const char *fmt = col->view.format ? col->view.format : "B";
+    Py_ssize_t itemsize = col->view.itemsize;
+
+    if (*fmt == '@' || *fmt == '=') {
+        fmt++;
+    }
+    if (fmt[0] == '\0' || fmt[1] != '\0') {
+        goto invalid;
+    }
+    col->width = (int)itemsize;
+    switch (*fmt) {
+        case 'B':
+            switch (col->source) {
+                case COL_INT16:
+                    col->kind = SINK_INT;
+                    col->width = 2;
+                    return 0;
+                case COL_INT32:
+                    col->kind = SINK_INT;
+                    col->width = 4;
+                    return 0;
+                case COL_INT64:
+                    col->kind = SINK_INT;
+                    col->width = 8;
+                    return 0;
+                case COL_UINT32:
+                    col->kind = SINK_UINT;
+                    col->width = 4;
+                    return 0;
+                case COL_FLOAT32:
+                    col->kind = SINK_FLOAT;
+                    col->width = 4;
+                    return 0;
+                case COL_FLOAT64:
+                    col->kind = SINK_FLOAT;
+                    col->width = 8;
+                    return 0;
+                case COL_BOOL:
+                    col->kind = SINK_BOOL;
+                    col->width = 1;
+                    return 0;
+                default:
+                    goto invalid;
+            }
+        case 'h':
+        case 'i':
+        case 'l':
+        case 'q':
+            col->kind = SINK_INT;
+            return 0;
+        case 'H':
+        case 'I':
+        case 'L':
+        case 'Q':
+            col->kind = SINK_UINT;
+            return 0;
+        case 'f':
+        case 'd':
+            col->kind = SINK_FLOAT;
+            return 0;
+        case '?':
+            col->kind = SINK_BOOL;
+            return 0;
+    }
+
+invalid:
+    PyErr_Format(
+        PyExc_TypeError, "Unsupported buffer format '%s' for column '%s'",
+        col->view.format ? col->view.format : "B", col->name);
+    return -1;
+}
+
+
+static int
+sink_column_check(SinkColumn *col)
+{
+    // Checks that the values of the column fit in the buffer
+    int compatible;
+
+    switch (col->kind) {
+        case SINK_BOOL:
+            compatible = col->source == COL_BOOL;
+            break;
+        case SINK_FLOAT:
+            compatible = (
+                col->source != COL_BOOL && col->source != COL_UTF8 &&
+                col->source != COL_BINARY);
+            break;
+        default:
+            compatible = (
+                col->source != COL_FLOAT32 && col->source != COL_FLOAT64 &&
+                col->source != COL_UTF8 && col->source != COL_BINARY);
+    }
+    if (!compatible) {
+        PyErr_Format(
+            PyExc_TypeError, "Column '%s' does not fit in buffer format '%s'",
+            col->name, col->view.format ? col->view.format : "B");
+        return -1;
+    }
+    return 0;
+}
+
+
+static Py_ssize_t
+sink_column_capacity(SinkColumn *col)
+{
+    Py_ssize_t capacity = PY_SSIZE_T_MAX;
+
+    if (col->view.obj) {
+        capacity = col->view.len / col->width;
+    }
+    if (col->nulls.obj && col->nulls.len < capacity) {
+        capacity = col->nulls.len;
+    }
+    return capacity;
+}
+
+
+static void
+sink_update_capacity(ColumnSink *self)
+{
+    Py_ssize_t capacity = PY_SSIZE_T_MAX, col_capacity;
+    int i;
+
+    for (i = 0; i < self->ncolumns; i++) {
+        col_capacity = sink_column_capacity(self->columns + i);
+        if (col_capacity < capacity) {
+            capacity = col_capacity;
+        }
+    }
+    self->capacity = capacity;
+}
+
+
+static int
+get_nulls_view(ColumnSink *self, int i, Py_buffer *view)
+{
+    PyObject *obj;
+    int ret = 0;
+
+    if (self->nulls == Py_None) {
+        return 0;
+    }
+    obj = PySequence_GetItem(self->nulls, i);
+    if (obj == NULL) {
+        return -1;
+    }
+    if (obj != Py_None) {
+        ret = PyObject_GetBuffer(
+            obj, view, PyBUF_WRITABLE | PyBUF_C_CONTIGUOUS);
+        if (ret == 0 && view->itemsize != 1) {
+            PyBuffer_Release(view);
+            PyErr_SetString(
+                PyExc_TypeError, "Null masks need one byte per row");
+            ret = -1;
+        }
+    }
+    Py_DECREF(obj);
+    return ret;
+}
+
+
+int
+ColumnSink_start(ColumnSink *self, PyObject *fields)
+{
+    // Acquires the buffers for the columns of a new result
+    Py_ssize_t ncolumns = PyTuple_GET_SIZE(fields);
+    int i;
+
+    if (PySequence_Size(self->buffers) != ncolumns || (
+            self->nulls != Py_None &&
+            PySequence_Size(self->nulls) != ncolumns)) {
+        if (!PyErr_Occurred()) {
+            PyErr_Format(
+                PyExc_ValueError, "Expected buffers for %zd columns",
+                ncolumns);
+        }
+        return -1;
+    }
+    ColumnSink_release(self);
+    self->columns = PyMem_Calloc(ncolumns + 1, sizeof(SinkColumn));
+    if (self->columns == NULL) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    self->ncolumns = (int)ncolumns;
+    self->rows = 0;
+
+    for (i = 0; i < ncolumns; i++) {
+        SinkColumn *col = self->columns + i;
+        PyObject *field = PyTuple_GET_ITEM(fields, i), *obj;
+        const char *name;
+        unsigned long oid;
+
+        name = PyUnicode_AsUTF8(PyStructSequence_GET_ITEM(field, 0));
+        if (name == NULL) {
+            goto error;
+        }
+        col->name = PyMem_Malloc(strlen(name) + 1);
+        if (col->name == NULL) {
+            PyErr_NoMemory();
+            goto error;
+        }
+        strcpy(col->name, name);
+        oid = PyLong_AsUnsignedLong(PyStructSequence_GET_ITEM(field, 1));
+        if (oid == (unsigned long)-1 && PyErr_Occurred()) {
+            goto error;
+        }
+        col->source = get_col_type((uint32_t)oid);
+
+        obj = PySequence_GetItem(self->buffers, i);
+        if (obj == NULL) {
+            goto error;
+        }
+        if (obj == Py_None) {
+            Py_DECREF(obj);
+            col->kind = SINK_SKIP;
+            continue;
+        }
+        if (PyObject_GetBuffer(
+                obj, &col->view,
+                PyBUF_WRITABLE | PyBUF_FORMAT | PyBUF_C_CONTIGUOUS) == -1) {
+            Py_DECREF(obj);
+            goto error;
+        }
+        Py_DECREF(obj);
+        if (sink_column_kind(col) == -1 || sink_column_check(col) == -1) {
+            goto error;
+        }
+        if (get_nulls_view(self, i, &col->nulls) == -1) {
+            goto error;
+        }
+    }
+    sink_update_capacity(self);
+    return 0;
+
+error:
+    ColumnSink_release(self);
+    return -1;
+}
+
+
+static int
+call_on_chunk(ColumnSink *self)
+{
+    PyObject *res;
+
+    res = PyObject_CallFunction(self->on_chunk, "n", self->rows);
+    if (res == NULL) {
+        return -1;
+    }
+    Py_DECREF(res);
+    self->rows = 0;
+    return 0;
+}
+
+
+static int
+resize_buffer(Py_buffer *view, Py_ssize_t size, int flags, char *name)
+{
+    // Resizes bytearray of the view, other buffers can not be resized
+    PyObject *obj = view->obj;
+    int ret;
+
+    if (view->len == size) {
+        return 0;
+    }
+    if (!PyByteArray_CheckExact(obj)) {
+        PyErr_Format(
+            PyExc_ValueError, "Buffer for column '%s' is full", name);
+        return -1;
+    }
+    Py_INCREF(obj);
+    PyBuffer_Release(view);
+    ret = PyByteArray_Resize(obj, size);
+    if (ret == 0) {
+        ret = PyObject_GetBuffer(obj, view, flags);
+    }
+    Py_DECREF(obj);
+    return ret;
+}
+
+
+int
+ColumnSink_reserve_row(ColumnSink *self)
+{
+    // Makes room for another row, by handing the chunk to on_chunk or by
+    // growing the buffers
+    Py_ssize_t capacity;
+    int i;
+
+    if (self->rows < self->capacity) {
+        return 0;
+    }
+    if (self->on_chunk) {
+        return call_on_chunk(self);
+    }
+    capacity = self->capacity < 32 ? 64 : self->capacity * 2;
+    for (i = 0; i < self->ncolumns; i++) {
+        SinkColumn *col = self->columns + i;
+
+        if (col->view.obj && col->view.len / col->width < capacity &&
+                resize_buffer(
+                    &col->view, capacity * col->width,
+                    PyBUF_WRITABLE | PyBUF_FORMAT | PyBUF_C_CONTIGUOUS,
+                    col->name) == -1) {
+            return -1;
+        }
+        if (col->nulls.obj && col->nulls.len < capacity &&
+                resize_buffer(
+                    &col->nulls, capacity,
+                    PyBUF_WRITABLE | PyBUF_C_CONTIGUOUS, col->name) == -1) {
+            return -1;
+        }
+    }
+    sink_update_capacity(self);
+    return 0;
+}
+
+
+static int
+write_int(SinkColumn *col, char *dest, int64_t val)
+{
+    switch (col->width) {
+        case 2:
+            if (col->kind == SINK_INT && val >= INT16_MIN && val <= INT16_MAX) {
+                int16_t v = (int16_t)val;
+                memcpy(dest, &v, 2);
+                return 0;
+            }
+            if (col->kind == SINK_UINT && val >= 0 && val <= UINT16_MAX) {
+                uint16_t v = (uint16_t)val;
+                memcpy(dest, &v, 2);
+                return 0;
+            }
+            break;
+        case 4:
+            if (col->kind == SINK_INT && val >= INT32_MIN && val <= INT32_MAX) {
+                int32_t v = (int32_t)val;
+                memcpy(dest, &v, 4);
+                return 0;
+            }
+            if (col->kind == SINK_UINT && val >= 0 && val <= UINT32_MAX) {
+                uint32_t v = (uint32_t)val;
+                memcpy(dest, &v, 4);
+                return 0;
+            }
+            break;
+        case 8:
+            if (col->kind == SINK_INT || val >= 0) {
+                memcpy(dest, &val, 8);
+                return 0;
+            }
+            break;
+    }
+    PyErr_Format(
+        PyExc_OverflowError, "Value out of range for buffer of column '%s'",
+        col->name);
+    return -1;
+}
+
+
+int
+ColumnSink_write(ColumnSink *self, int i, char *data, int32_t size)
+{
+    // Writes a value in the current row, or null when size is -1
+    SinkColumn *col = self->columns + i;
+    char *dest;
+    int64_t ival;
+    double dval;
+    char bval;
+
+    if (col->kind == SINK_SKIP) {
+        return 0;
+    }
+    dest = (char *)col->view.buf + self->rows * col->width;
+    if (col->nulls.obj) {
+        ((char *)col->nulls.buf)[self->rows] = size == -1;
+    }
+
+    if (size == -1) {
+        if (col->kind == SINK_FLOAT) {
+            dval = Py_NAN;
+            goto write_float;
+        }
+        if (col->nulls.obj == NULL) {
+            PyErr_Format(
+                PyExc_ValueError, "Null value in column '%s' without null "
+                "mask", col->name);
+            return -1;
+        }
+        memset(dest, 0, col->width);
+        return 0;
+    }
+
+    switch (col->kind) {
+        case SINK_FLOAT:
+            if (col->source == COL_FLOAT32 || col->source == COL_FLOAT64) {
+                if (parse_double(data, size, &dval) == -1) {
+                    goto invalid;
+                }
+            }
+            else {
+                if (parse_int64(data, size, &ival) == -1) {
+                    goto invalid;
+                }
+                dval = (double)ival;
+            }
+            goto write_float;
+        case SINK_BOOL:
+            if (parse_bool(data, size, &bval) == -1) {
+                goto invalid;
+            }
+            *dest = bval;
+            return 0;
+        default:
+            if (col->source == COL_BOOL) {
+                if (parse_bool(data, size, &bval) == -1) {
+                    goto invalid;
+                }
+                ival = bval;
+            }
+            else if (parse_int64(data, size, &ival) == -1) {
+                goto invalid;
+            }
+            return write_int(col, dest, ival);
+    }
+
+write_float:
+    if (col->width == 4) {
+        float fval = (float)dval;
+        memcpy(dest, &fval, sizeof(float));
+    }
+    else {
+        memcpy(dest, &dval, sizeof(double));
+    }
+    return 0;
+
+invalid:
+    PyErr_Format(
+        self->state->ProtocolError, "Invalid value for column '%s'",
+        col->name);
+    return -1;
+}
+
+
+int
+ColumnSink_finish(ColumnSink *self)
+{
+    // Hands the last chunk to on_chunk, or trims the growable buffers to
+    // the received rows
+    int i, ret = 0;
+
+    if (self->on_chunk) {
+        if (self->rows) {
+            ret = call_on_chunk(self);
+        }
+    }
+    else {
+        for (i = 0; i < self->ncolumns && ret == 0; i++) {
+            SinkColumn *col = self->columns + i;
+
+            if (col->view.obj && PyByteArray_CheckExact(col->view.obj)) {
+                ret = resize_buffer(
+                    &col->view, self->rows * col->width,
+                    PyBUF_WRITABLE | PyBUF_FORMAT | PyBUF_C_CONTIGUOUS,
+                    col->name);
+            }
+            if (ret == 0 && col->nulls.obj &&
+                    PyByteArray_CheckExact(col->nulls.obj)) {
+                ret = resize_buffer(
+                    &col->nulls, self->rows,
+                    PyBUF_WRITABLE | PyBUF_C_CONTIGUOUS, col->name);
+            }
+        }
+    }
+    ColumnSink_release(self);
+    return ret;
+}
+
+
+void
+ColumnSink_release(ColumnSink *self)
+{
+    // Releases the buffers of the current result
+    int i;
+
+    if (self->columns == NULL) {
+        return;
+    }
+    for (i = 0; i < self->ncolumns; i++) {
+        SinkColumn *col = self->columns + i;
+
+        if (col->view.obj) {
+            PyBuffer_Release(&col->view);
+        }
+        if (col->nulls.obj) {
+            PyBuffer_Release(&col->nulls);
+        }
+        PyMem_Free(col->name);
+    }
+    PyMem_Free(self->columns);
+    self->columns = NULL;
+    self->ncolumns = 0;
+    self->capacity = 0;
+}
+
+
+static PyObject *
+ColumnSink_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+    static char *kwlist[] = {"buffers", "nulls", "on_chunk", NULL};
+    ColumnSink *self;
+    PyObject *buffers, *nulls=Py_None, *on_chunk=Py_None;
+
+    if (!PyArg_ParseTupleAndKeywords(
+            args, kwds, "O|OO", kwlist, &buffers, &nulls, &on_chunk)) {
+        return NULL;
+    }
+    if (!PySequence_Check(buffers) ||
+            (nulls != Py_None && !PySequence_Check(nulls))) {
+        PyErr_SetString(
+            PyExc_TypeError, "Buffers and nulls must be sequences");
+        return NULL;
+    }
+    if (on_chunk != Py_None && !PyCallable_Check(on_chunk)) {
+        PyErr_SetString(PyExc_TypeError, "on_chunk must be callable");
+        return NULL;
+    }
+
+    self = (ColumnSink *)type->tp_alloc(type, 0);
+    if (self == NULL) {
+        return NULL;
+    }
+    self->state = get_state_by_type(type);
+    Py_INCREF(buffers);
+    self->buffers = buffers;
+    Py_INCREF(nulls);
+    self->nulls = nulls;
+    if (on_chunk != Py_None) {
+        Py_INCREF(on_chunk);
+        self->on_chunk = on_chunk;
+    }
+    return (PyObject *)self;
+}
+
+
+static void
+ColumnSink_dealloc(ColumnSink *self)
+{
+    PyTypeObject *tp = Py_TYPE(self);
+
+    ColumnSink_release(self);
+    Py_XDECREF(self->buffers);
+    Py_XDECREF(self->nulls);
+    Py_XDECREF(self->on_chunk);
+    tp->tp_free((PyObject *)self);
+    Py_DECREF(tp);
+}
+
+
+static PyMemberDef ColumnSink_members[] = {
+    {"buffers", T_OBJECT, offsetof(ColumnSink, buffers), READONLY,
+     "buffer or None per column"},
+    {"nulls", T_OBJECT, offsetof(ColumnSink, nulls), READONLY,
+     "null mask or None per column"},
+    {"on_chunk", T_OBJECT, offsetof(ColumnSink, on_chunk), READONLY,
+     "called with number of rows when buffers are full"},
+    {"rows", T_PYSSIZET, offsetof(ColumnSink, rows), READONLY,
+     "rows in current chunk"},
+    {"total_rows", T_LONGLONG, offsetof(ColumnSink, total_rows), READONLY,
+     "rows received in total"},
+    {NULL}
+};
+
+
+static PyType_Slot ColumnSink_slots[] = {
+    {Py_tp_dealloc, ColumnSink_dealloc},
+    {Py_tp_doc, PyDoc_STR(
+        "Caller provided buffers for the values of columns")},
+    {Py_tp_members, ColumnSink_members},
+    {Py_tp_new, ColumnSink_new},
+    {0, NULL}
+};
+
+
+PyType_Spec ColumnSinkSpec = {
+    "poqaio.ColumnSink",
+    sizeof(ColumnSink),
+    0,
+    Py_TPFLAGS_DEFAULT,
+    ColumnSink_slots
+};
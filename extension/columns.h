@@ -0,0 +1,47 @@
+#ifndef POQAIO_COLUMNS_H
+#define POQAIO_COLUMNS_H
+
+#include "poqaio.h"
+#include "arrow.h"
+
+
+// Kinds of values in a caller provided buffer
+typedef enum {
+    SINK_SKIP,       // no buffer for the column
+    SINK_INT,
+    SINK_UINT,
+    SINK_FLOAT,
+    SINK_BOOL,
+} sink_kind;
+
+typedef struct {
+    Py_buffer view;          // view.obj is NULL when there is no buffer
+    Py_buffer nulls;         // one byte per row, 1 for null
+    sink_kind kind;
+    int width;               // item size in buffer
+    col_type source;         // type of the column in the result
+    char *name;              // for error messages
+} SinkColumn;
+
+typedef struct {
+    PyObject_HEAD
+    PoqaioState *state;
+    PyObject *buffers;       // sequence with buffer or None per column
+    PyObject *nulls;         // sequence with buffer or None per column
+    PyObject *on_chunk;      // callable or NULL
+    int ncolumns;
+    SinkColumn *columns;     // while receiving a result
+    Py_ssize_t rows;         // rows written in current chunk
+    Py_ssize_t capacity;     // rows that fit in the buffers
+    long long total_rows;
+} ColumnSink;
+
+extern PyType_Spec ColumnSinkSpec;
+
+int ColumnSink_start(ColumnSink *, PyObject *fields);
+int ColumnSink_reserve_row(ColumnSink *);
+int ColumnSink_write(ColumnSink *, int col, char *data, int32_t size);
+int ColumnSink_finish(ColumnSink *);
+void ColumnSink_release(ColumnSink *);
+
+#endif
@@ -0,0 +1,243 @@
+#include "poqaio.h"
+#include "state.h"
+#include "decode.h"
+
+
+DecodeJob *
+DecodeJob_create(PoqaioState *state, int ncolumns, Py_ssize_t size)
+{
+    // Creates an empty job. The caller initializes the columns.
+    DecodeJob *self;
+
+    self = (DecodeJob *)state->DecodeJobType->tp_alloc(
+        state->DecodeJobType, 0);
+    if (self == NULL) {
+        return NULL;
+    }
+    self->state = state;
+    self->columns = PyMem_RawCalloc(ncolumns + 1, sizeof(ArrowColumn));
+    self->data = PyMem_RawMalloc(size);
+    if (self->columns == NULL || self->data == NULL) {
+        Py_DECREF(self);
+        PyErr_NoMemory();
+        return NULL;
+    }
+    self->ncolumns = ncolumns;
+    self->size = size;
+    return self;
+}
+
+
+DecodeJob *
+DecodeJob_next(DecodeJob *prev)
+{
+    // Creates an empty job with the columns of a previous job of the result
+    DecodeJob *self;
+    int i, ret;
+
+    self = DecodeJob_create(prev->state, prev->ncolumns, prev->size);
+    if (self == NULL) {
+        return NULL;
+    }
+    for (i = 0; i < self->ncolumns; i++) {
+        ret = column_init(
+            self->columns + i, prev->columns[i].type, prev->columns[i].name);
+        if (ret != COL_OK) {
+            column_set_error(self->state, ret, self->columns + i);
+            Py_DECREF(self);
+            return NULL;
+        }
+    }
+    return self;
+}
+
+
+static void
+DecodeJob_dealloc(DecodeJob *self)
+{
+    PyTypeObject *tp = Py_TYPE(self);
+    int i;
+
+    if (self->columns) {
+        for (i = 0; i < self->ncolumns; i++) {
+            column_free(self->columns + i);
+        }
+        PyMem_RawFree(self->columns);
+    }
+    PyMem_RawFree(self->data);
+    Py_XDECREF(self->future);
+    tp->tp_free((PyObject *)self);
+    Py_DECREF(tp);
+}
+
+
+int
+DecodeJob_add(DecodeJob *self, char *msg, Py_ssize_t size)
+{
+    // Copies a complete DataRow message into the job
+    if (self->len + size > self->size) {
+        Py_ssize_t new_size = self->size;
+        char *data;
+
+        while (new_size < self->len + size) {
+            new_size *= 2;
+        }
+        data = PyMem_RawRealloc(self->data, new_size);
+        if (data == NULL) {
+            PyErr_NoMemory();
+            return -1;
+        }
+        self->data = data;
+        self->size = new_size;
+    }
+    memcpy(self->data + self->len, msg, size);
+    self->len += size;
+    return 0;
+}
+
+
+static void
+decode_messages(DecodeJob *self)
+{
+    // Decodes the messages into the columns, without GIL
+    char *pos = self->data, *end = self->data + self->len;
+    int ret = COL_OK;
+
+    self->error_column = -1;
+    while (pos < end) {
+        uint32_t length;
+        char *msg_end;
+
+        // messages are complete, framing has been checked when receiving
+        memcpy(&length, pos + 1, 4);
+        msg_end = pos + 1 + be32toh(length);
+        ret = append_data_row(self->columns, self->ncolumns, pos + 5, msg_end,
+                              &self->error_column);
+        if (ret != COL_OK) {
+            break;
+        }
+        self->num_rows++;
+        pos = msg_end;
+    }
+    self->status = ret;
+
+    // raw data is not needed anymore
+    PyMem_RawFree(self->data);
+    self->data = NULL;
+    self->len = self->size = 0;
+}
+
+
+static int
+claim(DecodeJob *self)
+{
+    // Returns 1 for the first caller, the one that must decode
+    int first;
+
+    Py_BEGIN_CRITICAL_SECTION(self);
+    first = !self->claimed;
+    self->claimed = 1;
+    Py_END_CRITICAL_SECTION();
+    return first;
+}
+
+
+static PyObject *
+DecodeJob_decode(DecodeJob *self, PyObject *unused)
+{
+    // Runs in a thread of the executor
+    if (claim(self)) {
+        Py_BEGIN_ALLOW_THREADS
+        decode_messages(self);
+        Py_END_ALLOW_THREADS
+    }
+    Py_RETURN_NONE;
+}
+
+
+int
+DecodeJob_submit(DecodeJob *self, PyObject *submit)
+{
+    // Starts decoding using the submit method of an executor
+    PyObject *decode;
+
+    decode = PyObject_GetAttrString((PyObject *)self, "decode");
+    if (decode == NULL) {
+        return -1;
+    }
+    self->future = PyObject_CallFunctionObjArgs(submit, decode, NULL);
+    Py_DECREF(decode);
+    return self->future == NULL ? -1 : 0;
+}
+
+
+int
+DecodeJob_wait(DecodeJob *self)
+{
+    // Decodes the job in the current thread when no worker started it, or
+    // waits until the worker is done. Sets an exception for invalid values.
+    PyObject *ret;
+
+    if (claim(self)) {
+        if (self->future) {
+            // still queued in the executor, a worker that gets to it later
+            // finds it claimed
+            ret = PyObject_CallMethod(self->future, "cancel", NULL);
+            Py_CLEAR(self->future);
+            if (ret == NULL) {
+                return -1;
+            }
+            Py_DECREF(ret);
+        }
+        Py_BEGIN_ALLOW_THREADS
+        decode_messages(self);
+        Py_END_ALLOW_THREADS
+    }
+    else if (self->future) {
+        ret = PyObject_CallMethod(self->future, "result", NULL);
+        Py_CLEAR(self->future);
+        if (ret == NULL) {
+            return -1;
+        }
+        Py_DECREF(ret);
+    }
+    if (self->status != COL_OK) {
+        return column_set_error(
+            self->state, self->status,
+            self->error_column == -1 ? NULL : self->columns +
+            self->error_column);
+    }
+    return 0;
+}
+
+
+static PyMethodDef DecodeJob_methods[] = {
+    {"decode", (PyCFunction) DecodeJob_decode, METH_NOARGS,
+     "decode the data rows, releases the GIL"},
+    {NULL}
+};
+
+
+static PyMemberDef DecodeJob_members[] = {
+    {"num_rows", T_LONGLONG, offsetof(DecodeJob, num_rows), READONLY,
+     "number of decoded rows"},
+    {NULL}
+};
+
+
+static PyType_Slot DecodeJob_slots[] = {
+    {Py_tp_dealloc, DecodeJob_dealloc},
+    {Py_tp_doc, PyDoc_STR("Chunk of data rows decoded in a worker thread")},
+    {Py_tp_methods, DecodeJob_methods},
+    {Py_tp_members, DecodeJob_members},
+    {0, NULL}
+};
+
+
+PyType_Spec DecodeJobSpec = {
+    "poqaio.DecodeJob",
+    sizeof(DecodeJob),
+    0,
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_DISALLOW_INSTANTIATION,
+    DecodeJob_slots
+};
@@ -0,0 +1,33 @@
+#ifndef POQAIO_DECODE_H
+#define POQAIO_DECODE_H
+
+#include "poqaio.h"
+#include "arrow.h"
+
+
+// A chunk of raw DataRow messages of a single result, decoded into columns
+// by a worker thread without holding the GIL.
+typedef struct {
+    PyObject_HEAD
+    PoqaioState *state;
+    char *data;              // complete DataRow messages, including header
+    Py_ssize_t len;
+    Py_ssize_t size;
+    int ncolumns;
+    ArrowColumn *columns;    // decoded values
+    int64_t num_rows;
+    int status;              // result code of decoding
+    int error_column;        // column of failing value, -1 for message
+    int claimed;             // a thread is decoding or has decoded
+    PyObject *future;        // executor future, NULL when not submitted
+} DecodeJob;
+
+extern PyType_Spec DecodeJobSpec;
+
+DecodeJob *DecodeJob_create(PoqaioState *, int ncolumns, Py_ssize_t size);
+DecodeJob *DecodeJob_next(DecodeJob *);
+int DecodeJob_add(DecodeJob *, char *msg, Py_ssize_t size);
+int DecodeJob_submit(DecodeJob *, PyObject *submit);
+int DecodeJob_wait(DecodeJob *);
+
+#endif
@@ -0,0 +1,238 @@
+#include "errors.h"
+#include "state.h"
+
+
+typedef struct {
+    const char *name;
+    char code;
+    int is_int;
+} ErrorField;
+
+// severity is handled separately, it has a localized fallback
+static const ErrorField error_fields[] = {
+    {"code", 'C', 0},
+    {"message", 'M', 0},
+    {"detail", 'D', 0},
+    {"hint", 'H', 0},
+    {"position", 'P', 1},
+    {"internal_position", 'p', 1},
+    {"internal_query", 'q', 0},
+    {"where", 'W', 0},
+    {"schema_name", 's', 0},
+    {"table_name", 't', 0},
+    {"column_name", 'c', 0},
+    {"data_type_name", 'd', 0},
+    {"constraint_name", 'n', 0},
+    {"file_name", 'F', 0},
+    {"line_number", 'L', 1},
+    {"routine_name", 'R', 0},
+    {NULL}
+};
+
+
+static const char *
+find_field(const char *pos, const char *end, char code, Py_ssize_t *len)
+{
+    // Returns the value of the field in the validated fields data or NULL
+    const char *term;
+
+    while (pos < end && *pos) {
+        term = memchr(pos + 1, '\0', end - pos - 1);
+        if (*pos == code) {
+            *len = term - pos - 1;
+            return pos + 1;
+        }
+        pos = term + 1;
+    }
+    return NULL;
+}
+
+
+static PyObject *
+field_value(PyObject *exc, char code, char fallback, int is_int)
+{
+    PyObject *raw, *value;
+    const char *start, *end, *field;
+    Py_ssize_t len;
+
+    raw = PyObject_GetAttrString(exc, "_fields");
+    if (raw == NULL) {
+        return NULL;
+    }
+    if (!PyBytes_Check(raw)) {
+        Py_DECREF(raw);
+        Py_RETURN_NONE;
+    }
+    start = PyBytes_AS_STRING(raw);
+    end = start + PyBytes_GET_SIZE(raw);
+    field = find_field(start, end, code, &len);
+    if (field == NULL && fallback) {
+        field = find_field(start, end, fallback, &len);
+    }
+    if (field == NULL) {
+        value = Py_None;
+        Py_INCREF(value);
+    }
+    else if (is_int) {
+        value = PyLong_FromString(field, NULL, 10);
+        if (value == NULL) {
+            // keep as text
+            PyErr_Clear();
+            value = PyUnicode_DecodeUTF8(field, len, "replace");
+        }
+    }
+    else {
+        value = PyUnicode_DecodeUTF8(field, len, "replace");
+    }
+    Py_DECREF(raw);
+    return value;
+}
+
+
+static PyObject *
+error_field(PyObject *field, PyObject *exc)
+{
+    // fget of the properties, field is the entry in error_fields
+    const ErrorField *ef = PyCapsule_GetPointer(field, NULL);
+
+    if (ef == NULL) {
+        return NULL;
+    }
+    return field_value(exc, ef->code, 0, ef->is_int);
+}
+
+
+static PyObject *
+error_severity(PyObject *unused, PyObject *exc)
+{
+    // non localized severity is only sent by PostgreSQL 9.6 and later
+    return field_value(exc, 'V', 'S', 0);
+}
+
+
+static PyMethodDef error_field_def = {
+    "error_field", (PyCFunction)error_field, METH_O, NULL};
+static PyMethodDef error_severity_def = {
+    "error_severity", (PyCFunction)error_severity, METH_O, NULL};
+
+
+static int
+add_property(PyObject *dict, const char *name, PyMethodDef *def,
+             PyObject *self, PyObject *module)
+{
+    PyObject *fget, *prop;
+    int ret;
+
+    fget = PyCFunction_NewEx(def, self, module);
+    if (fget == NULL) {
+        return -1;
+    }
+    prop = PyObject_CallFunctionObjArgs(
+        (PyObject *)&PyProperty_Type, fget, NULL);
+    Py_DECREF(fget);
+    if (prop == NULL) {
+        return -1;
+    }
+    ret = PyDict_SetItemString(dict, name, prop);
+    Py_DECREF(prop);
+    return ret;
+}
+
+
+static PyObject *
+new_message_type(PyObject *module, const char *name, PyObject *base)
+{
+    PyObject *dict, *type = NULL, *capsule;
+    const ErrorField *ef;
+
+    dict = PyDict_New();
+    if (dict == NULL) {
+        return NULL;
+    }
+    if (add_property(
+            dict, "severity", &error_severity_def, Py_None, module) == -1) {
+        goto end;
+    }
+    for (ef = error_fields; ef->name; ef++) {
+        capsule = PyCapsule_New((void *)ef, NULL, NULL);
+        if (capsule == NULL) {
+            goto end;
+        }
+        if (add_property(
+                dict, ef->name, &error_field_def, capsule, module) == -1) {
+            Py_DECREF(capsule);
+            goto end;
+        }
+        Py_DECREF(capsule);
+    }
+    type = PyErr_NewException(name, base, dict);
+end:
+    Py_DECREF(dict);
+    return type;
+}
+
+
+int
+errors_init_state(PyObject *module, PoqaioState *state)
+{
+    state->ServerError = new_message_type(
+        module, "poqaio.ServerError", state->Error);
+    if (state->ServerError == NULL) {
+        return -1;
+    }
+    state->Notice = new_message_type(
+        module, "poqaio.Notice", PyExc_Warning);
+    if (state->Notice == NULL) {
+        return -1;
+    }
+    return 0;
+}
+
+
+PyObject *
+server_message_create(
+    PoqaioState *state, PyObject *type, char *data, Py_ssize_t len)
+{
+    // Creates a ServerError or Notice from the fields of the message. Only
+    // the message is decoded, as exception argument.
+    PyObject *exc, *raw, *message;
+    const char *pos = data, *end = data + len, *term, *msg;
+    Py_ssize_t msg_len;
+
+    // "({code}{value}\0)*\0"
+    while (pos < end && *pos) {
+        term = memchr(pos + 1, '\0', end - pos - 1);
+        if (term == NULL) {
+            break;
+        }
+        pos = term + 1;
+    }
+    if (pos != end - 1 || *pos) {
+        PyErr_SetString(state->ProtocolError, "Invalid error response");
+        return NULL;
+    }
+
+    msg = find_field(data, end, 'M', &msg_len);
+    if (msg == NULL) {
+        message = PyUnicode_FromStringAndSize(NULL, 0);
+    }
+    else {
+        message = PyUnicode_DecodeUTF8(msg, msg_len, "replace");
+    }
+    if (message == NULL) {
+        return NULL;
+    }
+    exc = PyObject_CallFunctionObjArgs(type, message, NULL);
+    Py_DECREF(message);
+    if (exc == NULL) {
+        return NULL;
+    }
+    raw = PyBytes_FromStringAndSize(data, len);
+    if (raw == NULL || PyObject_SetAttrString(exc, "_fields", raw) == -1) {
+        Py_XDECREF(raw);
+        Py_DECREF(exc);
+        return NULL;
+    }
+    Py_DECREF(raw);
+    return exc;
+}
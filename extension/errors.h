@@ -0,0 +1,15 @@
+#ifndef POQAIO_ERRORS_H
+#define POQAIO_ERRORS_H
+
+#include "poqaio.h"
+
+
+// ServerError and Notice keep the fields of the ErrorResponse or
+// NoticeResponse message as bytes in the "_fields" attribute. Properties
+// decode a field when it is accessed.
+
+int errors_init_state(PyObject *module, PoqaioState *state);
+PyObject *server_message_create(
+    PoqaioState *state, PyObject *type, char *data, Py_ssize_t len);
+
+#endif
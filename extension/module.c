@@ -1,90 +1,364 @@
 #include "poqaio.h"
 #include "protocol.h"
+#include "state.h"
+#include "arrow.h"
+#include "columns.h"
+#include "decode.h"
+#include "errors.h"
+#include "rows.h"
+#include "statement.h"
+#include "spill.h"
+#include "replication.h"
+#include "types.h"
 
 
-static struct PyModuleDef poqaio_module = {
-    PyModuleDef_HEAD_INIT,
-    "_poqaio",   /* name of module */
-    NULL,                /* module documentation, may be NULL */
-    -1,                 /* size of per-interpreter state of the module,
-                       or -1 if the module keeps state in global variables. */
-    NULL
+static PyStructSequence_Field fd_fields[] = {
+    {"field_name", PyDoc_STR("field name")},
+    {"type_oid", PyDoc_STR("type oid")},
+    {"field_size", PyDoc_STR("field size")},
+    {"type_mod", PyDoc_STR("type modifier")},
+    {"format", PyDoc_STR("field format")},
+    {"table_oid", PyDoc_STR("table oid")},
+    {"col_num", PyDoc_STR("column number in table")},
+    {0}
+};
+static PyStructSequence_Desc fd_desc = {
+    "poqaio.FieldDescription",
+    PyDoc_STR("Field description"),
+    fd_fields,
+    7
 };
 
+static PyStructSequence_Field res_fields[] = {
+    {"fields", PyDoc_STR("Fields")},
+    {"data", PyDoc_STR("Data rows")},
+    {"tag", PyDoc_STR("Tag")},
+    {0}
+};
+static PyStructSequence_Desc res_desc = {
+    "poqaio.Result",
+    PyDoc_STR("Database execution result"),
+    res_fields,
+    3
+};
 
-PyObject *PoqaioError;
-PyObject *PoqaioServerError;
-PyObject *PoqaioProtocolError;
+static PyStructSequence_Field stats_fields[] = {
+    {"bytes_received", PyDoc_STR("bytes received")},
+    {"bytes_sent", PyDoc_STR("bytes sent")},
+    {"messages", PyDoc_STR("received messages by identifier")},
+    {"rows", PyDoc_STR("decoded data rows")},
+    {"conversions", PyDoc_STR("converter calls by converter kind")},
+    {"jumbo_buffers", PyDoc_STR("allocated buffers for large messages")},
+    {"futures", PyDoc_STR("created futures")},
+    {"spilled_results", PyDoc_STR("results over the memory budget")},
+    {"spilled_bytes", PyDoc_STR("bytes of data rows spilled to file")},
+    {0}
+};
+static PyStructSequence_Desc stats_desc = {
+    "poqaio.Stats",
+    PyDoc_STR("Protocol counters"),
+    stats_fields,
+    9
+};
 
-PyTypeObject *FieldDescription;
-PyTypeObject *Result;
+static PyStructSequence_Field tl_fields[] = {
+    {"encode_start", PyDoc_STR("start of encoding query")},
+    {"encode_end", PyDoc_STR("end of encoding query")},
+    {"write_done", PyDoc_STR("query handed to transport")},
+    {"first_byte", PyDoc_STR("first byte of response received")},
+    {"row_description", PyDoc_STR("first row description received")},
+    {"first_data_row", PyDoc_STR("first data row received")},
+    {"command_complete", PyDoc_STR("last command complete received")},
+    {"ready", PyDoc_STR("ready for query received")},
+    {0}
+};
+static PyStructSequence_Desc tl_desc = {
+    "poqaio.Timeline",
+    PyDoc_STR("Monotonic timestamps in nanoseconds of query stages, "
+              "0 when stage did not occur"),
+    tl_fields,
+    8
+};
 
+static PyStructSequence_Field change_fields[] = {
+    {"kind", PyDoc_STR("'B' begin, 'I' insert, 'U' update, 'D' delete, "
+                       "'T' truncate or 'C' commit")},
+    {"lsn", PyDoc_STR("WAL position, the end of the transaction for commit")},
+    {"xid", PyDoc_STR("transaction id")},
+    {"timestamp", PyDoc_STR("commit time in microseconds since the epoch")},
+    {"relation", PyDoc_STR("Relation, tuple of them for truncate")},
+    {"new", PyDoc_STR("values of the new row")},
+    {"old", PyDoc_STR("old values of the key or the row, if sent")},
+    {0}
+};
+static PyStructSequence_Desc change_desc = {
+    "poqaio.Change",
+    PyDoc_STR("Change of a logical replication stream"),
+    change_fields,
+    7
+};
 
-PyMODINIT_FUNC
-PyInit__poqaio(void)
+
+static struct PyModuleDef poqaio_module;
+
+
+PoqaioState *
+get_state(PyObject *module)
 {
-    PyObject *m;
-
-    PyStructSequence_Field fd_fields[] = {
-        {"field_name", PyDoc_STR("field name")},
-        {"type_oid", PyDoc_STR("type oid")},
-        {"field_size", PyDoc_STR("field size")},
-        {"type_mod", PyDoc_STR("type modifier")},
-        {"format", PyDoc_STR("field format")},
-        {"table_oid", PyDoc_STR("table oid")},
-        {"col_num", PyDoc_STR("column number in table")},
-        {0}
-    };
-    PyStructSequence_Desc fd_desc = {
-        "poqaio.FieldDescription",
-        PyDoc_STR("Field description"),
-        fd_fields,
-        7
-    };
-    FieldDescription = PyStructSequence_NewType(&fd_desc);
-
-    PyStructSequence_Field res_fields[] = {
-        {"fields", PyDoc_STR("Fields")},
-        {"data", PyDoc_STR("Data rows")},
-        {"tag", PyDoc_STR("Tag")},
-        {0}
-    };
-    PyStructSequence_Desc res_desc = {
-        "poqaio.Result",
-        PyDoc_STR("Database execution result"),
-        res_fields,
-        3
-    };
-    Result = PyStructSequence_NewType(&res_desc);
-
-    if (PyType_Ready(&BaseProtType) < 0)
-        return NULL;
+    return (PoqaioState *)PyModule_GetState(module);
+}
 
-    PoqaioError = PyErr_NewException("poqaio.Error", NULL, NULL);
-    if (PoqaioError == NULL)
-        return NULL;
 
-    PoqaioServerError = PyErr_NewException(
-            "poqaio.ServerError", PoqaioError, NULL);
-    if (PoqaioServerError == NULL)
-        return NULL;
+PoqaioState *
+get_state_by_type(PyTypeObject *type)
+{
+    // Returns the state of the module that defined type or one of its bases,
+    // for Python subclasses
+#if PY_VERSION_HEX >= 0x030B0000
+    PyObject *module = PyType_GetModuleByDef(type, &poqaio_module);
+#else
+    PyObject *module = NULL;
 
-    PoqaioProtocolError = PyErr_NewException(
-            "poqaio.ProtocolError", PoqaioError, NULL);
-    if (PoqaioProtocolError == NULL)
-        return NULL;
+    for (; type != NULL && module == NULL; type = type->tp_base) {
+        if (type->tp_flags & Py_TPFLAGS_HEAPTYPE) {
+            module = ((PyHeapTypeObject *)type)->ht_module;
+        }
+    }
+#endif
+    return module ? get_state(module) : NULL;
+}
+
+
+static PyTypeObject *
+add_type(PyObject *m, PyType_Spec *spec)
+{
+    // Creates a heap type bound to the module and adds it as attribute
+    PyTypeObject *type;
 
-    m = PyModule_Create(&poqaio_module);
-    if (m == NULL) {
-        Py_DECREF(PoqaioError);
+    type = (PyTypeObject *)PyType_FromModuleAndSpec(m, spec, NULL);
+    if (type == NULL) {
         return NULL;
     }
+    if (PyModule_AddType(m, type) == -1) {
+        Py_DECREF(type);
+        return NULL;
+    }
+    return type;
+}
+
+
+static int
+poqaio_exec(PyObject *m)
+{
+    PoqaioState *state = get_state(m);
+
+    state->FieldDescription = PyStructSequence_NewType(&fd_desc);
+    if (state->FieldDescription == NULL)
+        return -1;
+
+    state->Result = PyStructSequence_NewType(&res_desc);
+    if (state->Result == NULL)
+        return -1;
+
+    state->Stats = PyStructSequence_NewType(&stats_desc);
+    if (state->Stats == NULL)
+        return -1;
+
+    state->Timeline = PyStructSequence_NewType(&tl_desc);
+    if (state->Timeline == NULL)
+        return -1;
+
+    state->Change = PyStructSequence_NewType(&change_desc);
+    if (state->Change == NULL)
+        return -1;
+
+    state->BaseProtType = add_type(m, &BaseProtSpec);
+    if (state->BaseProtType == NULL)
+        return -1;
+
+    if (BaseProt_init_state(state) == -1)
+        return -1;
+
+    state->RecordBatchType = add_type(m, &RecordBatchSpec);
+    if (state->RecordBatchType == NULL)
+        return -1;
+
+    state->ColumnSinkType = add_type(m, &ColumnSinkSpec);
+    if (state->ColumnSinkType == NULL)
+        return -1;
 
-    Py_INCREF(&BaseProtType);
-    PyModule_AddObject(m, "BaseProt", (PyObject *) &BaseProtType);
-    PyModule_AddObject(m, "Error", PoqaioError);
-    PyModule_AddObject(m, "ServerError", PoqaioServerError);
-    PyModule_AddObject(m, "ProtocolError", PoqaioProtocolError);
+    state->DecodeJobType = (PyTypeObject *)PyType_FromModuleAndSpec(
+        m, &DecodeJobSpec, NULL);
+    if (state->DecodeJobType == NULL)
+        return -1;
 
-    return m;
+    state->StatementType = add_type(m, &StatementSpec);
+    if (state->StatementType == NULL)
+        return -1;
+
+    state->RawRowsType = add_type(m, &RawRowsSpec);
+    if (state->RawRowsType == NULL)
+        return -1;
+
+    state->RelationType = add_type(m, &RelationSpec);
+    if (state->RelationType == NULL)
+        return -1;
+
+    // sentinel object, compared by identity
+    state->unchanged_toast = PyObject_CallNoArgs(
+        (PyObject *)&PyBaseObject_Type);
+    if (state->unchanged_toast == NULL ||
+            PyModule_AddObjectRef(
+                m, "UNCHANGED_TOAST", state->unchanged_toast) == -1)
+        return -1;
+
+    state->Error = PyErr_NewException("poqaio.Error", NULL, NULL);
+    if (state->Error == NULL)
+        return -1;
+
+    if (errors_init_state(m, state) == -1)
+        return -1;
+
+    if (rows_init_state(state) == -1)
+        return -1;
+
+    state->ProtocolError = PyErr_NewException(
+            "poqaio.ProtocolError", state->Error, NULL);
+    if (state->ProtocolError == NULL)
+        return -1;
+
+    if (PyModule_AddObjectRef(m, "Error", state->Error) == -1 ||
+            PyModule_AddObjectRef(
+                m, "Change", (PyObject *)state->Change) == -1 ||
+            PyModule_AddObjectRef(
+                m, "ServerError", state->ServerError) == -1 ||
+            PyModule_AddObjectRef(
+                m, "ProtocolError", state->ProtocolError) == -1 ||
+            PyModule_AddObjectRef(m, "Notice", state->Notice) == -1)
+        return -1;
+
+    if (PyModule_AddIntConstant(m, "RESULT_TUPLES", RESULT_TUPLES) == -1 ||
+            PyModule_AddIntConstant(m, "RESULT_ARROW", RESULT_ARROW) == -1 ||
+            PyModule_AddIntConstant(
+                m, "RESULT_COLUMNS", RESULT_COLUMNS) == -1 ||
+            PyModule_AddIntConstant(m, "RESULT_RAW", RESULT_RAW) == -1)
+        return -1;
+
+    if (PyModule_AddIntConstant(m, "ROW_TUPLE", ROW_TUPLE) == -1 ||
+            PyModule_AddIntConstant(m, "ROW_RECORD", ROW_RECORD) == -1 ||
+            PyModule_AddIntConstant(m, "ROW_DICT", ROW_DICT) == -1)
+        return -1;
+
+    return 0;
+}
+
+
+static int
+poqaio_traverse(PyObject *m, visitproc visit, void *arg)
+{
+    PoqaioState *state = get_state(m);
+
+    Py_VISIT(state->Error);
+    Py_VISIT(state->ServerError);
+    Py_VISIT(state->ProtocolError);
+    Py_VISIT(state->Notice);
+    Py_VISIT(state->FieldDescription);
+    Py_VISIT(state->Result);
+    Py_VISIT(state->Stats);
+    Py_VISIT(state->Timeline);
+    Py_VISIT(state->Change);
+    Py_VISIT(state->BaseProtType);
+    Py_VISIT(state->RecordBatchType);
+    Py_VISIT(state->ColumnSinkType);
+    Py_VISIT(state->DecodeJobType);
+    Py_VISIT(state->StatementType);
+    Py_VISIT(state->RawRowsType);
+    Py_VISIT(state->RelationType);
+    Py_VISIT(state->unchanged_toast);
+    Py_VISIT(state->get_running_loop);
+    Py_VISIT(state->future_type);
+    Py_VISIT(state->default_create_future);
+    Py_VISIT(state->record_types);
+    return 0;
+}
+
+
+static int
+poqaio_clear(PyObject *m)
+{
+    PoqaioState *state = get_state(m);
+
+    Py_CLEAR(state->Error);
+    Py_CLEAR(state->ServerError);
+    Py_CLEAR(state->ProtocolError);
+    Py_CLEAR(state->Notice);
+    Py_CLEAR(state->FieldDescription);
+    Py_CLEAR(state->Result);
+    Py_CLEAR(state->Stats);
+    Py_CLEAR(state->Timeline);
+    Py_CLEAR(state->Change);
+    Py_CLEAR(state->BaseProtType);
+    Py_CLEAR(state->RecordBatchType);
+    Py_CLEAR(state->ColumnSinkType);
+    Py_CLEAR(state->DecodeJobType);
+    Py_CLEAR(state->StatementType);
+    Py_CLEAR(state->RawRowsType);
+    Py_CLEAR(state->RelationType);
+    Py_CLEAR(state->unchanged_toast);
+    Py_CLEAR(state->get_running_loop);
+    Py_CLEAR(state->future_type);
+    Py_CLEAR(state->default_create_future);
+    Py_CLEAR(state->empty_tuple);
+    Py_CLEAR(state->record_types);
+    return 0;
+}
+
+
+static void
+poqaio_free(void *m)
+{
+    poqaio_clear((PyObject *)m);
+}
+
+
+static PyMethodDef poqaio_methods[] = {
+    {"global_stats", (PyCFunction) BaseProt_global_stats, METH_NOARGS,
+     "hot path counters summed over all connections of the interpreter"},
+    {"encode_parameters", (PyCFunction) encode_parameters, METH_O,
+     "parameters encoded as sent to the server, for use as cache key"},
+    {NULL}
+};
+
+
+static PyModuleDef_Slot poqaio_slots[] = {
+    {Py_mod_exec, poqaio_exec},
+#ifdef Py_mod_multiple_interpreters
+    // no process wide state, so every interpreter can have its own GIL
+    {Py_mod_multiple_interpreters, Py_MOD_PER_INTERPRETER_GIL_SUPPORTED},
+#endif
+#ifdef Py_mod_gil
+    // shared state between protocols is immutable or locked
+    {Py_mod_gil, Py_MOD_GIL_NOT_USED},
+#endif
+    {0, NULL}
+};
+
+
+static struct PyModuleDef poqaio_module = {
+    PyModuleDef_HEAD_INIT,
+    "_poqaio",                  /* name of module */
+    NULL,                       /* module documentation, may be NULL */
+    sizeof(PoqaioState),        /* size of per-interpreter state */
+    poqaio_methods,
+    poqaio_slots,
+    poqaio_traverse,
+    poqaio_clear,
+    poqaio_free
+};
+
+
+PyMODINIT_FUNC
+PyInit__poqaio(void)
+{
+    return PyModuleDef_Init(&poqaio_module);
 }
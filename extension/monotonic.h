@@ -0,0 +1,43 @@
+// Portable monotonic clock in nanoseconds. On Linux this is the same clock
+// as Python's time.monotonic_ns().
+
+#ifndef POQAIO_MONOTONIC_H
+#define POQAIO_MONOTONIC_H
+
+#include <stdint.h>
+
+#if defined(_WIN32)
+
+#	include <windows.h>
+
+static inline int64_t
+monotonic_ns(void)
+{
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER count;
+
+    if (freq.QuadPart == 0) {
+        QueryPerformanceFrequency(&freq);
+    }
+    QueryPerformanceCounter(&count);
+    return (int64_t)(count.QuadPart / freq.QuadPart) * 1000000000 +
+        (int64_t)(count.QuadPart % freq.QuadPart) * 1000000000 /
+        freq.QuadPart;
+}
+
+#else
+
+#	include <time.h>
+
+static inline int64_t
+monotonic_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+#endif
+
+#endif
@@ -1,14 +1,45 @@
+#ifndef POQAIO_POQAIO_H
+#define POQAIO_POQAIO_H
+
 #define PY_SSIZE_T_CLEAN
 #include <Python.h>
 #include <structmember.h>
 #include "portable_endian.h"
+#include "monotonic.h"
+
+#if PY_VERSION_HEX < 0x030B0000
+// public since 3.11
+#define PyFloat_Pack8 _PyFloat_Pack8
+#endif
+
+#if PY_VERSION_HEX < 0x030D0000
+// public since 3.13
+#define PyThreadState_GetUnchecked _PyThreadState_UncheckedGet
 
-extern PyObject *PoqaioError;
-extern PyObject *PoqaioServerError;
-extern PyObject *PoqaioProtocolError;
+// since 3.13, the borrowed reference is safe to take while holding the GIL
+static inline int
+PyDict_GetItemRef(PyObject *p, PyObject *key, PyObject **result)
+{
+    *result = PyDict_GetItemWithError(p, key);
+    if (*result != NULL) {
+        Py_INCREF(*result);
+        return 1;
+    }
+    return PyErr_Occurred() ? -1 : 0;
+}
+#endif
 
-extern PyTypeObject *FieldDescription;
-extern PyTypeObject *Result;
+#ifndef Py_BEGIN_CRITICAL_SECTION
+// since 3.13, only locks on free threaded builds
+#define Py_BEGIN_CRITICAL_SECTION(op) {
+#define Py_END_CRITICAL_SECTION() }
+#endif
+
+// Per module state, see state.h
+typedef struct _PoqaioState PoqaioState;
+
+PoqaioState *get_state(PyObject *module);
+PoqaioState *get_state_by_type(PyTypeObject *);
 
 
 #define INT2OID 21
@@ -20,5 +51,8 @@ extern PyTypeObject *Result;
 #define BOOLOID 16
 #define XIDOID 28
 #define CIDOID 29
+#define BYTEAOID 17
 
 #define TEXTOID 25
+
+#endif
@@ -1,6 +1,36 @@
 #include "poqaio.h"
 #include "protocol.h"
+#include "state.h"
 #include "types.h"
+#include "arrow.h"
+#include "columns.h"
+#include "decode.h"
+#include "auth.h"
+#include "errors.h"
+#include "rows.h"
+#include "statement.h"
+#include "spill.h"
+#include "replication.h"
+
+#ifdef _WIN32
+#	include <winsock2.h>
+#	define SOCK_WOULD_BLOCK() (WSAGetLastError() == WSAEWOULDBLOCK)
+#	define SOCK_INTERRUPTED() (WSAGetLastError() == WSAEINTR)
+#	define SET_SOCK_ERROR() PyErr_SetExcFromWindowsErr( \
+        PyExc_OSError, WSAGetLastError())
+#else
+#	include <errno.h>
+#	include <sys/socket.h>
+#	include <sys/uio.h>
+#	define SOCK_WOULD_BLOCK() \
+        (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+#	define SOCK_INTERRUPTED() (errno == EINTR)
+#	define SET_SOCK_ERROR() PyErr_SetFromErrno(PyExc_OSError)
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
 
 #define BUF_SIZE 16383
 //16383
@@ -10,48 +40,202 @@
 #define RECEIVING_HEADER(prot) ((prot)->msg_length == HEADER_SIZE)
 
 
-_Py_IDENTIFIER(done);
-_Py_IDENTIFIER(set_result);
+// Without GIL the global statistics are protected by a mutex. They are not
+// used for handling messages, the counters of a protocol are only written by
+// the protocol itself.
+#ifdef Py_GIL_DISABLED
+#define STATS_LOCK(state) PyMutex_Lock(&(state)->stats_mutex)
+#define STATS_UNLOCK(state) PyMutex_Unlock(&(state)->stats_mutex)
+#else
+#define STATS_LOCK(state)
+#define STATS_UNLOCK(state)
+#endif
 
 
-static PyObject *
-BaseProt_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+static PyObject *sync_wait(BaseProt *self);
+static void deliver_changes(BaseProt *self);
+static int prot_write(
+    BaseProt *self, char *data, Py_ssize_t size, PyObject *py_data);
+static int write_password_message(
+    BaseProt *self, const char *prefix, Py_ssize_t prefix_len,
+    const char *data, Py_ssize_t len);
+
+
+static void
+stats_add(ProtStats *dest, ProtStats *src)
 {
-    BaseProt *self;
-    char * in_buf=NULL;
-    PyObject *asyncio, *get_running_loop=NULL, *loop=NULL, *params=NULL,
-            *default_view, *create_future=NULL;
+    uint64_t *d = (uint64_t *)dest, *s = (uint64_t *)src;
+    size_t i;
 
-    self = (BaseProt *) type->tp_alloc(type, 0);
-    if (self == NULL) {
-        return NULL;
+    for (i = 0; i < sizeof(ProtStats) / sizeof(uint64_t); i++) {
+        d[i] += s[i];
     }
+}
 
-    // for status parameters
-    params = PyDict_New();
-    if (params == NULL) {
-        goto error;
+
+static void
+stats_link(BaseProt *self)
+{
+    PoqaioState *state = self->state;
+
+    STATS_LOCK(state);
+    self->stats_next = state->live_prots;
+    if (state->live_prots) {
+        state->live_prots->stats_prev = self;
     }
+    state->live_prots = self;
+    STATS_UNLOCK(state);
+}
+
+
+static void
+stats_unlink(BaseProt *self)
+{
+    PoqaioState *state = self->state;
+
+    if (state == NULL) {
+        // never linked
+        return;
+    }
+    STATS_LOCK(state);
+    if (self->stats_prev == NULL && state->live_prots != self) {
+        // never linked
+        STATS_UNLOCK(state);
+        return;
+    }
+    stats_add(&state->retired_stats, &self->stats);
+    if (self->stats_prev) {
+        self->stats_prev->stats_next = self->stats_next;
+    }
+    else {
+        state->live_prots = self->stats_next;
+    }
+    if (self->stats_next) {
+        self->stats_next->stats_prev = self->stats_prev;
+    }
+    STATS_UNLOCK(state);
+}
+
+
+int
+BaseProt_init_state(PoqaioState *state)
+{
+    // Looks up the asyncio objects once, when the module is imported
+    PyObject *asyncio, *base_events, *base_loop;
 
-    // get loop
     asyncio = PyImport_ImportModule("asyncio");
     if (asyncio == NULL) {
-        goto error;
+        return -1;
     }
-    get_running_loop = PyObject_GetAttrString(asyncio, "get_running_loop");
+    state->get_running_loop = PyObject_GetAttrString(
+        asyncio, "get_running_loop");
+    state->future_type = PyObject_GetAttrString(asyncio, "Future");
+    base_events = PyObject_GetAttrString(asyncio, "base_events");
     Py_DECREF(asyncio);
-    if (get_running_loop == NULL) {
-        goto error;
+    if (state->get_running_loop == NULL || state->future_type == NULL ||
+            base_events == NULL) {
+        Py_XDECREF(base_events);
+        return -1;
     }
-    loop = PyObject_CallFunction(get_running_loop, NULL);
-    Py_DECREF(get_running_loop);
+    base_loop = PyObject_GetAttrString(base_events, "BaseEventLoop");
+    Py_DECREF(base_events);
+    if (base_loop == NULL) {
+        return -1;
+    }
+    state->default_create_future = PyObject_GetAttrString(
+        base_loop, "create_future");
+    Py_DECREF(base_loop);
+    if (state->default_create_future == NULL) {
+        return -1;
+    }
+    state->empty_tuple = PyTuple_New(0);
+    if (state->empty_tuple == NULL) {
+        return -1;
+    }
+    return 0;
+}
+
+
+static int
+init_loop(BaseProt *self)
+{
+    // Sets up the running loop and the way futures are created
+    PyObject *loop=NULL, *create_future=NULL, *loop_create_future=NULL,
+            *future_kwargs=NULL;
+
+    // get loop
+    loop = PyObject_CallFunctionObjArgs(self->state->get_running_loop, NULL);
     if (loop == NULL) {
         goto error;
     }
 
     create_future = PyObject_GetAttrString(loop, "create_future");
     if (create_future == NULL) {
-        printf("Shit\n");
+        goto error;
+    }
+
+    // When the loop uses the default create_future, instantiate the
+    // (C implemented) future directly instead of through the Python method
+    loop_create_future = PyObject_GetAttrString(
+        (PyObject *)Py_TYPE(loop), "create_future");
+    if (loop_create_future == NULL) {
+        goto error;
+    }
+    if (loop_create_future == self->state->default_create_future) {
+        future_kwargs = Py_BuildValue("{sO}", "loop", loop);
+        if (future_kwargs == NULL) {
+            goto error;
+        }
+    }
+    Py_DECREF(loop_create_future);
+
+    self->loop = loop;
+    self->create_future = create_future;
+    self->future_kwargs = future_kwargs;
+    return 0;
+
+error:
+    Py_XDECREF(loop);
+    Py_XDECREF(create_future);
+    Py_XDECREF(loop_create_future);
+    Py_XDECREF(future_kwargs);
+    return -1;
+}
+
+
+static PyObject *
+BaseProt_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+    static char *kwlist[] = {"blocking", NULL};
+
+    BaseProt *self;
+    char * in_buf=NULL;
+    int blocking = 0;
+    PyObject *params=NULL, *default_view;
+
+    if (!PyArg_ParseTupleAndKeywords(
+            args, kwds, "|$p", kwlist, &blocking)) {
+        return NULL;
+    }
+
+    self = (BaseProt *) type->tp_alloc(type, 0);
+    if (self == NULL) {
+        return NULL;
+    }
+    self->state = get_state_by_type(type);
+    self->sock_fd = -1;
+    self->memory_budget = -1;
+    self->query_budget = -1;
+
+    // for status parameters
+    params = PyDict_New();
+    if (params == NULL) {
+        goto error;
+    }
+
+    // a blocking protocol does its own I/O and runs without loop
+    self->blocking = blocking;
+    if (!blocking && init_loop(self) == -1) {
         goto error;
     }
 
@@ -73,16 +257,13 @@ BaseProt_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
     self->default_buf = default_view;
 
     self->msg_length = HEADER_SIZE;
-    self->loop = loop;
-    self->create_future = create_future;
+    stats_link(self);
 
     return (PyObject *)self;
 
 error:
     Py_DECREF(self);
     Py_XDECREF(params);
-    Py_XDECREF(loop);
-    Py_XDECREF(create_future);
     if (in_buf) {
         PyMem_Free(in_buf);
     }
@@ -93,19 +274,74 @@ error:
 static void
 BaseProt_dealloc(BaseProt *self)
 {
+    PyTypeObject *tp = Py_TYPE(self);
+
     if (self->wr_list != NULL)
         PyObject_ClearWeakRefs((PyObject *) self);
+    stats_unlink(self);
+    Py_XDECREF(self->timeline_callback);
+    Py_XDECREF(self->notice_handler);
+    Py_XDECREF(self->notification_handler);
+    Py_XDECREF(self->prepare_name);
+    Py_XDECREF(self->prepare_query);
+    Py_XDECREF(self->parameter_types);
+    Py_XDECREF(self->statement);
+    Py_XDECREF(self->row_factory);
+    row_factory_clear(&self->rows);
+    PyMem_Free(self->timeline_ring);
+    Py_XDECREF(self->fut);
+    Py_XDECREF(self->callback);
+    Py_XDECREF(self->future_kwargs);
+    Py_XDECREF(self->fut_done);
+    Py_XDECREF(self->fut_set_result);
+    Py_XDECREF(self->fut_set_exception);
+    Py_XDECREF(self->write_ready);
+    Py_XDECREF(self->transport);
+    Py_XDECREF(self->transport_write);
+    Py_XDECREF(self->loop);
+    Py_XDECREF(self->create_future);
+    Py_XDECREF(self->default_buf);
+    Py_XDECREF(self->status_parameters);
+    Py_XDECREF(self->error);
+    Py_XDECREF(self->results);
+    Py_XDECREF(self->sync_result);
+    Py_XDECREF(self->sync_exc);
+    Py_XDECREF(self->result_fields);
+    Py_XDECREF(self->result_data);
+    Py_XDECREF(self->spill);
+    Py_XDECREF(self->batch);
+    Py_XDECREF(self->sink);
+    Py_XDECREF(self->decode_submit);
+    Py_XDECREF(self->decode_job);
+    Py_XDECREF(self->decode_jobs);
+    if (self->pgoutput) {
+        pgoutput_free(self->pgoutput);
+    }
+    Py_XDECREF(self->repl_handler);
+    PyMem_Free(self->converters);
+    PyMem_Free(self->user);
+    PyMem_Free(self->password);
+    PyMem_Free(self->warmup);
+    if (self->scram) {
+        scram_free(self->scram);
+    }
+    PyMem_Free(self->out_buf);
     PyMem_Free(self->in_buf);
     PyMem_Free(self->in_extra_buf);
-    Py_TYPE(self)->tp_free((PyObject*)self);
+    tp->tp_free((PyObject*)self);
+    Py_DECREF(tp);
 }
 
 
 static PyObject *
 BaseProt_connection_made(BaseProt *self, PyObject *arg)
 {
-    self->transport = arg;
-    self->transport_write = PyObject_GetAttrString(arg, "write");
+    Py_INCREF(arg);
+    Py_XSETREF(self->transport, arg);
+    Py_XSETREF(self->transport_write, PyObject_GetAttrString(arg, "write"));
+    if (self->transport_write == NULL) {
+        return NULL;
+    }
     Py_RETURN_NONE;
 }
 
@@ -117,7 +353,7 @@ check_length_gte(BaseProt *self, char *pos, ssize_t length) {
         char identifier[2] = {self->curr_msg[0], '\0'};
 
         PyErr_Format(
-            PoqaioProtocolError,
+            self->state->ProtocolError,
             "Invalid length for message with identifier '%s'. Expected %zu or "
             "more, but got %zu.",
             identifier, length, MSG_END(self) - pos);
@@ -187,6 +423,15 @@ read_int32(char **from) {
 }
 
 
+static uint64_t
+read_uint64(char **from) {
+    uint64_t val;
+    memcpy(&val, *from, sizeof(uint64_t));
+    *from += sizeof(uint64_t);
+    return be64toh(val);
+}
+
+
 static int
 read_uint32_check(BaseProt *self, char **from, uint32_t *val) {
     if (check_length_gte(self, *from, sizeof(uint32_t)) == -1)
@@ -217,13 +462,13 @@ read_py_uint32(char **from)
 
 
 static char *
-read_str(char **src, Py_ssize_t *len, size_t max_len)
+read_str(BaseProt *self, char **src, Py_ssize_t *len, size_t max_len)
 {
     char *term, *ret;
 
     term = memchr(*src, '\0', max_len);
     if (term == NULL) {
-        PyErr_SetString(PoqaioProtocolError, "Terminating zero not found");
+        PyErr_SetString(self->state->ProtocolError, "Terminating zero not found");
         return NULL;
     }
     ret = *src;
@@ -235,12 +480,12 @@ read_str(char **src, Py_ssize_t *len, size_t max_len)
 
 
 static PyObject *
-read_pystr(char **src, size_t max_len)
+read_pystr(BaseProt *self, char **src, size_t max_len)
 {
     Py_ssize_t len;
     char* str;
 
-    str = read_str(src, &len, max_len);
+    str = read_str(self, src, &len, max_len);
     if (str == NULL) {
         return NULL;
     }
@@ -254,7 +499,7 @@ check_length(BaseProt *self, int length) {
         char identifier[2] = {self->curr_msg[0], '\0'};
 
         PyErr_Format(
-            PoqaioProtocolError,
+            self->state->ProtocolError,
             "Invalid length for message with identifier '%s'. Expected %d, but "
             "got %d.",
             identifier, length, self->msg_length);
@@ -264,29 +509,166 @@ check_length(BaseProt *self, int length) {
 }
 
 
+static int
+auth_md5(BaseProt *self, char *salt)
+{
+    char password[MD5_PASSWORD_SIZE];
+
+    md5_password(self->user, self->password, salt, password);
+    return write_password_message(
+        self, NULL, 0, password, MD5_PASSWORD_SIZE);
+}
+
+
+static int
+auth_sasl(BaseProt *self, char *pos, char *end)
+{
+    // Starts SCRAM-SHA-256 when the server offers it
+    char *mechanism, prefix[18];
+    Py_ssize_t len;
+    int found = 0;
+    uint32_t message_len;
+
+    while (1) {
+        mechanism = read_str(self, &pos, &len, end - pos);
+        if (mechanism == NULL) {
+            return -1;
+        }
+        if (len == 0) {
+            break;
+        }
+        if (strcmp(mechanism, "SCRAM-SHA-256") == 0) {
+            found = 1;
+        }
+    }
+    if (pos != end) {
+        PyErr_SetString(
+            self->state->ProtocolError,
+            "Remaining data in authentication request message.");
+        return -1;
+    }
+    if (!found) {
+        PyErr_SetString(
+            self->state->ProtocolError,
+            "Server does not offer SCRAM-SHA-256 authentication");
+        return -1;
+    }
+    if (self->scram) {
+        scram_free(self->scram);
+    }
+    self->scram = scram_new();
+    if (self->scram == NULL) {
+        return -1;
+    }
+    // SASLInitialResponse: mechanism and length of client-first-message
+    memcpy(prefix, "SCRAM-SHA-256", 14);
+    message_len = htobe32((uint32_t)self->scram->message_len);
+    memcpy(prefix + 14, &message_len, 4);
+    return write_password_message(
+        self, prefix, 18, self->scram->message, self->scram->message_len);
+}
+
+
+static int
+send_warmup(BaseProt *self)
+{
+    // The warm-up queries are sent without waiting for the ReadyForQuery
+    // of the startup, the server handles them right after it
+    int ret;
+
+    ret = prot_write(self, self->warmup, self->warmup_len, NULL);
+    self->stats.bytes_sent += self->warmup_len;
+    PyMem_Free(self->warmup);
+    self->warmup = NULL;
+    return ret;
+}
+
+
 static int
 handle_auth_req(BaseProt *self)
 {
-    char *pos;
+    char *pos, *end;
     int specifier;
 
     pos = MSG_BODY(self);
+    end = MSG_END(self);
     if (check_length_gte(self, pos, 4) == -1) {
         return -1;
     }
     specifier = read_int32(&pos);
+    if (specifier != 0 && self->password == NULL) {
+        PyErr_SetString(self->state->ProtocolError, "Missing password");
+        return -1;
+    }
     switch (specifier) {
         case 0:
+            // AuthenticationOk
+            if (self->scram) {
+                PyErr_SetString(
+                    self->state->ProtocolError,
+                    "Server did not complete SCRAM authentication");
+                return -1;
+            }
+            if (self->warmup && send_warmup(self) == -1) {
+                return -1;
+            }
+            break;
+        case 5:
+            // AuthenticationMD5Password
+            if (check_length(self, 8) == -1 || auth_md5(self, pos) == -1) {
+                return -1;
+            }
+            pos += 4;
+            break;
+        case 10:
+            // AuthenticationSASL
+            if (auth_sasl(self, pos, end) == -1) {
+                return -1;
+            }
+            pos = end;
+            break;
+        case 11:
+            // AuthenticationSASLContinue
+            if (self->scram == NULL) {
+                PyErr_SetString(
+                    self->state->ProtocolError,
+                    "Unexpected SASL continue message");
+                return -1;
+            }
+            if (scram_continue(self->state, self->scram, self->password,
+                               pos, end - pos) == -1 ||
+                    write_password_message(
+                        self, NULL, 0, self->scram->message,
+                        self->scram->message_len) == -1) {
+                return -1;
+            }
+            pos = end;
+            break;
+        case 12:
+            // AuthenticationSASLFinal
+            if (self->scram == NULL) {
+                PyErr_SetString(
+                    self->state->ProtocolError,
+                    "Unexpected SASL final message");
+                return -1;
+            }
+            if (scram_finish(self->state, self->scram, pos, end - pos) == -1) {
+                return -1;
+            }
+            scram_free(self->scram);
+            self->scram = NULL;
+            pos = end;
             break;
         default:
             PyErr_Format(
-                PoqaioProtocolError,
+                self->state->ProtocolError,
                 "Unsupported authentication specifier: %d", specifier);
+            return -1;
     }
 
-    if (pos != MSG_END(self)) {
+    if (pos != end) {
         PyErr_SetString(
-            PoqaioProtocolError,
+            self->state->ProtocolError,
             "Remaining data in authentication request message.");
         return -1;
     }
@@ -319,10 +701,10 @@ handle_parameter_status(BaseProt *self) {
     end = MSG_END(self);
     if (end <= pos) {
         PyErr_SetString(
-            PoqaioProtocolError, "Empty parameter status message.");
+            self->state->ProtocolError, "Empty parameter status message.");
         goto end;
     }
-    bname = read_str(&pos, &len, end - pos);
+    bname = read_str(self, &pos, &len, end - pos);
     if (bname == NULL) {
         goto end;
     }
@@ -339,11 +721,11 @@ handle_parameter_status(BaseProt *self) {
 
     if (pos == end) {
         PyErr_SetString(
-            PoqaioProtocolError, "Missing value in parameter status message.");
+            self->state->ProtocolError, "Missing value in parameter status message.");
         return -1;
     }
 
-    bname = read_str(&pos, &len, end - pos);
+    bname = read_str(self, &pos, &len, end - pos);
     if (bname == NULL) {
         goto end;
     }
@@ -362,7 +744,7 @@ handle_parameter_status(BaseProt *self) {
     if (pos != end) {
         Py_DECREF(name);
         PyErr_SetString(
-            PoqaioProtocolError,
+            self->state->ProtocolError,
             "Remaining data after parameter status message.");
         goto end;
     }
@@ -375,13 +757,153 @@ end:
 }
 
 
+static int
+start_result(BaseProt *self, PyObject *fields, field_converter *plan)
+{
+    // Prepares receiving the rows of a result with the given field
+    // descriptions. Plan has the converters of a prepared statement, or is
+    // NULL to look them up.
+    Py_ssize_t i, nfields = PyTuple_GET_SIZE(fields);
+
+    PyMem_Free(self->converters);
+    self->converters = PyMem_Malloc(sizeof(field_converter) * (nfields + 1));
+    if (self->converters == NULL) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    if (plan) {
+        memcpy(self->converters, plan, sizeof(field_converter) * nfields);
+    }
+
+    Py_CLEAR(self->batch);
+    if (self->result_format == RESULT_ARROW) {
+        self->batch = (PyObject *)RecordBatch_create(self->state, nfields);
+        if (self->batch == NULL) {
+            goto error;
+        }
+    }
+    Py_CLEAR(self->decode_job);
+    Py_CLEAR(self->decode_jobs);
+    if (self->decode_submit && self->result_format != RESULT_COLUMNS &&
+            self->result_format != RESULT_RAW) {
+        self->decode_job = (PyObject *)DecodeJob_create(
+            self->state, nfields, self->decode_chunk_size + BUF_SIZE);
+        if (self->decode_job == NULL) {
+            goto error;
+        }
+    }
+
+    for (i = 0; i < nfields; i++) {
+        PyObject *field_desc = PyTuple_GET_ITEM(fields, i);
+        uint32_t oid;
+
+        if (plan && !self->batch && !self->decode_job) {
+            continue;
+        }
+        oid = (uint32_t)PyLong_AsUnsignedLong(
+            PyStructSequence_GET_ITEM(field_desc, 1));
+        if (!plan) {
+            self->converters[i].convert = get_converter(oid);
+            self->converters[i].kind = get_conv_kind(oid);
+        }
+
+        if (self->batch || self->decode_job) {
+            const char *name;
+            col_type type = get_col_type(oid);
+            int ret;
+
+            name = PyUnicode_AsUTF8(PyStructSequence_GET_ITEM(field_desc, 0));
+            if (name == NULL) {
+                goto error;
+            }
+            if (self->batch) {
+                RecordBatch *batch = (RecordBatch *)self->batch;
+
+                ret = column_init(batch->columns + i, type, name);
+                if (ret != COL_OK) {
+                    column_set_error(self->state, ret, batch->columns + i);
+                    goto error;
+                }
+            }
+            else if (type == COL_FLOAT32 || type == COL_BINARY) {
+                // tuples get the same values as the converters produce
+                type = type == COL_FLOAT32 ? COL_FLOAT64 : COL_UTF8;
+            }
+            if (self->decode_job) {
+                DecodeJob *job = (DecodeJob *)self->decode_job;
+
+                ret = column_init(job->columns + i, type, name);
+                if (ret != COL_OK) {
+                    column_set_error(self->state, ret, job->columns + i);
+                    goto error;
+                }
+            }
+        }
+    }
+
+    if (self->sink && ColumnSink_start(
+            (ColumnSink *)self->sink, fields) == -1) {
+        goto error;
+    }
+
+    self->row_plan = PLAN_NONE;
+    if (!self->batch && !self->sink && !self->decode_job) {
+        self->row_plan = PLAN_TEXT;
+        for (i = 0; i < nfields; i++) {
+            if (self->converters[i].kind != CONV_TEXT) {
+                self->row_plan = PLAN_TYPED;
+            }
+        }
+    }
+    if ((self->result_format == RESULT_TUPLES ||
+            self->result_format == RESULT_RAW) && row_factory_start(
+            self->state, &self->rows, fields) == -1) {
+        goto error;
+    }
+    self->result_nfields = (int16_t)nfields;
+    Py_INCREF(fields);
+    Py_XSETREF(self->result_fields, fields);
+    if (self->result_format == RESULT_RAW) {
+        // all rows stay undecoded
+        Py_XSETREF(self->spill, RawRows_create(self, NULL, 1));
+        if (self->spill == NULL) {
+            goto error;
+        }
+    }
+    return 0;
+
+error:
+    Py_CLEAR(self->batch);
+    Py_CLEAR(self->decode_job);
+    return -1;
+}
+
+
+static int
+start_statement(BaseProt *self)
+{
+    // Prepares receiving the rows of the executed prepared statement, for
+    // which no RowDescription is sent
+    Statement *stmt = (Statement *)self->statement;
+
+    if (stmt->fields == Py_None) {
+        return 0;
+    }
+    return start_result(self, stmt->fields, stmt->converters);
+}
+
+
 static int
 handle_row_description(BaseProt *self) {
     char *pos;
     int16_t nfields;
-    int i;
+    int i, ret;
     PyObject *fields;
 
+    if (self->timeline_enabled && !self->timeline.row_description) {
+        self->timeline.row_description = monotonic_ns();
+    }
+
     pos = MSG_BODY(self);
 
     if (read_int16_check(self, &pos, &nfields) == -1) {
@@ -393,24 +915,18 @@ handle_row_description(BaseProt *self) {
         return -1;
     }
 
-    self->converters = PyMem_Malloc(sizeof(converter) * nfields);
-    if (self->converters == NULL) {
-        return -1;
-    }
-
     for (i = 0; i < nfields; i++) {
         PyObject *field_desc, *field_val;
-        uint32_t oid;
 
         // Make a new field description and add to fields tuple
-        field_desc = PyStructSequence_New(FieldDescription);
+        field_desc = PyStructSequence_New(self->state->FieldDescription);
         if (field_desc == NULL) {
             goto error;
         }
         PyTuple_SET_ITEM(fields, i, field_desc);
 
         // get field name
-        field_val = read_pystr(&pos, MSG_END(self) - pos);
+        field_val = read_pystr(self, &pos, MSG_END(self) - pos);
         if (field_val == NULL) {
             goto error;
         }
@@ -418,7 +934,7 @@ handle_row_description(BaseProt *self) {
 
         // can we get the rest?
         if (MSG_END(self) - pos < 18) {
-            PyErr_SetString(PoqaioProtocolError, "Invalid field description.");
+            PyErr_SetString(self->state->ProtocolError, "Invalid field description.");
             goto error;
         }
 
@@ -437,8 +953,7 @@ handle_row_description(BaseProt *self) {
         PyStructSequence_SET_ITEM(field_desc, 6, field_val);
 
         // data type oid
-        oid = read_uint32(&pos);
-        field_val = PyLong_FromUnsignedLong(oid);
+        field_val = read_py_uint32(&pos);
         if (field_val == NULL) {
             goto error;
         }
@@ -464,19 +979,22 @@ handle_row_description(BaseProt *self) {
             goto error;
         }
         PyStructSequence_SET_ITEM(field_desc, 4, field_val);
-
-        self->converters[i] = get_converter(oid);
     }
 
     if (pos != MSG_END(self)) {
         PyErr_SetString(
-            PoqaioProtocolError, "Invalid field description, data remaining.");
+            self->state->ProtocolError, "Invalid field description, data remaining.");
         goto error;
     }
 
-    self->result_nfields = nfields;
-    self->result_fields = fields;
-    return 0;
+    if (self->prepare_name) {
+        // description of a statement being prepared, no rows follow
+        Py_XSETREF(self->result_fields, fields);
+        return 0;
+    }
+    ret = start_result(self, fields, NULL);
+    Py_DECREF(fields);
+    return ret;
 
 error:
     Py_DECREF(fields);
@@ -485,20 +1003,311 @@ error:
 
 
 static int
-handle_data_row(BaseProt *self) {
-    int i, ret=-1;
-    char *pos;
-    PyObject *row;
-    int16_t nfields;
+handle_parameter_description(BaseProt *self) {
+    // Keeps the parameter types of a statement being prepared
+    char *pos = MSG_BODY(self);
+    int16_t nparams;
+    int i;
+    PyObject *types;
 
-    if (self->error) {
+    if (read_int16_check(self, &pos, &nparams) == -1) {
+        return -1;
+    }
+    if (nparams < 0 || MSG_END(self) - pos != 4 * (Py_ssize_t)nparams) {
+        PyErr_SetString(
+            self->state->ProtocolError, "Invalid parameter description.");
+        return -1;
+    }
+    types = PyTuple_New(nparams);
+    if (types == NULL) {
+        return -1;
+    }
+    for (i = 0; i < nparams; i++) {
+        PyObject *oid = read_py_uint32(&pos);
+        if (oid == NULL) {
+            Py_DECREF(types);
+            return -1;
+        }
+        PyTuple_SET_ITEM(types, i, oid);
+    }
+    Py_XSETREF(self->parameter_types, types);
+    return 0;
+}
+
+
+static int
+arrow_data_row(BaseProt *self) {
+    // Appends the values of the data row to the columns of the batch
+    RecordBatch *batch = (RecordBatch *)self->batch;
+    int ret, col;
+
+    ret = append_data_row(batch->columns, batch->ncolumns, MSG_BODY(self),
+                          MSG_END(self), &col);
+    if (ret != COL_OK) {
+        return column_set_error(self->state, ret, col == -1 ? NULL : batch->columns + col);
+    }
+    batch->num_rows++;
+    self->stats.rows++;
+    return 0;
+}
+
+
+static int
+queue_data_row(BaseProt *self) {
+    // Copies the data row into the current decode job and submits the job to
+    // the executor when it is full
+    DecodeJob *job = (DecodeJob *)self->decode_job, *next;
+    int ret;
+
+    if (DecodeJob_add(job, self->curr_msg, self->msg_length) == -1) {
+        return -1;
+    }
+    if (job->len < self->decode_chunk_size) {
+        return 0;
+    }
+    if (self->decode_jobs == NULL) {
+        self->decode_jobs = PyList_New(0);
+        if (self->decode_jobs == NULL) {
+            return -1;
+        }
+    }
+    if (PyList_Append(self->decode_jobs, (PyObject *)job) == -1) {
+        return -1;
+    }
+    next = DecodeJob_next(job);
+    if (next == NULL) {
+        // the result fails, finish_decoding skips merging its jobs
+        return -1;
+    }
+    self->decode_job = (PyObject *)next;
+    ret = DecodeJob_submit(job, self->decode_submit);
+    Py_DECREF(job);
+    return ret;
+}
+
+
+static int
+merge_job(BaseProt *self, DecodeJob *job) {
+    // Adds the decoded values of a job to the batch, or as tuples to the
+    // result data
+    int i, ret;
+    int64_t j;
+
+    if (DecodeJob_wait(job) == -1) {
+        return -1;
+    }
+    self->stats.rows += job->num_rows;
+
+    if (self->batch) {
+        RecordBatch *batch = (RecordBatch *)self->batch;
+
+        for (i = 0; i < job->ncolumns; i++) {
+            ret = column_extend(batch->columns + i, job->columns + i);
+            if (ret != COL_OK) {
+                return column_set_error(self->state, ret, batch->columns + i);
+            }
+        }
+        batch->num_rows += job->num_rows;
+        return 0;
+    }
+
+    if (self->result_data == NULL) {
+        self->result_data = PyList_New(0);
+        if (self->result_data == NULL) {
+            return -1;
+        }
+    }
+    for (i = 0; i < job->ncolumns; i++) {
+        ArrowColumn *col = job->columns + i;
+
+        self->stats.conversions[self->converters[i].kind] +=
+            col->length - col->null_count;
+    }
+    for (j = 0; j < job->num_rows; j++) {
+        PyObject *row;
+
+        row = row_new(&self->rows, job->ncolumns);
+        if (row == NULL) {
+            return -1;
+        }
+        for (i = 0; i < job->ncolumns; i++) {
+            PyObject *val = column_value(job->columns + i, j);
+            if (val == NULL) {
+                Py_DECREF(row);
+                return -1;
+            }
+            PyTuple_SET_ITEM(row, i, val);
+        }
+        row = row_finish(&self->rows, row);
+        if (row == NULL) {
+            return -1;
+        }
+        ret = PyList_Append(self->result_data, row);
+        Py_DECREF(row);
+        if (ret == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+static int
+finish_decoding(BaseProt *self) {
+    // Decodes the last job and merges all jobs of the result in order. Jobs
+    // still running in the executor are waited for.
+    DecodeJob *job = (DecodeJob *)self->decode_job;
+    Py_ssize_t i;
+    int ret = 0;
+
+    if (self->error) {
+        // the rows of a failed result are not needed, running jobs finish
+        // on their own
+        Py_CLEAR(self->decode_jobs);
+        Py_CLEAR(self->decode_job);
+        return 0;
+    }
+    if (self->decode_jobs) {
+        for (i = 0; i < PyList_GET_SIZE(self->decode_jobs); i++) {
+            ret = merge_job(
+                self, (DecodeJob *)PyList_GET_ITEM(self->decode_jobs, i));
+            if (ret == -1) {
+                break;
+            }
+        }
+        Py_CLEAR(self->decode_jobs);
+    }
+    if (ret == 0 && job->len) {
+        ret = merge_job(self, job);
+    }
+    Py_CLEAR(self->decode_job);
+    return ret;
+}
+
+
+static int
+columns_data_row(BaseProt *self) {
+    // Writes the values of the data row in the buffers of the sink
+    ColumnSink *sink = (ColumnSink *)self->sink;
+    char *pos;
+    int16_t nfields;
+    int i;
+
+    pos = MSG_BODY(self);
+    if (read_int16_check(self, &pos, &nfields) == -1)
+        return -1;
+
+    if (nfields != sink->ncolumns) {
+        PyErr_SetString(
+            self->state->ProtocolError,
+            "Invalid data row, number of values differs from row description."
+            );
+        return -1;
+    }
+    if (ColumnSink_reserve_row(sink) == -1) {
+        return -1;
+    }
+    for (i = 0; i < nfields; i++) {
+        int32_t val_size;
+
+        if (read_int32_check(self, &pos, &val_size) == -1)
+            return -1;
+
+        if (val_size != -1 && check_length_gte(self, pos, val_size) == -1) {
+            return -1;
+        }
+        if (ColumnSink_write(sink, i, pos, val_size) == -1) {
+            return -1;
+        }
+        if (val_size != -1) {
+            pos += val_size;
+        }
+    }
+    if (pos != MSG_END(self)) {
+        PyErr_SetString(
+            self->state->ProtocolError, "Invalid data row message, data remaining.");
+        return -1;
+    }
+    sink->rows++;
+    sink->total_rows++;
+    self->stats.rows++;
+    return 0;
+}
+
+
+static int
+spill_data_row(BaseProt *self, char *body, Py_ssize_t size)
+{
+    // Adds a DataRow message body to the raw rows of the result. For a
+    // result over the memory budget they are created here, the rows decoded
+    // so far stay in the result.
+    if (self->spill == NULL) {
+        self->spill = RawRows_create(self, self->result_data, 0);
+        if (self->spill == NULL) {
+            return -1;
+        }
+        Py_CLEAR(self->result_data);
+        self->stats.spilled_results++;
+    }
+    if (RawRows_add(self->spill, body, size) == -1) {
+        return -1;
+    }
+    if (self->result_format != RESULT_RAW) {
+        // raw results are kept undecoded on request, not spilled
+        self->stats.spilled_bytes += size;
+    }
+    return 0;
+}
+
+
+static inline int
+over_budget(BaseProt *self, Py_ssize_t size)
+{
+    // Accounts for a data row of size bytes, returns whether to keep it raw
+    self->result_bytes += size;
+    return self->spill || (
+        self->query_budget >= 0 && self->result_bytes > self->query_budget);
+}
+
+
+static int
+handle_data_row(BaseProt *self) {
+    int i, ret=-1;
+    char *pos;
+    PyObject *row;
+    int16_t nfields;
+
+    if (self->timeline_enabled && !self->timeline.first_data_row) {
+        self->timeline.first_data_row = monotonic_ns();
+    }
+
+    if (self->error) {
         // Error already set, ignore message
         return 0;
     }
 
     if (!self->uses_utf8) {
         PyErr_SetString(
-            PoqaioProtocolError, "Client encoding is not set to UTF-8");
+            self->state->ProtocolError, "Client encoding is not set to UTF-8");
+        return -1;
+    }
+
+    if (self->decode_job) {
+        return queue_data_row(self);
+    }
+    if (self->batch) {
+        return arrow_data_row(self);
+    }
+    if (self->sink) {
+        return columns_data_row(self);
+    }
+    if (over_budget(self, MSG_END(self) - MSG_BODY(self))) {
+        if (spill_data_row(self, MSG_BODY(self),
+                           MSG_END(self) - MSG_BODY(self)) == -1) {
+            return -1;
+        }
+        self->stats.rows++;
+        return 0;
     }
 
     if (self->result_data == NULL) {
@@ -516,11 +1325,12 @@ handle_data_row(BaseProt *self) {
 
     if (nfields != self->result_nfields) {
         PyErr_SetString(
-            PoqaioProtocolError,
+            self->state->ProtocolError,
             "Invalid data row, number of values differs from row description."
             );
+        return -1;
     }
-    row = PyTuple_New(nfields);
+    row = row_new(&self->rows, nfields);
     if (row == NULL) {
         return -1;
     }
@@ -530,7 +1340,7 @@ handle_data_row(BaseProt *self) {
 
         // Get value size
         if (read_int32_check(self, &pos, &val_size) == -1)
-            return -1;
+            goto error;
 
         if (val_size == -1) {
             val = Py_None;
@@ -541,10 +1351,11 @@ handle_data_row(BaseProt *self) {
                 goto error;
             }
 
-            val = self->converters[i](self, pos, val_size);
+            val = self->converters[i].convert(self->state, pos, val_size);
             if (val == NULL) {
                 goto error;
             }
+            self->stats.conversions[self->converters[i].kind]++;
             pos += val_size;
         }
 
@@ -552,17 +1363,19 @@ handle_data_row(BaseProt *self) {
     }
     if (pos != MSG_END(self)) {
         PyErr_SetString(
-            PoqaioProtocolError, "Invalid data row message, data remaining.");
+            self->state->ProtocolError, "Invalid data row message, data remaining.");
         goto error;
     }
 
-    if (PyList_Append(self->result_data, row) == -1)
+    row = row_finish(&self->rows, row);
+    if (row == NULL || PyList_Append(self->result_data, row) == -1)
         goto error;
 
+    self->stats.rows++;
     ret = 0;
 
 error:
-    Py_DECREF(row);
+    Py_XDECREF(row);
     return ret;
 }
 
@@ -572,11 +1385,19 @@ handle_command_complete(BaseProt *self) {
     char *pos;
     PyObject *py_val, *result, *results;
 
+    TIMELINE_MARK(self, command_complete);
+
+    if (self->decode_job && finish_decoding(self) == -1) {
+        return -1;
+    }
     if (self->converters) {
         PyMem_Free(self->converters);
         self->converters = NULL;
     }
-    result = PyStructSequence_New(Result);
+    // rows of the next statement need a new row description
+    self->result_nfields = 0;
+    self->row_plan = PLAN_NONE;
+    result = PyStructSequence_New(self->state->Result);
     if (result == NULL) {
         return -1;
     }
@@ -595,19 +1416,36 @@ handle_command_complete(BaseProt *self) {
     PyStructSequence_SET_ITEM(result, 0, py_val);
 
     // data
-    py_val = self->result_data;
-    if (py_val == NULL) {
-        py_val = Py_None;
-        Py_INCREF(Py_None);
+    if (self->batch) {
+        py_val = self->batch;
+        self->batch = NULL;
+    }
+    else if (self->sink && ((ColumnSink *)self->sink)->columns) {
+        if (ColumnSink_finish((ColumnSink *)self->sink) == -1) {
+            goto error;
+        }
+        py_val = self->sink;
+        Py_INCREF(py_val);
+    }
+    else if (self->spill) {
+        if (RawRows_finish(self->spill) == -1) {
+            goto error;
+        }
+        py_val = (PyObject *)self->spill;
+        self->spill = NULL;
     }
     else {
-        // no decref, sequence will steal
+        py_val = self->result_data;
         self->result_data = NULL;
     }
+    if (py_val == NULL) {
+        py_val = Py_None;
+        Py_INCREF(Py_None);
+    }
     PyStructSequence_SET_ITEM(result, 1, py_val);
 
     // tag
-    py_val = read_pystr(&pos, MSG_END(self) - pos);
+    py_val = read_pystr(self, &pos, MSG_END(self) - pos);
     if (py_val == NULL) {
         goto error;
     }
@@ -631,6 +1469,10 @@ handle_command_complete(BaseProt *self) {
         }
         Py_DECREF(result);
     }
+    if (self->statement_skips && --self->statement_skips == 0) {
+        // the rows of the next statement are those of the prepared one
+        return start_statement(self);
+    }
     return 0;
 
 error:
@@ -639,100 +1481,576 @@ error:
 }
 
 
-static int
-handle_ready(BaseProt *self) {
-    char status;
+static PyObject *
+timeline_to_py(PoqaioState *state, QueryTimeline *timeline)
+{
+    PyObject *py_timeline;
+    int64_t *stages = (int64_t *)timeline;
+    int i;
 
-    if (check_length(self, 1) == -1) {
-        return -1;
+    py_timeline = PyStructSequence_New(state->Timeline);
+    if (py_timeline == NULL) {
+        return NULL;
     }
-    status = MSG_BODY(self)[0];
-    switch (status) {
-        case 'I':
-        case 'E':
-        case 'T':
-            self->transaction_status = status;
-            break;
-        default: {
-            char status_string[2] = {status, 0};
-            PyErr_Format(
-                PoqaioProtocolError,
-                "Invalid transaction code in ReadyResponse, got '%s'",
-                status_string);
-            return -1;
+    for (i = 0; i < 8; i++) {
+        PyObject *stage = PyLong_FromLongLong(stages[i]);
+        if (stage == NULL) {
+            Py_DECREF(py_timeline);
+            return NULL;
         }
+        PyStructSequence_SET_ITEM(py_timeline, i, stage);
     }
-    PyObject *py_done;
-    int done;
+    return py_timeline;
+}
 
-    py_done = _PyObject_CallMethodIdObjArgs(self->fut, &PyId_done, NULL) ;
-    if (py_done == NULL) {
-        return -1;
+
+static void
+deliver_timeline(BaseProt *self)
+{
+    QueryTimeline *timeline = &self->timeline;
+
+    if (timeline->encode_start == 0) {
+        // not an executed query, i.e. startup
+        return;
     }
-    done = PyObject_IsTrue(py_done);
-//    done = py_done == Py_True;
-    Py_DECREF(py_done);
-    PyObject *res;
 
-    int ret = 0;
+    if (self->timeline_callback) {
+        PyObject *py_timeline, *res;
 
-    if (self->error) {
-        if (!done) {
-            res = PyObject_CallMethod(
-                    self->fut, "set_exception", "O", self->error);
-            if (res == NULL) {
-                ret = -1;
-            }
-            else {
-                Py_DECREF(res);
-            }
+        py_timeline = timeline_to_py(self->state, timeline);
+        if (py_timeline == NULL) {
+            goto unraisable;
         }
-        Py_CLEAR(self->error);
-        Py_CLEAR(self->results);
+        res = PyObject_CallFunctionObjArgs(
+            self->timeline_callback, py_timeline, NULL);
+        Py_DECREF(py_timeline);
+        if (res == NULL) {
+            goto unraisable;
+        }
+        Py_DECREF(res);
     }
     else {
-        if (!done) {
-            PyObject *result;
+        Py_ssize_t idx;
 
-            if (self->results == NULL) {
-                result = Py_None;
-                Py_INCREF(result);
-            }
-            else {
-                result = self->results;
-                self->results = NULL;
-            }
-            res = _PyObject_CallMethodIdObjArgs(
-                self->fut, &PyId_set_result, result, NULL);
-            Py_DECREF(result);
-
-            if (res == NULL) {
-                ret = -1;
-            }
-            else {
-                Py_DECREF(res);
-            }
+        if (self->timeline_count == self->timeline_capacity) {
+            // full, overwrite oldest
+            idx = self->timeline_start;
+            self->timeline_start = (idx + 1) % self->timeline_capacity;
+            self->timelines_dropped++;
+        }
+        else {
+            idx = (self->timeline_start + self->timeline_count) %
+                self->timeline_capacity;
+            self->timeline_count++;
         }
+        self->timeline_ring[idx] = *timeline;
     }
-    return ret;
+    memset(timeline, 0, sizeof(QueryTimeline));
+    return;
+
+unraisable:
+    // A failing sink must not break the protocol
+    PyErr_WriteUnraisable(self->timeline_callback);
+    memset(timeline, 0, sizeof(QueryTimeline));
 }
 
 
-static int
-handle_error(BaseProt *self) {
-    PyErr_SetString(PoqaioProtocolError, "ERROR!!!!!");
-    return 0;
+static PyObject *
+create_waiter(BaseProt *self, PyObject *callback)
+{
+    // Creates what will be completed at the next ReadyForQuery: either the
+    // callback, or a new future that is returned.
+    PyObject *fut;
+
+    if (self->blocking) {
+        // no need to wait for anyone but ourselves
+        return sync_wait(self);
+    }
+    if (callback != Py_None) {
+        Py_INCREF(callback);
+        Py_XSETREF(self->callback, callback);
+        Py_RETURN_NONE;
+    }
+
+    if (self->future_kwargs) {
+        fut = PyObject_Call(
+            self->state->future_type, self->state->empty_tuple,
+            self->future_kwargs);
+    }
+    else {
+        fut = PyObject_CallFunctionObjArgs(self->create_future, NULL);
+    }
+    if (fut == NULL) {
+        return NULL;
+    }
+    if (self->fut_done == NULL ||
+            (PyObject *)Py_TYPE(fut) != self->fut_type) {
+        // cache unbound methods, to call them without attribute lookup
+        PyObject *typ = (PyObject *)Py_TYPE(fut);
+
+        Py_CLEAR(self->fut_done);
+        Py_CLEAR(self->fut_set_result);
+        Py_CLEAR(self->fut_set_exception);
+        self->fut_done = PyObject_GetAttrString(typ, "done");
+        self->fut_set_result = PyObject_GetAttrString(typ, "set_result");
+        self->fut_set_exception = PyObject_GetAttrString(
+            typ, "set_exception");
+        if (self->fut_set_exception == NULL ||
+                self->fut_set_result == NULL || self->fut_done == NULL) {
+            Py_CLEAR(self->fut_done);
+            Py_DECREF(fut);
+            return NULL;
+        }
+        self->fut_type = typ;  // borrowed, only used for comparison
+    }
+    self->stats.futures++;
+
+    Py_INCREF(fut);
+    Py_XSETREF(self->fut, fut);
+    return fut;
 }
 
 
 static int
-handle_message(BaseProt *self) {
-    int res;
+complete_waiter(BaseProt *self, PyObject *result, PyObject *exc)
+{
+    // Completes the waiter with either the result or the exception
+    PyObject *res, *fut;
+    int done;
 
-//    printf("Message received: %c\n", self->curr_msg[0]);
-    switch (self->curr_msg[0]) {
-        case 'R':
-            res = handle_auth_req(self);
+    if (self->blocking) {
+        Py_XINCREF(result);
+        Py_XSETREF(self->sync_result, result);
+        Py_XINCREF(exc);
+        Py_XSETREF(self->sync_exc, exc);
+        self->sync_done = 1;
+        return 0;
+    }
+    if (self->callback) {
+        PyObject *callback = self->callback;
+
+        self->callback = NULL;
+        res = PyObject_CallFunctionObjArgs(
+            callback, result ? result : Py_None, exc ? exc : Py_None, NULL);
+        if (res == NULL) {
+            // not the problem of the connection
+            PyErr_WriteUnraisable(callback);
+        }
+        else {
+            Py_DECREF(res);
+        }
+        Py_DECREF(callback);
+        return 0;
+    }
+
+    if (self->fut == NULL) {
+        return 0;
+    }
+    // release the future, it should not keep the result alive
+    fut = self->fut;
+    self->fut = NULL;
+
+    res = PyObject_CallFunctionObjArgs(self->fut_done, fut, NULL);
+    if (res == NULL) {
+        goto end;
+    }
+    done = PyObject_IsTrue(res);
+    Py_DECREF(res);
+    if (done) {
+        // cancelled
+        goto end;
+    }
+    if (exc) {
+        res = PyObject_CallFunctionObjArgs(
+            self->fut_set_exception, fut, exc, NULL);
+    }
+    else {
+        res = PyObject_CallFunctionObjArgs(
+            self->fut_set_result, fut, result, NULL);
+    }
+    if (res != NULL) {
+        Py_DECREF(res);
+    }
+
+end:
+    Py_DECREF(fut);
+    return res == NULL ? -1 : 0;
+}
+
+
+static int
+prepare_complete(BaseProt *self)
+{
+    // Completes the waiter with the Statement that is described
+    PyObject *statement, *fields = self->result_fields;
+    int ret;
+
+    statement = (PyObject *)Statement_create(
+        self->state, self->prepare_name, self->prepare_query,
+        self->parameter_types ? self->parameter_types :
+            self->state->empty_tuple,
+        fields ? fields : Py_None);
+    Py_CLEAR(self->prepare_name);
+    Py_CLEAR(self->prepare_query);
+    Py_CLEAR(self->parameter_types);
+    Py_CLEAR(self->result_fields);
+    Py_CLEAR(self->results);
+    if (statement == NULL) {
+        return -1;
+    }
+    ret = complete_waiter(self, statement, NULL);
+    Py_DECREF(statement);
+    return ret;
+}
+
+
+static int
+handle_ready(BaseProt *self) {
+    char status;
+
+    if (check_length(self, 1) == -1) {
+        return -1;
+    }
+    status = MSG_BODY(self)[0];
+    switch (status) {
+        case 'I':
+        case 'E':
+        case 'T':
+            self->transaction_status = status;
+            break;
+        default: {
+            char status_string[2] = {status, 0};
+            PyErr_Format(
+                self->state->ProtocolError,
+                "Invalid transaction code in ReadyResponse, got '%s'",
+                status_string);
+            return -1;
+        }
+    }
+    int ret;
+
+    if (self->ready_skips) {
+        // end of startup or of a warm-up query, more will follow
+        self->ready_skips--;
+        return 0;
+    }
+    if (self->pgoutput) {
+        // end of the replication stream
+        deliver_changes(self);
+        pgoutput_free(self->pgoutput);
+        self->pgoutput = NULL;
+        Py_CLEAR(self->repl_handler);
+        self->copy_both = 0;
+    }
+    if (self->sink) {
+        ColumnSink_release((ColumnSink *)self->sink);
+        Py_CLEAR(self->sink);
+    }
+    Py_CLEAR(self->statement);
+    self->statement_skips = 0;
+    if (self->prepare_name && !self->error) {
+        ret = prepare_complete(self);
+    }
+    else if (self->error) {
+        ret = complete_waiter(self, NULL, self->error);
+        Py_CLEAR(self->error);
+        Py_CLEAR(self->results);
+        Py_CLEAR(self->result_fields);
+        Py_CLEAR(self->result_data);
+        Py_CLEAR(self->spill);
+        Py_CLEAR(self->batch);
+        Py_CLEAR(self->decode_job);
+        Py_CLEAR(self->decode_jobs);
+        self->row_plan = PLAN_NONE;
+        Py_CLEAR(self->prepare_name);
+        Py_CLEAR(self->prepare_query);
+        Py_CLEAR(self->parameter_types);
+    }
+    else {
+        PyObject *result;
+
+        if (self->results == NULL) {
+            result = Py_None;
+            Py_INCREF(result);
+        }
+        else {
+            result = self->results;
+            self->results = NULL;
+        }
+        ret = complete_waiter(self, result, NULL);
+        Py_DECREF(result);
+    }
+    if (self->timeline_enabled) {
+        self->timeline.ready = monotonic_ns();
+        deliver_timeline(self);
+    }
+    return ret;
+}
+
+
+static int
+handle_error(BaseProt *self) {
+    // Raises the ServerError, to be recorded and set on the waiter at
+    // ReadyForQuery. The connection stays usable.
+    PyObject *exc;
+
+    exc = server_message_create(
+        self->state, self->state->ServerError, MSG_BODY(self),
+        MSG_END(self) - MSG_BODY(self));
+    if (exc == NULL) {
+        return -1;
+    }
+    PyErr_SetObject((PyObject *)Py_TYPE(exc), exc);
+    Py_DECREF(exc);
+    return -1;
+}
+
+
+static int
+handle_notice(BaseProt *self) {
+    PyObject *notice, *res;
+
+    if (self->notice_handler == NULL) {
+        // nobody is interested
+        return 0;
+    }
+    notice = server_message_create(
+        self->state, self->state->Notice, MSG_BODY(self),
+        MSG_END(self) - MSG_BODY(self));
+    if (notice == NULL) {
+        return -1;
+    }
+    res = PyObject_CallFunctionObjArgs(self->notice_handler, notice, NULL);
+    Py_DECREF(notice);
+    if (res == NULL) {
+        // A failing handler must not break the protocol
+        PyErr_WriteUnraisable(self->notice_handler);
+        return 0;
+    }
+    Py_DECREF(res);
+    return 0;
+}
+
+
+static int
+handle_notification(BaseProt *self) {
+    // Calls the handler with the process id, channel and payload of a
+    // NotificationResponse, which can arrive at any time
+    PyObject *res;
+    char *pos = MSG_BODY(self), *channel, *payload;
+    Py_ssize_t channel_len, payload_len;
+    int32_t process_id;
+
+    if (read_int32_check(self, &pos, &process_id) == -1) {
+        return -1;
+    }
+    channel = read_str(self, &pos, &channel_len, MSG_END(self) - pos);
+    if (channel == NULL) {
+        return -1;
+    }
+    payload = read_str(self, &pos, &payload_len, MSG_END(self) - pos);
+    if (payload == NULL) {
+        return -1;
+    }
+    if (pos != MSG_END(self)) {
+        PyErr_SetString(
+            self->state->ProtocolError, "Invalid notification response.");
+        return -1;
+    }
+    if (self->notification_handler == NULL) {
+        return 0;
+    }
+    res = PyObject_CallFunction(
+        self->notification_handler, "is#s#", process_id, channel,
+        channel_len, payload, payload_len);
+    if (res == NULL) {
+        // A failing handler must not break the protocol
+        PyErr_WriteUnraisable(self->notification_handler);
+        return 0;
+    }
+    Py_DECREF(res);
+    return 0;
+}
+
+
+static int
+send_standby_status(BaseProt *self, char reply)
+{
+    // Sends a Standby status update with the received and acknowledged
+    // positions. The server can drop the WAL up to the flushed position.
+    // Applied is the same as flushed, the changes are not applied anywhere
+    // else.
+    char msg[39], *pos = msg;
+    uint64_t positions[4];
+    uint32_t msize = htobe32(38);
+    int i;
+
+    positions[0] = self->received_lsn;
+    positions[1] = self->flushed_lsn;
+    positions[2] = self->flushed_lsn;
+    positions[3] = (uint64_t)pg_clock_now();
+    *pos++ = 'd';
+    memcpy(pos, &msize, 4);
+    pos += 4;
+    *pos++ = 'r';
+    for (i = 0; i < 4; i++) {
+        uint64_t val = htobe64(positions[i]);
+
+        memcpy(pos, &val, 8);
+        pos += 8;
+    }
+    *pos = reply;
+    if (prot_write(self, msg, 39, NULL) == -1) {
+        return -1;
+    }
+    self->stats.bytes_sent += 39;
+    self->feedback_time = monotonic_ns();
+    return 0;
+}
+
+
+static int
+send_copy_done(BaseProt *self)
+{
+    // Ends the replication stream, the server ends its side as well
+    if (self->copy_done_sent) {
+        return 0;
+    }
+    if (prot_write(self, "c\0\0\0\x04", 5, NULL) == -1) {
+        return -1;
+    }
+    self->stats.bytes_sent += 5;
+    self->copy_done_sent = 1;
+    return 0;
+}
+
+
+static void
+deliver_changes(BaseProt *self)
+{
+    // Calls the handler with the decoded changes as a list, and the lsn of
+    // the last one
+    PyObject *changes, *res;
+
+    if (self->pgoutput == NULL ||
+            PyList_GET_SIZE(self->pgoutput->changes) == 0) {
+        return;
+    }
+    changes = self->pgoutput->changes;
+    self->pgoutput->changes = PyList_New(0);
+    if (self->pgoutput->changes == NULL) {
+        self->pgoutput->changes = changes;
+        PyErr_WriteUnraisable((PyObject *)self);
+        return;
+    }
+    self->delivered_lsn = self->pgoutput->batch_lsn;
+    res = PyObject_CallFunction(
+        self->repl_handler, "OK", changes,
+        (unsigned long long)self->delivered_lsn);
+    Py_DECREF(changes);
+    if (res == NULL) {
+        // A failing handler must not break the protocol
+        PyErr_WriteUnraisable(self->repl_handler);
+        return;
+    }
+    Py_DECREF(res);
+}
+
+
+static int
+handle_copy_both(BaseProt *self) {
+    // CopyBothResponse, the WAL streams after START_REPLICATION
+    if (self->pgoutput == NULL) {
+        PyErr_SetString(
+            self->state->ProtocolError, "Unexpected copy both response.");
+        return -1;
+    }
+    self->copy_both = 1;
+    self->feedback_time = monotonic_ns();
+    return 0;
+}
+
+
+static int
+handle_copy_data(BaseProt *self) {
+    // XLogData or Primary keepalive message of the replication stream
+    char *pos = MSG_BODY(self);
+    uint64_t wal_start, wal_end;
+    char reply;
+
+    if (!self->copy_both) {
+        PyErr_SetString(self->state->ProtocolError, "Unexpected copy data.");
+        return -1;
+    }
+    if (check_length_gte(self, pos, 1) == -1) {
+        return -1;
+    }
+    switch (*pos++) {
+        case 'w':
+            // start and end of WAL, send time, followed by the pgoutput
+            // message
+            if (check_length_gte(self, pos, 24) == -1) {
+                return -1;
+            }
+            wal_start = read_uint64(&pos);
+            pos += 16;
+            // received up to the end of the data
+            wal_end = wal_start + (uint64_t)(MSG_END(self) - pos);
+            if (wal_end > self->received_lsn) {
+                self->received_lsn = wal_end;
+            }
+            return pgoutput_decode(
+                self->state, self->pgoutput, pos, MSG_END(self), wal_start);
+        case 'k':
+            // end of WAL, send time and whether to reply immediately
+            if (check_length(self, 18) == -1) {
+                return -1;
+            }
+            wal_end = read_uint64(&pos);
+            pos += 8;
+            reply = *pos;
+            if (wal_end > self->received_lsn) {
+                self->received_lsn = wal_end;
+            }
+            if (!self->pgoutput->in_transaction &&
+                    PyList_GET_SIZE(self->pgoutput->changes) == 0 &&
+                    self->flushed_lsn >= self->delivered_lsn) {
+                // Everything is acknowledged, the WAL up to here has no
+                // changes for us
+                self->flushed_lsn = self->received_lsn;
+            }
+            if (reply) {
+                return send_standby_status(self, 0);
+            }
+            return 0;
+    }
+    PyErr_SetString(
+        self->state->ProtocolError, "Invalid replication message.");
+    return -1;
+}
+
+
+static int
+handle_copy_done(BaseProt *self) {
+    // The server ended the replication stream, CommandComplete follows
+    if (!self->copy_both) {
+        PyErr_SetString(self->state->ProtocolError, "Unexpected copy done.");
+        return -1;
+    }
+    self->copy_both = 0;
+    return send_copy_done(self);
+}
+
+
+static int
+handle_message(BaseProt *self) {
+    int res;
+
+//    printf("Message received: %c\n", self->curr_msg[0]);
+    self->stats.messages[(unsigned char)self->curr_msg[0]]++;
+    switch (self->curr_msg[0]) {
+        case 'R':
+            res = handle_auth_req(self);
             break;
         case 'Z':
             res = handle_ready(self);
@@ -752,493 +2070,2138 @@ handle_message(BaseProt *self) {
         case 'D':
             res = handle_data_row(self);
             break;
+        case 't':
+            res = handle_parameter_description(self);
+            break;
         case 'n':  // NoData
         case '1':  // ParseComplete
         case '2':  // BindComplete
             res = check_length(self, 0);
             break;
-        case 'N':  // TODO: Handle notice
-            res = 0;
+        case 'N':
+            res = handle_notice(self);
+            break;
+        case 'A':
+            res = handle_notification(self);
             break;
         case 'E':
             res = handle_error(self);
             break;
+        case 'W':
+            res = handle_copy_both(self);
+            break;
+        case 'd':
+            res = handle_copy_data(self);
+            break;
+        case 'c':
+            res = handle_copy_done(self);
+            break;
         default: {
             char identifier[2] = {self->curr_msg[0], 0};
             PyErr_Format(
-                PoqaioProtocolError,
+                self->state->ProtocolError,
                 "Unknown identifier '%s'",
                 identifier);
             return -1;
         }
     }
-    return res;
-}
-
+    return res;
+}
+
+
+static int
+sock_fatal(BaseProt *self)
+{
+    // Reports the socket error in the current exception to the transport,
+    // which closes the socket and tells the protocol the connection is lost.
+    PyObject *ex_type, *ex_val, *ex_tb, *res;
+
+    PyErr_Fetch(&ex_type, &ex_val, &ex_tb);
+    PyErr_NormalizeException(&ex_type, &ex_val, &ex_tb);
+    Py_XDECREF(ex_type);
+    Py_XDECREF(ex_tb);
+    res = PyObject_CallMethod(self->transport, "_fatal", "O", ex_val);
+    Py_DECREF(ex_val);
+    if (res == NULL) {
+        return -1;
+    }
+    Py_DECREF(res);
+    return 0;
+}
+
+
+static int
+out_buf_append(BaseProt *self, char *data, Py_ssize_t size)
+{
+    if (self->out_len + size > self->out_size) {
+        Py_ssize_t new_size = (self->out_len + size) * 2;
+        char *buf;
+
+        buf = PyMem_Realloc(self->out_buf, new_size);
+        if (buf == NULL) {
+            PyErr_NoMemory();
+            return -1;
+        }
+        self->out_buf = buf;
+        self->out_size = new_size;
+    }
+    memcpy(self->out_buf + self->out_len, data, size);
+    self->out_len += size;
+    return 0;
+}
+
+
+static void
+out_buf_consume(BaseProt *self, Py_ssize_t size)
+{
+    self->out_len -= size;
+    if (self->out_len) {
+        memmove(self->out_buf, self->out_buf + size, self->out_len);
+    }
+}
+
+
+static int
+sock_send_all(BaseProt *self, char *data, Py_ssize_t size)
+{
+    // Sends all data on the blocking socket, without holding the GIL
+    Py_ssize_t sent;
+
+    while (size) {
+        Py_BEGIN_ALLOW_THREADS
+        sent = send(self->sock_fd, data, size, MSG_NOSIGNAL);
+        Py_END_ALLOW_THREADS
+        if (sent < 0) {
+            if (SOCK_INTERRUPTED() && PyErr_CheckSignals() == 0) {
+                continue;
+            }
+            if (!PyErr_Occurred()) {
+                SET_SOCK_ERROR();
+            }
+            // unknown how much got sent, the connection is unusable
+            self->sock_fd = -1;
+            return -1;
+        }
+        data += sent;
+        size -= sent;
+    }
+    return 0;
+}
+
+
+static int
+sock_send(BaseProt *self, char *data, Py_ssize_t size)
+{
+    // Sends data directly on the socket. Whatever can not be sent now is
+    // kept in the outbound buffer, to be sent when the socket is writable.
+    Py_ssize_t sent;
+    int had_pending = self->out_len != 0;
+
+    if (self->blocking) {
+        return sock_send_all(self, data, size);
+    }
+    if (had_pending) {
+#ifdef _WIN32
+        if (out_buf_append(self, data, size) == -1) {
+            return -1;
+        }
+        data = NULL;
+        sent = send(self->sock_fd, self->out_buf, (int)self->out_len, 0);
+#else
+        // send pending data and new data in one go
+        struct iovec iov[2] = {
+            {self->out_buf, self->out_len}, {data, size}
+        };
+        sent = writev(self->sock_fd, iov, 2);
+#endif
+    }
+    else {
+        sent = send(self->sock_fd, data, size, MSG_NOSIGNAL);
+    }
+    if (sent < 0) {
+        if (!SOCK_WOULD_BLOCK()) {
+            SET_SOCK_ERROR();
+            return sock_fatal(self);
+        }
+        sent = 0;
+    }
+
+    if (had_pending) {
+        Py_ssize_t pending_sent = sent < self->out_len ? sent : self->out_len;
+
+        out_buf_consume(self, pending_sent);
+        sent -= pending_sent;
+    }
+    if (data != NULL && sent < size) {
+        if (out_buf_append(self, data + sent, size - sent) == -1) {
+            return -1;
+        }
+    }
+    if (self->out_len && !had_pending) {
+        // wait until writable
+        PyObject *res;
+
+        res = PyObject_CallMethod(
+            self->loop, "add_writer", "iO", self->sock_fd, self->write_ready);
+        if (res == NULL) {
+            return -1;
+        }
+        Py_DECREF(res);
+    }
+    return 0;
+}
+
+
+static int
+prot_write(BaseProt *self, char *data, Py_ssize_t size, PyObject *py_data)
+{
+    // Writes data to the server, either directly on the socket or through
+    // the transport. When available, py_data is a bytes object of data.
+    PyObject *res;
+
+    if (self->sock_fd != -1) {
+        return sock_send(self, data, size);
+    }
+    if (self->transport == NULL || self->transport == Py_None) {
+        // connection lost, nobody would ever answer
+        PyErr_SetString(PyExc_ConnectionError, "Connection closed");
+        return -1;
+    }
+    if (py_data) {
+        res = PyObject_CallFunctionObjArgs(self->transport_write, py_data, NULL);
+    }
+    else {
+        res = PyObject_CallFunction(self->transport_write, "y#", data, size);
+    }
+    if (res == NULL) {
+        return -1;
+    }
+    Py_DECREF(res);
+    return 0;
+}
+
+
+static void
+outbuf_write(char **buf, void *src, Py_ssize_t n) {
+    memcpy(*buf, src, n);
+    *buf += n;
+}
+
+
+static int
+write_password_message(
+    BaseProt *self, const char *prefix, Py_ssize_t prefix_len,
+    const char *data, Py_ssize_t len)
+{
+    // PasswordMessage, also used for the SASL messages
+    char *msg, *pos;
+    Py_ssize_t size = 5 + prefix_len + len;
+    int32_t msize = (int32_t)htobe32((uint32_t)(size - 1));
+    int ret;
+
+    msg = PyMem_Malloc(size);
+    if (msg == NULL) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    pos = msg;
+    outbuf_write(&pos, "p", 1);
+    outbuf_write(&pos, &msize, 4);
+    outbuf_write(&pos, (char *)prefix, prefix_len);
+    outbuf_write(&pos, (char *)data, len);
+    ret = prot_write(self, msg, size, NULL);
+    PyMem_Free(msg);
+    self->stats.bytes_sent += size;
+    return ret;
+}
+
+
+static int
+set_warmup(BaseProt *self, PyObject *queries)
+{
+    // Prepares a Query message per warm-up query
+    PyObject *seq;
+    Py_ssize_t i, n, size = 0, len;
+    const char *query;
+    char *pos;
+    int32_t msize;
+
+    seq = PySequence_Fast(queries, "Warm-up queries must be a sequence");
+    if (seq == NULL) {
+        return -1;
+    }
+    n = PySequence_Fast_GET_SIZE(seq);
+    for (i = 0; i < n; i++) {
+        query = PyUnicode_AsUTF8AndSize(
+            PySequence_Fast_GET_ITEM(seq, i), &len);
+        if (query == NULL) {
+            Py_DECREF(seq);
+            return -1;
+        }
+        size += 6 + len;
+    }
+    if (n == 0) {
+        Py_DECREF(seq);
+        return 0;
+    }
+    self->warmup = PyMem_Malloc(size);
+    if (self->warmup == NULL) {
+        Py_DECREF(seq);
+        PyErr_NoMemory();
+        return -1;
+    }
+    pos = self->warmup;
+    for (i = 0; i < n; i++) {
+        // UTF-8 is cached in the string object
+        query = PyUnicode_AsUTF8AndSize(
+            PySequence_Fast_GET_ITEM(seq, i), &len);
+        msize = (int32_t)htobe32((uint32_t)(len + 5));
+        outbuf_write(&pos, "Q", 1);
+        outbuf_write(&pos, &msize, 4);
+        outbuf_write(&pos, (char *)query, len + 1);
+    }
+    Py_DECREF(seq);
+    self->warmup_len = size;
+    self->ready_skips = (int)n;
+    return 0;
+}
+
+
+static PyObject *
+BaseProt_startup(BaseProt *self,  PyObject *args) {
+    char *user, *db, *app, *pwd, *options=NULL, *replication=NULL;
+    char *startup_message, *pos;
+    Py_ssize_t user_len, db_len=0, app_len, pwd_len, options_len=0, size;
+    Py_ssize_t replication_len=0;
+    int32_t msize;
+    int ret;
+    PyObject *warmup=Py_None;
+
+    if (!PyArg_ParseTuple(
+            args,"s#z#z#z#|z#Oz#", &user, &user_len, &db,
+            &db_len, &app, &app_len, &pwd, &pwd_len, &options, &options_len,
+            &warmup, &replication, &replication_len)) {
+        return NULL;
+    }
+    if (warmup != Py_None && set_warmup(self, warmup) == -1) {
+        return NULL;
+    }
+    user_len += 1;
+    self->user = PyMem_Malloc(user_len);
+    if (self->user == NULL) {
+        return PyErr_NoMemory();
+    }
+    memcpy(self->user, user, user_len);
+    if (pwd) {
+        pwd_len += 1;
+        self->password = PyMem_Malloc(pwd_len);
+        if (self->password == NULL) {
+            return PyErr_NoMemory();
+        }
+        memcpy(self->password, pwd, pwd_len);
+    }
+
+    // size = 8 (header) + 'user' (5) + 'DateStyle' (10) + 'ISO' (4) +
+    //     'client_encoding' (16) + 'UTF8' (5) + terminating zero (1) = 49
+    size = 49 + user_len;
+    if (db_len) {
+        // 'database' (9) + value
+        db_len += 1;
+        size += 9 + db_len;
+    }
+    if (app_len) {
+        // 'application_name' (17) + value
+        app_len += 1;
+        size += 17 + app_len;
+    }
+    if (options_len) {
+        // 'options' (8) + value, command line options like "-c name=value"
+        options_len += 1;
+        size += 8 + options_len;
+    }
+    if (replication_len) {
+        // 'replication' (12) + value, "database" for logical replication
+        replication_len += 1;
+        size += 12 + replication_len;
+    }
+    startup_message = PyMem_Malloc(size);
+    if (startup_message == NULL) {
+        return PyErr_NoMemory();
+    }
+
+    pos = startup_message;
+
+    // size of buffer (including size)
+    msize = (int32_t)htobe32((uint32_t)size);
+    outbuf_write(&pos, &msize, sizeof(msize));
+
+    // write protocol version and user
+    outbuf_write(&pos, "\0\x03\0\0user", 9);
+    outbuf_write(&pos, user, user_len);
+
+    if (db_len) {
+        // write database name
+        outbuf_write(&pos, "database", 9);
+        outbuf_write(&pos, db, db_len);
+    }
+    if (app_len) {
+        // write application name
+        outbuf_write(&pos, "application_name", 17);
+        outbuf_write(&pos, app, app_len);
+    }
+    if (options_len) {
+        outbuf_write(&pos, "options", 8);
+        outbuf_write(&pos, options, options_len);
+    }
+    if (replication_len) {
+        outbuf_write(&pos, "replication", 12);
+        outbuf_write(&pos, replication, replication_len);
+    }
+
+    // write standard parameters
+    memcpy(pos, "DateStyle\0ISO\0client_encoding\0UTF8\0", 36);
+
+    // really send it
+    ret = prot_write(self, startup_message, size, NULL);
+    PyMem_Free(startup_message);
+    if (ret == -1) {
+        return NULL;
+    }
+    self->stats.bytes_sent += size;
+
+//    printf("Startup sent\n");
+
+    // create a future to report on later
+    return create_waiter(self, Py_None);
+}
+
+
+static Py_ssize_t
+statements_size(PyObject *statements, int extended)
+{
+    // Returns the size of the messages for the extra statements, or -1 on
+    // error. For the simple query protocol it is the length of the text
+    // including separator.
+    Py_ssize_t i, len, size = 0;
+
+    if (statements == Py_None) {
+        return 0;
+    }
+    if (!PyTuple_Check(statements)) {
+        PyErr_SetString(PyExc_TypeError, "Statements must be a tuple");
+        return -1;
+    }
+    for (i = 0; i < PyTuple_GET_SIZE(statements); i++) {
+        if (PyUnicode_AsUTF8AndSize(
+                PyTuple_GET_ITEM(statements, i), &len) == NULL) {
+            return -1;
+        }
+        // Parse (9 + len), Bind (13) and Execute (10) or text and separator
+        size += extended ? len + 32 : len + 2;
+    }
+    return size;
+}
+
+
+static void
+write_statements(char **pos, PyObject *statements)
+{
+    // Writes Parse, Bind and Execute messages of the statements without
+    // parameters, using the unnamed statement and portal
+    Py_ssize_t i, len;
+    const char *stmt;
+    uint32_t msize;
+
+    if (statements == Py_None) {
+        return;
+    }
+    for (i = 0; i < PyTuple_GET_SIZE(statements); i++) {
+        // UTF-8 is cached in the string object
+        stmt = PyUnicode_AsUTF8AndSize(PyTuple_GET_ITEM(statements, i), &len);
+        outbuf_write(pos, "P", 1);
+        msize = htobe32((uint32_t)(len + 8));
+        outbuf_write(pos, &msize, 4);
+        outbuf_write(pos, "", 1);
+        outbuf_write(pos, (char *)stmt, len + 1);
+        outbuf_write(pos, "\0\0", 2);
+        outbuf_write(pos, "B\0\0\0\x0c\0\0\0\0\0\0\0\0", 13);
+        outbuf_write(pos, "E\0\0\0\x09\0\0\0\0\0", 10);
+    }
+}
+
+
+static void
+write_statements_text(char **pos, PyObject *statements, int before)
+{
+    // Writes the statements as text around the query of a simple query,
+    // separated by semicolons. A newline ends a comment at the end of the
+    // query.
+    Py_ssize_t i, len;
+    const char *stmt;
+
+    if (statements == Py_None) {
+        return;
+    }
+    for (i = 0; i < PyTuple_GET_SIZE(statements); i++) {
+        stmt = PyUnicode_AsUTF8AndSize(PyTuple_GET_ITEM(statements, i), &len);
+        if (!before) {
+            outbuf_write(pos, "\n;", 2);
+        }
+        outbuf_write(pos, (char *)stmt, len);
+        if (before) {
+            outbuf_write(pos, ";\n", 2);
+        }
+    }
+}
+
+
+static PyObject *
+bind_statement(
+    Statement *stmt, PyObject **params, Py_ssize_t num_params,
+    PyObject *before, Py_ssize_t before_size, PyObject *after,
+    Py_ssize_t after_size, Py_ssize_t *msg_size)
+{
+    // Returns the messages that execute the prepared statement, with the
+    // parameters encoded for the described types. No Parse and Describe
+    // messages are needed.
+    static char fin[] = (
+            "E\0\0\0\x09\0\0\0\0\0"  // execute
+            "H\0\0\0\x04"            // flush
+            "S\0\0\0\x04"            // sync
+            );
+    Param *params_enc;
+    PyObject *py_buf = NULL;
+    Py_ssize_t i, name_len, value_size = 0, bind_size;
+    const char *name;
+    char *pos;
+    uint32_t uval32;
+    uint16_t val16;
+
+    if (num_params != stmt->nparams) {
+        PyErr_Format(
+            PyExc_ValueError, "Statement takes %d parameters, %zd given",
+            (int)stmt->nparams, num_params);
+        return NULL;
+    }
+    name = PyUnicode_AsUTF8AndSize(stmt->name, &name_len);
+    if (name == NULL) {
+        return NULL;
+    }
+    params_enc = PyMem_Calloc(num_params + 1, sizeof(Param));
+    if (params_enc == NULL) {
+        return PyErr_NoMemory();
+    }
+    for (i = 0; i < num_params; i++) {
+        if (fill_typed_param(
+                params_enc + i, stmt->param_oids[i], params[i]) == -1) {
+            goto end;
+        }
+        if (params_enc[i].size > 0) {
+            value_size += params_enc[i].size;
+        }
+    }
+
+    // Bind Message: 15 + name_len + 6 * num_params + param_value_length
+    //     'B'(1) + size(4) + empty portal name (1) + statement name and
+    //     term zero (name_len + 1) + num_params (2) + parameter formats
+    //     (2 * num_params) + num_params (2) + [param_length + param_value]*
+    //     (4 * num_params + param_value_length) + num_format_codes (2) +
+    //     format_code (2)
+    bind_size = 15 + name_len + 6 * num_params + value_size;
+    *msg_size = before_size + bind_size + 20 + after_size;
+    py_buf = PyBytes_FromStringAndSize(NULL, *msg_size);
+    if (py_buf == NULL) {
+        goto end;
+    }
+    pos = PyBytes_AS_STRING(py_buf);
+    write_statements(&pos, before);
+
+    *pos++ = 'B';
+    uval32 = htobe32((uint32_t)(bind_size - 1));
+    outbuf_write(&pos, &uval32, sizeof(uval32));
+    *pos++ = '\0';
+    outbuf_write(&pos, (char *)name, name_len + 1);
+    val16 = htobe16((uint16_t)num_params);
+    outbuf_write(&pos, &val16, sizeof(val16));
+    for (i = 0; i < num_params; i++) {
+        val16 = htobe16((uint16_t)params_enc[i].format);
+        outbuf_write(&pos, &val16, sizeof(val16));
+    }
+    val16 = htobe16((uint16_t)num_params);
+    outbuf_write(&pos, &val16, sizeof(val16));
+    for (i = 0; i < num_params; i++) {
+        Param *param = params_enc + i;
+
+        uval32 = htobe32((uint32_t)(int32_t)param->size);
+        outbuf_write(&pos, &uval32, sizeof(uval32));
+        if (param->size > 0) {
+            if (param->write(param, pos) == -1) {
+                Py_CLEAR(py_buf);
+                goto end;
+            }
+            pos += param->size;
+        }
+    }
+    // text results, converted like those of other queries
+    outbuf_write(&pos, "\0\x01\0\0", 4);
+
+    outbuf_write(&pos, fin, 10);
+    write_statements(&pos, after);
+    outbuf_write(&pos, fin + 10, 10);
+
+end:
+    // params after a failing one are not filled and have no free function
+    for (i = 0; i < num_params; i++) {
+        if (params_enc[i].free) {
+            params_enc[i].free(params_enc + i);
+        }
+    }
+    PyMem_Free(params_enc);
+    return py_buf;
+}
+
+
+static void
+abandon_execute(BaseProt *self)
+{
+    // Forgets the statement that could not be sent, nothing will answer it
+    Py_CLEAR(self->fut);
+    Py_CLEAR(self->callback);
+    if (self->sink) {
+        ColumnSink_release((ColumnSink *)self->sink);
+        Py_CLEAR(self->sink);
+    }
+    Py_CLEAR(self->statement);
+    self->statement_skips = 0;
+    Py_CLEAR(self->result_fields);
+    Py_CLEAR(self->spill);
+    Py_CLEAR(self->batch);
+    Py_CLEAR(self->decode_job);
+    Py_CLEAR(self->decode_jobs);
+}
+
+
+PyObject *
+BaseProt_execute(BaseProt *self, PyObject *args) {
+    const char *query = NULL;
+    char *buf, *pos;
+    Py_ssize_t query_len;
+    int ret;
+    PyObject *py_query, *py_params, *py_buf, *callback=Py_None, *sink=Py_None;
+    PyObject *before=Py_None, *after=Py_None, *row_factory=Py_None;
+    PyObject *py_budget=Py_None, *waiter=NULL;
+    Py_ssize_t msg_size=0, num_params=0, i, before_size, after_size;
+    Py_ssize_t budget;
+    int32_t msize;
+    int result_format=RESULT_TUPLES;
+    Statement *statement = NULL;
+
+    // Before and after are tuples of statements without parameters and
+    // results, like BEGIN and COMMIT, that are sent in the same write. Their
+    // command results are part of the returned results. Row factory None
+    // means the row factory of the connection. The query is a str or a
+    // prepared Statement. Memory budget None means the budget of the
+    // connection.
+    if (!PyArg_ParseTuple(
+            args, "OO|OiOOOOO", &py_query, &py_params, &callback,
+            &result_format, &sink, &before, &after, &row_factory,
+            &py_budget)) {
+        return NULL;
+    }
+    if (py_budget == Py_None) {
+        budget = self->memory_budget;
+    }
+    else {
+        budget = PyLong_AsSsize_t(py_budget);
+        if (budget == -1 && PyErr_Occurred()) {
+            return NULL;
+        }
+        if (budget < 0) {
+            PyErr_SetString(
+                PyExc_ValueError, "Memory budget must not be negative");
+            return NULL;
+        }
+    }
+    if (Py_TYPE(py_query) == self->state->StatementType) {
+        statement = (Statement *)py_query;
+    }
+    else if (PyUnicode_Check(py_query)) {
+        query = PyUnicode_AsUTF8AndSize(py_query, &query_len);
+        if (query == NULL) {
+            return NULL;
+        }
+    }
+    else {
+        PyErr_SetString(
+            PyExc_TypeError, "Query must be a str or a prepared Statement");
+        return NULL;
+    }
+    if (result_format < RESULT_TUPLES || result_format > RESULT_RAW) {
+        PyErr_SetString(PyExc_ValueError, "Invalid result format");
+        return NULL;
+    }
+    if ((result_format == RESULT_COLUMNS) !=
+            (Py_TYPE(sink) == self->state->ColumnSinkType)) {
+        PyErr_SetString(
+            PyExc_TypeError, "A ColumnSink is needed for RESULT_COLUMNS");
+        return NULL;
+    }
+    if (callback != Py_None && !PyCallable_Check(callback)) {
+        PyErr_SetString(PyExc_TypeError, "Callback must be callable");
+        return NULL;
+    }
+    if (row_factory == Py_None && self->row_factory) {
+        row_factory = self->row_factory;
+    }
+    if (row_factory_select(&self->rows, row_factory) == -1) {
+        return NULL;
+    }
+
+    if (self->timeline_enabled) {
+        memset(&self->timeline, 0, sizeof(QueryTimeline));
+        self->timeline.encode_start = monotonic_ns();
+    }
+
+    if (py_params != Py_None) {
+        py_params = PySequence_Fast(
+                py_params, "Parameters must be a sequence or None");
+        if (py_params == NULL) {
+            return NULL;
+        }
+        num_params = PySequence_Fast_GET_SIZE(py_params);
+        if (num_params == 0) {
+            Py_DECREF(py_params);
+        }
+    }
+
+    before_size = statements_size(before, num_params != 0 || statement);
+    after_size = statements_size(after, num_params != 0 || statement);
+    if (before_size == -1 || after_size == -1) {
+        if (num_params) {
+            Py_DECREF(py_params);
+        }
+        return NULL;
+    }
+
+    if (statement) {
+        py_buf = bind_statement(
+            statement, num_params ? PySequence_Fast_ITEMS(py_params) : NULL,
+            num_params, before, before_size, after, after_size, &msg_size);
+        if (num_params) {
+            Py_DECREF(py_params);
+        }
+        if (py_buf == NULL) {
+            return NULL;
+        }
+    }
+    else if (num_params == 0) {
+        // simple query
+
+        msg_size = query_len + 6;  // query length + term zero + length + identifier
+        msg_size += before_size + after_size;
+        py_buf = PyBytes_FromStringAndSize(NULL, msg_size);
+        if (py_buf == NULL) {
+            return NULL;
+        }
+        buf = PyBytes_AS_STRING(py_buf);
+
+        // write identifier
+        *buf++ = 'Q';
+
+        // write msg length
+        msize = (int32_t)htobe32((uint32_t)(msg_size - 1));
+        outbuf_write(&buf, &msize, sizeof(msize));
+
+        // write query
+        write_statements_text(&buf, before, 1);
+        outbuf_write(&buf, (char *)query, query_len);
+        write_statements_text(&buf, after, 0);
+        *buf = '\0';
+    }
+    else {
+        Param *params;
+        int32_t value_size = 0;
+        uint32_t uval32;
+        int16_t val16;
+        PyObject **fast_params;
+
+        static char fin[] = (
+                "D\0\0\0\x06P\0"         // describe
+                "E\0\0\0\x09\0\0\0\0\0"  // execute
+                "H\0\0\0\x04"            // flush
+                "S\0\0\0\x04"            // sync
+                );
+
+//        printf("Complex query\n");
+
+        if (num_params > INT16_MAX) {
+            PyErr_SetString(
+                PyExc_ValueError,
+                "Too many parameters provided. Maximum number is 32767");
+            Py_DECREF(py_params);
+            return NULL;
+        }
+
+        params = PyMem_Calloc(num_params, sizeof(Param));
+        if (params == NULL) {
+            Py_DECREF(py_params);
+            return PyErr_NoMemory();
+        }
+//        printf("Complex query 2\n");
+
+        fast_params = PySequence_Fast_ITEMS(py_params);
+        for (i = 0; i < num_params; i++) {
+            PyObject *py_param =  fast_params[i];
+            Param *param = params + i;
+            if (fill_param(param, py_param) == -1) {
+                while (i--) {
+                    if (params[i].free) {
+                        params[i].free(params + i);
+                    }
+                }
+                PyMem_Free(params);
+                Py_DECREF(py_params);
+                return NULL;
+            }
+            if (param->size > 0) {
+                value_size += param->size;
+            }
+        }
+
+//        printf("Complex query 3\n");
+
+        // Parse Message: 9 + querylen + 4 * num_params
+        //     'P'(1) + size(4) + empty name (1) + query string (len) +
+        //     term zero(1) + num_params (2) + param_oids (4 * num_params)
+        //
+        // Bind Message: 15 + 6 * num_params + param_value_length
+        //     'B'(1) + size(4) + empty portal name (1) +
+        //     empty statement name (1) + num_params (2) +
+        //     parameter formats (2 * num_params) + num_params (2) +
+        //     [param_length + param_value]* (4 * num_params + param_value_length)
+        //     num_format_codes (2) + format_code (2)
+
+        msg_size = 51 + 10 * num_params + query_len + value_size;
+        msg_size += before_size + after_size;
+        py_buf = PyBytes_FromStringAndSize(NULL, msg_size);
+        if (py_buf == NULL) {
+            for (i = 0; i < num_params; i++) {
+                if (params[i].free) {
+                    params[i].free(params + i);
+                }
+            }
+            PyMem_Free(params);
+            Py_DECREF(py_params);
+            return NULL;
+        }
+        buf = PyBytes_AS_STRING(py_buf);
+        pos = buf;
+        write_statements(&pos, before);
+        buf = pos;
+
+        // 0: Parse identifier
+        buf[0] = 'P';
+        pos = buf + 1;
+        // 1: Parse message size
+        uval32 = htobe32(8 + query_len + 4 * num_params);
+        outbuf_write(&pos, &uval32, sizeof(uval32));
+        // 5: Empty name
+        *pos++ = '\0';
+        // 6: Query
+        outbuf_write(&pos, (char *)query, query_len);
+        // 6 + querylen: Query terminator
+        *pos++ = '\0';
+        // 7 + querylen: Number of parameter oids
+        val16 = (int16_t)htobe16(num_params);
+        outbuf_write(&pos, &val16, sizeof(val16));
+        // 9 + querylen: Parameter oids
+
+        char *fmt_pos = buf + 18 + query_len + 4 * num_params;
+        char *val_pos = buf + 20 + query_len + 6 * num_params;
+        for (i = 0; i < num_params; i++) {
+            Param *param = params + i;
+
+            uval32 = htobe32(param->oid);
+            outbuf_write(&pos, &uval32, sizeof(uval32));
+
+            // parameter format
+            val16 = (int16_t)htobe16((uint16_t)param->format);
+            outbuf_write(&fmt_pos, &val16, sizeof(val16));
+
+            // parameter value
+            int32_t size = (int32_t)param->size;
+
+            msize = (int32_t)htobe32((uint32_t)size);
+            outbuf_write(&val_pos, &msize, sizeof(msize));
+            if (size > 0) {
+                param->write(param, val_pos);
+                val_pos += size;
+            }
+        }
+
+        // 9 + querylen + 4 * num_params: Bind identifier
+        *pos++ = 'B';
+        // 10 + querylen + 4 * num_params: Bind message size
+        uval32 = htobe32(14 + 6 * num_params + value_size);
+        outbuf_write(&pos, &uval32, sizeof(uval32));
+        // 14 + querylen + 4 * num_params: Empty portal name
+        *pos++ = '\0';
+        // 15 + querylen + 4 * num_params: Empty statement name
+        *pos++ = '\0';
+        // 16 + querylen + 4 * num_params: Number of parameter formats
+        val16 = (int16_t)htobe16((uint16_t)num_params);
+        outbuf_write(&pos, &val16, sizeof(val16));
+        // 18 + querylen + 4 * num_params: Parameter formats
+        pos += 2 * num_params;  // skip alread written formats
+        // 18 + querylen + 6 * num_params: Number of parameter values
+        val16 = (int16_t)htobe16((uint16_t)num_params);
+        outbuf_write(&pos, &val16, sizeof(val16));
+        // 20 + querylen + 6 * num_params: Parameter values
+        pos += 4 * num_params + value_size; // skip already written values
+        // 20 + querylen + 10 * num_params + param_values:
+        //      Number of result format codes
+        outbuf_write(&pos, "\0\x01", 2);
+        // 22 + querylen + 10 * num_params + param_values: Result format codes
+        outbuf_write(&pos, "\0\0", 2);
+
+        // 24 + querylen + 10 * num_params + param_values: Final messages,
+        // with the statements after the query before flush and sync
+        outbuf_write(&pos, fin, 17);
+        write_statements(&pos, after);
+        outbuf_write(&pos, fin + 17, 10);
+        // 51 + querylen + 10 * num_params + param_values: end
+
+        for (i = 0; i < num_params; i++) {
+            Param *param = params + i;
+            if (param->free) {
+                param->free(param);
+            }
+        }
+        PyMem_Free(params);
+        Py_DECREF(py_params);
+    }
+
+    TIMELINE_MARK(self, encode_end);
+
+    // Everything to receive the response is set up before sending: once the
+    // query is written, its response must be consumed by this statement.
+    self->result_format = result_format;
+    self->query_budget = budget;
+    self->result_bytes = 0;
+    if (result_format == RESULT_COLUMNS) {
+        Py_INCREF(sink);
+        Py_XSETREF(self->sink, sink);
+    }
+    if (statement) {
+        // no RowDescription follows, the rows are made as described
+        Py_INCREF(statement);
+        Py_XSETREF(self->statement, (PyObject *)statement);
+        self->statement_skips =
+            before == Py_None ? 0 : (int)PyTuple_GET_SIZE(before);
+        if (self->statement_skips == 0 && start_statement(self) == -1) {
+            goto error;
+        }
+    }
+    if (!self->blocking) {
+        // create a future, or register the callback, to report on later
+        waiter = create_waiter(self, callback);
+        if (waiter == NULL) {
+            goto error;
+        }
+    }
+
+    // really send it
+    ret = prot_write(self, PyBytes_AS_STRING(py_buf), msg_size, py_buf);
+    Py_CLEAR(py_buf);
+    if (ret == -1) {
+        goto error;
+    }
+    self->stats.bytes_sent += msg_size;
+
+    TIMELINE_MARK(self, write_done);
+
+    if (self->blocking) {
+        return sync_wait(self);
+    }
+    return waiter;
+
+error:
+    Py_XDECREF(py_buf);
+    Py_XDECREF(waiter);
+    abandon_execute(self);
+    return NULL;
+}
+
+
+static PyObject *
+BaseProt_prepare(BaseProt *self, PyObject *args)
+{
+    // Prepares the query as named statement and describes its parameters
+    // and result, the waiter gets a Statement
+    const char *name, *query;
+    char *buf, *pos;
+    Py_ssize_t name_len, query_len, msg_size;
+    PyObject *py_name, *py_query, *py_buf, *callback=Py_None;
+    uint32_t uval32;
+    int ret;
+
+    if (!PyArg_ParseTuple(
+            args, "UU|O", &py_name, &py_query, &callback)) {
+        return NULL;
+    }
+    if (callback != Py_None && !PyCallable_Check(callback)) {
+        PyErr_SetString(PyExc_TypeError, "Callback must be callable");
+        return NULL;
+    }
+    name = PyUnicode_AsUTF8AndSize(py_name, &name_len);
+    if (name == NULL) {
+        return NULL;
+    }
+    query = PyUnicode_AsUTF8AndSize(py_query, &query_len);
+    if (query == NULL) {
+        return NULL;
+    }
+    if (strlen(name) != (size_t)name_len ||
+            strlen(query) != (size_t)query_len) {
+        PyErr_SetString(PyExc_ValueError, "embedded null character");
+        return NULL;
+    }
+
+    // Parse: 'P' (1) + size (4) + name (name_len + 1) + query (query_len +
+    //     1) + no parameter types (2)
+    // Describe: 'D' (1) + size (4) + 'S' (1) + name (name_len + 1)
+    // Sync: 'S' (1) + size (4)
+    msg_size = 21 + 2 * name_len + query_len;
+    py_buf = PyBytes_FromStringAndSize(NULL, msg_size);
+    if (py_buf == NULL) {
+        return NULL;
+    }
+    buf = PyBytes_AS_STRING(py_buf);
+    pos = buf;
+    *pos++ = 'P';
+    uval32 = htobe32((uint32_t)(8 + name_len + query_len));
+    outbuf_write(&pos, &uval32, sizeof(uval32));
+    outbuf_write(&pos, (char *)name, name_len + 1);
+    outbuf_write(&pos, (char *)query, query_len + 1);
+    outbuf_write(&pos, "\0\0", 2);
+    *pos++ = 'D';
+    uval32 = htobe32((uint32_t)(6 + name_len));
+    outbuf_write(&pos, &uval32, sizeof(uval32));
+    *pos++ = 'S';
+    outbuf_write(&pos, (char *)name, name_len + 1);
+    outbuf_write(&pos, "S\0\0\0\x04", 5);
+
+    ret = prot_write(self, buf, msg_size, py_buf);
+    Py_DECREF(py_buf);
+    if (ret == -1) {
+        return NULL;
+    }
+    self->stats.bytes_sent += msg_size;
+
+    Py_INCREF(py_name);
+    Py_XSETREF(self->prepare_name, py_name);
+    Py_INCREF(py_query);
+    Py_XSETREF(self->prepare_query, py_query);
+    Py_CLEAR(self->parameter_types);
+    self->result_format = RESULT_TUPLES;
+    return create_waiter(self, callback);
+}
+
+
+static PyObject *
+BaseProt_start_replication(BaseProt *self, PyObject *args)
+{
+    // Sends the START_REPLICATION command of a logical slot using pgoutput.
+    // The handler is called with each batch of decoded changes and the lsn
+    // of the last one. The waiter completes when the stream has ended. A
+    // standby status update is sent every feedback interval in seconds.
+    const char *query;
+    char *buf;
+    Py_ssize_t query_len, msg_size;
+    PyObject *py_query, *handler, *py_buf, *callback=Py_None;
+    unsigned long long start_lsn;
+    double interval = 10.0;
+    uint32_t msize;
+    int ret;
+
+    if (!PyArg_ParseTuple(
+            args, "UOK|dO", &py_query, &handler, &start_lsn, &interval,
+            &callback)) {
+        return NULL;
+    }
+    if (!PyCallable_Check(handler)) {
+        PyErr_SetString(PyExc_TypeError, "Handler must be callable");
+        return NULL;
+    }
+    if (callback != Py_None && !PyCallable_Check(callback)) {
+        PyErr_SetString(PyExc_TypeError, "Callback must be callable");
+        return NULL;
+    }
+    if (interval < 0) {
+        PyErr_SetString(
+            PyExc_ValueError, "Feedback interval must not be negative");
+        return NULL;
+    }
+    if (self->blocking) {
+        PyErr_SetString(
+            self->state->Error, "Replication needs a non blocking connection");
+        return NULL;
+    }
+    if (self->pgoutput) {
+        PyErr_SetString(self->state->Error, "Already replicating");
+        return NULL;
+    }
+    query = PyUnicode_AsUTF8AndSize(py_query, &query_len);
+    if (query == NULL) {
+        return NULL;
+    }
+    if (strlen(query) != (size_t)query_len) {
+        PyErr_SetString(PyExc_ValueError, "embedded null character");
+        return NULL;
+    }
+
+    // Query: 'Q' (1) + size (4) + query (query_len + 1)
+    msg_size = query_len + 6;
+    py_buf = PyBytes_FromStringAndSize(NULL, msg_size);
+    if (py_buf == NULL) {
+        return NULL;
+    }
+    buf = PyBytes_AS_STRING(py_buf);
+    buf[0] = 'Q';
+    msize = htobe32((uint32_t)(msg_size - 1));
+    memcpy(buf + 1, &msize, 4);
+    memcpy(buf + 5, query, query_len + 1);
+
+    self->pgoutput = pgoutput_new();
+    if (self->pgoutput == NULL) {
+        Py_DECREF(py_buf);
+        return NULL;
+    }
+    ret = prot_write(self, buf, msg_size, py_buf);
+    Py_DECREF(py_buf);
+    if (ret == -1) {
+        pgoutput_free(self->pgoutput);
+        self->pgoutput = NULL;
+        return NULL;
+    }
+    self->stats.bytes_sent += msg_size;
+
+    Py_INCREF(handler);
+    Py_XSETREF(self->repl_handler, handler);
+    self->copy_both = 0;
+    self->copy_done_sent = 0;
+    self->received_lsn = start_lsn;
+    self->delivered_lsn = start_lsn;
+    self->flushed_lsn = start_lsn;
+    self->feedback_interval = (int64_t)(interval * 1e9);
+    self->result_format = RESULT_TUPLES;
+    return create_waiter(self, callback);
+}
+
+
+static PyObject *
+BaseProt_acknowledge(BaseProt *self, PyObject *arg)
+{
+    // The changes up to lsn are handled, the server does not need to send
+    // them again. Reported in the next standby status update.
+    unsigned long long lsn;
+
+    lsn = PyLong_AsUnsignedLongLong(arg);
+    if (lsn == (unsigned long long)-1 && PyErr_Occurred()) {
+        return NULL;
+    }
+    if (lsn > self->received_lsn) {
+        // can not be flushed before it is received
+        lsn = self->received_lsn;
+    }
+    if (lsn > self->flushed_lsn) {
+        self->flushed_lsn = lsn;
+    }
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+BaseProt_send_feedback(BaseProt *self, PyObject *unused)
+{
+    // Sends a standby status update now
+    if (self->copy_both && send_standby_status(self, 0) == -1) {
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+BaseProt_stop_replication(BaseProt *self, PyObject *unused)
+{
+    // Reports the acknowledged position and ends the replication stream
+    if (self->copy_both && !self->copy_done_sent && (
+            send_standby_status(self, 0) == -1 ||
+            send_copy_done(self) == -1)) {
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+BaseProt_fail_waiter(BaseProt *self, PyObject *exc)
+{
+    if (complete_waiter(self, NULL, exc) == -1) {
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+
+static char *
+receive_window(BaseProt *self, Py_ssize_t *size)
+{
+    // A message must always fit entirely in a buffer. Easy for parsing.
+    // There are two buffers, a fixed size one called 'in_buf' and an
+    // dynamic one 'in_extra_buf'for large messages.
+
+    // Return the (remaining) buffer
+    char *buf;
+    int buf_size;
+
+    if (self->in_extra_buf) {
+        buf = self->in_extra_buf;
+        buf_size = self->msg_length;
+    }
+    else {
+        buf = self->in_buf;
+        buf_size = BUF_SIZE;
+    }
+    *size = buf_size - self->received_bytes;
+    return buf + self->received_bytes;
+}
+
+
+static PyObject *
+BaseProt_get_buffer(BaseProt *self, PyObject *arg)
+{
+    char *buf;
+    Py_ssize_t size;
+
+//    printf("Getting buffer\n");
+
+    buf = receive_window(self, &size);
+    return PyMemoryView_FromMemory(buf, size, PyBUF_WRITE);
+}
+
+
+static int
+_BaseProt_buffer_updated(BaseProt *self)
+{
+    int32_t length;
+    int ret;
+
+    if (RECEIVING_HEADER(self)) {
+//        printf("Identifier: %c\n", self->curr_msg[0]);
+        length = get_int32(self->curr_msg + 1);
+        // TODO: check for negative msg_length;
+//        if (length < 4) {
+//                raise
+//        }
+
+        self->msg_length = length + 1;  // body including length plus identifier
+        if (self->msg_length > BUF_SIZE) {
+            // big buffer is needed
+            char *buf;
+
+            buf = PyMem_Malloc(self->msg_length + 1);
+            if (buf == NULL) {
+                PyErr_NoMemory();
+                return -1;
+            }
+            self->in_extra_buf = buf;
+            self->stats.jumbo_buffers++;
+
+            // copy already received data (header) into big buffer
+            memcpy(buf, self->curr_msg, self->received_bytes);
+            self->curr_msg = buf;
+            return 0;
+        }
+
+        if (self->msg_length > self->received_bytes) {
+            // incomplete message, we want more
+            return 0;
+        }
+    }
+    ret = handle_message(self);
+
+    // Done with message. Clean up
+    if (self->in_extra_buf) {
+        // clear large buffer
+        PyMem_Free(self->in_extra_buf);
+        self->in_extra_buf = NULL;
+        self->received_bytes = 0;
+        self->curr_msg = self->in_buf;
+    }
+    else {
+        self->received_bytes -= self->msg_length;
+        self->curr_msg += self->msg_length;
+    }
+    self->msg_length = HEADER_SIZE;
+    return ret;
+}
+
+
+static inline PyObject *
+decode_typed_value(BaseProt *self, int i, char *data, int32_t size)
+{
+    // Converts a value without indirect call for the common types. Invalid
+    // values are left to the converter, for the error message.
+    int64_t ival;
+    double dval;
+
+    switch (self->converters[i].kind) {
+        case CONV_INT:
+            if (parse_int64(data, size, &ival) == 0) {
+                return PyLong_FromLongLong(ival);
+            }
+            break;
+        case CONV_FLOAT:
+            if (parse_double(data, size, &dval) == 0) {
+                return PyFloat_FromDouble(dval);
+            }
+            break;
+        case CONV_BOOL:
+            if (size == 1 && (*data == 't' || *data == 'f')) {
+                return PyBool_FromLong(*data == 't');
+            }
+            break;
+        default:
+            return PyUnicode_FromStringAndSize(data, size);
+    }
+    return self->converters[i].convert(self->state, data, size);
+}
+
+
+static PyObject *
+decode_planned_row(BaseProt *self, char *pos, char *end,
+                   uint64_t *conversions)
+{
+    // Decodes a complete DataRow message body into a tuple
+    int16_t i, nfields = self->result_nfields;
+    Py_ssize_t remaining;
+    PyObject *row, *val;
+
+    // hoisted: the row must at least hold the count and the value sizes
+    if (end - pos < 2 + 4 * (Py_ssize_t)nfields ||
+            read_int16(&pos) != nfields) {
+        PyErr_SetString(self->state->ProtocolError, "Invalid data row message.");
+        return NULL;
+    }
+    remaining = end - pos - 4 * (Py_ssize_t)nfields;
+
+    row = row_new(&self->rows, nfields);
+    if (row == NULL) {
+        return NULL;
+    }
+    for (i = 0; i < nfields; i++) {
+        int32_t size = get_int32(pos);
+
+        pos += 4;
+        if (size == -1) {
+            Py_INCREF(Py_None);
+            PyTuple_SET_ITEM(row, i, Py_None);
+            continue;
+        }
+        if (size < 0 || size > remaining) {
+            PyErr_SetString(self->state->ProtocolError, "Invalid data row message.");
+            goto error;
+        }
+        remaining -= size;
+        if (self->row_plan == PLAN_TEXT) {
+            val = PyUnicode_FromStringAndSize(pos, size);
+        }
+        else {
+            val = decode_typed_value(self, i, pos, size);
+        }
+        if (val == NULL) {
+            goto error;
+        }
+        conversions[self->converters[i].kind]++;
+        PyTuple_SET_ITEM(row, i, val);
+        pos += size;
+    }
+    if (remaining) {
+        PyErr_SetString(
+            self->state->ProtocolError, "Invalid data row message, data remaining.");
+        goto error;
+    }
+    return row_finish(&self->rows, row);
+
+error:
+    Py_DECREF(row);
+    return NULL;
+}
+
+
+static int
+handle_data_rows(BaseProt *self)
+{
+    // Handles all consecutive complete DataRow messages in the receive buffer
+    // in one loop, following the plan made for the row description. Returns
+    // the number of handled messages. Zero means the generic path must handle
+    // the current message.
+    char *msg = self->curr_msg, *buf_end = msg + self->received_bytes;
+    uint64_t conversions[NUM_CONV_KINDS] = {0};
+    int i, count = 0, ret = 0;
+
+    if (self->error || !self->uses_utf8) {
+        return 0;
+    }
+    if (self->result_data == NULL && self->spill == NULL) {
+        self->result_data = PyList_New(0);
+        if (self->result_data == NULL) {
+            return -1;
+        }
+    }
+    if (self->timeline_enabled && !self->timeline.first_data_row) {
+        self->timeline.first_data_row = monotonic_ns();
+    }
+
+    while (buf_end - msg >= HEADER_SIZE && msg[0] == 'D') {
+        int32_t length = get_int32(msg + 1);
+        char *msg_end = msg + 1 + length;
+        PyObject *row;
+
+        if (length < 4 || length > buf_end - msg - 1) {
+            // incomplete or invalid
+            break;
+        }
+        if (over_budget(self, length - 4)) {
+            ret = spill_data_row(self, msg + HEADER_SIZE, length - 4);
+            msg = msg_end;
+            count++;
+            if (ret == -1) {
+                break;
+            }
+            continue;
+        }
+        row = decode_planned_row(self, msg + HEADER_SIZE, msg_end,
+                                 conversions);
+        msg = msg_end;
+        count++;
+        if (row == NULL) {
+            ret = -1;
+            break;
+        }
+        ret = PyList_Append(self->result_data, row);
+        Py_DECREF(row);
+        if (ret == -1) {
+            break;
+        }
+    }
 
-static void
-outbuf_write(char **buf, void *src, Py_ssize_t n) {
-    memcpy(*buf, src, n);
-    *buf += n;
+    self->stats.messages['D'] += count;
+    self->stats.rows += count - (ret == -1);
+    for (i = 0; i < NUM_CONV_KINDS; i++) {
+        self->stats.conversions[i] += conversions[i];
+    }
+    self->received_bytes -= (int32_t)(msg - self->curr_msg);
+    self->curr_msg = msg;
+    return ret == -1 ? -1 : count;
 }
 
 
-static PyObject *
-BaseProt_startup(BaseProt *self,  PyObject *args) {
-    char *user, *db, *app, *pwd, *startup_message, *pos;
-    Py_ssize_t user_len, db_len=0, app_len, pwd_len, size;
-    int32_t msize;
-    PyObject *ret;
+static int
+record_error(BaseProt *self)
+{
+    // Something went wrong while handling a message. Raising errors makes no
+    // sense, because those do not end up in user space. Store the exception
+    // to set it on the waiter at ReadyForQuery.
+    int is_protocol_error;
+    PyObject *ex_type, *ex_val, *ex_tb, *res;
+
+    is_protocol_error = PyErr_ExceptionMatches(self->state->ProtocolError);
+
+    if (self->error && (
+            PyErr_GivenExceptionMatches(
+                self->error, self->state->ProtocolError) || !is_protocol_error)
+            ) {
+        // Already recorded at least equally important exception
+        PyErr_Clear();
+        return 0;
+    }
 
-    if (!PyArg_ParseTuple(
-            args,"s#z#z#z#", &user, &user_len, &db,
-            &db_len, &app, &app_len, &pwd, &pwd_len)) {
-        return NULL;
+    // First get the exception instance
+    PyErr_Fetch(&ex_type, &ex_val, &ex_tb);
+    PyErr_NormalizeException(&ex_type, &ex_val, &ex_tb);
+    if (ex_tb != NULL) {
+        PyException_SetTraceback(ex_val, ex_tb);
+        Py_DECREF(ex_tb);
     }
-    user_len += 1;
-    self->user = PyMem_Malloc(user_len);
-    if (self->user == NULL) {
-        return PyErr_NoMemory();
+    Py_DECREF(ex_type);
+
+    // record error
+    Py_XSETREF(self->error, ex_val);
+
+    // close connection in case of Protocol error
+    if (is_protocol_error && self->blocking) {
+        // stop receiving, the owner closes the socket
+        self->sock_fd = -1;
     }
-    memcpy(self->user, user, user_len);
-    if (pwd) {
-        pwd_len += 1;
-        self->password = PyMem_Malloc(pwd_len);
-        if (self->password == NULL) {
-            return PyErr_NoMemory();
+    else if (is_protocol_error) {
+        int is_closing;
+
+        res = PyObject_CallMethod(self->transport, "is_closing", NULL);
+        if (res == NULL) {
+            return -1;
+        }
+        is_closing = PyObject_IsTrue(res);
+        Py_DECREF(res);
+        if (!is_closing) {
+            res = PyObject_CallMethod(self->transport, "close", NULL);
+            if (res == NULL) {
+                return -1;
+            }
+            Py_DECREF(res);
         }
-        memcpy(self->password, pwd, pwd_len);
     }
+    return 0;
+}
 
-    // size = 8 (header) + 'user' (5) + 'DateStyle' (10) + 'ISO' (4) +
-    //     'client_encoding' (16) + 'UTF8' (5) + terminating zero (1) = 49
-    size = 49 + user_len;
-    if (db_len) {
-        // 'database' (9) + value
-        db_len += 1;
-        size += 9 + db_len;
-    }
-    if (app_len) {
-        // 'application_name' (17) + value
-        app_len += 1;
-        size += 17 + app_len;
+
+static int
+process_received(BaseProt *self, Py_ssize_t nbytes)
+{
+    // Handles the complete messages after nbytes were received in the buffer
+    int ret;
+
+    self->received_bytes += nbytes;
+    self->stats.bytes_received += nbytes;
+    if (self->timeline_enabled && !self->timeline.first_byte) {
+        self->timeline.first_byte = monotonic_ns();
     }
-    startup_message = PyMem_Malloc(size);
-    if (startup_message == NULL) {
-        return PyErr_NoMemory();
+    while (self->received_bytes >= self->msg_length) {
+        if (self->row_plan && RECEIVING_HEADER(self) &&
+                self->curr_msg[0] == 'D') {
+            ret = handle_data_rows(self);
+            if (ret == -1 && record_error(self) == -1) {
+                return -1;
+            }
+            if (ret != 0) {
+                continue;
+            }
+        }
+        if (_BaseProt_buffer_updated(self) == -1 && record_error(self) == -1) {
+            return -1;
+        }
     }
 
-    pos = startup_message;
+    if (self->in_extra_buf == NULL && self->curr_msg != self->in_buf) {
+        // Positioned after last handled message
+        if (self->received_bytes) {
+            // Partial message, move to beginning
+            memmove(self->in_buf, self->curr_msg, self->received_bytes);
+        }
+        // Position at start
+        self->curr_msg = self->in_buf;
+    }
+    if (self->pgoutput) {
+        // changes are delivered once per received chunk
+        deliver_changes(self);
+        if (self->copy_both && self->feedback_interval &&
+                monotonic_ns() - self->feedback_time >=
+                    self->feedback_interval &&
+                send_standby_status(self, 0) == -1 &&
+                record_error(self) == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
 
-    // size of buffer (including size)
-    msize = (int32_t)htobe32((uint32_t)size);
-    outbuf_write(&pos, &msize, sizeof(msize));
 
-    // write protocol version and user
-    outbuf_write(&pos, "\0\x03\0\0user", 9);
-    outbuf_write(&pos, user, user_len);
+static PyObject *
+sync_wait(BaseProt *self)
+{
+    // Receives and handles messages on the blocking socket until
+    // ReadyForQuery. The GIL is released while waiting for the server.
+    char *buf;
+    Py_ssize_t size, nbytes;
+    PyObject *exc, *result;
+
+    self->sync_done = 0;
+    while (!self->sync_done) {
+        if (self->sock_fd == -1) {
+            // protocol error, fail without waiting for ReadyForQuery
+            if (self->error == NULL) {
+                PyErr_SetString(PyExc_ConnectionError, "Connection closed");
+                return NULL;
+            }
+            complete_waiter(self, NULL, self->error);
+            Py_CLEAR(self->error);
+            break;
+        }
+        buf = receive_window(self, &size);
+        Py_BEGIN_ALLOW_THREADS
+        nbytes = recv(self->sock_fd, buf, size, 0);
+        Py_END_ALLOW_THREADS
+        if (nbytes > 0) {
+            if (process_received(self, nbytes) == -1) {
+                self->sock_fd = -1;
+                return NULL;
+            }
+            continue;
+        }
+        if (nbytes == 0) {
+            PyErr_SetString(PyExc_ConnectionResetError, "Connection closed");
+        }
+        else if (SOCK_INTERRUPTED() && PyErr_CheckSignals() == 0) {
+            continue;
+        }
+        else if (!PyErr_Occurred()) {
+            SET_SOCK_ERROR();
+        }
+        // the response is not complete, the connection is unusable
+        self->sock_fd = -1;
+        return NULL;
+    }
 
-    if (db_len) {
-        // write database name
-        outbuf_write(&pos, "database", 9);
-        outbuf_write(&pos, db, db_len);
+    exc = self->sync_exc;
+    if (exc) {
+        self->sync_exc = NULL;
+        PyErr_SetObject((PyObject *)Py_TYPE(exc), exc);
+        Py_DECREF(exc);
+        Py_CLEAR(self->sync_result);
+        return NULL;
     }
-    if (app_len) {
-        // write application name
-        outbuf_write(&pos, "application_name", 17);
-        outbuf_write(&pos, app, app_len);
+    if (self->sync_result == NULL) {
+        Py_RETURN_NONE;
     }
+    result = self->sync_result;
+    self->sync_result = NULL;
+    return result;
+}
 
-    // write standard parameters
-    memcpy(pos, "DateStyle\0ISO\0client_encoding\0UTF8\0", 36);
 
-    // really send it
-    ret = PyObject_CallMethod(
-        self->transport, "write", "y#", startup_message, size);
-    if (ret == NULL) {
+static PyObject *
+BaseProt_buffer_updated(BaseProt *self, PyObject *arg)
+{
+    // This is called from the transport when data is available.
+    long nbytes;
+
+//    printf("Data received\n");
+
+    nbytes = PyLong_AsLong(arg);
+    if (nbytes == -1 && PyErr_Occurred()) {
         return NULL;
     }
-    Py_DECREF(ret);
 
-//    printf("Startup sent\n");
+    if (nbytes < 0) {
+        PyErr_SetString(
+            self->state->ProtocolError, "invalid value for received bytes");
+        // TODO: abort
+        return NULL;
+    }
 
-    // create a future to report on later
-    self->fut = PyObject_CallMethod(self->loop, "create_future", NULL);
-    return self->fut;
+    if (process_received(self, nbytes) == -1) {
+        return NULL;
+    }
+    Py_RETURN_NONE;
 }
 
 
-PyObject *
-BaseProt_execute(BaseProt *self, PyObject *args) {
-    char *query, *buf, *pos;
-    Py_ssize_t query_len;
-    PyObject *py_params, *ret, *py_buf;
-    Py_ssize_t msg_size, num_params=0, i;
-    int32_t msize;
+static PyObject *
+BaseProt_attach_socket(BaseProt *self, PyObject *args)
+{
+    // Makes the protocol read and write the non blocking socket itself.
+    // The loop must call read_ready when the socket is readable.
+    int fd;
 
-    if (!PyArg_ParseTuple(args, "s#O", &query, &query_len, &py_params)) {
+    if (!PyArg_ParseTuple(args, "i", &fd)) {
         return NULL;
     }
-
-    if (py_params != Py_None) {
-        py_params = PySequence_Fast(
-                py_params, "Parameters must be a sequence or None");
-        if (py_params == NULL) {
+    if (!self->blocking && self->write_ready == NULL) {
+        self->write_ready = PyObject_GetAttrString(
+            (PyObject *)self, "write_ready");
+        if (self->write_ready == NULL) {
             return NULL;
         }
-        num_params = PySequence_Fast_GET_SIZE(py_params);
-        if (num_params == 0) {
-            Py_DECREF(py_params);
-        }
     }
+    self->sock_fd = fd;
+    Py_RETURN_NONE;
+}
 
-    if (num_params == 0) {
-        // simple query
 
-        msg_size = query_len + 6;  // query length + term zero + length + identifier
-        py_buf = PyBytes_FromStringAndSize(NULL, msg_size);
-        if (py_buf == NULL) {
-            return NULL;
-        }
-        buf = PyBytes_AS_STRING(py_buf);
+static PyObject *
+BaseProt_detach_socket(BaseProt *self, PyObject *unused)
+{
+    self->sock_fd = -1;
+    self->out_len = 0;
+    Py_CLEAR(self->write_ready);  // reference cycle
+    Py_RETURN_NONE;
+}
 
-        // write identifier
-        *buf++ = 'Q';
 
-        // write msg length
-        msize = (int32_t)htobe32((uint32_t)(msg_size - 1));
-        outbuf_write(&buf, &msize, sizeof(msize));
+static PyObject *
+BaseProt_read_ready(BaseProt *self, PyObject *unused)
+{
+    char *buf;
+    Py_ssize_t size, nbytes;
 
-        // write query
-        outbuf_write(&buf, query, query_len);
-        *buf = '\0';
+    if (self->sock_fd == -1) {
+        Py_RETURN_NONE;
     }
-    else {
-        Param *params;
-        int32_t value_size = 0;
-        uint32_t uval32;
-        int16_t val16;
-        PyObject **fast_params;
-
-        static char fin[] = (
-                "D\0\0\0\x06P\0"         // describe
-                "E\0\0\0\x09\0\0\0\0\0"  // execute
-                "H\0\0\0\x04"            // flush
-                "S\0\0\0\x04"            // sync
-                );
-
-//        printf("Complex query\n");
-
-        if (num_params > INT16_MAX) {
-            PyErr_SetString(
-                PyExc_ValueError,
-                "Too many parameters provided. Maximum number is 32767");
+    buf = receive_window(self, &size);
+    nbytes = recv(self->sock_fd, buf, size, 0);
+    if (nbytes > 0) {
+        if (process_received(self, nbytes) == -1) {
             return NULL;
         }
-
-        params = PyMem_Calloc(num_params, sizeof(Param));
-        if (params == NULL) {
-            return PyErr_NoMemory();
+    }
+    else if (nbytes == 0) {
+        // end of file
+        PyErr_SetString(PyExc_ConnectionResetError, "Connection closed");
+        if (sock_fatal(self) == -1) {
+            return NULL;
         }
-//        printf("Complex query 2\n");
+    }
+    else if (!SOCK_WOULD_BLOCK()) {
+        SET_SOCK_ERROR();
+        if (sock_fatal(self) == -1) {
+            return NULL;
+        }
+    }
+    Py_RETURN_NONE;
+}
 
-        fast_params = PySequence_Fast_ITEMS(py_params);
-        for (i = 0; i < num_params; i++) {
-            PyObject *py_param =  fast_params[i];
-            Param *param = params + i;
-            if (fill_param(param, py_param) == -1) {
-                return NULL;
+
+static PyObject *
+BaseProt_write_ready(BaseProt *self, PyObject *unused)
+{
+    Py_ssize_t sent;
+
+    if (self->sock_fd == -1) {
+        Py_RETURN_NONE;
+    }
+    if (self->out_len) {
+        sent = send(self->sock_fd, self->out_buf, self->out_len, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (SOCK_WOULD_BLOCK()) {
+                Py_RETURN_NONE;
             }
-            if (param->size > 0) {
-                value_size += param->size;
+            SET_SOCK_ERROR();
+            if (sock_fatal(self) == -1) {
+                return NULL;
             }
+            Py_RETURN_NONE;
         }
+        out_buf_consume(self, sent);
+    }
+    if (self->out_len == 0) {
+        PyObject *res;
 
-//        printf("Complex query 3\n");
-
-        // Parse Message: 9 + querylen + 4 * num_params
-        //     'P'(1) + size(4) + empty name (1) + query string (len) +
-        //     term zero(1) + num_params (2) + param_oids (4 * num_params)
-        //
-        // Bind Message: 15 + 6 * num_params + param_value_length
-        //     'B'(1) + size(4) + empty portal name (1) +
-        //     empty statement name (1) + num_params (2) +
-        //     parameter formats (2 * num_params) + num_params (2) +
-        //     [param_length + param_value]* (4 * num_params + param_value_length)
-        //     num_format_codes (2) + format_code (2)
-
-        msg_size = 51 + 10 * num_params + query_len + value_size;
-        py_buf = PyBytes_FromStringAndSize(NULL, msg_size);
-        if (py_buf == NULL) {
+        res = PyObject_CallMethod(
+            self->loop, "remove_writer", "i", self->sock_fd);
+        if (res == NULL) {
             return NULL;
         }
-        buf = PyBytes_AS_STRING(py_buf);
+        Py_DECREF(res);
+    }
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+BaseProt_sock_write(BaseProt *self, PyObject *arg)
+{
+    // Writes bytes like object on the socket, in order with the queries
+    Py_buffer view;
+    Py_ssize_t size;
+    int ret;
+
+    if (PyObject_GetBuffer(arg, &view, PyBUF_SIMPLE) == -1) {
+        return NULL;
+    }
+    size = view.len;
+    ret = prot_write(self, view.buf, size, NULL);
+    PyBuffer_Release(&view);
+    if (ret == -1) {
+        return NULL;
+    }
+    self->stats.bytes_sent += size;
+    Py_RETURN_NONE;
+}
+
 
-        // 0: Parse identifier
-        buf[0] = 'P';
-        pos = buf + 1;
-        // 1: Parse message size
-        uval32 = htobe32(8 + query_len + 4 * num_params);
-        outbuf_write(&pos, &uval32, sizeof(uval32));
-        // 5: Empty name
-        *pos++ = '\0';
-        // 6: Query
-        outbuf_write(&pos, query, query_len);
-        // 6 + querylen: Query terminator
-        *pos++ = '\0';
-        // 7 + querylen: Number of parameter oids
-        val16 = (int16_t)htobe16(num_params);
-        outbuf_write(&pos, &val16, sizeof(val16));
-        // 9 + querylen: Parameter oids
+static const char *conv_kind_names[NUM_CONV_KINDS] = {
+    "int", "float", "bool", "text"
+};
 
-        char *fmt_pos = buf + 18 + query_len + 4 * num_params;
-        char *val_pos = buf + 20 + query_len + 6 * num_params;
-        for (i = 0; i < num_params; i++) {
-            Param *param = params + i;
 
-            uval32 = htobe32(param->oid);
-            outbuf_write(&pos, &uval32, sizeof(uval32));
+PyObject *
+stats_to_py(PoqaioState *state, ProtStats *stats)
+{
+    PyObject *py_stats, *val;
+    int i;
 
-            // parameter format
-            val16 = (int16_t)htobe16((uint16_t)params->format);
-            outbuf_write(&fmt_pos, &val16, sizeof(val16));
+    py_stats = PyStructSequence_New(state->Stats);
+    if (py_stats == NULL) {
+        return NULL;
+    }
 
-            // parameter value
-            int32_t size = (int32_t)param->size;
+    // bytes received
+    val = PyLong_FromUnsignedLongLong(stats->bytes_received);
+    if (val == NULL) {
+        goto error;
+    }
+    PyStructSequence_SET_ITEM(py_stats, 0, val);
 
-            msize = (int32_t)htobe32((uint32_t)size);
-            outbuf_write(&val_pos, &msize, sizeof(msize));
-            if (size > 0) {
-                param->write(param, val_pos);
-                val_pos += size;
-            }
+    // bytes sent
+    val = PyLong_FromUnsignedLongLong(stats->bytes_sent);
+    if (val == NULL) {
+        goto error;
+    }
+    PyStructSequence_SET_ITEM(py_stats, 1, val);
+
+    // messages by identifier, only the ones that are received
+    val = PyDict_New();
+    if (val == NULL) {
+        goto error;
+    }
+    PyStructSequence_SET_ITEM(py_stats, 2, val);
+    for (i = 0; i < 256; i++) {
+        PyObject *count;
+        char identifier[2] = {(char)i, '\0'};
+
+        if (stats->messages[i] == 0) {
+            continue;
+        }
+        count = PyLong_FromUnsignedLongLong(stats->messages[i]);
+        if (count == NULL) {
+            goto error;
+        }
+        if (PyDict_SetItemString(val, identifier, count) == -1) {
+            Py_DECREF(count);
+            goto error;
         }
+        Py_DECREF(count);
+    }
 
-        // 9 + querylen + 4 * num_params: Bind identifier
-        *pos++ = 'B';
-        // 10 + querylen + 4 * num_params: Bind message size
-        uval32 = htobe32(14 + 6 * num_params + value_size);
-        outbuf_write(&pos, &uval32, sizeof(uval32));
-        // 14 + querylen + 4 * num_params: Empty portal name
-        *pos++ = '\0';
-        // 15 + querylen + 4 * num_params: Empty statement name
-        *pos++ = '\0';
-        // 16 + querylen + 4 * num_params: Number of parameter formats
-        val16 = (int16_t)htobe16((uint16_t)num_params);
-        outbuf_write(&pos, &val16, sizeof(val16));
-        // 18 + querylen + 4 * num_params: Parameter formats
-        pos += 2 * num_params;  // skip alread written formats
-        // 18 + querylen + 6 * num_params: Number of parameter values
-        val16 = (int16_t)htobe16((uint16_t)num_params);
-        outbuf_write(&pos, &val16, sizeof(val16));
-        // 20 + querylen + 6 * num_params: Parameter values
-        pos += 4 * num_params + value_size; // skip already written values
-        // 20 + querylen + 10 * num_params + param_values:
-        //      Number of result format codes
-        outbuf_write(&pos, "\0\x01", 2);
-        // 22 + querylen + 10 * num_params + param_values: Result format codes
-        outbuf_write(&pos, "\0\0", 2);
+    // rows
+    val = PyLong_FromUnsignedLongLong(stats->rows);
+    if (val == NULL) {
+        goto error;
+    }
+    PyStructSequence_SET_ITEM(py_stats, 3, val);
 
-        // 24 + querylen + 10 * num_params + param_values: Final messages
-        outbuf_write(&pos, fin, 27);
-        // 51 + querylen + 10 * num_params + param_values: end
+    // conversions by converter kind
+    val = PyDict_New();
+    if (val == NULL) {
+        goto error;
+    }
+    PyStructSequence_SET_ITEM(py_stats, 4, val);
+    for (i = 0; i < NUM_CONV_KINDS; i++) {
+        PyObject *count;
 
-        for (i = 0; i < num_params; i++) {
-            Param *param = params + i;
-            if (param->free) {
-                param->free(param);
-            }
+        count = PyLong_FromUnsignedLongLong(stats->conversions[i]);
+        if (count == NULL) {
+            goto error;
+        }
+        if (PyDict_SetItemString(val, conv_kind_names[i], count) == -1) {
+            Py_DECREF(count);
+            goto error;
         }
+        Py_DECREF(count);
     }
 
-    // really send it
-    ret = PyObject_CallFunctionObjArgs(self->transport_write, py_buf, NULL);
-    Py_DECREF(py_buf);
-    if (ret == NULL) {
-        return NULL;
+    // jumbo buffers
+    val = PyLong_FromUnsignedLongLong(stats->jumbo_buffers);
+    if (val == NULL) {
+        goto error;
     }
-    Py_DECREF(ret);
+    PyStructSequence_SET_ITEM(py_stats, 5, val);
 
-    // create a future to report on later
-    self->fut = PyObject_CallFunctionObjArgs(self->create_future, NULL);
-    return self->fut;
+    // futures
+    val = PyLong_FromUnsignedLongLong(stats->futures);
+    if (val == NULL) {
+        goto error;
+    }
+    PyStructSequence_SET_ITEM(py_stats, 6, val);
+
+    // spilled results
+    val = PyLong_FromUnsignedLongLong(stats->spilled_results);
+    if (val == NULL) {
+        goto error;
+    }
+    PyStructSequence_SET_ITEM(py_stats, 7, val);
+
+    // spilled bytes
+    val = PyLong_FromUnsignedLongLong(stats->spilled_bytes);
+    if (val == NULL) {
+        goto error;
+    }
+    PyStructSequence_SET_ITEM(py_stats, 8, val);
 
+    return py_stats;
+
+error:
+    Py_DECREF(py_stats);
+    return NULL;
 }
 
 
-static PyObject *
-BaseProt_get_buffer(BaseProt *self, PyObject *arg)
+PyObject *
+BaseProt_global_stats(PyObject *mod, PyObject *unused)
 {
+    // Sums the counters of the protocols of this interpreter
+    PoqaioState *state = get_state(mod);
+    ProtStats stats;
+    BaseProt *prot;
+
+    // Without GIL, counters of protocols that are busy in other threads are
+    // read while they change, so the sum is a snapshot.
+    STATS_LOCK(state);
+    stats = state->retired_stats;
+    for (prot = state->live_prots; prot != NULL; prot = prot->stats_next) {
+        stats_add(&stats, &prot->stats);
+    }
+    STATS_UNLOCK(state);
+    return stats_to_py(state, &stats);
+}
 
-    // A message must always fit entirely in a buffer. Easy for parsing.
-    // There are two buffers, a fixed size one called 'in_buf' and an
-    // dynamic one 'in_extra_buf'for large messages.
 
-    // Return a view on the (remaining) buffer
-    char *buf;
-    int buf_size;
+static PyObject *
+BaseProt_get_stats(BaseProt *self, void *closure)
+{
+    return stats_to_py(self->state, &self->stats);
+}
 
-//    printf("Getting buffer\n");
 
-    if (self->in_extra_buf) {
-        buf = self->in_extra_buf;
-        buf_size = self->msg_length;
+static PyObject *
+BaseProt_set_timeline_sink(BaseProt *self, PyObject *sink)
+{
+    // Sink is either None to disable, a callable that is called with each
+    // timeline or the capacity of a ring buffer to be drained by the user.
+    QueryTimeline *ring = NULL;
+    Py_ssize_t capacity = 0;
+
+    if (PyLong_Check(sink) && !PyBool_Check(sink)) {
+        capacity = PyLong_AsSsize_t(sink);
+        if (capacity == -1 && PyErr_Occurred()) {
+            return NULL;
+        }
+        if (capacity <= 0) {
+            PyErr_SetString(
+                PyExc_ValueError, "Timeline capacity must be positive");
+            return NULL;
+        }
+        ring = PyMem_Calloc(capacity, sizeof(QueryTimeline));
+        if (ring == NULL) {
+            return PyErr_NoMemory();
+        }
     }
-    else {
-        buf = self->in_buf;
-        buf_size = BUF_SIZE;
+    else if (sink != Py_None && !PyCallable_Check(sink)) {
+        PyErr_SetString(
+            PyExc_TypeError,
+            "Timeline sink must be None, a callable or a capacity");
+        return NULL;
     }
 
-    return PyMemoryView_FromMemory(
-        buf + self->received_bytes,
-        buf_size - self->received_bytes,
-        PyBUF_WRITE);
+    Py_CLEAR(self->timeline_callback);
+    PyMem_Free(self->timeline_ring);
+    self->timeline_ring = ring;
+    self->timeline_capacity = capacity;
+    self->timeline_start = 0;
+    self->timeline_count = 0;
+    self->timelines_dropped = 0;
+    memset(&self->timeline, 0, sizeof(QueryTimeline));
+
+    if (ring == NULL && sink != Py_None) {
+        Py_INCREF(sink);
+        self->timeline_callback = sink;
+    }
+    self->timeline_enabled = (sink != Py_None);
+    Py_RETURN_NONE;
 }
 
 
-static int
-_BaseProt_buffer_updated(BaseProt *self)
+static PyObject *
+BaseProt_set_notification_handler(BaseProt *self, PyObject *handler)
 {
-    int32_t length;
-    int ret;
+    // Handler is called with process id, channel and payload of each
+    // notification, or None to ignore notifications
+    if (handler != Py_None && !PyCallable_Check(handler)) {
+        PyErr_SetString(
+            PyExc_TypeError, "Notification handler must be None or a callable");
+        return NULL;
+    }
+    Py_CLEAR(self->notification_handler);
+    if (handler != Py_None) {
+        Py_INCREF(handler);
+        self->notification_handler = handler;
+    }
+    Py_RETURN_NONE;
+}
 
-    if (RECEIVING_HEADER(self)) {
-//        printf("Identifier: %c\n", self->curr_msg[0]);
-        length = get_int32(self->curr_msg + 1);
-        // TODO: check for negative msg_length;
-//        if (length < 4) {
-//                raise
-//        }
 
-        self->msg_length = length + 1;  // body including length plus identifier
-        if (self->msg_length > BUF_SIZE) {
-            // big buffer is needed
-            char *buf;
+static PyObject *
+BaseProt_set_row_factory(BaseProt *self, PyObject *factory)
+{
+    // Default row factory of the queries, None for tuples
+    if (row_factory_kind(factory) == -1) {
+        return NULL;
+    }
+    Py_CLEAR(self->row_factory);
+    if (factory != Py_None) {
+        Py_INCREF(factory);
+        self->row_factory = factory;
+    }
+    Py_RETURN_NONE;
+}
 
-            buf = PyMem_Malloc(self->msg_length + 1);
-            if (buf == NULL) {
-                PyErr_NoMemory();
-                return -1;
-            }
-            self->in_extra_buf = buf;
 
-            // copy already received data (header) into big buffer
-            memcpy(buf, self->curr_msg, self->received_bytes);
-            self->curr_msg = buf;
-            return 0;
-        }
+static PyObject *
+BaseProt_set_memory_budget(BaseProt *self, PyObject *arg)
+{
+    // Default memory budget of the queries in bytes of received rows, None
+    // for no budget
+    Py_ssize_t budget = -1;
 
-        if (self->msg_length > self->received_bytes) {
-            // incomplete message, we want more
-            return 0;
+    if (arg != Py_None) {
+        budget = PyLong_AsSsize_t(arg);
+        if (budget == -1 && PyErr_Occurred()) {
+            return NULL;
+        }
+        if (budget < 0) {
+            PyErr_SetString(
+                PyExc_ValueError, "Memory budget must not be negative");
+            return NULL;
         }
     }
-    ret = handle_message(self);
+    self->memory_budget = budget;
+    Py_RETURN_NONE;
+}
 
-    // Done with message. Clean up
-    if (self->in_extra_buf) {
-        // clear large buffer
-        PyMem_Free(self->in_extra_buf);
-        self->in_extra_buf = NULL;
-        self->received_bytes = 0;
-        self->curr_msg = self->in_buf;
+
+static PyObject *
+BaseProt_set_notice_handler(BaseProt *self, PyObject *handler)
+{
+    // Handler is called with a Notice for each NoticeResponse, or None to
+    // ignore notices
+    if (handler != Py_None && !PyCallable_Check(handler)) {
+        PyErr_SetString(
+            PyExc_TypeError, "Notice handler must be None or a callable");
+        return NULL;
     }
-    else {
-        self->received_bytes -= self->msg_length;
-        self->curr_msg += self->msg_length;
+    Py_CLEAR(self->notice_handler);
+    if (handler != Py_None) {
+        Py_INCREF(handler);
+        self->notice_handler = handler;
     }
-    self->msg_length = HEADER_SIZE;
-    return ret;
+    Py_RETURN_NONE;
 }
 
 
 static PyObject *
-BaseProt_buffer_updated(BaseProt *self, PyObject *arg)
+BaseProt_set_decode_pool(BaseProt *self, PyObject *args)
 {
-    // This is called from the transport when data is available. Raising
-    // errors makes no sense, because those do not end up in user space.
-    // Make sure to gather exceptions and store those for later to set them
-    // on the future.
-    long nbytes;
+    // Submit is the submit method of an executor, or None to decode rows in
+    // the loop thread.
+    PyObject *submit;
+    Py_ssize_t chunk_size = 1 << 20;
 
-//    printf("Data received\n");
-
-    nbytes = PyLong_AsLong(arg);
-    if (nbytes == -1 && PyErr_Occurred()) {
+    if (!PyArg_ParseTuple(args, "O|n", &submit, &chunk_size)) {
         return NULL;
     }
-
-    if (nbytes < 0) {
-        PyErr_SetString(
-            PoqaioProtocolError, "invalid value for received bytes");
-        // TODO: abort
+    if (submit != Py_None && !PyCallable_Check(submit)) {
+        PyErr_SetString(PyExc_TypeError, "Submit must be None or a callable");
         return NULL;
     }
+    if (chunk_size <= 0) {
+        PyErr_SetString(PyExc_ValueError, "Chunk size must be positive");
+        return NULL;
+    }
+    if (submit == Py_None) {
+        submit = NULL;
+    }
+    Py_XINCREF(submit);
+    Py_XSETREF(self->decode_submit, submit);
+    self->decode_chunk_size = chunk_size;
+    Py_RETURN_NONE;
+}
 
-    self->received_bytes += nbytes;
-    while (self->received_bytes >= self->msg_length) {
-        if (_BaseProt_buffer_updated(self) == -1) {
-            // Something went wrong
-            int is_protocol_error;
-
-            is_protocol_error = PyErr_ExceptionMatches(PoqaioProtocolError);
-
-            if (self->error && (
-                    PyErr_GivenExceptionMatches(
-                        self->error, PoqaioProtocolError) || !is_protocol_error)
-                    ) {
-                // Already recorded at least equally important exception
-                PyErr_Clear();
-            }
-            else {
-                // First get the exception instance
-                PyObject *ex_type, *ex_val, *ex_tb;
-                PyErr_Fetch(&ex_type, &ex_val, &ex_tb);
-                PyErr_NormalizeException(&ex_type, &ex_val, &ex_tb);
-                if (ex_tb != NULL) {
-                    PyException_SetTraceback(ex_val, ex_tb);
-                    Py_DECREF(ex_tb);
-                }
-                Py_DECREF(ex_type);
-
-                // record error
-                self->error = ex_val;
-
-                // close connection in case of Protocol error
-                if (is_protocol_error) {
-                    PyObject *is_closing;
-                    int _is_closing;
-                    is_closing = PyObject_CallMethod(
-                        self->transport, "is_closing", NULL);
-                    if (is_closing == NULL) {
-                        return NULL;
-                    }
-                    _is_closing = PyObject_IsTrue(is_closing);
-                    Py_DECREF(is_closing);
-                    if (!_is_closing) {
-                        if (PyObject_CallMethod(
-                                self->transport, "close", NULL) == NULL) {
-                            return NULL;
-                        }
-                    }
-                }
-            }
-        }
+
+static PyObject *
+BaseProt_drain_timelines(BaseProt *self, PyObject *unused)
+{
+    PyObject *timelines;
+    Py_ssize_t i;
+
+    timelines = PyList_New(self->timeline_count);
+    if (timelines == NULL) {
+        return NULL;
     }
+    for (i = 0; i < self->timeline_count; i++) {
+        PyObject *py_timeline;
 
-    if (self->in_extra_buf == NULL && self->curr_msg != self->in_buf) {
-        // Positioned after last handled message
-        if (self->received_bytes) {
-            // Partial message, move to beginning
-            memmove(self->in_buf, self->curr_msg, self->received_bytes);
+        py_timeline = timeline_to_py(self->state, self->timeline_ring +
+            (self->timeline_start + i) % self->timeline_capacity);
+        if (py_timeline == NULL) {
+            Py_DECREF(timelines);
+            return NULL;
         }
-        // Position at start
-        self->curr_msg = self->in_buf;
+        PyList_SET_ITEM(timelines, i, py_timeline);
     }
-    Py_RETURN_NONE;
+    self->timeline_start = 0;
+    self->timeline_count = 0;
+    return timelines;
 }
 
 
+// The methods run in a critical section on the protocol. On free threaded
+// builds this keeps two threads from changing the state of a protocol at the
+// same time, otherwise the GIL does. Protocols do not share mutable state, so
+// protocols in different threads handle messages in parallel.
+#define LOCKED_METHOD(func) \
+static PyObject * \
+func##_locked(BaseProt *self, PyObject *arg) \
+{ \
+    PyObject *ret; \
+    Py_BEGIN_CRITICAL_SECTION(self); \
+    ret = func(self, arg); \
+    Py_END_CRITICAL_SECTION(); \
+    return ret; \
+}
+
+LOCKED_METHOD(BaseProt_get_buffer)
+LOCKED_METHOD(BaseProt_buffer_updated)
+LOCKED_METHOD(BaseProt_connection_made)
+LOCKED_METHOD(BaseProt_startup)
+LOCKED_METHOD(BaseProt_execute)
+LOCKED_METHOD(BaseProt_fail_waiter)
+LOCKED_METHOD(BaseProt_attach_socket)
+LOCKED_METHOD(BaseProt_detach_socket)
+LOCKED_METHOD(BaseProt_read_ready)
+LOCKED_METHOD(BaseProt_write_ready)
+LOCKED_METHOD(BaseProt_sock_write)
+LOCKED_METHOD(BaseProt_set_timeline_sink)
+LOCKED_METHOD(BaseProt_drain_timelines)
+LOCKED_METHOD(BaseProt_set_decode_pool)
+LOCKED_METHOD(BaseProt_set_notice_handler)
+LOCKED_METHOD(BaseProt_set_row_factory)
+LOCKED_METHOD(BaseProt_set_memory_budget)
+LOCKED_METHOD(BaseProt_set_notification_handler)
+LOCKED_METHOD(BaseProt_prepare)
+LOCKED_METHOD(BaseProt_start_replication)
+LOCKED_METHOD(BaseProt_acknowledge)
+LOCKED_METHOD(BaseProt_send_feedback)
+LOCKED_METHOD(BaseProt_stop_replication)
+
+
+static PyGetSetDef BaseProt_getset[] = {
+    {"stats", (getter)BaseProt_get_stats, NULL, "hot path counters", NULL},
+    {NULL}
+};
+
+
 static PyMemberDef BaseProt_members[] = {
     {"error", T_OBJECT, offsetof(BaseProt, error), 0, ""}, // remove
     {"fut", T_OBJECT, offsetof(BaseProt, fut), 0, ""}, // remove
@@ -1251,65 +4214,93 @@ static PyMemberDef BaseProt_members[] = {
     {"password", T_STRING, offsetof(BaseProt, password), READONLY, "password"},
     {"user", T_STRING, offsetof(BaseProt, user), READONLY, "user"},
     {"transport", T_OBJECT, offsetof(BaseProt, transport), 0, ""},
+    {"result_bytes", T_PYSSIZET, offsetof(BaseProt, result_bytes), READONLY,
+     "bytes of data rows received for the current or last query"
+    },
+    {"write_buffer_size", T_PYSSIZET, offsetof(BaseProt, out_len), READONLY,
+     "bytes waiting to be sent on the socket"
+    },
+    {"timelines_dropped", T_ULONGLONG,
+     offsetof(BaseProt, timelines_dropped), READONLY,
+     "number of timelines overwritten in full ring buffer"
+    },
+    {"__weaklistoffset__", T_PYSSIZET, offsetof(BaseProt, wr_list), READONLY},
     {NULL}
 };
 
 
 static PyMethodDef BaseProt_methods[] = {
-    {"get_buffer", (PyCFunction) BaseProt_get_buffer, METH_O,
+    {"get_buffer", (PyCFunction) BaseProt_get_buffer_locked, METH_O,
      "Return the name, combining the first and last name"
     },
-    {"buffer_updated", (PyCFunction) BaseProt_buffer_updated, METH_O,
+    {"buffer_updated", (PyCFunction) BaseProt_buffer_updated_locked, METH_O,
      "buffer updated"
     },
-    {"connection_made", (PyCFunction) BaseProt_connection_made, METH_O,
+    {"connection_made", (PyCFunction) BaseProt_connection_made_locked, METH_O,
      "connection made"
     },
-    {"startup", (PyCFunction) BaseProt_startup, METH_VARARGS,
+    {"startup", (PyCFunction) BaseProt_startup_locked, METH_VARARGS,
      "startup"},
-    {"execute", (PyCFunction) BaseProt_execute, METH_VARARGS,
-     "execute"},
+    {"execute", (PyCFunction) BaseProt_execute_locked, METH_VARARGS,
+     "execute query, returns a future or calls callback(result, exc)"},
+    {"prepare", (PyCFunction) BaseProt_prepare_locked, METH_VARARGS,
+     "prepare named statement, returns a future or calls callback(result, "
+     "exc) for the Statement"},
+    {"fail_waiter", (PyCFunction) BaseProt_fail_waiter_locked, METH_O,
+     "set exception on pending future or callback"},
+    {"attach_socket", (PyCFunction) BaseProt_attach_socket_locked, METH_VARARGS,
+     "read and write the non blocking socket with the given fd directly"},
+    {"detach_socket", (PyCFunction) BaseProt_detach_socket_locked, METH_NOARGS,
+     "stop using the socket"},
+    {"read_ready", (PyCFunction) BaseProt_read_ready_locked, METH_NOARGS,
+     "receive from socket, called by loop when readable"},
+    {"write_ready", (PyCFunction) BaseProt_write_ready_locked, METH_NOARGS,
+     "send pending data, called by loop when writable"},
+    {"sock_write", (PyCFunction) BaseProt_sock_write_locked, METH_O,
+     "write data on the socket"},
+    {"set_timeline_sink", (PyCFunction) BaseProt_set_timeline_sink_locked, METH_O,
+     "set callable or ring buffer capacity for query timelines"},
+    {"drain_timelines", (PyCFunction) BaseProt_drain_timelines_locked, METH_NOARGS,
+     "remove and return timelines from ring buffer"},
+    {"set_decode_pool", (PyCFunction) BaseProt_set_decode_pool_locked, METH_VARARGS,
+     "decode data rows in chunks using the submit method of an executor"},
+    {"set_notice_handler", (PyCFunction) BaseProt_set_notice_handler_locked, METH_O,
+     "set callable for notices of the server"},
+    {"set_notification_handler",
+     (PyCFunction) BaseProt_set_notification_handler_locked, METH_O,
+     "set callable for notifications of LISTEN channels"},
+    {"set_row_factory", (PyCFunction) BaseProt_set_row_factory_locked, METH_O,
+     "set default row factory, a ROW_* constant or callable"},
+    {"set_memory_budget", (PyCFunction) BaseProt_set_memory_budget_locked,
+     METH_O, "set default memory budget of results, or None"},
+    {"start_replication",
+     (PyCFunction) BaseProt_start_replication_locked, METH_VARARGS,
+     "start logical replication, handler is called with batches of changes"},
+    {"acknowledge", (PyCFunction) BaseProt_acknowledge_locked, METH_O,
+     "acknowledge the changes up to the lsn"},
+    {"send_feedback", (PyCFunction) BaseProt_send_feedback_locked,
+     METH_NOARGS, "send standby status update"},
+    {"stop_replication", (PyCFunction) BaseProt_stop_replication_locked,
+     METH_NOARGS, "end the replication stream"},
     {NULL}
 };
 
 
-PyTypeObject BaseProtType = {
-    PyVarObject_HEAD_INIT(NULL, 0)
-    "BaseProt",                                 /* tp_name */
-    sizeof(BaseProt),                           /* tp_basicsize */
-    0,                                          /* tp_itemsize */
-    (destructor)BaseProt_dealloc,               /* tp_dealloc */
-    0,                                          /* tp_print */
-    0,                                          /* tp_getattr */
-    0,                                          /* tp_setattr */
-    0,                                          /* tp_reserved */
-    0,                                          /* tp_repr */
-    0,                                          /* tp_as_number */
-    0,                                          /* tp_as_sequence */
-    0,                                          /* tp_as_mapping */
-    0,                                          /* tp_hash  */
-    0,                                          /* tp_call */
-    0,                                          /* tp_str */
-    0,                                          /* tp_getattro */
-    0,                                          /* tp_setattro */
-    0,                                          /* tp_as_buffer */
-    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,   /* tp_flags */
-    PyDoc_STR("poqaio BaseProt object"),        /* tp_doc */
-    0,                                          /* tp_traverse */
-    0,                                          /* tp_clear */
-    0,                                          /* tp_richcompare */
-    offsetof(BaseProt, wr_list),                /* tp_weaklistoffset */
-    0,                                          /* tp_iter */
-    0,                                          /* tp_iternext */
-    BaseProt_methods,                           /* tp_methods */
-    BaseProt_members,                           /* tp_members */
-    0,                                          /* tp_getset */
-    0,                                          /* tp_base */
-    0,                                          /* tp_dict */
-    0,                                          /* tp_descr_get */
-    0,                                          /* tp_descr_set */
-    0,                                          /* tp_dictoffset */
-    0,                                          /* tp_init */
-    0,                                          /* tp_alloc */
-    BaseProt_new                                /* tp_new */
+static PyType_Slot BaseProt_slots[] = {
+    {Py_tp_dealloc, BaseProt_dealloc},
+    {Py_tp_doc, PyDoc_STR("poqaio BaseProt object")},
+    {Py_tp_methods, BaseProt_methods},
+    {Py_tp_members, BaseProt_members},
+    {Py_tp_getset, BaseProt_getset},
+    {Py_tp_new, BaseProt_new},
+    {0, NULL}
+};
+
+
+PyType_Spec BaseProtSpec = {
+    "poqaio.BaseProt",
+    sizeof(BaseProt),
+    0,
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,
+    BaseProt_slots
 };
@@ -1,14 +1,74 @@
 #ifndef POQAIO_PROTOCOL_H
 #define POQAIO_PROTOCOL_H
 
+#include "rows.h"
+
 typedef struct _BaseProt BaseProt;
 
-typedef PyObject *(*converter)(BaseProt *, char *, int32_t);
+typedef PyObject *(*converter)(PoqaioState *, char *, int32_t);
+
+// class of result converter, used for counting conversions
+typedef enum {
+    CONV_INT,
+    CONV_FLOAT,
+    CONV_BOOL,
+    CONV_TEXT,
+    NUM_CONV_KINDS
+} conv_kind;
+
+typedef struct {
+    converter convert;
+    conv_kind kind;
+} field_converter;
 
 converter get_converter(uint32_t);
+conv_kind get_conv_kind(uint32_t);
+
+// Hot path counters. Only contains uint64_t members, so it can be summed as
+// an array.
+typedef struct {
+    uint64_t bytes_received;
+    uint64_t bytes_sent;
+    uint64_t messages[256];  // indexed by message identifier
+    uint64_t rows;
+    uint64_t conversions[NUM_CONV_KINDS];
+    uint64_t jumbo_buffers;
+    uint64_t futures;
+    uint64_t spilled_results;
+    uint64_t spilled_bytes;
+} ProtStats;
+
+// Monotonic timestamps in nanoseconds of the stages of a single query. Only
+// contains int64_t members, in the order of the Timeline struct sequence.
+typedef struct {
+    int64_t encode_start;
+    int64_t encode_end;
+    int64_t write_done;
+    int64_t first_byte;
+    int64_t row_description;
+    int64_t first_data_row;
+    int64_t command_complete;
+    int64_t ready;
+} QueryTimeline;
+
+#define TIMELINE_MARK(prot, stage) do { \
+    if ((prot)->timeline_enabled) (prot)->timeline.stage = monotonic_ns(); \
+} while (0)
+
+// decode plans for consecutive data rows of a tuples result
+#define PLAN_NONE 0              // handle each message separately
+#define PLAN_TEXT 1              // only text columns
+#define PLAN_TYPED 2             // at least one int, float or bool column
+
+// result formats
+#define RESULT_TUPLES 0
+#define RESULT_ARROW 1
+#define RESULT_COLUMNS 2
+#define RESULT_RAW 3
 
 typedef struct _BaseProt {
     PyObject_HEAD
+    PoqaioState *state;
     char *in_buf;            // default receive buffer
     char *in_extra_buf;      // XL jumbo buffer, dynamically allocated
     char *curr_msg;          // pointer in buffer to current message
@@ -16,6 +76,10 @@ typedef struct _BaseProt {
 
     char *password;
     char *user;
+    struct _ScramState *scram;     // during SCRAM authentication
+    char *warmup;                  // Query messages to send when
+    Py_ssize_t warmup_len;         // authenticated
+    int ready_skips;               // ReadyForQuery messages before result
 
     int32_t msg_length;      // length of current message
     int32_t received_bytes;  // number of received bytes in current buffer
@@ -26,23 +90,99 @@ typedef struct _BaseProt {
 
     PyObject *loop;
     PyObject *create_future;
+    PyObject *future_kwargs;       // loop kwarg when instantiating directly
     PyObject *transport;
     PyObject *fut;
+    PyObject *callback;            // alternative to future
+    PyObject *fut_type;            // borrowed, type of cached methods
+    PyObject *fut_done;            // unbound methods of future type
+    PyObject *fut_set_result;
+    PyObject *fut_set_exception;
 
     int16_t result_nfields;
     PyObject *results;
     PyObject *result_fields;
     PyObject *result_data;
-    converter *converters;
+    field_converter *converters;
+    int row_plan;
+    PyObject *row_factory;         // default of the connection, or NULL
+    RowFactory rows;               // makes the rows of the current query
+
+    // memory budget of tuple results, in bytes of received rows, -1 for none
+    Py_ssize_t memory_budget;      // default of the connection
+    Py_ssize_t query_budget;       // of the current query
+    Py_ssize_t result_bytes;       // received rows of the current query
+    struct _RawRows *spill;        // rows kept undecoded, or NULL
+
+    // prepared statements
+    PyObject *prepare_name;        // statement being described, or NULL
+    PyObject *prepare_query;
+    PyObject *parameter_types;     // of the statement being described
+    PyObject *statement;           // Statement being executed, or NULL
+    int statement_skips;           // results of statements before it
 
     PyObject *transport_write;
     PyObject *error;
     PyObject *status_parameters;
     PyObject *wr_list;
+    PyObject *notice_handler;      // callable or NULL
+    PyObject *notification_handler;  // callable or NULL
     int32_t backend_process_id;
     int32_t backend_secret_key;
+
+    // direct socket mode
+    int sock_fd;                   // -1 when using the transport
+    char *out_buf;                 // data that could not be sent yet
+    Py_ssize_t out_len;
+    Py_ssize_t out_size;
+    PyObject *write_ready;         // bound method, for add_writer
+
+    // result format of current query
+    int result_format;
+    PyObject *batch;               // RecordBatch, for RESULT_ARROW
+    PyObject *sink;                // ColumnSink, for RESULT_COLUMNS
+
+    // parallel decoding of data rows in worker threads
+    PyObject *decode_submit;       // submit method of executor, or NULL
+    Py_ssize_t decode_chunk_size;  // bytes of data rows per job
+    PyObject *decode_job;          // DecodeJob being filled
+    PyObject *decode_jobs;         // list of submitted jobs of the result
+
+    // logical replication, streaming after START_REPLICATION
+    struct _PgOutput *pgoutput;    // decoder, NULL when not replicating
+    PyObject *repl_handler;        // called with each batch of changes
+    int copy_both;                 // CopyBothResponse received
+    int copy_done_sent;
+    uint64_t received_lsn;         // end of the received WAL
+    uint64_t delivered_lsn;        // of the last change passed to handler
+    uint64_t flushed_lsn;          // acknowledged by the handler
+    int64_t feedback_interval;     // nanoseconds, 0 for no periodic status
+    int64_t feedback_time;         // of the last standby status update
+
+    // blocking mode, no loop, I/O happens in execute itself
+    int blocking;
+    int sync_done;                 // ReadyForQuery received
+    PyObject *sync_result;
+    PyObject *sync_exc;
+
+    ProtStats stats;
+    BaseProt *stats_prev;    // list of live protocols, for global stats
+    BaseProt *stats_next;
+
+    int timeline_enabled;
+    QueryTimeline timeline;            // timeline of current query
+    PyObject *timeline_callback;
+    QueryTimeline *timeline_ring;      // bounded buffer of timelines
+    Py_ssize_t timeline_capacity;
+    Py_ssize_t timeline_start;         // position of oldest timeline in ring
+    Py_ssize_t timeline_count;
+    uint64_t timelines_dropped;
 } BaseProt;
 
-extern PyTypeObject BaseProtType;
+extern PyType_Spec BaseProtSpec;
+
+int BaseProt_init_state(PoqaioState *);
+PyObject *stats_to_py(PoqaioState *, ProtStats *);
+PyObject *BaseProt_global_stats(PyObject *, PyObject *);
 
 #endif
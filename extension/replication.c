@@ -0,0 +1,595 @@
+#include "poqaio.h"
+#include "state.h"
+#include <time.h>
+#include "replication.h"
+
+
+// microseconds between the Unix epoch and the PostgreSQL epoch 2000-01-01
+#define PG_EPOCH_USECS INT64_C(946684800000000)
+
+
+int64_t
+pg_clock_now(void)
+{
+    // Wall clock time in microseconds since the PostgreSQL epoch, as sent in
+    // standby status updates
+    struct timespec ts;
+
+    timespec_get(&ts, TIME_UTC);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000 - PG_EPOCH_USECS;
+}
+
+
+static uint16_t
+read_uint16(char **from) {
+    uint16_t val;
+    memcpy(&val, *from, sizeof(val));
+    *from += sizeof(val);
+    return be16toh(val);
+}
+
+
+static uint32_t
+read_uint32(char **from) {
+    uint32_t val;
+    memcpy(&val, *from, sizeof(val));
+    *from += sizeof(val);
+    return be32toh(val);
+}
+
+
+static uint64_t
+read_uint64(char **from) {
+    uint64_t val;
+    memcpy(&val, *from, sizeof(val));
+    *from += sizeof(val);
+    return be64toh(val);
+}
+
+
+static PyObject *
+read_name(char **from, char *end)
+{
+    // Returns the zero terminated string at from as str, or NULL without
+    // exception when it is not terminated
+    char *str_end = memchr(*from, '\0', end - *from);
+    PyObject *name;
+
+    if (str_end == NULL) {
+        return NULL;
+    }
+    name = PyUnicode_DecodeUTF8(*from, str_end - *from, NULL);
+    *from = str_end + 1;
+    return name;
+}
+
+
+static void
+Relation_dealloc(Relation *self)
+{
+    PyTypeObject *tp = Py_TYPE(self);
+
+    Py_XDECREF(self->namespace);
+    Py_XDECREF(self->name);
+    Py_XDECREF(self->columns);
+    Py_XDECREF(self->type_oids);
+    Py_XDECREF(self->key_columns);
+    PyMem_Free(self->converters);
+    tp->tp_free((PyObject *)self);
+    Py_DECREF(tp);
+}
+
+
+static PyObject *
+Relation_get_replica_identity(Relation *self, void *closure)
+{
+    return PyUnicode_FromOrdinal((unsigned char)self->replica_identity);
+}
+
+
+static PyObject *
+Relation_repr(Relation *self)
+{
+    return PyUnicode_FromFormat(
+        "<Relation %U.%U (%u)>", self->namespace, self->name, self->oid);
+}
+
+
+static PyMemberDef Relation_members[] = {
+    {"oid", T_UINT, offsetof(Relation, oid), READONLY, "oid of the table"},
+    {"namespace", T_OBJECT, offsetof(Relation, namespace), READONLY,
+     "schema of the table"},
+    {"name", T_OBJECT, offsetof(Relation, name), READONLY, "table name"},
+    {"columns", T_OBJECT, offsetof(Relation, columns), READONLY,
+     "column names"},
+    {"type_oids", T_OBJECT, offsetof(Relation, type_oids), READONLY,
+     "type oid per column"},
+    {"key_columns", T_OBJECT, offsetof(Relation, key_columns), READONLY,
+     "names of the columns of the replica identity"},
+    {NULL}
+};
+
+
+static PyGetSetDef Relation_getset[] = {
+    {"replica_identity", (getter)Relation_get_replica_identity, NULL,
+     "'d' default, 'n' nothing, 'f' all columns or 'i' index", NULL},
+    {NULL}
+};
+
+
+static PyType_Slot Relation_slots[] = {
+    {Py_tp_dealloc, Relation_dealloc},
+    {Py_tp_repr, Relation_repr},
+    {Py_tp_doc, PyDoc_STR("Table of a logical replication stream")},
+    {Py_tp_members, Relation_members},
+    {Py_tp_getset, Relation_getset},
+    {0, NULL}
+};
+
+
+PyType_Spec RelationSpec = {
+    "poqaio.Relation",
+    sizeof(Relation),
+    0,
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_DISALLOW_INSTANTIATION,
+    Relation_slots
+};
+
+
+PgOutput *
+pgoutput_new(void)
+{
+    PgOutput *out;
+
+    out = PyMem_Calloc(1, sizeof(PgOutput));
+    if (out == NULL) {
+        PyErr_NoMemory();
+        return NULL;
+    }
+    out->relations = PyDict_New();
+    out->changes = PyList_New(0);
+    out->xid = PyLong_FromLong(0);
+    out->commit_time = PyLong_FromLong(0);
+    if (out->relations == NULL || out->changes == NULL ||
+            out->xid == NULL || out->commit_time == NULL) {
+        pgoutput_free(out);
+        return NULL;
+    }
+    return out;
+}
+
+
+void
+pgoutput_free(PgOutput *out)
+{
+    Py_XDECREF(out->relations);
+    Py_XDECREF(out->changes);
+    Py_XDECREF(out->xid);
+    Py_XDECREF(out->commit_time);
+    PyMem_Free(out);
+}
+
+
+static int
+decode_relation(PoqaioState *state, PgOutput *out, char *pos, char *end)
+{
+    // Replaces the description of the table. It precedes the first change
+    // of the table in the stream, and follows a change of its schema.
+    Relation *rel;
+    PyObject *key_columns = NULL, *oid;
+    Py_ssize_t nkeys = 0;
+    int i, ret;
+
+    if (end - pos < 4) {
+        goto invalid;
+    }
+    rel = (Relation *)state->RelationType->tp_alloc(state->RelationType, 0);
+    if (rel == NULL) {
+        return -1;
+    }
+    rel->oid = read_uint32(&pos);
+    rel->namespace = read_name(&pos, end);
+    if (rel->namespace == NULL) {
+        goto error;
+    }
+    rel->name = read_name(&pos, end);
+    if (rel->name == NULL) {
+        goto error;
+    }
+    if (end - pos < 3) {
+        goto error;
+    }
+    rel->replica_identity = *pos++;
+    rel->ncolumns = read_uint16(&pos);
+    rel->columns = PyTuple_New(rel->ncolumns);
+    rel->type_oids = PyTuple_New(rel->ncolumns);
+    key_columns = PyTuple_New(rel->ncolumns);
+    rel->converters = PyMem_Calloc(rel->ncolumns + 1, sizeof(field_converter));
+    if (rel->columns == NULL || rel->type_oids == NULL ||
+            key_columns == NULL) {
+        goto error;
+    }
+    if (rel->converters == NULL) {
+        PyErr_NoMemory();
+        goto error;
+    }
+    for (i = 0; i < rel->ncolumns; i++) {
+        PyObject *name;
+        uint32_t type_oid;
+        char flags;
+
+        if (end - pos < 1) {
+            goto error;
+        }
+        flags = *pos++;
+        name = read_name(&pos, end);
+        if (name == NULL) {
+            goto error;
+        }
+        PyTuple_SET_ITEM(rel->columns, i, name);
+        if (end - pos < 8) {
+            goto error;
+        }
+        type_oid = read_uint32(&pos);
+        pos += 4;  // type modifier
+        oid = PyLong_FromUnsignedLong(type_oid);
+        if (oid == NULL) {
+            goto error;
+        }
+        PyTuple_SET_ITEM(rel->type_oids, i, oid);
+        rel->converters[i].convert = get_converter(type_oid);
+        rel->converters[i].kind = get_conv_kind(type_oid);
+        if (flags & 1) {
+            Py_INCREF(name);
+            PyTuple_SET_ITEM(key_columns, nkeys++, name);
+        }
+    }
+    if (pos != end) {
+        goto error;
+    }
+    if (_PyTuple_Resize(&key_columns, nkeys) == -1) {
+        goto error;
+    }
+    rel->key_columns = key_columns;
+    key_columns = NULL;
+
+    oid = PyLong_FromUnsignedLong(rel->oid);
+    if (oid == NULL) {
+        Py_DECREF(rel);
+        return -1;
+    }
+    ret = PyDict_SetItem(out->relations, oid, (PyObject *)rel);
+    Py_DECREF(oid);
+    Py_DECREF(rel);
+    return ret;
+
+error:
+    Py_XDECREF(key_columns);
+    Py_DECREF(rel);
+    if (PyErr_Occurred()) {
+        return -1;
+    }
+invalid:
+    PyErr_SetString(state->ProtocolError, "Invalid relation message.");
+    return -1;
+}
+
+
+static Relation *
+get_relation(PoqaioState *state, PgOutput *out, char **pos, char *end)
+{
+    // Returns the borrowed Relation with the oid at pos
+    PyObject *oid, *rel;
+
+    if (end - *pos < 4) {
+        PyErr_SetString(state->ProtocolError, "Invalid change message.");
+        return NULL;
+    }
+    oid = PyLong_FromUnsignedLong(read_uint32(pos));
+    if (oid == NULL) {
+        return NULL;
+    }
+    rel = PyDict_GetItemWithError(out->relations, oid);
+    if (rel == NULL && !PyErr_Occurred()) {
+        PyErr_Format(
+            state->ProtocolError, "Change of unknown relation %S.", oid);
+    }
+    Py_DECREF(oid);
+    return (Relation *)rel;
+}
+
+
+static PyObject *
+decode_tuple(PoqaioState *state, Relation *rel, char **from, char *end)
+{
+    // Decodes TupleData into a tuple of values, using the converters of the
+    // column types, like a DataRow in text format
+    PyObject *values, *val;
+    char *pos = *from;
+    int32_t size;
+    int i;
+
+    if (end - pos < 2 || read_uint16(&pos) != rel->ncolumns) {
+        goto invalid;
+    }
+    values = PyTuple_New(rel->ncolumns);
+    if (values == NULL) {
+        return NULL;
+    }
+    for (i = 0; i < rel->ncolumns; i++) {
+        if (end - pos < 1) {
+            Py_DECREF(values);
+            goto invalid;
+        }
+        switch (*pos++) {
+            case 'n':
+                val = Py_None;
+                Py_INCREF(val);
+                break;
+            case 'u':
+                // unchanged TOASTed value, not sent
+                val = state->unchanged_toast;
+                Py_INCREF(val);
+                break;
+            case 't':
+                if (end - pos < 4) {
+                    Py_DECREF(values);
+                    goto invalid;
+                }
+                size = (int32_t)read_uint32(&pos);
+                if (size < 0 || size > end - pos) {
+                    Py_DECREF(values);
+                    goto invalid;
+                }
+                val = rel->converters[i].convert(state, pos, size);
+                if (val == NULL) {
+                    Py_DECREF(values);
+                    return NULL;
+                }
+                pos += size;
+                break;
+            default:
+                Py_DECREF(values);
+                goto invalid;
+        }
+        PyTuple_SET_ITEM(values, i, val);
+    }
+    *from = pos;
+    return values;
+
+invalid:
+    PyErr_SetString(state->ProtocolError, "Invalid tuple data.");
+    return NULL;
+}
+
+
+static int
+add_change(PoqaioState *state, PgOutput *out, char kind, uint64_t lsn,
+           PyObject *relation, PyObject *new, PyObject *old)
+{
+    // Appends a Change to the changes to deliver. Steals the references to
+    // new and old.
+    PyObject *change, *val;
+    int ret;
+
+    change = PyStructSequence_New(state->Change);
+    if (change == NULL) {
+        Py_XDECREF(new);
+        Py_XDECREF(old);
+        return -1;
+    }
+    if (new == NULL) {
+        new = Py_None;
+        Py_INCREF(new);
+    }
+    PyStructSequence_SET_ITEM(change, 5, new);
+    if (old == NULL) {
+        old = Py_None;
+        Py_INCREF(old);
+    }
+    PyStructSequence_SET_ITEM(change, 6, old);
+    if (relation == NULL) {
+        relation = Py_None;
+    }
+    Py_INCREF(relation);
+    PyStructSequence_SET_ITEM(change, 4, relation);
+
+    val = PyUnicode_FromOrdinal(kind);
+    if (val == NULL) {
+        goto error;
+    }
+    PyStructSequence_SET_ITEM(change, 0, val);
+    val = PyLong_FromUnsignedLongLong(lsn);
+    if (val == NULL) {
+        goto error;
+    }
+    PyStructSequence_SET_ITEM(change, 1, val);
+    Py_INCREF(out->xid);
+    PyStructSequence_SET_ITEM(change, 2, out->xid);
+    Py_INCREF(out->commit_time);
+    PyStructSequence_SET_ITEM(change, 3, out->commit_time);
+
+    ret = PyList_Append(out->changes, change);
+    Py_DECREF(change);
+    out->batch_lsn = lsn;
+    return ret;
+
+error:
+    Py_DECREF(change);
+    return -1;
+}
+
+
+static int
+decode_row_change(
+    PoqaioState *state, PgOutput *out, char kind, char *pos, char *end,
+    uint64_t lsn)
+{
+    // Decodes an Insert, Update or Delete. The old values are the key
+    // columns ('K') or the whole row ('O'), depending on the replica
+    // identity. Other columns of a key tuple are None.
+    Relation *rel;
+    PyObject *new = NULL, *old = NULL;
+
+    rel = get_relation(state, out, &pos, end);
+    if (rel == NULL) {
+        return -1;
+    }
+    if (end - pos < 1) {
+        goto invalid;
+    }
+    if (kind != 'I' && (*pos == 'K' || *pos == 'O')) {
+        pos++;
+        old = decode_tuple(state, rel, &pos, end);
+        if (old == NULL) {
+            return -1;
+        }
+    }
+    if (kind != 'D') {
+        if (end - pos < 1 || *pos++ != 'N') {
+            goto invalid;
+        }
+        new = decode_tuple(state, rel, &pos, end);
+        if (new == NULL) {
+            goto error;
+        }
+    }
+    else if (old == NULL) {
+        goto invalid;
+    }
+    if (pos != end) {
+        goto invalid;
+    }
+    return add_change(state, out, kind, lsn, (PyObject *)rel, new, old);
+
+invalid:
+    PyErr_SetString(state->ProtocolError, "Invalid change message.");
+error:
+    Py_XDECREF(new);
+    Py_XDECREF(old);
+    return -1;
+}
+
+
+static int
+decode_truncate(
+    PoqaioState *state, PgOutput *out, char *pos, char *end, uint64_t lsn)
+{
+    // A Truncate change has a tuple of the truncated relations
+    PyObject *relations;
+    Relation *rel;
+    uint32_t i, nrels;
+    int ret;
+
+    if (end - pos < 5) {
+        goto invalid;
+    }
+    nrels = read_uint32(&pos);
+    pos++;  // options, CASCADE and RESTART IDENTITY
+    if ((uint64_t)(end - pos) != (uint64_t)nrels * 4) {
+        goto invalid;
+    }
+    relations = PyTuple_New(nrels);
+    if (relations == NULL) {
+        return -1;
+    }
+    for (i = 0; i < nrels; i++) {
+        rel = get_relation(state, out, &pos, end);
+        if (rel == NULL) {
+            Py_DECREF(relations);
+            return -1;
+        }
+        Py_INCREF(rel);
+        PyTuple_SET_ITEM(relations, i, (PyObject *)rel);
+    }
+    ret = add_change(state, out, 'T', lsn, relations, NULL, NULL);
+    Py_DECREF(relations);
+    return ret;
+
+invalid:
+    PyErr_SetString(state->ProtocolError, "Invalid truncate message.");
+    return -1;
+}
+
+
+static int
+set_transaction(PgOutput *out, int64_t commit_time, PyObject *xid)
+{
+    // Sets the transaction of the next changes, steals the reference to xid
+    PyObject *py_time;
+
+    if (xid == NULL) {
+        return -1;
+    }
+    py_time = PyLong_FromLongLong(commit_time + PG_EPOCH_USECS);
+    if (py_time == NULL) {
+        Py_DECREF(xid);
+        return -1;
+    }
+    Py_SETREF(out->xid, xid);
+    Py_SETREF(out->commit_time, py_time);
+    return 0;
+}
+
+
+int
+pgoutput_decode(
+    PoqaioState *state, PgOutput *out, char *pos, char *end, uint64_t lsn)
+{
+    // Decodes the pgoutput message of an XLogData message that starts at
+    // lsn. Changes are appended to the changes of out, relations are kept
+    // to decode the rows of later changes.
+    int64_t commit_time;
+    char kind;
+
+    if (end - pos < 1) {
+        goto invalid;
+    }
+    kind = *pos++;
+    switch (kind) {
+        case 'B':
+            // final lsn, commit time and xid of the transaction
+            if (end - pos != 20) {
+                goto invalid;
+            }
+            pos += 8;
+            commit_time = (int64_t)read_uint64(&pos);
+            if (set_transaction(
+                    out, commit_time,
+                    PyLong_FromUnsignedLong(read_uint32(&pos))) == -1) {
+                return -1;
+            }
+            out->in_transaction = 1;
+            return add_change(state, out, 'B', lsn, NULL, NULL, NULL);
+        case 'C':
+            // flags, commit lsn, end lsn and commit time. The end lsn is
+            // what is acknowledged after handling the transaction.
+            if (end - pos != 25) {
+                goto invalid;
+            }
+            pos += 9;
+            lsn = read_uint64(&pos);
+            Py_INCREF(out->xid);
+            if (set_transaction(
+                    out, (int64_t)read_uint64(&pos), out->xid) == -1) {
+                return -1;
+            }
+            out->in_transaction = 0;
+            return add_change(state, out, 'C', lsn, NULL, NULL, NULL);
+        case 'R':
+            return decode_relation(state, out, pos, end);
+        case 'I':
+        case 'U':
+        case 'D':
+            return decode_row_change(state, out, kind, pos, end, lsn);
+        case 'T':
+            return decode_truncate(state, out, pos, end, lsn);
+        case 'Y':  // Type
+        case 'O':  // Origin
+        case 'M':  // logical decoding Message
+            return 0;
+    }
+invalid:
+    PyErr_SetString(state->ProtocolError, "Invalid pgoutput message.");
+    return -1;
+}
@@ -0,0 +1,39 @@
+#ifndef POQAIO_REPLICATION_H
+#define POQAIO_REPLICATION_H
+
+#include "poqaio.h"
+#include "protocol.h"
+
+// Table described by a Relation message of pgoutput
+typedef struct {
+    PyObject_HEAD
+    uint32_t oid;
+    PyObject *namespace;
+    PyObject *name;
+    char replica_identity;
+    PyObject *columns;             // tuple of column names
+    PyObject *type_oids;           // tuple of type oids per column
+    PyObject *key_columns;         // tuple of names of the key columns
+    int ncolumns;
+    field_converter *converters;
+} Relation;
+
+// State of decoding the pgoutput messages of a logical replication stream
+typedef struct _PgOutput {
+    PyObject *relations;           // dict oid -> Relation
+    PyObject *changes;             // list of changes not yet delivered
+    uint64_t batch_lsn;            // of the last decoded change
+    PyObject *xid;                 // of the current transaction, shared
+    PyObject *commit_time;         // by its changes
+    int in_transaction;            // between Begin and Commit
+} PgOutput;
+
+extern PyType_Spec RelationSpec;
+
+PgOutput *pgoutput_new(void);
+void pgoutput_free(PgOutput *);
+int pgoutput_decode(
+    PoqaioState *state, PgOutput *out, char *pos, char *end, uint64_t lsn);
+int64_t pg_clock_now(void);
+
+#endif
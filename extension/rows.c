@@ -0,0 +1,203 @@
+#include "rows.h"
+#include "state.h"
+
+// record types are cached by field names, the cache is emptied when full
+#define RECORD_TYPES_MAX 256
+
+
+int
+rows_init_state(PoqaioState *state)
+{
+    state->record_types = PyDict_New();
+    return state->record_types == NULL ? -1 : 0;
+}
+
+
+int
+row_factory_kind(PyObject *factory)
+{
+    // Returns the ROW_* constant for a row factory argument. Besides the
+    // constants, the tuple and dict types select the built in factories.
+    long kind;
+
+    if (factory == Py_None || factory == (PyObject *)&PyTuple_Type) {
+        return ROW_TUPLE;
+    }
+    if (factory == (PyObject *)&PyDict_Type) {
+        return ROW_DICT;
+    }
+    if (PyLong_CheckExact(factory)) {
+        kind = PyLong_AsLong(factory);
+        if (kind < ROW_TUPLE || kind > ROW_DICT) {
+            if (!PyErr_Occurred()) {
+                PyErr_SetString(PyExc_ValueError, "Invalid row factory");
+            }
+            return -1;
+        }
+        return (int)kind;
+    }
+    if (!PyCallable_Check(factory)) {
+        PyErr_SetString(
+            PyExc_TypeError, "Row factory must be a ROW_* constant or callable");
+        return -1;
+    }
+    return ROW_CLASS;
+}
+
+
+int
+row_factory_select(RowFactory *rf, PyObject *factory)
+{
+    // Uses factory for the rows of the next query
+    int kind = row_factory_kind(factory);
+
+    if (kind == -1) {
+        return -1;
+    }
+    row_factory_clear(rf);
+    rf->kind = kind;
+    if (kind == ROW_CLASS) {
+        Py_INCREF(factory);
+        rf->cls = factory;
+    }
+    return 0;
+}
+
+
+static PyTypeObject *
+record_type_new(PyObject *names)
+{
+    // Creates a struct sequence type with the names as fields
+    PyStructSequence_Desc desc = {
+        "poqaio.Record", "Row of a query result", NULL, 0};
+    PyStructSequence_Field *fields;
+    PyTypeObject *type = NULL;
+    Py_ssize_t i, nfields = PyTuple_GET_SIZE(names);
+
+    fields = PyMem_Calloc(nfields + 1, sizeof(PyStructSequence_Field));
+    if (fields == NULL) {
+        PyErr_NoMemory();
+        return NULL;
+    }
+    for (i = 0; i < nfields; i++) {
+        fields[i].name = PyUnicode_AsUTF8(PyTuple_GET_ITEM(names, i));
+        if (fields[i].name == NULL) {
+            goto end;
+        }
+    }
+    desc.fields = fields;
+    desc.n_in_sequence = (int)nfields;
+    type = PyStructSequence_NewType(&desc);
+    if (type == NULL) {
+        goto end;
+    }
+    // The members of the type point to the UTF-8 of the names, keep them
+    if (PyObject_SetAttrString((PyObject *)type, "_fields", names) == -1) {
+        Py_CLEAR(type);
+    }
+end:
+    PyMem_Free(fields);
+    return type;
+}
+
+
+static PyTypeObject *
+record_type_get(PoqaioState *state, PyObject *names)
+{
+    // Returns a new reference to the cached record type for the names. The
+    // cache is shared by the protocols of all threads, and can be cleared
+    // by another one at any time, so no borrowed references.
+    PyObject *type;
+
+    switch (PyDict_GetItemRef(state->record_types, names, &type)) {
+        case 1:
+            return (PyTypeObject *)type;
+        case -1:
+            return NULL;
+    }
+    type = (PyObject *)record_type_new(names);
+    if (type == NULL) {
+        return NULL;
+    }
+    if (PyDict_GET_SIZE(state->record_types) >= RECORD_TYPES_MAX) {
+        PyDict_Clear(state->record_types);
+    }
+    if (PyDict_SetItem(state->record_types, names, type) == -1) {
+        Py_DECREF(type);
+        return NULL;
+    }
+    return (PyTypeObject *)type;
+}
+
+
+int
+row_factory_start(PoqaioState *state, RowFactory *rf, PyObject *fields)
+{
+    // Prepares the factory for the rows of a result with the given field
+    // descriptions
+    PyObject *names, *name;
+    Py_ssize_t i, nfields = PyTuple_GET_SIZE(fields);
+
+    if (rf->kind == ROW_TUPLE) {
+        return 0;
+    }
+    names = PyTuple_New(nfields);
+    if (names == NULL) {
+        return -1;
+    }
+    for (i = 0; i < nfields; i++) {
+        // interned names have their hash cached and compare by identity
+        name = PyStructSequence_GET_ITEM(PyTuple_GET_ITEM(fields, i), 0);
+        Py_INCREF(name);
+        PyUnicode_InternInPlace(&name);
+        PyTuple_SET_ITEM(names, i, name);
+    }
+    Py_XSETREF(rf->names, names);
+    if (rf->kind == ROW_RECORD) {
+        Py_XSETREF(rf->record_type, record_type_get(state, names));
+        if (rf->record_type == NULL) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+PyObject *
+row_factory_make(RowFactory *rf, PyObject *values)
+{
+    // Makes a dict or instance from the values tuple, steals the reference
+    PyObject *row, **items;
+    Py_ssize_t i, nfields;
+
+    if (values == NULL) {
+        return NULL;
+    }
+    items = PySequence_Fast_ITEMS(values);
+    nfields = PyTuple_GET_SIZE(values);
+    if (rf->kind == ROW_CLASS) {
+        // all values as keyword arguments
+        row = PyObject_Vectorcall(rf->cls, items, 0, rf->names);
+    }
+    else {
+        row = PyDict_New();
+        for (i = 0; row && i < nfields; i++) {
+            if (PyDict_SetItem(
+                    row, PyTuple_GET_ITEM(rf->names, i), items[i]) == -1) {
+                Py_CLEAR(row);
+            }
+        }
+    }
+    Py_DECREF(values);
+    return row;
+}
+
+
+void
+row_factory_clear(RowFactory *rf)
+{
+    rf->kind = ROW_TUPLE;
+    Py_CLEAR(rf->cls);
+    Py_CLEAR(rf->names);
+    Py_CLEAR(rf->record_type);
+}
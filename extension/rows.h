@@ -0,0 +1,51 @@
+#ifndef POQAIO_ROWS_H
+#define POQAIO_ROWS_H
+
+#include "poqaio.h"
+
+// row factories
+#define ROW_TUPLE 0
+#define ROW_RECORD 1             // struct sequence with the field names
+#define ROW_DICT 2
+#define ROW_CLASS 3              // other callable, called with keywords
+
+// Makes the rows of the current result. The values of a row are decoded into
+// a tuple, or directly into a record. Dicts and classes are made from that
+// tuple afterwards.
+typedef struct {
+    int kind;
+    PyObject *cls;               // callable for ROW_CLASS
+    PyObject *names;             // interned field names of the result
+    PyTypeObject *record_type;   // for ROW_RECORD
+} RowFactory;
+
+int rows_init_state(PoqaioState *state);
+int row_factory_kind(PyObject *factory);
+int row_factory_select(RowFactory *rf, PyObject *factory);
+int row_factory_start(PoqaioState *state, RowFactory *rf, PyObject *fields);
+PyObject *row_factory_make(RowFactory *rf, PyObject *values);
+void row_factory_clear(RowFactory *rf);
+
+
+static inline PyObject *
+row_new(RowFactory *rf, Py_ssize_t nfields)
+{
+    // Returns the container for the values of a row
+    if (rf->kind == ROW_RECORD) {
+        return PyStructSequence_New(rf->record_type);
+    }
+    return PyTuple_New(nfields);
+}
+
+
+static inline PyObject *
+row_finish(RowFactory *rf, PyObject *values)
+{
+    // Returns the row for the filled container, steals the reference
+    if (rf->kind < ROW_DICT) {
+        return values;
+    }
+    return row_factory_make(rf, values);
+}
+
+#endif
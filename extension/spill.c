@@ -0,0 +1,836 @@
+#include "poqaio.h"
+#include "state.h"
+#include "spill.h"
+
+#ifdef _WIN32
+// no spill file, the messages are always collected in memory
+#else
+#	include <errno.h>
+#	include <stdlib.h>
+#	include <unistd.h>
+#	include <sys/mman.h>
+#endif
+
+// messages are written to the spill file in blocks of this size
+#define SPILL_BUF_SIZE (1 << 20)
+// initial buffer of messages collected in memory
+#define MEMORY_BUF_SIZE 8192
+
+// Exported rows start with this header in the byte order of the writer,
+// followed by the field descriptions, as in a RowDescription message. Then,
+// aligned to 8 bytes, the int64_t offset per row in the row data and the row
+// data, the bodies of the DataRow messages.
+typedef struct {
+    char magic[4];
+    uint32_t byte_order;
+    uint32_t version;
+    int32_t nfields;
+    int64_t nrows;
+    int64_t fields_size;
+    int64_t data_size;
+} ExportHeader;
+
+#define EXPORT_MAGIC "PQRW"
+#define EXPORT_BYTE_ORDER 0x01020304
+#define EXPORT_VERSION 1
+#define ALIGN8(size) (((size) + 7) & ~(Py_ssize_t)7)
+
+
+#ifndef _WIN32
+static int
+spill_file_open(void)
+{
+    // Creates an unlinked temporary file in TMPDIR
+    const char *dir = getenv("TMPDIR");
+    char *path;
+    size_t len;
+    int fd;
+
+    if (dir == NULL || *dir == '\0') {
+        dir = "/tmp";
+    }
+    len = strlen(dir);
+    path = PyMem_Malloc(len + 15);
+    if (path == NULL) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    memcpy(path, dir, len);
+    memcpy(path + len, "/poqaio-XXXXXX", 15);
+    fd = mkstemp(path);
+    if (fd == -1) {
+        PyErr_SetFromErrnoWithFilename(PyExc_OSError, path);
+    }
+    else {
+        unlink(path);
+    }
+    PyMem_Free(path);
+    return fd;
+}
+
+
+static int
+spill_write(RawRows *self, char *data, Py_ssize_t len)
+{
+    ssize_t written = 0;
+
+    Py_BEGIN_ALLOW_THREADS
+    while (len > 0) {
+        written = write(self->fd, data, len);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        data += written;
+        len -= written;
+    }
+    Py_END_ALLOW_THREADS
+    if (written == -1) {
+        PyErr_SetFromErrno(PyExc_OSError);
+        return -1;
+    }
+    return 0;
+}
+#endif
+
+
+RawRows *
+RawRows_create(BaseProt *prot, PyObject *head, int in_memory)
+{
+    // Creates the rows of the current result of the protocol, that has the
+    // already decoded rows in head, a list or NULL. The messages are written
+    // to a spill file, unless in_memory is set.
+    PoqaioState *state = prot->state;
+    RawRows *self;
+
+    self = (RawRows *)state->RawRowsType->tp_alloc(state->RawRowsType, 0);
+    if (self == NULL) {
+        return NULL;
+    }
+    self->state = state;
+    self->fd = -1;
+    self->head = head ? head : PyList_New(0);
+    if (self->head == NULL) {
+        Py_DECREF(self);
+        return NULL;
+    }
+    Py_XINCREF(head);
+    Py_INCREF(prot->result_fields);
+    self->fields = prot->result_fields;
+
+    // the same rows as the protocol would make
+    self->nfields = prot->result_nfields;
+    self->converters = PyMem_Malloc(
+        sizeof(field_converter) * (self->nfields + 1));
+    self->spilled = !in_memory;
+    self->wsize = in_memory ? MEMORY_BUF_SIZE : SPILL_BUF_SIZE;
+    self->wbuf = PyMem_RawMalloc(self->wsize);
+    if (self->converters == NULL || self->wbuf == NULL) {
+        Py_DECREF(self);
+        PyErr_NoMemory();
+        return NULL;
+    }
+    memcpy(self->converters, prot->converters,
+           sizeof(field_converter) * self->nfields);
+    self->rows = prot->rows;
+    Py_XINCREF(self->rows.cls);
+    Py_XINCREF(self->rows.names);
+    Py_XINCREF(self->rows.record_type);
+
+#ifndef _WIN32
+    if (!in_memory) {
+        self->fd = spill_file_open();
+        if (self->fd == -1) {
+            Py_DECREF(self);
+            return NULL;
+        }
+    }
+#endif
+    return self;
+}
+
+
+static int
+make_room(RawRows *self, char *msg, Py_ssize_t size)
+{
+    // Makes room in the write buffer for a message of size bytes, by writing
+    // the buffer to the spill file or by growing it. Returns 1 when the
+    // message itself is written to the file.
+    Py_ssize_t new_size;
+    char *wbuf;
+
+#ifndef _WIN32
+    if (self->fd != -1) {
+        if (spill_write(self, self->wbuf, self->wlen) == -1) {
+            return -1;
+        }
+        self->wlen = 0;
+        if (size <= self->wsize) {
+            return 0;
+        }
+        // larger than the buffer, write directly
+        return spill_write(self, msg, size) == -1 ? -1 : 1;
+    }
+#endif
+    new_size = self->wsize * 2;
+    if (new_size < self->wlen + size) {
+        new_size = self->wlen + size;
+    }
+    wbuf = PyMem_RawRealloc(self->wbuf, new_size);
+    if (wbuf == NULL) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    self->wbuf = wbuf;
+    self->wsize = new_size;
+    return 0;
+}
+
+
+int
+RawRows_add(RawRows *self, char *msg, Py_ssize_t size)
+{
+    // Appends the body of a DataRow message
+    int64_t offset = self->nbytes;
+    Py_ssize_t buffered = size;
+
+    if (self->nrows == self->offsets_size) {
+        Py_ssize_t new_size = self->offsets_size ? self->offsets_size * 2 : 1024;
+        char *offsets = PyMem_RawRealloc(
+            self->offsets, new_size * sizeof(int64_t));
+
+        if (offsets == NULL) {
+            PyErr_NoMemory();
+            return -1;
+        }
+        self->offsets = offsets;
+        self->offsets_size = new_size;
+    }
+    if (self->wlen + size > self->wsize) {
+        int ret = make_room(self, msg, size);
+
+        if (ret == -1) {
+            return -1;
+        }
+        if (ret == 1) {
+            buffered = 0;
+        }
+    }
+    memcpy(self->offsets + sizeof(int64_t) * self->nrows, &offset,
+           sizeof(int64_t));
+    self->nrows++;
+    memcpy(self->wbuf + self->wlen, msg, buffered);
+    self->wlen += buffered;
+    self->nbytes += size;
+    return 0;
+}
+
+
+int
+RawRows_finish(RawRows *self)
+{
+    // Makes the rows available, at the end of the result
+    if (self->fd == -1) {
+        // collected in memory
+        self->data = self->wbuf;
+        self->wbuf = NULL;
+        return 0;
+    }
+#ifndef _WIN32
+    if (spill_write(self, self->wbuf, self->wlen) == -1) {
+        return -1;
+    }
+    PyMem_RawFree(self->wbuf);
+    self->wbuf = NULL;
+    if (self->nbytes) {
+        void *data = mmap(
+            NULL, self->nbytes, PROT_READ, MAP_SHARED, self->fd, 0);
+
+        if (data == MAP_FAILED) {
+            PyErr_SetFromErrno(PyExc_OSError);
+            return -1;
+        }
+        self->data = data;
+        self->mapped = 1;
+    }
+    // the mapping keeps the file
+    close(self->fd);
+    self->fd = -1;
+#endif
+    return 0;
+}
+
+
+static int64_t
+row_offset(RawRows *self, Py_ssize_t index)
+{
+    // Offsets of exported rows are not necessarily aligned
+    int64_t offset;
+
+    if (index == self->nrows) {
+        return self->nbytes;
+    }
+    memcpy(&offset, self->offsets + sizeof(int64_t) * index, sizeof(int64_t));
+    return offset;
+}
+
+
+static PyObject *
+decode_row(RawRows *self, Py_ssize_t index)
+{
+    // Decodes a row. The message is copied first, converters temporarily
+    // terminate values and the data is read only.
+    PyObject *row, *val;
+    int64_t start = row_offset(self, index), end_offset;
+    Py_ssize_t size;
+    char *pos, *end;
+    int16_t nfields;
+    int32_t val_size;
+    int i;
+
+    end_offset = row_offset(self, index + 1);
+    if (start < 0 || end_offset < start || end_offset > self->nbytes) {
+        goto invalid;
+    }
+    size = (Py_ssize_t)(end_offset - start);
+    if (size + 1 > self->scratch_size) {
+        char *scratch = PyMem_RawRealloc(self->scratch, size + 1);
+        if (scratch == NULL) {
+            return PyErr_NoMemory();
+        }
+        self->scratch = scratch;
+        self->scratch_size = size + 1;
+    }
+    memcpy(self->scratch, self->data + start, size);
+    pos = self->scratch;
+    end = pos + size;
+
+    if (size < 2) {
+        goto invalid;
+    }
+    memcpy(&nfields, pos, 2);
+    nfields = (int16_t)be16toh(nfields);
+    pos += 2;
+    if (nfields != self->nfields) {
+        goto invalid;
+    }
+    row = row_new(&self->rows, nfields);
+    if (row == NULL) {
+        return NULL;
+    }
+    for (i = 0; i < nfields; i++) {
+        if (end - pos < 4) {
+            Py_DECREF(row);
+            goto invalid;
+        }
+        memcpy(&val_size, pos, 4);
+        val_size = (int32_t)be32toh(val_size);
+        pos += 4;
+        if (val_size == -1) {
+            Py_INCREF(Py_None);
+            PyTuple_SET_ITEM(row, i, Py_None);
+            continue;
+        }
+        if (val_size < 0 || val_size > end - pos) {
+            Py_DECREF(row);
+            goto invalid;
+        }
+        val = self->converters[i].convert(self->state, pos, val_size);
+        if (val == NULL) {
+            Py_DECREF(row);
+            return NULL;
+        }
+        PyTuple_SET_ITEM(row, i, val);
+        pos += val_size;
+    }
+    if (pos != end) {
+        Py_DECREF(row);
+        goto invalid;
+    }
+    return row_finish(&self->rows, row);
+
+invalid:
+    PyErr_SetString(self->state->ProtocolError, "Invalid data row message.");
+    return NULL;
+}
+
+
+static Py_ssize_t
+RawRows_length(RawRows *self)
+{
+    return PyList_GET_SIZE(self->head) + self->nrows;
+}
+
+
+static PyObject *
+RawRows_item(RawRows *self, Py_ssize_t index)
+{
+    Py_ssize_t nhead = PyList_GET_SIZE(self->head);
+    PyObject *row;
+
+    if (index < 0 || index >= nhead + self->nrows) {
+        PyErr_SetString(PyExc_IndexError, "RawRows index out of range");
+        return NULL;
+    }
+    if (index < nhead) {
+        row = PyList_GET_ITEM(self->head, index);
+        Py_INCREF(row);
+        return row;
+    }
+    if (self->data == NULL) {
+        PyErr_SetString(PyExc_RuntimeError, "Result is not complete");
+        return NULL;
+    }
+    Py_BEGIN_CRITICAL_SECTION(self);
+    row = decode_row(self, index - nhead);
+    Py_END_CRITICAL_SECTION();
+    return row;
+}
+
+
+static PyObject *
+RawRows_subscript(RawRows *self, PyObject *item)
+{
+    Py_ssize_t start, stop, step, length, i;
+    PyObject *rows, *row;
+
+    if (PyIndex_Check(item)) {
+        i = PyNumber_AsSsize_t(item, PyExc_IndexError);
+        if (i == -1 && PyErr_Occurred()) {
+            return NULL;
+        }
+        if (i < 0) {
+            i += RawRows_length(self);
+        }
+        return RawRows_item(self, i);
+    }
+    if (!PySlice_Check(item)) {
+        PyErr_SetString(
+            PyExc_TypeError, "RawRows indices must be integers or slices");
+        return NULL;
+    }
+    if (PySlice_Unpack(item, &start, &stop, &step) == -1) {
+        return NULL;
+    }
+    length = PySlice_AdjustIndices(
+        RawRows_length(self), &start, &stop, step);
+    rows = PyList_New(length);
+    if (rows == NULL) {
+        return NULL;
+    }
+    for (i = 0; i < length; i++, start += step) {
+        row = RawRows_item(self, start);
+        if (row == NULL) {
+            Py_DECREF(rows);
+            return NULL;
+        }
+        PyList_SET_ITEM(rows, i, row);
+    }
+    return rows;
+}
+
+
+static char *
+write_field_value(char *pos, PyObject *field_desc, int index, int width)
+{
+    // Writes a value of a field description in network byte order
+    long long val = PyLong_AsLongLong(
+        PyStructSequence_GET_ITEM(field_desc, index));
+
+    if (width == 2) {
+        uint16_t val16 = htobe16((uint16_t)val);
+        memcpy(pos, &val16, 2);
+    }
+    else {
+        uint32_t val32 = htobe32((uint32_t)val);
+        memcpy(pos, &val32, 4);
+    }
+    return pos + width;
+}
+
+
+static Py_ssize_t
+export_fields(RawRows *self, char *pos)
+{
+    // Writes the field descriptions like in a RowDescription, or only
+    // returns their size when pos is NULL
+    Py_ssize_t i, len, size = 0;
+
+    for (i = 0; i < self->nfields; i++) {
+        PyObject *field_desc = PyTuple_GET_ITEM(self->fields, i);
+        const char *name;
+
+        name = PyUnicode_AsUTF8AndSize(
+            PyStructSequence_GET_ITEM(field_desc, 0), &len);
+        if (name == NULL) {
+            return -1;
+        }
+        size += len + 19;
+        if (pos == NULL) {
+            continue;
+        }
+        memcpy(pos, name, len + 1);
+        pos += len + 1;
+        pos = write_field_value(pos, field_desc, 5, 4);  // table oid
+        pos = write_field_value(pos, field_desc, 6, 2);  // column number
+        pos = write_field_value(pos, field_desc, 1, 4);  // type oid
+        pos = write_field_value(pos, field_desc, 2, 2);  // type size
+        pos = write_field_value(pos, field_desc, 3, 4);  // type modifier
+        pos = write_field_value(pos, field_desc, 4, 2);  // format
+    }
+    return PyErr_Occurred() ? -1 : size;
+}
+
+
+static Py_ssize_t
+export_size(RawRows *self, Py_ssize_t *fields_size)
+{
+    if (PyList_GET_SIZE(self->head)) {
+        PyErr_SetString(
+            PyExc_ValueError,
+            "Rows that were decoded before spilling can not be exported");
+        return -1;
+    }
+    *fields_size = export_fields(self, NULL);
+    if (*fields_size == -1) {
+        return -1;
+    }
+    return ALIGN8((Py_ssize_t)sizeof(ExportHeader) + *fields_size) +
+        self->nrows * (Py_ssize_t)sizeof(int64_t) + self->nbytes;
+}
+
+
+static int
+export_into(RawRows *self, char *buf, Py_ssize_t fields_size)
+{
+    ExportHeader header;
+    char *pos;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, EXPORT_MAGIC, 4);
+    header.byte_order = EXPORT_BYTE_ORDER;
+    header.version = EXPORT_VERSION;
+    header.nfields = self->nfields;
+    header.nrows = self->nrows;
+    header.fields_size = fields_size;
+    header.data_size = self->nbytes;
+    memcpy(buf, &header, sizeof(header));
+
+    pos = buf + sizeof(header);
+    if (export_fields(self, pos) == -1) {
+        return -1;
+    }
+    memset(pos + fields_size, 0,
+           ALIGN8(sizeof(header) + fields_size) - sizeof(header) - fields_size);
+    pos = buf + ALIGN8(sizeof(header) + fields_size);
+    if (self->nrows) {
+        memcpy(pos, self->offsets, self->nrows * sizeof(int64_t));
+        pos += self->nrows * sizeof(int64_t);
+        memcpy(pos, self->data, self->nbytes);
+    }
+    return 0;
+}
+
+
+static PyObject *
+RawRows_export(RawRows *self, PyObject *args)
+{
+    // Writes the rows with their field descriptions into a writable buffer
+    // and returns the number of bytes written, or returns them as bytes
+    // without buffer
+    PyObject *buffer = Py_None, *ret;
+    Py_ssize_t size, fields_size;
+    Py_buffer view;
+
+    if (!PyArg_ParseTuple(args, "|O", &buffer)) {
+        return NULL;
+    }
+    size = export_size(self, &fields_size);
+    if (size == -1) {
+        return NULL;
+    }
+    if (buffer == Py_None) {
+        ret = PyBytes_FromStringAndSize(NULL, size);
+        if (ret != NULL && export_into(
+                self, PyBytes_AS_STRING(ret), fields_size) == -1) {
+            Py_CLEAR(ret);
+        }
+        return ret;
+    }
+    if (PyObject_GetBuffer(buffer, &view, PyBUF_WRITABLE) == -1) {
+        return NULL;
+    }
+    ret = NULL;
+    if (view.len < size) {
+        PyErr_Format(
+            PyExc_ValueError, "Buffer too small, %zd bytes needed", size);
+    }
+    else if (export_into(self, view.buf, fields_size) == 0) {
+        ret = PyLong_FromSsize_t(size);
+    }
+    PyBuffer_Release(&view);
+    return ret;
+}
+
+
+static PyObject *
+RawRows_get_spilled_rows(RawRows *self, void *closure)
+{
+    return PyLong_FromSsize_t(self->spilled ? self->nrows : 0);
+}
+
+
+static PyObject *
+RawRows_get_export_size(RawRows *self, void *closure)
+{
+    Py_ssize_t size, fields_size;
+
+    size = export_size(self, &fields_size);
+    if (size == -1) {
+        return NULL;
+    }
+    return PyLong_FromSsize_t(size);
+}
+
+
+static PyObject *
+import_fields(PoqaioState *state, char *pos, char *end, int nfields)
+{
+    // Reads the exported field descriptions
+    PyObject *fields, *field_desc, *val;
+    uint32_t val32;
+    uint16_t val16;
+    int i;
+
+    fields = PyTuple_New(nfields);
+    if (fields == NULL) {
+        return NULL;
+    }
+    for (i = 0; i < nfields; i++) {
+        char *name_end = memchr(pos, '\0', end - pos);
+
+        if (name_end == NULL || end - name_end - 1 < 18) {
+            PyErr_SetString(PyExc_ValueError, "Invalid exported rows");
+            goto error;
+        }
+        field_desc = PyStructSequence_New(state->FieldDescription);
+        if (field_desc == NULL) {
+            goto error;
+        }
+        PyTuple_SET_ITEM(fields, i, field_desc);
+        val = PyUnicode_DecodeUTF8(pos, name_end - pos, NULL);
+        if (val == NULL) {
+            goto error;
+        }
+        PyStructSequence_SET_ITEM(field_desc, 0, val);
+        pos = name_end + 1;
+
+#define READ_FIELD_VALUE(index, width, make) \
+        memcpy(&val##width, pos, width / 8); \
+        pos += width / 8; \
+        val = make; \
+        if (val == NULL) { \
+            goto error; \
+        } \
+        PyStructSequence_SET_ITEM(field_desc, index, val);
+
+        READ_FIELD_VALUE(5, 32, PyLong_FromUnsignedLong(be32toh(val32)))
+        READ_FIELD_VALUE(6, 16, PyLong_FromLong((int16_t)be16toh(val16)))
+        READ_FIELD_VALUE(1, 32, PyLong_FromUnsignedLong(be32toh(val32)))
+        READ_FIELD_VALUE(2, 16, PyLong_FromLong((int16_t)be16toh(val16)))
+        READ_FIELD_VALUE(3, 32, PyLong_FromLong((int32_t)be32toh(val32)))
+        READ_FIELD_VALUE(4, 16, PyLong_FromLong((int16_t)be16toh(val16)))
+#undef READ_FIELD_VALUE
+    }
+    if (pos != end) {
+        PyErr_SetString(PyExc_ValueError, "Invalid exported rows");
+        goto error;
+    }
+    return fields;
+
+error:
+    Py_DECREF(fields);
+    return NULL;
+}
+
+
+static PyObject *
+RawRows_from_buffer(PyTypeObject *cls, PyObject *args)
+{
+    // Returns the rows exported in buffer, which is used without copying.
+    // Row factory is like the one of a query, the default makes tuples.
+    PoqaioState *state = get_state_by_type(cls);
+    PyObject *buffer, *row_factory = Py_None;
+    ExportHeader header;
+    RawRows *self;
+    Py_ssize_t i, len, offsets_pos, data_pos;
+    char *buf;
+
+    if (!PyArg_ParseTuple(args, "O|O", &buffer, &row_factory)) {
+        return NULL;
+    }
+    self = (RawRows *)state->RawRowsType->tp_alloc(state->RawRowsType, 0);
+    if (self == NULL) {
+        return NULL;
+    }
+    self->state = state;
+    self->fd = -1;
+    if (PyObject_GetBuffer(buffer, &self->view, PyBUF_SIMPLE) == -1) {
+        goto error;
+    }
+    buf = self->view.buf;
+    len = self->view.len;
+
+    // validate the sizes, the offsets are checked when decoding a row
+    if (len < (Py_ssize_t)sizeof(header)) {
+        goto invalid;
+    }
+    memcpy(&header, buf, sizeof(header));
+    if (memcmp(header.magic, EXPORT_MAGIC, 4) != 0 ||
+            header.byte_order != EXPORT_BYTE_ORDER ||
+            header.version != EXPORT_VERSION ||
+            header.nfields < 0 || header.nfields > INT16_MAX ||
+            header.nrows < 0 || header.fields_size < 0 ||
+            header.data_size < 0 ||
+            header.fields_size > len - (Py_ssize_t)sizeof(header)) {
+        goto invalid;
+    }
+    offsets_pos = ALIGN8((Py_ssize_t)sizeof(header) + header.fields_size);
+    if (offsets_pos > len ||
+            header.nrows > (len - offsets_pos) / (Py_ssize_t)sizeof(int64_t)) {
+        goto invalid;
+    }
+    data_pos = offsets_pos + header.nrows * sizeof(int64_t);
+    if (header.data_size > len - data_pos) {
+        goto invalid;
+    }
+
+    self->fields = import_fields(
+        state, buf + sizeof(header),
+        buf + sizeof(header) + header.fields_size, header.nfields);
+    if (self->fields == NULL) {
+        goto error;
+    }
+    self->nfields = header.nfields;
+    self->converters = PyMem_Malloc(
+        sizeof(field_converter) * (self->nfields + 1));
+    if (self->converters == NULL) {
+        PyErr_NoMemory();
+        goto error;
+    }
+    for (i = 0; i < self->nfields; i++) {
+        uint32_t oid = (uint32_t)PyLong_AsUnsignedLong(PyStructSequence_GET_ITEM(
+            PyTuple_GET_ITEM(self->fields, i), 1));
+
+        self->converters[i].convert = get_converter(oid);
+        self->converters[i].kind = get_conv_kind(oid);
+    }
+    if (row_factory_select(&self->rows, row_factory) == -1 ||
+            row_factory_start(state, &self->rows, self->fields) == -1) {
+        goto error;
+    }
+    self->head = PyList_New(0);
+    if (self->head == NULL) {
+        goto error;
+    }
+    self->offsets = buf + offsets_pos;
+    self->nrows = header.nrows;
+    self->data = buf + data_pos;
+    self->nbytes = header.data_size;
+    return (PyObject *)self;
+
+invalid:
+    PyErr_SetString(PyExc_ValueError, "Invalid exported rows");
+error:
+    Py_DECREF(self);
+    return NULL;
+}
+
+
+static void
+RawRows_dealloc(RawRows *self)
+{
+    PyTypeObject *tp = Py_TYPE(self);
+
+    if (self->view.obj) {
+        // exported rows, the data is in the buffer
+        PyBuffer_Release(&self->view);
+    }
+    else {
+        PyMem_RawFree(self->offsets);
+#ifndef _WIN32
+        if (self->mapped) {
+            munmap(self->data, self->nbytes);
+            self->data = NULL;
+        }
+#endif
+        PyMem_RawFree(self->data);
+    }
+#ifndef _WIN32
+    if (self->fd != -1) {
+        close(self->fd);
+    }
+#endif
+    PyMem_RawFree(self->wbuf);
+    PyMem_RawFree(self->scratch);
+    PyMem_Free(self->converters);
+    row_factory_clear(&self->rows);
+    Py_XDECREF(self->fields);
+    Py_XDECREF(self->head);
+    tp->tp_free((PyObject *)self);
+    Py_DECREF(tp);
+}
+
+
+static PyMemberDef RawRows_members[] = {
+    {"fields", T_OBJECT, offsetof(RawRows, fields), READONLY,
+     "field descriptions"},
+    {"nbytes", T_PYSSIZET, offsetof(RawRows, nbytes), READONLY,
+     "size of the undecoded rows as received"},
+    {NULL}
+};
+
+
+static PyGetSetDef RawRows_getset[] = {
+    {"spilled_rows", (getter)RawRows_get_spilled_rows, NULL,
+     "rows over the memory budget, 0 when the result was not spilled", NULL},
+    {"export_size", (getter)RawRows_get_export_size, NULL,
+     "bytes needed by export", NULL},
+    {NULL}
+};
+
+
+static PyMethodDef RawRows_methods[] = {
+    {"export", (PyCFunction) RawRows_export, METH_VARARGS,
+     "write the rows into a writable buffer, or return them as bytes"},
+    {"from_buffer", (PyCFunction) RawRows_from_buffer,
+     METH_VARARGS | METH_CLASS,
+     "rows exported in buffer, decoded when accessed"},
+    {NULL}
+};
+
+
+static PyType_Slot RawRows_slots[] = {
+    {Py_tp_dealloc, RawRows_dealloc},
+    {Py_tp_doc, PyDoc_STR(
+        "Rows of a result kept as received, decoded when accessed")},
+    {Py_tp_members, RawRows_members},
+    {Py_tp_getset, RawRows_getset},
+    {Py_tp_methods, RawRows_methods},
+    {Py_sq_length, RawRows_length},
+    {Py_sq_item, RawRows_item},
+    {Py_mp_length, RawRows_length},
+    {Py_mp_subscript, RawRows_subscript},
+    {0, NULL}
+};
+
+
+PyType_Spec RawRowsSpec = {
+    "poqaio.RawRows",
+    sizeof(RawRows),
+    0,
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_DISALLOW_INSTANTIATION,
+    RawRows_slots
+};
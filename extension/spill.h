@@ -0,0 +1,48 @@
+#ifndef POQAIO_SPILL_H
+#define POQAIO_SPILL_H
+
+#include "poqaio.h"
+#include "protocol.h"
+
+
+// Rows of a result kept as the received DataRow messages, that are decoded
+// when they are accessed. The messages come from:
+//  - a result that exceeded the memory budget of its query. The rows decoded
+//    before that are kept in a list, the messages after it are written to an
+//    unlinked temporary file, that is mapped when the result is complete. The
+//    result takes little more memory than the page cache the kernel can
+//    evict.
+//  - a RESULT_RAW query, the messages are collected in memory.
+//  - a buffer with exported rows, for example shared memory of another
+//    process. The buffer is used without copying.
+typedef struct _RawRows {
+    PyObject_HEAD
+    PoqaioState *state;
+    PyObject *fields;              // tuple of FieldDescription
+    PyObject *head;                // rows decoded before spilling
+    int fd;                        // spill file, -1 when closed or unused
+    int spilled;                   // over the memory budget of its query
+    int mapped;                    // data is the mapped spill file
+    char *data;                    // messages, after finishing
+    Py_ssize_t nbytes;             // size of the messages
+    char *wbuf;                    // messages not yet written to the file,
+    Py_ssize_t wlen;               // or all messages when collected in
+    Py_ssize_t wsize;              // memory
+    char *offsets;                 // int64_t offset of each message
+    Py_ssize_t nrows;
+    Py_ssize_t offsets_size;
+    int nfields;
+    field_converter *converters;
+    RowFactory rows;
+    char *scratch;                 // copy of the message being decoded
+    Py_ssize_t scratch_size;
+    Py_buffer view;                // of exported rows, obj NULL otherwise
+} RawRows;
+
+extern PyType_Spec RawRowsSpec;
+
+RawRows *RawRows_create(BaseProt *prot, PyObject *head, int in_memory);
+int RawRows_add(RawRows *, char *msg, Py_ssize_t size);
+int RawRows_finish(RawRows *);
+
+#endif
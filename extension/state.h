@@ -0,0 +1,55 @@
+#ifndef POQAIO_STATE_H
+#define POQAIO_STATE_H
+
+#include "poqaio.h"
+#include "protocol.h"
+#include "auth.h"
+
+
+// State of a module instance. Every (sub)interpreter that imports the module
+// gets its own. Objects keep a borrowed pointer to it, which stays valid
+// because an object references its type and the type references the module.
+typedef struct _PoqaioState {
+    PyObject *Error;
+    PyObject *ServerError;
+    PyObject *ProtocolError;
+    PyObject *Notice;
+
+    PyTypeObject *FieldDescription;
+    PyTypeObject *Result;
+    PyTypeObject *Stats;
+    PyTypeObject *Timeline;
+    PyTypeObject *Change;
+
+    PyTypeObject *BaseProtType;
+    PyTypeObject *RecordBatchType;
+    PyTypeObject *ColumnSinkType;
+    PyTypeObject *DecodeJobType;
+    PyTypeObject *StatementType;
+    PyTypeObject *RawRowsType;
+    PyTypeObject *RelationType;
+
+    // asyncio.get_running_loop, asyncio.Future and
+    // BaseEventLoop.create_future
+    PyObject *get_running_loop;
+    PyObject *future_type;
+    PyObject *default_create_future;
+    PyObject *empty_tuple;
+    PyObject *unchanged_toast;     // value of unchanged TOASTed columns
+
+    // Record types by field names
+    PyObject *record_types;
+
+    // Counters of deallocated protocols and list of live protocols. Together
+    // they make up the global statistics.
+    ProtStats retired_stats;
+    BaseProt *live_prots;
+#ifdef Py_GIL_DISABLED
+    PyMutex stats_mutex;
+#endif
+
+    // SCRAM keys derived from passwords, shared by all connections
+    ScramKeyCache scram_keys;
+} PoqaioState;
+
+#endif
@@ -0,0 +1,103 @@
+#include "poqaio.h"
+#include "state.h"
+#include "statement.h"
+
+
+Statement *
+Statement_create(
+    PoqaioState *state, PyObject *name, PyObject *query,
+    PyObject *parameter_types, PyObject *fields)
+{
+    // Creates the statement from its ParameterDescription and RowDescription
+    // and looks up the converters of the fields
+    Statement *self;
+    Py_ssize_t i, nfields = 0;
+
+    self = (Statement *)state->StatementType->tp_alloc(
+        state->StatementType, 0);
+    if (self == NULL) {
+        return NULL;
+    }
+    Py_INCREF(name);
+    self->name = name;
+    Py_INCREF(query);
+    self->query = query;
+    Py_INCREF(parameter_types);
+    self->parameter_types = parameter_types;
+    Py_INCREF(fields);
+    self->fields = fields;
+
+    self->nparams = (int16_t)PyTuple_GET_SIZE(parameter_types);
+    self->param_oids = PyMem_Calloc(self->nparams + 1, sizeof(uint32_t));
+    if (self->fields != Py_None) {
+        nfields = PyTuple_GET_SIZE(fields);
+        self->converters = PyMem_Calloc(nfields + 1, sizeof(field_converter));
+    }
+    if (self->param_oids == NULL ||
+            (self->fields != Py_None && self->converters == NULL)) {
+        Py_DECREF(self);
+        PyErr_NoMemory();
+        return NULL;
+    }
+    for (i = 0; i < self->nparams; i++) {
+        self->param_oids[i] = (uint32_t)PyLong_AsUnsignedLong(
+            PyTuple_GET_ITEM(parameter_types, i));
+    }
+    for (i = 0; i < nfields; i++) {
+        uint32_t oid = (uint32_t)PyLong_AsUnsignedLong(PyStructSequence_GET_ITEM(
+            PyTuple_GET_ITEM(fields, i), 1));
+
+        self->converters[i].convert = get_converter(oid);
+        self->converters[i].kind = get_conv_kind(oid);
+    }
+    if (PyErr_Occurred()) {
+        Py_DECREF(self);
+        return NULL;
+    }
+    return self;
+}
+
+
+static void
+Statement_dealloc(Statement *self)
+{
+    PyTypeObject *tp = Py_TYPE(self);
+
+    Py_XDECREF(self->name);
+    Py_XDECREF(self->query);
+    Py_XDECREF(self->parameter_types);
+    Py_XDECREF(self->fields);
+    PyMem_Free(self->param_oids);
+    PyMem_Free(self->converters);
+    tp->tp_free((PyObject *)self);
+    Py_DECREF(tp);
+}
+
+
+static PyMemberDef Statement_members[] = {
+    {"name", T_OBJECT, offsetof(Statement, name), READONLY,
+     "name of the statement on the server"},
+    {"query", T_OBJECT, offsetof(Statement, query), READONLY, "query"},
+    {"parameter_types", T_OBJECT, offsetof(Statement, parameter_types),
+     READONLY, "type oid per parameter"},
+    {"fields", T_OBJECT, offsetof(Statement, fields), READONLY,
+     "FieldDescription per result column, or None"},
+    {NULL}
+};
+
+
+static PyType_Slot Statement_slots[] = {
+    {Py_tp_dealloc, Statement_dealloc},
+    {Py_tp_doc, PyDoc_STR("Description of a prepared statement")},
+    {Py_tp_members, Statement_members},
+    {0, NULL}
+};
+
+
+PyType_Spec StatementSpec = {
+    "poqaio.Statement",
+    sizeof(Statement),
+    0,
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_DISALLOW_INSTANTIATION,
+    Statement_slots
+};
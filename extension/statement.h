@@ -0,0 +1,28 @@
+#ifndef POQAIO_STATEMENT_H
+#define POQAIO_STATEMENT_H
+
+#include "poqaio.h"
+#include "protocol.h"
+
+
+// Named statement prepared on the server. The parameter types and the
+// result fields are described once, so executing it needs no type guessing
+// for the parameters and no RowDescription for the rows.
+typedef struct {
+    PyObject_HEAD
+    PyObject *name;
+    PyObject *query;
+    PyObject *parameter_types;     // tuple of type oids
+    PyObject *fields;              // tuple of FieldDescription, or None
+    uint32_t *param_oids;
+    int16_t nparams;
+    field_converter *converters;   // per field, NULL without fields
+} Statement;
+
+extern PyType_Spec StatementSpec;
+
+Statement *Statement_create(
+    PoqaioState *, PyObject *name, PyObject *query, PyObject *parameter_types,
+    PyObject *fields);
+
+#endif
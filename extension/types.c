@@ -1,10 +1,11 @@
 #include "poqaio.h"
 #include "protocol.h"
+#include "state.h"
 #include "types.h"
 
 
 static PyObject *
-convert_long_result(BaseProt *self, char *data, int32_t size) {
+convert_long_result(PoqaioState *state, char *data, int32_t size) {
 
     PyObject *ret;
     char *end;
@@ -18,7 +19,7 @@ convert_long_result(BaseProt *self, char *data, int32_t size) {
     if (end != data + size && ret != NULL) {
         Py_DECREF(ret);
         PyErr_SetString(
-            PoqaioProtocolError, "Remaining data when parsing integer value");
+            state->ProtocolError, "Remaining data when parsing integer value");
         return NULL;
     }
     return ret;
@@ -26,7 +27,7 @@ convert_long_result(BaseProt *self, char *data, int32_t size) {
 
 
 static PyObject *
-convert_float_result(BaseProt *self, char *data, int32_t size) {
+convert_float_result(PoqaioState *state, char *data, int32_t size) {
     double val;
     char bval[size + 1];
     char *pend;
@@ -34,11 +35,11 @@ convert_float_result(BaseProt *self, char *data, int32_t size) {
     memcpy(bval, data, size);
     bval[size] = '\0';
 
-    val = PyOS_string_to_double(bval, &pend, PoqaioProtocolError);
+    val = PyOS_string_to_double(bval, &pend, state->ProtocolError);
     if (val == -1.0 && PyErr_Occurred())
         return NULL;
     if (pend != bval + size) {
-        PyErr_SetString(PoqaioProtocolError, "Invalid floating point value");
+        PyErr_SetString(state->ProtocolError, "Invalid floating point value");
         return NULL;
     }
     return PyFloat_FromDouble(val);
@@ -46,26 +47,115 @@ convert_float_result(BaseProt *self, char *data, int32_t size) {
 
 
 PyObject *
-convert_text_result(BaseProt *self, char *data, int32_t size) {
+convert_text_result(PoqaioState *state, char *data, int32_t size) {
     return PyUnicode_FromStringAndSize(data, size);
 }
 
 PyObject *
-convert_bool_result(BaseProt *self, char *data, int32_t size) {
+convert_bool_result(PoqaioState *state, char *data, int32_t size) {
     if (size != 1) {
-        PyErr_SetString(PoqaioProtocolError, "Invalid length for bool value");
+        PyErr_SetString(state->ProtocolError, "Invalid length for bool value");
         return NULL;
     }
     if (*data == 't')
         Py_RETURN_TRUE;
     if (*data == 'f')
         Py_RETURN_FALSE;
-    PyErr_SetString(PoqaioProtocolError, "Invalid value for bool value");
+    PyErr_SetString(state->ProtocolError, "Invalid value for bool value");
     return NULL;
 }
 
-converter
-get_converter(uint32_t oid)
+int
+parse_int64(const char *data, int32_t size, int64_t *val)
+{
+    const char *end = data + size;
+    uint64_t acc = 0, limit = INT64_MAX;
+    int negative = 0;
+
+    if (size > 0 && *data == '-') {
+        negative = 1;
+        limit = (uint64_t)INT64_MAX + 1;
+        data++;
+    }
+    if (data == end) {
+        return -1;
+    }
+    for (; data < end; data++) {
+        unsigned int digit = (unsigned char)*data - '0';
+
+        if (digit > 9 || acc > (limit - digit) / 10) {
+            return -1;
+        }
+        acc = acc * 10 + digit;
+    }
+    *val = negative ? (int64_t)(0 - acc) : (int64_t)acc;
+    return 0;
+}
+
+
+int
+parse_double(const char *data, int32_t size, double *val)
+{
+    // strtod depends on LC_NUMERIC, which Python leaves at "C"
+    char buf[64], *end;
+
+    if (size <= 0 || size >= (int32_t)sizeof(buf)) {
+        return -1;
+    }
+    memcpy(buf, data, size);
+    buf[size] = '\0';
+    *val = strtod(buf, &end);
+    return end == buf + size ? 0 : -1;
+}
+
+
+int
+parse_bool(const char *data, int32_t size, char *val)
+{
+    if (size != 1 || (*data != 't' && *data != 'f')) {
+        return -1;
+    }
+    *val = *data == 't';
+    return 0;
+}
+
+
+static int
+hex_value(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+
+int
+parse_bytea_hex(const char *data, int32_t size, char *dest)
+{
+    // Decodes bytea in hex output format into (size - 2) / 2 bytes
+    const char *end = data + size;
+
+    if (size < 2 || size % 2 || data[0] != '\\' || data[1] != 'x') {
+        return -1;
+    }
+    for (data += 2; data < end; data += 2) {
+        int high = hex_value(data[0]), low = hex_value(data[1]);
+
+        if (high == -1 || low == -1) {
+            return -1;
+        }
+        *dest++ = (char)(high << 4 | low);
+    }
+    return 0;
+}
+
+
+conv_kind
+get_conv_kind(uint32_t oid)
 {
     switch(oid) {
         case INT2OID:
@@ -74,11 +164,27 @@ get_converter(uint32_t oid)
         case OIDOID:
         case XIDOID:
         case CIDOID:
-            return convert_long_result;
+            return CONV_INT;
         case FLOAT4OID:
         case FLOAT8OID:
-            return convert_float_result;
+            return CONV_FLOAT;
         case BOOLOID:
+            return CONV_BOOL;
+        default:
+            return CONV_TEXT;
+    }
+}
+
+
+converter
+get_converter(uint32_t oid)
+{
+    switch(get_conv_kind(oid)) {
+        case CONV_INT:
+            return convert_long_result;
+        case CONV_FLOAT:
+            return convert_float_result;
+        case CONV_BOOL:
             return convert_bool_result;
         default:
             return convert_text_result;
@@ -123,6 +229,7 @@ fill_int8_param(Param *param, int64_t val)
     param->format = 1;
     param->ctx.val64 = val;
     param->size = sizeof(int64_t);
+    param->write = write_int8;
     return 0;
 }
 
@@ -202,7 +309,7 @@ int fill_bool_param(Param *param, PyObject *py_param)
 
 int write_float(Param *param, char *dest)
 {
-    if (_PyFloat_Pack8(param->ctx.dval, (unsigned char *)dest, 0) < 0) {
+    if (PyFloat_Pack8(param->ctx.dval, (void *)dest, 0) < 0) {
         return -1;
     }
     return 0;
@@ -258,3 +365,205 @@ fill_param(Param *param, PyObject *py_param)
     }
     return fill_txt_param(param, py_param);
 }
+
+
+
+int write_int2(Param *param, char *dest) {
+    int16_t val;
+
+    val = htobe16((int16_t)param->ctx.val32);
+    memcpy(dest, &val, sizeof(int16_t));
+    return 0;
+}
+
+
+int write_binary_bool(Param *param, char *dest)
+{
+    dest[0] = param->py_val == Py_True;
+    return 0;
+}
+
+
+int write_bytes(Param *param, char *dest)
+{
+    memcpy(dest, PyBytes_AS_STRING(param->py_val), param->size);
+    return 0;
+}
+
+
+static int
+fill_typed_int_param(Param *param, uint32_t oid, PyObject *py_param)
+{
+    // Binary integer of the parameter type, or text when out of range, in
+    // which case the server reports the error
+    int overflow;
+    long long val;
+
+    val = PyLong_AsLongLongAndOverflow(py_param, &overflow);
+    if (val == -1 && PyErr_Occurred()) {
+        return -1;
+    }
+    if (overflow) {
+        return fill_txt_param(param, py_param);
+    }
+    switch (oid) {
+        case INT2OID:
+            if (val < INT16_MIN || val > INT16_MAX) {
+                return fill_txt_param(param, py_param);
+            }
+            fill_int4_param(param, (int32_t)val);
+            param->size = sizeof(int16_t);
+            param->write = write_int2;
+            break;
+        case INT4OID:
+            if (val < INT32_MIN || val > INT32_MAX) {
+                return fill_txt_param(param, py_param);
+            }
+            fill_int4_param(param, (int32_t)val);
+            break;
+        case OIDOID:
+            if (val < 0 || val > UINT32_MAX) {
+                return fill_txt_param(param, py_param);
+            }
+            fill_int4_param(param, (int32_t)(uint32_t)val);
+            break;
+        case FLOAT8OID:
+            // exact as double
+            if (val < -(1LL << 53) || val > (1LL << 53)) {
+                return fill_txt_param(param, py_param);
+            }
+            param->oid = FLOAT8OID;
+            param->format = 1;
+            param->size = 8;
+            param->ctx.dval = (double)val;
+            param->write = write_float;
+            return 0;
+        default:
+            fill_int8_param(param, val);
+    }
+    return 0;
+}
+
+
+int
+fill_typed_param(Param *param, uint32_t oid, PyObject *py_param)
+{
+    // Encodes the parameter for the type the server expects, as described
+    // for a prepared statement. Values that have no binary encoding for the
+    // type are sent as text, for the server to convert.
+    PyTypeObject *typ = Py_TYPE(py_param);
+
+    if (py_param == Py_None) {
+        param->size = -1;
+        return 0;
+    }
+    switch (oid) {
+        case INT2OID:
+        case INT4OID:
+        case INT8OID:
+        case OIDOID:
+            if (typ == &PyLong_Type) {
+                return fill_typed_int_param(param, oid, py_param);
+            }
+            break;
+        case FLOAT8OID:
+            if (typ == &PyFloat_Type) {
+                return fill_float_param(param, py_param);
+            }
+            if (typ == &PyLong_Type) {
+                return fill_typed_int_param(param, oid, py_param);
+            }
+            break;
+        case BOOLOID:
+            if (typ == &PyBool_Type) {
+                param->format = 1;
+                param->size = 1;
+                param->py_val = py_param;
+                param->write = write_binary_bool;
+                return 0;
+            }
+            break;
+        case BYTEAOID:
+            if (typ == &PyBytes_Type) {
+                Py_INCREF(py_param);
+                param->format = 1;
+                param->size = PyBytes_GET_SIZE(py_param);
+                param->py_val = py_param;
+                param->write = write_bytes;
+                param->free = free_obj_param;
+                return 0;
+            }
+            break;
+    }
+    if (typ == &PyUnicode_Type) {
+        return fill_str_param(param, py_param);
+    }
+    return fill_txt_param(param, py_param);
+}
+
+
+PyObject *
+encode_parameters(PyObject *module, PyObject *py_params)
+{
+    // Returns the parameters as bytes, encoded like in a Bind message and
+    // preceded by the type oid. Equal bytes mean the server gets the same
+    // parameters, which makes it usable as cache key.
+    PyObject *fast, *ret = NULL, **items;
+    Param *params;
+    Py_ssize_t i, num_params, size = 0;
+    char *pos;
+    uint32_t val32;
+
+    if (py_params == Py_None) {
+        return PyBytes_FromStringAndSize(NULL, 0);
+    }
+    fast = PySequence_Fast(
+        py_params, "Parameters must be a sequence or None");
+    if (fast == NULL) {
+        return NULL;
+    }
+    num_params = PySequence_Fast_GET_SIZE(fast);
+    items = PySequence_Fast_ITEMS(fast);
+    params = PyMem_Calloc(num_params + 1, sizeof(Param));
+    if (params == NULL) {
+        Py_DECREF(fast);
+        return PyErr_NoMemory();
+    }
+    for (i = 0; i < num_params; i++) {
+        if (fill_param(params + i, items[i]) == -1) {
+            goto end;
+        }
+        size += 8 + (params[i].size > 0 ? params[i].size : 0);
+    }
+    ret = PyBytes_FromStringAndSize(NULL, size);
+    if (ret == NULL) {
+        goto end;
+    }
+    pos = PyBytes_AS_STRING(ret);
+    for (i = 0; i < num_params; i++) {
+        Param *param = params + i;
+
+        val32 = htobe32(param->oid);
+        memcpy(pos, &val32, 4);
+        val32 = htobe32((uint32_t)param->size);
+        memcpy(pos + 4, &val32, 4);
+        pos += 8;
+        if (param->size > 0) {
+            if (param->write(param, pos) == -1) {
+                Py_CLEAR(ret);
+                goto end;
+            }
+            pos += param->size;
+        }
+    }
+end:
+    // params after a failing one are not filled and have no free function
+    for (i = 0; i < num_params; i++) {
+        if (params[i].free) {
+            params[i].free(params + i);
+        }
+    }
+    PyMem_Free(params);
+    Py_DECREF(fast);
+    return ret;
+}
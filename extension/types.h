@@ -30,5 +30,14 @@ typedef struct _Param {
 } Param;
 
 int fill_param(Param *, PyObject *);
+int fill_typed_param(Param *, uint32_t oid, PyObject *);
+PyObject *encode_parameters(PyObject *module, PyObject *params);
+
+// Parsing of text values, without GIL and without setting exceptions.
+// Return 0 on success, -1 for an invalid value.
+int parse_int64(const char *data, int32_t size, int64_t *val);
+int parse_double(const char *data, int32_t size, double *val);
+int parse_bool(const char *data, int32_t size, char *val);
+int parse_bytea_hex(const char *data, int32_t size, char *dest);
 
 #endif
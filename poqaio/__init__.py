@@ -1,8 +1,16 @@
-from .connection import connect
-from ._poqaio import Error, ProtocolError, ServerError
+from .cache import ResultCache
+from .connection import PreparedStatement, connect
+from .pool import Pool, create_pool
+from .replicas import ReplicaPool, create_replica_pool
+from ._poqaio import (
+    Error, Notice, ProtocolError, RawRows, RecordBatch, ROW_DICT,
+    ROW_RECORD, ROW_TUPLE, ServerError, global_stats)
 from .public_const import *
 
-__all__ = (['connect', 'Error', 'ProtocolError', 'ServerError'] +
+__all__ = (['connect', 'create_pool', 'create_replica_pool', 'Error',
+            'Notice', 'Pool', 'PreparedStatement', 'ProtocolError',
+            'RawRows', 'RecordBatch', 'ReplicaPool', 'ResultCache', 'ROW_DICT', 'ROW_RECORD', 'ROW_TUPLE',
+            'ServerError', 'global_stats'] +
            [n for n in dir(public_const) if not n.startswith('_')])  # noqa
 
 __version__ = "0.3.4"
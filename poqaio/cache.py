@@ -0,0 +1,191 @@
+"""Client side cache of query results.
+
+Results are cached by query text and parameters, encoded as they are sent
+to the server. Entries expire after their time to live and are evicted
+least recently used first, when there are too many or they take too much
+memory. Entries are tagged, for example with the tables that a query reads,
+so they can be invalidated when the tables change, also by notifications
+of the server:
+
+    cache = ResultCache(max_bytes=16 << 20, ttl=60)
+    conn.set_result_cache(cache)
+    await cache.listen(conn)
+    rows = await conn.execute_cached(
+        "SELECT * FROM countries", tags=["countries"])
+
+A trigger then runs pg_notify('poqaio_cache', 'countries') to invalidate
+the entries tagged countries.
+"""
+import asyncio
+import collections
+import time
+
+from ._poqaio import encode_parameters
+
+
+def _freeze(results):
+    # Results as shared by hits: a tuple of results with the data as tuple
+    return tuple(
+        type(res)((res.fields, tuple(res.data), res.tag))
+        if isinstance(res.data, list) else res
+        for res in results)
+
+
+class _Entry:
+    __slots__ = ('results', 'size', 'tags', 'expires')
+
+    def __init__(self, results, size, tags, expires):
+        self.results = results
+        self.size = size
+        self.tags = tags
+        self.expires = expires
+
+
+class ResultCache:
+    """Least recently used cache of query results.
+
+    Max_entries and max_bytes bound the number and total size of the
+    entries, the size being the number of bytes received for a result. Ttl
+    is the default time to live in seconds, None to keep entries until
+    evicted or invalidated.
+
+    Cached results are shared by all hits. The data of results is stored as
+    a tuple, but the rows are only immutable for the ROW_TUPLE and
+    ROW_RECORD row factories. A cache can be shared by connections to the
+    same database as the same user.
+    """
+
+    def __init__(self, max_entries=1024, max_bytes=16 << 20, ttl=None):
+        self.max_entries = max_entries
+        self.max_bytes = max_bytes
+        self.ttl = ttl
+        self.hits = 0
+        self.misses = 0
+        self.evictions = 0
+        self.nbytes = 0
+        self._entries = collections.OrderedDict()
+        self._tags = {}                  # tag -> set of keys
+        self._pending = {}               # key -> future of running query
+        self._generations = {}           # tag -> number of invalidations
+        self._clears = 0
+
+    def __len__(self):
+        return len(self._entries)
+
+    @staticmethod
+    def key(query, parameters, row_factory=None):
+        return query, encode_parameters(parameters), row_factory
+
+    def get(self, key):
+        """Returns the cached results for key, or None."""
+        entry = self._entries.get(key)
+        if entry is None:
+            return None
+        if entry.expires is not None and entry.expires <= time.monotonic():
+            self._remove(key)
+            return None
+        self._entries.move_to_end(key)
+        return entry.results
+
+    def put(self, key, results, size, tags=(), ttl=None):
+        """Stores results for key and returns the immutable results."""
+        results = _freeze(results)
+        if size > self.max_bytes:
+            return results
+        if key in self._entries:
+            self._remove(key)
+        ttl = self.ttl if ttl is None else ttl
+        tags = frozenset(tags)
+        self._entries[key] = _Entry(
+            results, size, tags,
+            None if ttl is None else time.monotonic() + ttl)
+        self.nbytes += size
+        for tag in tags:
+            self._tags.setdefault(tag, set()).add(key)
+        while (len(self._entries) > self.max_entries or
+               self.nbytes > self.max_bytes):
+            self._remove(next(iter(self._entries)))
+            self.evictions += 1
+        return results
+
+    def _remove(self, key):
+        entry = self._entries.pop(key)
+        self.nbytes -= entry.size
+        for tag in entry.tags:
+            keys = self._tags[tag]
+            keys.discard(key)
+            if not keys:
+                del self._tags[tag]
+
+    def invalidate(self, *tags):
+        """Removes the entries with any of the tags."""
+        for tag in tags:
+            self._generations[tag] = self._generations.get(tag, 0) + 1
+            for key in list(self._tags.get(tag, ())):
+                self._remove(key)
+
+    def _generation(self, tags):
+        return self._clears, [self._generations.get(tag, 0) for tag in tags]
+
+    def clear(self):
+        self._clears += 1
+        self._generations.clear()
+        self._entries.clear()
+        self._tags.clear()
+        self.nbytes = 0
+
+    async def fetch(self, key, execute, tags=(), ttl=None):
+        """Returns the cached results, or the results of awaiting execute().
+
+        Execute returns the results and their size. Concurrent misses for
+        the same key share a single execution. Results are not stored when
+        one of the tags is invalidated while executing, they might be stale.
+        """
+        results = self.get(key)
+        if results is not None:
+            self.hits += 1
+            return results
+        pending = self._pending.get(key)
+        if pending is not None:
+            self.hits += 1
+            return await asyncio.shield(pending)
+        self.misses += 1
+        fut = asyncio.get_running_loop().create_future()
+        self._pending[key] = fut
+        tags = frozenset(tags)
+        generation = self._generation(tags)
+        try:
+            results, size = await execute()
+            results = _freeze(results)
+            if generation == self._generation(tags):
+                results = self.put(key, results, size, tags, ttl)
+        except Exception as exc:
+            fut.set_exception(exc)
+            # retrieved, waiters get their own copy
+            fut.exception()
+            raise
+        except BaseException:
+            fut.cancel()
+            raise
+        else:
+            fut.set_result(results)
+        finally:
+            del self._pending[key]
+        return results
+
+    def _notified(self, conn, pid, channel, payload):
+        if payload:
+            self.invalidate(*(tag.strip() for tag in payload.split(',')))
+        else:
+            self.clear()
+
+    async def listen(self, conn, channel='poqaio_cache'):
+        """Invalidate on notifications on channel, received by conn.
+
+        The payload is a comma separated list of tags, an empty payload
+        clears the cache.
+        """
+        await conn.add_listener(channel, self._notified)
+
+    async def unlisten(self, conn, channel='poqaio_cache'):
+        await conn.remove_listener(channel, self._notified)
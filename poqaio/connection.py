@@ -3,8 +3,13 @@ import getpass
 import os.path
 import sys
 
+from ._poqaio import (
+    ColumnSink, Error, RESULT_ARROW, RESULT_COLUMNS, RESULT_RAW,
+    RESULT_TUPLES)
 from .common import TransactionStatus
 from .protocol import PGProtocol
+from .replication import ReplicationStream, format_lsn
+from .transport import open_direct
 
 
 class Result:
@@ -13,7 +18,7 @@ class Result:
         self._results = results
 
 
-class Connection:
+class BaseConnection:
     def __init__(
             self, protocol, host, port, database, user, application_name,
             fallback_application_name):
@@ -24,12 +29,8 @@ class Connection:
         self.database = database
         self.user = user
         self._application_name = application_name or fallback_application_name
-        self._execute_lock = asyncio.Lock()
-
-    async def _startup(self, password):
-#         print("starting up")
-        await self._protocol.startup(
-            self.user, self.database, self._application_name, password)
+        self._row_factory = None
+        self._statement_count = 0
 
     @property
     def application_name(self):
@@ -67,9 +68,473 @@ class Connection:
     def status_parameters(self):
         return self._protocol.status_parameters
 
-    async def execute(self, query, parameters=None):
+    @property
+    def stats(self):
+        return self._protocol.stats
+
+    def set_timeline_sink(self, sink):
+        """Record timelines of executed queries.
+
+        The sink is either a callable that receives each Timeline, the
+        capacity of a ring buffer that is emptied by drain_timelines() or
+        None to stop recording.
+        """
+        self._protocol.set_timeline_sink(sink)
+
+    def drain_timelines(self):
+        return self._protocol.drain_timelines()
+
+    def set_notice_handler(self, handler):
+        """Call handler with a Notice for each notice of the server.
+
+        Notices are ignored without handler, use None to remove it. The
+        handler is called while receiving, exceptions it raises are
+        reported as unraisable.
+        """
+        self._protocol.set_notice_handler(handler)
+
+    def set_row_factory(self, factory):
+        """Set how the rows of executed queries are made.
+
+        Factory is ROW_TUPLE (or None) for tuples, ROW_RECORD for tuples
+        with the field names as attributes, ROW_DICT for dicts, or a
+        callable, like a class, that is called with the values as keyword
+        arguments. The rows are made while receiving, it can also be passed
+        per query to execute().
+        """
+        self._protocol.set_row_factory(factory)
+        self._row_factory = factory
+
+    def set_memory_budget(self, nbytes):
+        """Limit the memory of the rows of executed queries.
+
+        When the data rows received for a query exceed nbytes, the remaining
+        rows of its results are written undecoded to a temporary file, that
+        is mapped in memory when the result is complete. Such a result has a
+        RawRows sequence as data, that decodes the spilled rows when they are
+        accessed. Use None for no limit, it can also be passed per query to
+        execute(). Arrow and column results are not affected.
+        """
+        self._protocol.set_memory_budget(nbytes)
+
+    @property
+    def result_bytes(self):
+        """Bytes of data rows received for the last query."""
+        return self._protocol.result_bytes
+
+    def _statement_name(self):
+        # unique per connection
+        self._statement_count += 1
+        return f"poqaio_stmt_{self._statement_count}"
+
+    def set_decode_pool(self, executor, chunk_size=1 << 20):
+        """Decode the rows of results in threads of the executor.
+
+        The received data rows are collected in chunks of about chunk_size
+        bytes, that are decoded into columns by the executor threads without
+        holding the GIL. Only creating the row tuples happens in the event
+        loop thread, after the last row is received. Use None to decode in
+        the event loop thread again.
+        """
+        self._protocol.set_decode_pool(
+            None if executor is None else executor.submit, chunk_size)
+
+
+class PreparedStatement:
+    """Named statement prepared on the server, see Connection.prepare.
+
+    The methods are those of the connection with the statement as query,
+    so they are coroutines for an asyncio connection.
+    """
+
+    def __init__(self, conn, statement):
+        self._conn = conn
+        self._statement = statement
+
+    @property
+    def name(self):
+        return self._statement.name
+
+    @property
+    def query(self):
+        return self._statement.query
+
+    @property
+    def parameter_types(self):
+        """Type oid per parameter, as described by the server."""
+        return self._statement.parameter_types
+
+    @property
+    def fields(self):
+        """FieldDescription per result column, or None."""
+        return self._statement.fields
+
+    def execute(self, parameters=None, *, row_factory=None,
+                memory_budget=None):
+        return self._conn.execute(
+            self._statement, parameters, row_factory=row_factory,
+            memory_budget=memory_budget)
+
+    def fetch_arrow(self, parameters=None):
+        return self._conn.fetch_arrow(self._statement, parameters)
+
+    def fetch_raw(self, parameters=None, *, row_factory=None):
+        return self._conn.fetch_raw(
+            self._statement, parameters, row_factory=row_factory)
+
+    def fetch_into(self, buffers, parameters=None, **kwargs):
+        return self._conn.fetch_into(
+            self._statement, buffers, parameters, **kwargs)
+
+    def close(self):
+        """Deallocate the statement on the server."""
+        return self._conn.execute(f"DEALLOCATE {quote_ident(self.name)}")
+
+
+_isolation_levels = {
+    'read_committed': 'READ COMMITTED',
+    'repeatable_read': 'REPEATABLE READ',
+    'serializable': 'SERIALIZABLE',
+    'read_uncommitted': 'READ UNCOMMITTED',
+}
+
+
+class Transaction:
+    """Transaction block, or savepoint when nested.
+
+    Nothing is sent when entering the block. The BEGIN or SAVEPOINT
+    statement is sent together with the first query, and the COMMIT or
+    RELEASE statement together with the query passed to commit().
+    """
+
+    def __init__(self, conn, isolation=None, readonly=False,
+                 deferrable=False):
+        if isolation is not None and isolation not in _isolation_levels:
+            raise ValueError(f"Invalid isolation level: {isolation}")
+        self._conn = conn
+        self._isolation = isolation
+        self._readonly = readonly
+        self._deferrable = deferrable
+        self._savepoint = None
+        self._started = False
+        self._done = False
+
+    def _begin_statement(self):
+        if self._savepoint:
+            return f"SAVEPOINT {self._savepoint}"
+        stmt = "BEGIN"
+        if self._isolation:
+            stmt += f" ISOLATION LEVEL {_isolation_levels[self._isolation]}"
+        if self._readonly:
+            stmt += " READ ONLY"
+        if self._deferrable:
+            stmt += " DEFERRABLE"
+        return stmt
+
+    def _end_statements(self, commit):
+        if self._savepoint is None:
+            return ("COMMIT" if commit else "ROLLBACK",)
+        if commit:
+            return (f"RELEASE SAVEPOINT {self._savepoint}",)
+        return (f"ROLLBACK TO SAVEPOINT {self._savepoint}",
+                f"RELEASE SAVEPOINT {self._savepoint}")
+
+    async def __aenter__(self):
+        conn = self._conn
+        if self._started or self._done:
+            raise Error("Transaction already used")
+        if conn._transactions:
+            if self._isolation or self._readonly or self._deferrable:
+                raise Error(
+                    "Nested transaction can not have options")
+            self._savepoint = f"poqaio_sp_{len(conn._transactions)}"
+        elif conn.transaction_status != TransactionStatus.IDLE:
+            raise Error("Connection is already in a transaction")
+        conn._transactions.append(self)
+        return self
+
+    async def __aexit__(self, exc_type, exc, tb):
+        try:
+            if not self._done:
+                await self._end(exc_type is None)
+        finally:
+            self._conn._transactions.remove(self)
+
+    async def _end(self, commit):
+        self._done = True
+        status = self._conn.transaction_status
+        if not self._started or (
+                self._savepoint is None and status == TransactionStatus.IDLE):
+            # no query was executed or the transaction ended already
+            return
+        failed = status == TransactionStatus.ERROR
+        await self._conn._execute_statements(
+            self._end_statements(commit and not failed))
+        if commit and failed:
+            raise Error("Transaction failed and is rolled back")
+
+    async def commit(self, query=None, parameters=None, *, row_factory=None):
+        """Commit the transaction, or release the savepoint.
+
+        When a query is given it is executed first, in the same round trip.
+        Returns the results of the query.
+        """
+        if self._done:
+            raise Error("Transaction is already finished")
+        if query is None:
+            await self._end(True)
+            return None
+        self._done = True
+        try:
+            async with self._conn._execute_lock:
+                return await self._conn._execute_in_transaction(
+                    query, parameters, None, RESULT_TUPLES, None,
+                    self._end_statements(True), row_factory)
+        except BaseException:
+            # the commit statement is skipped when the query fails
+            self._done = False
+            raise
+
+    async def rollback(self):
+        """Roll back the transaction, or to the savepoint."""
+        if self._done:
+            raise Error("Transaction is already finished")
+        await self._end(False)
+
+
+class Connection(BaseConnection):
+    def __init__(self, *args):
+        super().__init__(*args)
+        self._execute_lock = asyncio.Lock()
+        self._transactions = []     # stack of entered Transactions
+        self._listeners = {}        # channel -> callbacks
+        self._result_cache = None
+
+    def transaction(self, isolation=None, readonly=False, deferrable=False):
+        """Return a Transaction, for use as asynchronous context manager.
+
+        Isolation is one of 'read_committed', 'repeatable_read',
+        'serializable' and 'read_uncommitted', or None for the default.
+        A nested transaction uses a savepoint.
+
+            async with conn.transaction() as tr:
+                await conn.execute("INSERT ...")
+                await tr.commit("UPDATE ...")
+
+        """
+        return Transaction(self, isolation, readonly, deferrable)
+
+    async def _execute_in_transaction(
+            self, query, parameters, callback=None,
+            result_format=RESULT_TUPLES, sink=None, after=(),
+            row_factory=None, memory_budget=None):
+        # Executes query, preceded by the BEGIN or SAVEPOINT statements of
+        # entered transactions that did not start yet
+        before = ()
+        pending = [tr for tr in self._transactions if not tr._started]
+        if pending:
+            before = tuple(tr._begin_statement() for tr in pending)
+            for tr in pending:
+                tr._started = True
+        try:
+            results = await self._execute(
+                query, parameters, callback, result_format, sink, before,
+                after, row_factory, memory_budget)
+        except BaseException:
+            if pending and self.transaction_status == TransactionStatus.IDLE:
+                # the query failed before BEGIN ran, send it with the next
+                for tr in pending:
+                    tr._started = False
+            raise
+        if results and (before or after):
+            results = results[len(before):len(results) - len(after)]
+        return results
+
+    async def _execute_statements(self, statements):
+        async with self._execute_lock:
+            await self._execute(statements[0], None, None, RESULT_TUPLES,
+                                None, (), statements[1:])
+
+    async def _startup(
+            self, password, options=None, warmup=None, replication=None):
+#         print("starting up")
+        await self._protocol.startup(
+            self.user, self.database, self._application_name, password,
+            options, warmup, replication)
+
+    async def execute(
+            self, query, parameters=None, *, row_factory=None,
+            memory_budget=None):
+        """Execute query and return the results.
+
+        Row factory and memory budget override the ones of the connection
+        for this query, see set_row_factory and set_memory_budget.
+        """
+        async with self._execute_lock:
+            return await self._execute_in_transaction(
+                query, parameters, row_factory=row_factory,
+                memory_budget=memory_budget)
+
+    async def prepare(self, query, name=None):
+        """Prepare query as named statement and return a PreparedStatement.
+
+        The server describes the types of the parameters and the result
+        columns once. Executing the statement sends the parameters in the
+        binary format of their described type where possible, instead of
+        guessing the type from the Python value, and the rows are made
+        without RowDescription. Name defaults to one that is unique for the
+        connection.
+        """
+        async with self._execute_lock:
+            statement = await self._protocol.prepare(
+                name or self._statement_name(), query)
+        return PreparedStatement(self, statement)
+
+    def set_result_cache(self, cache):
+        """Use a poqaio.cache.ResultCache for execute_cached, or None."""
+        self._result_cache = cache
+
+    async def execute_cached(
+            self, query, parameters=None, *, tags=(), ttl=None,
+            row_factory=None):
+        """Execute query or return its cached results.
+
+        Results are stored in the result cache of the connection with the
+        tags and time to live (seconds, None for the default of the cache).
+        Within a transaction, or without cache, the query is executed
+        normally.
+        """
+        cache = self._result_cache
+        if (cache is None or self._transactions or
+                self.transaction_status != TransactionStatus.IDLE):
+            return await self.execute(
+                query, parameters, row_factory=row_factory)
+        if row_factory is None:
+            row_factory = self._row_factory
+        key = cache.key(query, parameters, row_factory)
+
+        async def execute():
+            async with self._execute_lock:
+                received = self._protocol.stats.bytes_received
+                results = await self._execute(
+                    query, parameters, None, RESULT_TUPLES, None, None, None,
+                    row_factory)
+                return results, self._protocol.stats.bytes_received - received
+
+        return await cache.fetch(key, execute, tags, ttl)
+
+    def _notify(self, pid, channel, payload):
+        for callback in list(self._listeners.get(channel, ())):
+            try:
+                callback(self, pid, channel, payload)
+            except Exception as exc:
+                loop = asyncio.get_running_loop()
+                loop.call_exception_handler({
+                    'message': "Exception in notification callback",
+                    'exception': exc,
+                })
+
+    async def add_listener(self, channel, callback):
+        """Call callback(connection, pid, channel, payload) on notifications.
+
+        The connection executes LISTEN for the channel when it gets its
+        first callback.
+        """
+        listeners = self._listeners.get(channel)
+        if listeners is None:
+            self._protocol.set_notification_handler(self._notify)
+            listeners = self._listeners[channel] = []
+            try:
+                await self.execute(f"LISTEN {quote_ident(channel)}")
+            except BaseException:
+                del self._listeners[channel]
+                raise
+        listeners.append(callback)
+
+    async def remove_listener(self, channel, callback):
+        listeners = self._listeners.get(channel)
+        if listeners is None or callback not in listeners:
+            return
+        listeners.remove(callback)
+        if not listeners:
+            del self._listeners[channel]
+            await self.execute(f"UNLISTEN {quote_ident(channel)}")
+
+    async def fetch_arrow(self, query, parameters=None):
+        """Execute query and return the rows of the last result in columns.
+
+        The returned RecordBatch implements the Arrow PyCapsule interface,
+        for example pyarrow.record_batch(batch) converts it without copying.
+        No Python objects are created for the values.
+        """
         async with self._execute_lock:
-            return await self._execute(query, parameters)
+            results = await self._execute_in_transaction(
+                query, parameters, None, RESULT_ARROW)
+        return last_batch(results)
+
+    async def fetch_raw(self, query, parameters=None, *, row_factory=None):
+        """Execute query and return the rows of the last result undecoded.
+
+        The returned RawRows keeps the data row messages as received and
+        decodes a row when it is accessed. It can be exported into shared
+        memory for other processes, see poqaio.shared.
+        """
+        async with self._execute_lock:
+            results = await self._execute_in_transaction(
+                query, parameters, None, RESULT_RAW, row_factory=row_factory)
+        return last_batch(results)
+
+    async def fetch_into(
+            self, query, buffers, parameters=None, *, nulls=None,
+            on_chunk=None):
+        """Execute query and write the values in the given buffers.
+
+        Buffers is a sequence with a writable buffer (bytearray,
+        array.array, numpy array...) or None per column. The buffer format
+        determines the type written, a bytes buffer gets values in the width
+        of the column type. Integer, float and bool columns are supported.
+
+        Nulls is an optional sequence with a byte per row buffer or None per
+        column, that is set to 1 for null values. Without null mask, null
+        becomes NaN for floats and is an error for other types.
+
+        When the buffers are full, on_chunk is called with the number of
+        rows in the buffers, after which writing starts at the beginning
+        again. It is also called for the rows of the last chunk. Without
+        on_chunk, bytearray buffers grow as needed and are trimmed to the
+        received rows.
+
+        Returns the total number of rows.
+        """
+        sink = ColumnSink(buffers, nulls, on_chunk)
+        async with self._execute_lock:
+            await self._execute_in_transaction(
+                query, parameters, None, RESULT_COLUMNS, sink)
+        return sink.total_rows
+
+    def start_replication(
+            self, slot, publication_names, start_lsn=0, *, proto_version=1,
+            feedback_interval=10.0, max_pending=16, auto_acknowledge=True):
+        """Return a ReplicationStream of the logical replication slot.
+
+        The connection must be opened with replication="database" and the
+        slot must use the pgoutput plugin. Streaming starts at start_lsn, or
+        at the position confirmed before when it is 0. A standby status
+        update is sent every feedback_interval seconds. When max_pending
+        batches are not consumed yet, the connection stops reading.
+        Without auto_acknowledge, the consumer calls acknowledge(lsn)
+        itself. The connection can not be used for queries while the
+        stream is open. See poqaio.replication.
+        """
+        publications = ','.join(
+            quote_ident(name) for name in publication_names)
+        query = (
+            f"START_REPLICATION SLOT {quote_ident(slot)} LOGICAL "
+            f"{format_lsn(start_lsn)} (proto_version '{int(proto_version)}', "
+            f"publication_names {quote_literal(publications)})")
+        return ReplicationStream(
+            self, query, start_lsn, feedback_interval, max_pending,
+            auto_acknowledge)
 
     async def close(self):
         if self._execute_lock.locked():
@@ -81,26 +546,34 @@ class Connection:
             self._protocol.close()
 
 
-async def connect(
-        host=None, port=None, database=None, user=None, password=None,
-        # passfile=None,
-        connect_timeout=None, application_name=None,
-        fallback_application_name=None, **conn_kwargs):
+def quote_ident(name):
+    return '"' + name.replace('"', '""') + '"'
 
-    # TODO:
-    #    support already connected socket?
-    #    support SSL
 
+def quote_literal(value):
+    return "'" + value.replace("'", "''") + "'"
+
+
+def last_batch(results):
+    for result in reversed(results or ()):
+        if result.fields is not None:
+            return result.data
+
+
+def startup_options(server_settings):
+    """Returns the options startup parameter that applies the settings."""
+    if not server_settings:
+        return None
+    return ' '.join(
+        '-c ' + f"{name}={value}".replace('\\', '\\\\').replace(' ', '\\ ')
+        for name, value in server_settings.items())
+
+
+def resolve_address(host, port):
+    """Returns host, port and unix socket path (or None) to connect to."""
     if port is None:
         port = 5432
     port = int(port)
-    if user is None:
-        user = getpass.getuser()
-
-    if fallback_application_name is None:
-        fallback_application_name = 'poqaio'
-
-    loop = asyncio.get_running_loop()
     if not host:
         if sys.platform == 'win32':
             host = 'localhost'
@@ -116,7 +589,161 @@ async def connect(
         path = f"{host}{'' if host.endswith('/') else '/'}.s.PGSQL.{port}"
     else:
         path = None
-    if path is not None:
+    return host, port, path
+
+
+def parse_hosts(host, port):
+    """Returns the list of host, port tuples to connect to.
+
+    Like libpq, host and port are comma separated strings or sequences. A
+    single port applies to all hosts.
+    """
+    hosts = host.split(',') if isinstance(host, str) else host
+    if hosts is None or isinstance(hosts, os.PathLike):
+        hosts = [hosts]
+    hosts = [h.strip() or None if isinstance(h, str) else h for h in hosts]
+    ports = port.split(',') if isinstance(port, str) else port
+    if ports is None or isinstance(ports, int):
+        ports = [ports]
+    ports = [
+        (int(p) if p.strip() else None) if isinstance(p, str) else p
+        for p in ports]
+    if len(ports) == 1:
+        ports = ports * len(hosts)
+    elif len(ports) != len(hosts):
+        raise ValueError("Number of ports does not match number of hosts")
+    return list(zip(hosts, ports))
+
+
+async def session_attrs(conn):
+    """Returns whether the session is read only and whether it is a standby.
+
+    Servers of version 14 and later report both as status parameters, for
+    older servers they are queried.
+    """
+    params = conn.status_parameters
+    hot_standby = params.get('in_hot_standby')
+    read_only = params.get('default_transaction_read_only')
+    if hot_standby is None or read_only is None:
+        res = await conn.execute(
+            "SELECT pg_catalog.pg_is_in_recovery()::text, "
+            "pg_catalog.current_setting('transaction_read_only')")
+        hot_standby, read_only = res[0].data[0]
+    standby = hot_standby in ('on', 'true')
+    return standby or read_only == 'on', standby
+
+
+_session_checks = {
+    'any': lambda read_only, standby: True,
+    'read-write': lambda read_only, standby: not read_only,
+    'read-only': lambda read_only, standby: read_only,
+    'primary': lambda read_only, standby: not standby,
+    'standby': lambda read_only, standby: standby,
+    'prefer-standby': lambda read_only, standby: standby,
+}
+
+
+async def connect(
+        host=None, port=None, database=None, user=None, password=None,
+        # passfile=None,
+        connect_timeout=None, application_name=None,
+        fallback_application_name=None, direct=False, server_settings=None,
+        warmup=None, target_session_attrs='any', replication=None,
+        **conn_kwargs):
+    """Open a connection.
+
+    Server_settings is a mapping of run-time parameters, like search_path,
+    that are set in the startup message instead of with extra statements.
+    Warmup is a sequence of queries, for example SET or PREPARE statements,
+    that are sent as soon as authentication succeeds, without waiting for
+    the server to be ready. The connection is returned after they are
+    executed.
+
+    Host and port can list multiple servers, see parse_hosts. They are
+    tried in order until a connection is made with a session that matches
+    target_session_attrs: 'any', 'read-write', 'read-only', 'primary',
+    'standby' or 'prefer-standby'. The latter falls back to any server
+    when there is no standby.
+
+    Replication "database" opens a connection for logical replication, see
+    Connection.start_replication.
+    """
+    check = _session_checks.get(target_session_attrs)
+    if check is None:
+        raise ValueError(
+            f"Invalid target_session_attrs: {target_session_attrs}")
+    hosts = parse_hosts(host, port)
+    fallback = None
+    error = None
+    for host, port in hosts:
+        try:
+            conn = await _connect_host(
+                host, port, database, user, password, connect_timeout,
+                application_name, fallback_application_name, direct,
+                server_settings, warmup, replication, conn_kwargs)
+        except (OSError, asyncio.TimeoutError, Error) as exc:
+            if len(hosts) == 1:
+                raise
+            error = exc
+            continue
+        except BaseException:
+            if fallback is not None:
+                await fallback.close()
+            raise
+        try:
+            matches = target_session_attrs == 'any' or check(
+                *await session_attrs(conn))
+        except (OSError, asyncio.TimeoutError, Error) as exc:
+            # like a connect error, try the next host
+            await conn.close()
+            if len(hosts) == 1:
+                raise
+            error = exc
+            continue
+        except BaseException:
+            await conn.close()
+            if fallback is not None:
+                await fallback.close()
+            raise
+        if matches:
+            if fallback is not None:
+                await fallback.close()
+            return conn
+        if target_session_attrs == 'prefer-standby' and fallback is None:
+            fallback = conn
+        else:
+            await conn.close()
+    if fallback is not None:
+        return fallback
+    if error is not None:
+        raise ConnectionError(
+            f"Could not connect to any of {len(hosts)} hosts: {error}"
+        ) from error
+    raise Error(f"No host with target_session_attrs {target_session_attrs}")
+
+
+async def _connect_host(
+        host, port, database, user, password, connect_timeout,
+        application_name, fallback_application_name, direct,
+        server_settings, warmup, replication, conn_kwargs):
+
+    # TODO:
+    #    support already connected socket?
+    #    support SSL
+
+    if user is None:
+        user = getpass.getuser()
+
+    if fallback_application_name is None:
+        fallback_application_name = 'poqaio'
+
+    loop = asyncio.get_running_loop()
+    host, port, path = resolve_address(host, port)
+    if direct:
+        # protocol reads and writes the socket itself
+        _, protocol = await asyncio.wait_for(
+            open_direct(loop, PGProtocol, host, port, path), connect_timeout)
+    elif path is not None:
         _, protocol = await loop.create_unix_connection(
             PGProtocol, path, **conn_kwargs)
     else:
@@ -129,5 +756,12 @@ async def connect(
         protocol, host, port, database, user, application_name,
         fallback_application_name)
 
-    await conn._startup(password)
+    try:
+        await conn._startup(
+            password, startup_options(server_settings), warmup, replication)
+    except BaseException:
+        # for example authentication failed, the next host may be tried
+        if protocol.transport is not None:
+            protocol.transport.close()
+        raise
     return conn
@@ -0,0 +1,416 @@
+"""Connection pool spreading connections over event loops in threads.
+
+Every shard runs an event loop in its own thread, that owns a part of the
+connections. Messages of connections of different shards are handled in
+parallel when the decoding does not hold the GIL: on free threaded Python
+builds, or with a decode pool for the row decoding itself.
+
+Connections are acquired from the shard with the least connections in use,
+and can be used from any event loop. The operations are run on the shard
+loop, and their results are handed to the loop of the caller.
+"""
+import asyncio
+import logging
+import os
+import threading
+
+from ._poqaio import Error, ProtocolError
+from .connection import connect
+
+_logger = logging.getLogger(__name__)
+
+
+class _Shard:
+
+    def __init__(self, index, size, connect_kwargs, decode_pool):
+        self.index = index
+        self.load = 0                # connections in use or waited for
+        self.loop = asyncio.new_event_loop()
+        self._size = size
+        self._connect_kwargs = connect_kwargs
+        self._decode_pool = decode_pool
+        self._connections = []
+        self._idle = None
+        self._thread = threading.Thread(
+            target=self.loop.run_forever, name=f"poqaio-shard-{index}",
+            daemon=True)
+        self._thread.start()
+
+    def run(self, coro):
+        """Runs coroutine in shard loop.
+
+        Returns a concurrent future with the outcome.
+        """
+        return asyncio.run_coroutine_threadsafe(coro, self.loop)
+
+    # methods below run in the shard loop
+
+    async def _connect(self):
+        conn = await connect(**self._connect_kwargs)
+        if self._decode_pool is not None:
+            conn.set_decode_pool(self._decode_pool)
+        self._connections.append(conn)
+        return conn
+
+    async def open(self):
+        self._idle = asyncio.LifoQueue()
+        for _ in range(self._size):
+            self._idle.put_nowait(await self._connect())
+
+    async def get(self):
+        return await self._idle.get()
+
+    def put(self, conn):
+        self._idle.put_nowait(conn)
+
+    def discard(self, conn):
+        # replace a broken connection in the background
+        self._connections.remove(conn)
+        self.loop.create_task(self._replace(conn))
+
+    async def _replace(self, conn):
+        try:
+            await conn.close()
+        except Exception:
+            pass
+        delay = 0.5
+        while self._idle is not None:
+            try:
+                conn = await self._connect()
+            except (OSError, asyncio.TimeoutError, Error) as ex:
+                _logger.warning(
+                    "Shard %d failed to replace connection, retrying in "
+                    "%.1f s: %r", self.index, delay, ex)
+                await asyncio.sleep(delay)
+                delay = min(delay * 2, 30)
+                continue
+            if self._idle is None:
+                # closed while connecting
+                self._connections.remove(conn)
+                await conn.close()
+            else:
+                self.put(conn)
+            return
+
+    async def close(self):
+        self._idle = None
+        conns, self._connections = self._connections, []
+        for conn in conns:
+            await conn.close()
+
+    # end of shard loop methods
+
+    def stop(self):
+        self.loop.call_soon_threadsafe(self.loop.stop)
+        self._thread.join()
+        self.loop.close()
+
+
+def _status_property(name):
+    # read only status of the connection in the shard, like stats
+    def get(self):
+        return getattr(self._connection(), name)
+    return property(get, doc=f"{name} of the underlying connection")
+
+
+class PooledConnection:
+    """Connection acquired from a Pool.
+
+    It can be used from the event loop that acquired it. The query methods
+    are the same as those of Connection, and run on the loop of the shard.
+    Of the other attributes only the status properties are available.
+    """
+
+    def __init__(self, shard, conn):
+        self._shard = shard
+        self._conn = conn
+        self._broken = False
+
+    @property
+    def shard(self):
+        return self._shard.index
+
+    application_name = _status_property('application_name')
+    date_style = _status_property('date_style')
+    is_superuser = _status_property('is_superuser')
+    time_zone = _status_property('time_zone')
+    server_version = _status_property('server_version')
+    transaction_status = _status_property('transaction_status')
+    status_parameters = _status_property('status_parameters')
+    stats = _status_property('stats')
+    result_bytes = _status_property('result_bytes')
+
+    def _connection(self):
+        if self._conn is None:
+            raise ProtocolError("Connection is released")
+        return self._conn
+
+    async def _run(self, coro):
+        if self._conn is None:
+            coro.close()
+            raise ProtocolError("Connection is released")
+        try:
+            return await asyncio.wrap_future(self._shard.run(coro))
+        except BaseException as ex:
+            # Only a server error leaves the connection in a known state. A
+            # cancelled query would leave its results to the next user.
+            if not isinstance(ex, Error) or isinstance(ex, ProtocolError):
+                self._broken = True
+            raise
+
+    async def execute(
+            self, query, parameters=None, *, row_factory=None,
+            memory_budget=None):
+        return await self._run(self._connection().execute(
+            query, parameters, row_factory=row_factory,
+            memory_budget=memory_budget))
+
+    async def execute_cached(
+            self, query, parameters=None, *, tags=(), ttl=None,
+            row_factory=None):
+        return await self._run(self._connection().execute_cached(
+            query, parameters, tags=tags, ttl=ttl, row_factory=row_factory))
+
+    async def fetch_arrow(self, query, parameters=None):
+        return await self._run(
+            self._connection().fetch_arrow(query, parameters))
+
+    async def fetch_raw(self, query, parameters=None, *, row_factory=None):
+        return await self._run(self._connection().fetch_raw(
+            query, parameters, row_factory=row_factory))
+
+    async def fetch_into(
+            self, query, buffers, parameters=None, *, nulls=None,
+            on_chunk=None):
+        # on_chunk is called in the shard thread
+        return await self._run(self._connection().fetch_into(
+            query, buffers, parameters, nulls=nulls, on_chunk=on_chunk))
+
+    async def prepare(self, query, name=None):
+        return PooledStatement(
+            self, await self._run(self._connection().prepare(query, name)))
+
+    def transaction(self, isolation=None, readonly=False, deferrable=False):
+        return PooledTransaction(self, self._connection().transaction(
+            isolation, readonly, deferrable))
+
+
+class PooledStatement:
+    """PreparedStatement of a PooledConnection.
+
+    The statement is executed on the loop of the shard, as long as the
+    connection is not released.
+    """
+
+    def __init__(self, conn, statement):
+        self._conn = conn
+        self._statement = statement
+
+    @property
+    def name(self):
+        return self._statement.name
+
+    @property
+    def query(self):
+        return self._statement.query
+
+    @property
+    def parameter_types(self):
+        return self._statement.parameter_types
+
+    @property
+    def fields(self):
+        return self._statement.fields
+
+    async def execute(self, parameters=None, *, row_factory=None,
+                      memory_budget=None):
+        return await self._conn._run(self._statement.execute(
+            parameters, row_factory=row_factory, memory_budget=memory_budget))
+
+    async def fetch_arrow(self, parameters=None):
+        return await self._conn._run(self._statement.fetch_arrow(parameters))
+
+    async def fetch_raw(self, parameters=None, *, row_factory=None):
+        return await self._conn._run(self._statement.fetch_raw(
+            parameters, row_factory=row_factory))
+
+    async def fetch_into(self, buffers, parameters=None, **kwargs):
+        return await self._conn._run(self._statement.fetch_into(
+            buffers, parameters, **kwargs))
+
+    async def close(self):
+        return await self._conn._run(self._statement.close())
+
+
+class PooledTransaction:
+    """Transaction of a PooledConnection.
+
+    Entering and leaving the block, commit and rollback run on the loop of
+    the shard.
+    """
+
+    def __init__(self, conn, transaction):
+        self._conn = conn
+        self._transaction = transaction
+
+    async def __aenter__(self):
+        await self._conn._run(self._transaction.__aenter__())
+        return self
+
+    async def __aexit__(self, exc_type, exc, tb):
+        return await self._conn._run(
+            self._transaction.__aexit__(exc_type, exc, tb))
+
+    async def commit(self, query=None, parameters=None, *, row_factory=None):
+        return await self._conn._run(self._transaction.commit(
+            query, parameters, row_factory=row_factory))
+
+    async def rollback(self):
+        return await self._conn._run(self._transaction.rollback())
+
+
+class _Acquire:
+
+    def __init__(self, pool):
+        self._pool = pool
+        self._conn = None
+
+    def __await__(self):
+        return self._pool._acquire().__await__()
+
+    async def __aenter__(self):
+        self._conn = await self._pool._acquire()
+        return self._conn
+
+    async def __aexit__(self, *exc_info):
+        self._pool.release(self._conn)
+
+
+class Pool:
+    """Pool of connections spread over event loops in separate threads.
+
+    Use create_pool to create an opened pool.
+    """
+
+    def __init__(
+            self, shards=None, size=2, decode_pool=None, **connect_kwargs):
+        if shards is None:
+            shards = os.cpu_count() or 1
+        if shards < 1 or size < 1:
+            raise ValueError("Number of shards and size must be positive")
+        self._num_shards = shards
+        self._size = size
+        self._decode_pool = decode_pool
+        self._connect_kwargs = connect_kwargs
+        self._shards = []
+        self._lock = threading.Lock()
+
+    async def open(self):
+        self._shards = [
+            _Shard(i, self._size, self._connect_kwargs, self._decode_pool)
+            for i in range(self._num_shards)]
+        try:
+            await asyncio.gather(*[
+                asyncio.wrap_future(shard.run(shard.open()))
+                for shard in self._shards])
+        except BaseException:
+            await self.close()
+            raise
+        return self
+
+    def acquire(self):
+        """Acquire a connection from the least loaded shard.
+
+        Use as "async with pool.acquire() as conn:" or await it and call
+        release afterwards.
+        """
+        return _Acquire(self)
+
+    async def _acquire(self):
+        with self._lock:
+            if not self._shards:
+                raise ProtocolError("Pool is closed")
+            shard = min(self._shards, key=lambda s: s.load)
+            shard.load += 1
+        fut = shard.run(shard.get())
+        try:
+            conn = await asyncio.wrap_future(fut)
+        except BaseException:
+            # the connection may arrive after cancellation
+            fut.add_done_callback(lambda f: self._put_back(shard, f))
+            self._unload(shard)
+            raise
+        return PooledConnection(shard, conn)
+
+    def _put_back(self, shard, fut):
+        if not fut.cancelled() and fut.exception() is None:
+            shard.loop.call_soon_threadsafe(shard.put, fut.result())
+
+    def _unload(self, shard):
+        with self._lock:
+            shard.load -= 1
+
+    def release(self, conn):
+        """Return an acquired connection to its shard."""
+        if conn._conn is None:
+            return
+        shard, raw_conn = conn._shard, conn._conn
+        conn._conn = None
+        self._unload(shard)
+        if shard.loop.is_closed():
+            return
+        shard.loop.call_soon_threadsafe(
+            shard.discard if conn._broken else shard.put, raw_conn)
+
+    async def execute(
+            self, query, parameters=None, *, row_factory=None,
+            memory_budget=None):
+        async with self.acquire() as conn:
+            return await conn.execute(
+                query, parameters, row_factory=row_factory,
+                memory_budget=memory_budget)
+
+    async def fetch_arrow(self, query, parameters=None):
+        async with self.acquire() as conn:
+            return await conn.fetch_arrow(query, parameters)
+
+    async def fetch_raw(self, query, parameters=None, *, row_factory=None):
+        async with self.acquire() as conn:
+            return await conn.fetch_raw(
+                query, parameters, row_factory=row_factory)
+
+    async def fetch_into(self, query, buffers, parameters=None, **kwargs):
+        async with self.acquire() as conn:
+            return await conn.fetch_into(query, buffers, parameters, **kwargs)
+
+    @property
+    def loads(self):
+        """Connections in use or waited for, per shard."""
+        return [shard.load for shard in self._shards]
+
+    async def close(self):
+        with self._lock:
+            shards, self._shards = self._shards, []
+        for shard in shards:
+            try:
+                await asyncio.wrap_future(shard.run(shard.close()))
+            finally:
+                await asyncio.get_running_loop().run_in_executor(
+                    None, shard.stop)
+
+    async def __aenter__(self):
+        return self
+
+    async def __aexit__(self, *exc_info):
+        await self.close()
+
+
+async def create_pool(shards=None, size=2, decode_pool=None, **connect_kwargs):
+    """Create a pool with size connections for each of the shards.
+
+    Shards is the number of event loop threads, by default the number of
+    CPUs. The connect_kwargs are passed to connect. When decode_pool is an
+    executor, it is used by all connections to decode results, see
+    Connection.set_decode_pool.
+    """
+    return await Pool(shards, size, decode_pool, **connect_kwargs).open()
@@ -83,25 +83,13 @@ class PGProtocol(BaseProt, asyncio.BufferedProtocol):
 # #         self.result = None
 
     def connection_lost(self, exc):
-        if self.error:
-            self.fut.set_exception(self.error)
-            self.error = None
-        if exc:
-            self.set_exception(exc)
+        error = self.error or exc
+        self.error = None
+        if error is None:
+            error = ConnectionError("Connection closed")
+        self.fail_waiter(error)
         self.transport = None
 
-    def set_exception(self, ex):
-        if (isinstance(ex, (ProtocolError)) or self.transport.is_closing()):
-            if not self.fut.done():
-                self.fut.set_exception(ex)
-            self.transport.close()
-        else:
-            self.error = ex
-
-    def set_result(self, result=None):
-        if not self.fut.done():
-            self.fut.set_result(result)
-
 #     def check_length_equal(self, length):
 #         if len(self.message) != length:
 #             raise ProtocolError(
@@ -467,6 +455,6 @@ class PGProtocol(BaseProt, asyncio.BufferedProtocol):
 
     def close(self):
         transport = self.transport
-        if not transport.is_closing():
+        if transport is not None and not transport.is_closing():
             transport.write(b'X\0\0\0\x04')
             transport.close()
@@ -0,0 +1,272 @@
+"""Connection pool routing queries over a primary server and its standbys.
+
+Writes go to the primary. Read only queries go to a standby, the one with
+the lowest round trip time weighted by the queries in flight. The round
+trip time and the role of every server are measured by a probe connection
+per server. A server that can not be reached is skipped until a probe
+succeeds again, so queries fail over to the remaining servers.
+"""
+import asyncio
+import time
+
+from ._poqaio import Error, ProtocolError
+from .common import TransactionStatus
+from .connection import connect, parse_hosts, session_attrs
+
+# weight of a new round trip time sample in the moving average
+_RTT_WEIGHT = 0.3
+
+
+class _Server:
+
+    def __init__(self, host, port, size):
+        self.host = host
+        self.port = port
+        self.standby = None          # unknown until a probe succeeds
+        self.rtt = None              # smoothed round trip time in seconds
+        self.in_flight = 0           # connections in use or waited for
+        self.down = True
+        self.slots = asyncio.Semaphore(size)
+        self.idle = []
+        self.probe_conn = None
+
+    def add_rtt(self, rtt):
+        if self.rtt is None:
+            self.rtt = rtt
+        else:
+            self.rtt += _RTT_WEIGHT * (rtt - self.rtt)
+
+    def score(self):
+        # unmeasured servers are tried first
+        return (self.rtt or 0.0) * (self.in_flight + 1), self.in_flight
+
+    def info(self):
+        return {
+            "host": self.host,
+            "port": self.port,
+            "standby": self.standby,
+            "rtt": self.rtt,
+            "in_flight": self.in_flight,
+            "down": self.down,
+        }
+
+
+class _Acquire:
+
+    def __init__(self, pool, readonly):
+        self._pool = pool
+        self._readonly = readonly
+        self._server = None
+        self._conn = None
+
+    async def __aenter__(self):
+        self._server, self._conn = await self._pool._acquire(self._readonly)
+        return self._conn
+
+    async def __aexit__(self, exc_type, exc, tb):
+        await self._pool._release(self._server, self._conn, exc_type)
+
+
+class ReplicaPool:
+    """Connections to a primary and its standbys.
+
+    Use create_replica_pool to create one.
+    """
+
+    def __init__(self, hosts, size, probe_interval, probe_timeout,
+                 connect_kwargs):
+        self._servers = [_Server(host, port, size) for host, port in hosts]
+        self._probe_interval = probe_interval
+        self._probe_timeout = probe_timeout
+        self._connect_kwargs = connect_kwargs
+        self._prober = None
+        self._closed = False
+
+    async def _connect(self, server):
+        return await connect(
+            host=server.host, port=server.port, **self._connect_kwargs)
+
+    async def _measure(self, server):
+        # Measures the round trip time and the role of the server
+        if server.probe_conn is None:
+            server.probe_conn = await self._connect(server)
+        start = time.perf_counter()
+        await server.probe_conn.execute("")
+        server.add_rtt(time.perf_counter() - start)
+        server.standby = (await session_attrs(server.probe_conn))[1]
+        server.down = False
+
+    async def _probe(self, server):
+        # A server that does not answer within the probe timeout is down
+        try:
+            await asyncio.wait_for(self._measure(server), self._probe_timeout)
+        except (OSError, asyncio.TimeoutError, Error):
+            await self._server_down(server)
+
+    async def _server_down(self, server):
+        server.down = True
+        server.rtt = None
+        conns, server.idle = server.idle, []
+        if server.probe_conn is not None:
+            conns.append(server.probe_conn)
+            server.probe_conn = None
+        for conn in conns:
+            try:
+                await conn.close()
+            except Exception:
+                pass
+
+    async def probe(self):
+        """Probe all servers once."""
+        await asyncio.gather(*(self._probe(s) for s in self._servers))
+
+    async def _run_prober(self):
+        while True:
+            await asyncio.sleep(self._probe_interval)
+            await self.probe()
+
+    async def open(self):
+        await self.probe()
+        if all(server.down for server in self._servers):
+            raise ConnectionError("None of the servers can be reached")
+        if self._probe_interval:
+            self._prober = asyncio.get_running_loop().create_task(
+                self._run_prober())
+        return self
+
+    def _choose(self, readonly, exclude):
+        up = [s for s in self._servers if not s.down and s not in exclude]
+        primaries = [s for s in up if not s.standby]
+        if readonly:
+            # the primary only takes reads when no standby is available
+            candidates = [s for s in up if s.standby] or primaries
+        else:
+            candidates = primaries
+        if not candidates:
+            raise ConnectionError(
+                "No server available" if readonly else
+                "No primary server available")
+        return min(candidates, key=_Server.score)
+
+    async def _acquire(self, readonly):
+        # Returns a server and a connection to it, trying other servers when
+        # a server can not be reached
+        if self._closed:
+            raise Error("Pool is closed")
+        failed = []
+        while True:
+            server = self._choose(readonly, failed)
+            server.in_flight += 1
+            await server.slots.acquire()
+            try:
+                if server.idle:
+                    return server, server.idle.pop()
+                return server, await self._connect(server)
+            except (OSError, asyncio.TimeoutError, Error):
+                server.in_flight -= 1
+                server.slots.release()
+                failed.append(server)
+                await self._server_down(server)
+            except BaseException:
+                server.in_flight -= 1
+                server.slots.release()
+                raise
+
+    async def _release(self, server, conn, exc_type):
+        # A cancelled query leaves the connection in an unknown state. When
+        # the server can not be reached, its other connections are closed as
+        # well, until a probe succeeds.
+        broken = exc_type is not None and issubclass(
+            exc_type, (OSError, ProtocolError, asyncio.CancelledError))
+        try:
+            if exc_type is not None and issubclass(exc_type, OSError):
+                await self._server_down(server)
+            if (broken or self._closed or server.down or
+                    conn.transaction_status != TransactionStatus.IDLE):
+                await conn.close()
+            else:
+                server.idle.append(conn)
+        finally:
+            server.in_flight -= 1
+            server.slots.release()
+
+    def acquire(self, readonly=False):
+        """Acquire a connection for use in an async with statement.
+
+        A read only connection is to a standby, unless none is available.
+        """
+        return _Acquire(self, readonly)
+
+    async def _run(self, readonly, method, *args, **kwargs):
+        # Read only queries are tried once more on another server when the
+        # connection fails
+        for attempt in range(2 if readonly else 1):
+            try:
+                async with self.acquire(readonly) as conn:
+                    return await getattr(conn, method)(*args, **kwargs)
+            except (OSError, ProtocolError):
+                if attempt or not readonly:
+                    raise
+
+    async def execute(
+            self, query, parameters=None, *, readonly=False,
+            row_factory=None, memory_budget=None):
+        return await self._run(
+            readonly, 'execute', query, parameters, row_factory=row_factory,
+            memory_budget=memory_budget)
+
+    async def fetch_arrow(self, query, parameters=None, *, readonly=False):
+        return await self._run(readonly, 'fetch_arrow', query, parameters)
+
+    async def fetch_raw(
+            self, query, parameters=None, *, readonly=False,
+            row_factory=None):
+        return await self._run(
+            readonly, 'fetch_raw', query, parameters, row_factory=row_factory)
+
+    async def fetch_into(
+            self, query, buffers, parameters=None, *, readonly=False,
+            **kwargs):
+        return await self._run(
+            readonly, 'fetch_into', query, buffers, parameters, **kwargs)
+
+    @property
+    def servers(self):
+        """Role, round trip time and load per server."""
+        return [server.info() for server in self._servers]
+
+    async def close(self):
+        self._closed = True
+        if self._prober is not None:
+            self._prober.cancel()
+            try:
+                await self._prober
+            except asyncio.CancelledError:
+                pass
+            self._prober = None
+        for server in self._servers:
+            await self._server_down(server)
+
+    async def __aenter__(self):
+        return self
+
+    async def __aexit__(self, *exc_info):
+        await self.close()
+
+
+async def create_replica_pool(
+        host=None, port=None, size=2, probe_interval=1.0, probe_timeout=None,
+        **connect_kwargs):
+    """Create a pool for the servers in host and port, see parse_hosts.
+
+    Every server gets up to size connections, that are opened when needed.
+    The servers are probed every probe_interval seconds. A server that does
+    not answer a probe within probe_timeout seconds, by default the probe
+    interval, is considered down.
+    """
+    if probe_timeout is None:
+        probe_timeout = probe_interval or None
+    pool = ReplicaPool(
+        parse_hosts(host, port), size, probe_interval, probe_timeout,
+        connect_kwargs)
+    return await pool.open()
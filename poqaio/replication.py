@@ -0,0 +1,176 @@
+"""Logical replication with the pgoutput plugin.
+
+A connection opened with replication="database" streams the changes of a
+logical replication slot. The pgoutput messages are decoded by the
+extension, with the same converters as query results, into Change tuples
+that arrive in batches:
+
+    conn = await poqaio.connect(database="app", replication="database")
+    async with conn.start_replication("app_slot", ["app_pub"]) as stream:
+        async for changes in stream:
+            for change in changes:
+                if change.kind == 'I':
+                    print(change.relation.name, change.new)
+
+A batch holds the changes decoded from the data received at once. Its
+changes are acknowledged when the next batch is requested, so the server
+may drop the WAL up to them. The acknowledged position is reported in a
+standby status update every feedback interval and whenever the server asks
+for it. Changes that are not acknowledged are sent again by a next
+START_REPLICATION of the slot.
+
+Values of TOASTed columns that an update did not change are not sent, they
+are UNCHANGED_TOAST in the new values.
+"""
+import asyncio
+import collections
+
+from ._poqaio import Change, Error, Relation, UNCHANGED_TOAST
+
+__all__ = ['Change', 'Relation', 'ReplicationStream', 'UNCHANGED_TOAST',
+           'format_lsn', 'parse_lsn']
+
+
+def format_lsn(lsn):
+    """Returns the lsn in the textual form of the server, like 16/B374D848."""
+    return f"{lsn >> 32:X}/{lsn & 0xFFFFFFFF:X}"
+
+
+def parse_lsn(text):
+    """Returns the lsn in the textual form of the server as int."""
+    high, low = text.split('/')
+    return int(high, 16) << 32 | int(low, 16)
+
+
+class ReplicationStream:
+    """Batches of changes of a replication slot, see
+    Connection.start_replication.
+
+    It is an asynchronous context manager, that starts the stream when
+    entered and stops it when left, and an asynchronous iterator of the
+    batches. Each batch is a list of Change tuples.
+    """
+
+    def __init__(self, conn, query, start_lsn, feedback_interval,
+                 max_pending, auto_acknowledge):
+        self._conn = conn
+        self._protocol = conn._protocol
+        self._query = query
+        self._start_lsn = start_lsn
+        self._feedback_interval = feedback_interval
+        self._max_pending = max_pending
+        self._auto_acknowledge = auto_acknowledge
+        self._batches = collections.deque()
+        self._done = None           # completes when the stream has ended
+        self._waiter = None
+        self._paused = False
+        self._last_lsn = None       # of the batch returned last
+        self._reported = False      # error of the stream raised
+        self.lsn = start_lsn        # of the last change received
+
+    async def __aenter__(self):
+        if self._done is not None:
+            raise Error("Replication stream already used")
+        lock = self._conn._execute_lock
+        await lock.acquire()
+        try:
+            self._done = self._protocol.start_replication(
+                self._query, self._on_batch, self._start_lsn,
+                self._feedback_interval)
+        except BaseException:
+            lock.release()
+            raise
+        self._done.add_done_callback(self._ended)
+        return self
+
+    async def __aexit__(self, exc_type, exc, tb):
+        try:
+            await self.close()
+        except Exception:
+            if exc_type is None:
+                raise
+
+    def __aiter__(self):
+        return self
+
+    async def __anext__(self):
+        if self._done is None:
+            raise Error("Replication stream is not started")
+        if self._last_lsn is not None and self._auto_acknowledge:
+            self.acknowledge(self._last_lsn)
+            self._last_lsn = None
+        while not self._batches:
+            if self._done.done():
+                # raises the error that ended the stream
+                self._reported = True
+                self._done.result()
+                raise StopAsyncIteration
+            self._waiter = asyncio.get_running_loop().create_future()
+            try:
+                await self._waiter
+            finally:
+                self._waiter = None
+        changes, self._last_lsn = self._batches.popleft()
+        if self._paused and len(self._batches) <= self._max_pending // 2:
+            self._resume()
+        return changes
+
+    def acknowledge(self, lsn):
+        """Confirm that the changes up to lsn are handled.
+
+        The server learns it from the next standby status update, see
+        send_feedback.
+        """
+        self._protocol.acknowledge(lsn)
+
+    def send_feedback(self):
+        """Send a standby status update now."""
+        self._protocol.send_feedback()
+
+    async def close(self):
+        """Stop the stream and wait for the server to end it.
+
+        Batches that are not returned yet are discarded, and the last
+        returned batch is not acknowledged. Raises the error that ended the
+        stream, unless iterating raised it already.
+        """
+        done = self._done
+        if done is None:
+            return
+        if not done.done():
+            self._protocol.stop_replication()
+            # the server ends the stream after the data sent before
+            self._resume()
+        self._batches.clear()
+        try:
+            await asyncio.shield(done)
+        except Exception:
+            if not self._reported:
+                self._reported = True
+                raise
+
+    def _on_batch(self, changes, lsn):
+        # called by the protocol with each batch of changes
+        self.lsn = lsn
+        self._batches.append((changes, lsn))
+        self._wake()
+        if not self._paused and len(self._batches) >= self._max_pending:
+            # stop reading, TCP makes the server wait for the consumer
+            self._paused = True
+            self._protocol.transport.pause_reading()
+
+    def _resume(self):
+        if self._paused:
+            self._paused = False
+            transport = self._protocol.transport
+            if transport is not None:
+                transport.resume_reading()
+
+    def _ended(self, fut):
+        self._conn._execute_lock.release()
+        self._wake()
+
+    def _wake(self):
+        waiter = self._waiter
+        if waiter is not None and not waiter.done():
+            waiter.set_result(None)
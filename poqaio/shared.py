@@ -0,0 +1,79 @@
+"""Query results in shared memory, for use by other processes.
+
+A result fetched with fetch_raw keeps the data rows as received. Exporting
+copies them, together with the field descriptions, into a shared memory
+block. Other processes attach to the block by name and decode a row when
+they access it, so no rows are pickled:
+
+    rows = await conn.fetch_raw("SELECT * FROM items")
+    shm = export_rows(rows)
+    # hand shm.name to a worker
+    ...
+    with SharedRows(name) as shared:
+        for row in shared:
+            ...
+
+The creator unlinks the block when the workers are done with it. The format
+is in the byte order of the exporting machine.
+"""
+import sys
+from multiprocessing import shared_memory
+
+from ._poqaio import RawRows
+
+# attached blocks are not unlinked by the resource tracker of the worker
+_attach_kwargs = {'track': False} if sys.version_info >= (3, 13) else {}
+
+
+def export_rows(rows, name=None):
+    """Copy RawRows into a new SharedMemory block and return the block."""
+    shm = shared_memory.SharedMemory(
+        name, create=True, size=max(rows.export_size, 1))
+    try:
+        rows.export(shm.buf)
+    except BaseException:
+        shm.close()
+        shm.unlink()
+        raise
+    return shm
+
+
+class SharedRows:
+    """Rows exported to the shared memory block with the given name.
+
+    It is a sequence of the rows, decoded from the RawRows in the rows
+    attribute, that uses the block without copying. Row factory is like the
+    one of a query. The block can only be closed when no other references
+    to the RawRows remain.
+    """
+
+    def __init__(self, name, row_factory=None):
+        self._shm = shared_memory.SharedMemory(name, **_attach_kwargs)
+        try:
+            self.rows = RawRows.from_buffer(self._shm.buf, row_factory)
+        except BaseException:
+            self._shm.close()
+            raise
+
+    @property
+    def fields(self):
+        return self.rows.fields
+
+    def __len__(self):
+        return len(self.rows)
+
+    def __getitem__(self, index):
+        return self.rows[index]
+
+    def __iter__(self):
+        return iter(self.rows)
+
+    def close(self):
+        self.rows = None
+        self._shm.close()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc_info):
+        self.close()
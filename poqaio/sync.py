@@ -0,0 +1,158 @@
+"""Blocking connections, for use without event loop.
+
+The same protocol implementation as the asyncio connection is used, but it
+reads and writes the socket itself, and releases the GIL while waiting for
+the server.
+"""
+import getpass
+import socket
+import threading
+
+from ._poqaio import (
+    BaseProt, ColumnSink, ProtocolError, RESULT_ARROW, RESULT_COLUMNS,
+    RESULT_RAW, RESULT_TUPLES)
+from .connection import (
+    BaseConnection, PreparedStatement, last_batch, resolve_address,
+    startup_options)
+
+
+class Connection(BaseConnection):
+    def __init__(self, sock, *args):
+        super().__init__(*args)
+        self._sock = sock
+        self._execute_lock = threading.Lock()
+
+    def _startup(self, password, options=None, warmup=None):
+        self._protocol.startup(
+            self.user, self.database, self._application_name, password,
+            options, warmup)
+
+    def execute(
+            self, query, parameters=None, *, row_factory=None,
+            memory_budget=None):
+        """Execute query and return the results.
+
+        See poqaio.connection.Connection.execute.
+        """
+        return self._run(
+            query, parameters, RESULT_TUPLES, None, row_factory, memory_budget)
+
+    def prepare(self, query, name=None):
+        """Prepare query as named statement and return a PreparedStatement.
+
+        See poqaio.connection.Connection.prepare.
+        """
+        with self._execute_lock:
+            try:
+                statement = self._protocol.prepare(
+                    name or self._statement_name(), query)
+            except (OSError, ProtocolError, KeyboardInterrupt):
+                self._close_socket()
+                raise
+        return PreparedStatement(self, statement)
+
+    def _run(self, query, parameters, result_format, sink=None,
+             row_factory=None, memory_budget=None):
+        with self._execute_lock:
+            try:
+                return self._execute(
+                    query, parameters, None, result_format, sink, None, None,
+                    row_factory, memory_budget)
+            except (OSError, ProtocolError, KeyboardInterrupt):
+                # the connection is in an unknown state
+                self._close_socket()
+                raise
+
+    def fetch_arrow(self, query, parameters=None):
+        """Execute query and return the rows of the last result in columns.
+
+        See poqaio.connection.Connection.fetch_arrow.
+        """
+        return last_batch(self._run(query, parameters, RESULT_ARROW))
+
+    def fetch_raw(self, query, parameters=None, *, row_factory=None):
+        """Execute query and return the rows of the last result undecoded.
+
+        See poqaio.connection.Connection.fetch_raw.
+        """
+        return last_batch(self._run(
+            query, parameters, RESULT_RAW, None, row_factory))
+
+    def fetch_into(
+            self, query, buffers, parameters=None, *, nulls=None,
+            on_chunk=None):
+        """Execute query and write the values in the given buffers.
+
+        See poqaio.connection.Connection.fetch_into.
+        """
+        sink = ColumnSink(buffers, nulls, on_chunk)
+        self._run(query, parameters, RESULT_COLUMNS, sink)
+        return sink.total_rows
+
+    def _close_socket(self):
+        if self._sock is not None:
+            self._protocol.detach_socket()
+            self._sock.close()
+            self._sock = None
+
+    def close(self):
+        with self._execute_lock:
+            if self._sock is None:
+                return
+            try:
+                self._protocol.sock_write(b'X\0\0\0\x04')
+            except OSError:
+                pass
+            self._close_socket()
+
+    @property
+    def closed(self):
+        return self._sock is None
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc_info):
+        self.close()
+
+
+def connect(
+        host=None, port=None, database=None, user=None, password=None,
+        connect_timeout=None, application_name=None,
+        fallback_application_name=None, server_settings=None, warmup=None):
+    """Open a blocking connection.
+
+    See poqaio.connection.connect for server_settings and warmup.
+    """
+
+    if user is None:
+        user = getpass.getuser()
+
+    if fallback_application_name is None:
+        fallback_application_name = 'poqaio'
+
+    host, port, path = resolve_address(host, port)
+    if path is not None:
+        sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        sock.settimeout(connect_timeout)
+        try:
+            sock.connect(path)
+        except BaseException:
+            sock.close()
+            raise
+    else:
+        sock = socket.create_connection((host, port), connect_timeout)
+        sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+    sock.settimeout(None)
+
+    protocol = BaseProt(blocking=True)
+    protocol.attach_socket(sock.fileno())
+    conn = Connection(
+        sock, protocol, host, port, database, user, application_name,
+        fallback_application_name)
+    try:
+        conn._startup(password, startup_options(server_settings), warmup)
+    except BaseException:
+        conn._close_socket()
+        raise
+    return conn
@@ -0,0 +1,145 @@
+import asyncio
+import socket
+
+
+class DirectTransport(asyncio.Transport):
+    """Transport that lets the protocol do the socket I/O itself.
+
+    The loop only signals readiness of the socket. The protocol receives
+    directly into its own buffer and sends queries without intermediate
+    copies or transport buffering.
+    """
+
+    def __init__(self, loop, sock, protocol):
+        super().__init__({'socket': sock})
+        self._loop = loop
+        self._sock = sock
+        self._protocol = protocol
+        self._closing = False
+        self._reading = True
+        sock.setblocking(False)
+        self._fd = sock.fileno()
+        protocol.connection_made(self)
+        protocol.attach_socket(self._fd)
+        loop.add_reader(self._fd, protocol.read_ready)
+
+    def get_extra_info(self, name, default=None):
+        if self._sock is None:
+            return default
+        if name == 'peername':
+            try:
+                return self._sock.getpeername()
+            except OSError:
+                return default
+        if name == 'sockname':
+            return self._sock.getsockname()
+        return super().get_extra_info(name, default)
+
+    def get_protocol(self):
+        return self._protocol
+
+    def is_closing(self):
+        return self._closing
+
+    def get_write_buffer_size(self):
+        return self._protocol.write_buffer_size if self._sock else 0
+
+    def is_reading(self):
+        return self._reading and not self._closing
+
+    def pause_reading(self):
+        if self._reading and not self._closing:
+            self._reading = False
+            self._loop.remove_reader(self._fd)
+
+    def resume_reading(self):
+        if not self._reading and not self._closing:
+            self._reading = True
+            self._loop.add_reader(self._fd, self._protocol.read_ready)
+
+    def write(self, data):
+        if self._closing:
+            # like asyncio transports, silently drop data after closing
+            return
+        self._protocol.sock_write(data)
+
+    def close(self):
+        # like asyncio transports, data not sent yet is flushed first
+        if self._closing:
+            return
+        self._closing = True
+        self._loop.remove_reader(self._fd)
+        if self._protocol.write_buffer_size:
+            self._loop.remove_writer(self._fd)
+            self._loop.add_writer(self._fd, self._flush)
+        else:
+            self._close(None)
+
+    def abort(self):
+        self._fatal(None)
+
+    def _fatal(self, exc):
+        self._closing = True
+        self._close(exc)
+
+    def _flush(self):
+        # an error closes the transport through _fatal
+        self._protocol.write_ready()
+        if self._sock is not None and not self._protocol.write_buffer_size:
+            self._close(None)
+
+    def _close(self, exc):
+        if self._sock is None:
+            return
+        self._loop.remove_reader(self._fd)
+        self._loop.remove_writer(self._fd)
+        self._protocol.detach_socket()
+        self._sock.close()
+        self._sock = None
+        self._loop.call_soon(self._call_connection_lost, exc)
+
+    def _call_connection_lost(self, exc):
+        try:
+            self._protocol.connection_lost(exc)
+        finally:
+            self._protocol = None
+
+
+async def open_direct(loop, protocol_factory, host=None, port=None, path=None):
+    if path is not None:
+        sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        sock.setblocking(False)
+        try:
+            await loop.sock_connect(sock, path)
+        except BaseException:
+            sock.close()
+            raise
+    else:
+        # like loop.create_connection, try the addresses in turn
+        infos = await loop.getaddrinfo(
+            host, port, type=socket.SOCK_STREAM, proto=socket.IPPROTO_TCP)
+        error = None
+        for family, type_, proto, _, address in infos:
+            sock = socket.socket(family, type_, proto)
+            try:
+                sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+                sock.setblocking(False)
+                await loop.sock_connect(sock, address)
+                break
+            except OSError as exc:
+                sock.close()
+                error = exc
+            except BaseException:
+                sock.close()
+                raise
+        else:
+            if error is None:
+                raise OSError(f"No address found for {host}")
+            raise error
+    try:
+        protocol = protocol_factory()
+        transport = DirectTransport(loop, sock, protocol)
+    except BaseException:
+        sock.close()
+        raise
+    return transport, protocol
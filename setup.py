@@ -8,8 +8,22 @@ ext = Extension(
         "extension/module.c",
         "extension/protocol.c",
         "extension/types.c",
+        "extension/arrow.c",
+        "extension/columns.c",
+        "extension/decode.c",
+        "extension/auth.c",
+        "extension/errors.c",
+        "extension/rows.c",
+        "extension/statement.c",
+        "extension/spill.c",
+        "extension/replication.c",
+    ],
+    depends=[
+        "protocol.h", "poqaio.h", "types.h", "portable_endian.h",
+        "monotonic.h", "arrow.h", "columns.h", "decode.h", "state.h",
+        "auth.h", "errors.h", "rows.h", "statement.h", "spill.h",
+        "replication.h",
     ],
-    depends=["protocol.h", "poqaio.h", "types.h"],
 )
 
 setup(ext_modules=[ext])
@@ -0,0 +1,71 @@
+import asyncio
+import unittest
+
+import poqaio
+
+from bench.mockserver import MockServer, Response, rows_response
+
+
+class ResultCacheTest(unittest.IsolatedAsyncioTestCase):
+
+    async def asyncSetUp(self):
+        script = {"slow": rows_response(3, latency=0.1)}
+        self.server = await MockServer(
+            script, default=lambda query, params: Response(tag='SET')).start()
+        self.cache = poqaio.ResultCache()
+        self.conns = []
+        for _ in range(2):
+            conn = await poqaio.connect(
+                host=self.server.host, port=self.server.port)
+            conn.set_result_cache(self.cache)
+            self.conns.append(conn)
+
+    async def asyncTearDown(self):
+        for conn in self.conns:
+            await conn.close()
+        await self.server.close()
+
+    def queries(self):
+        return sum(query == "slow" for query, _ in self.server.queries)
+
+    async def fetch_while(self, invalidate):
+        # fetches from both connections, invalidating while executing
+        fetches = asyncio.gather(*(
+            conn.execute_cached("slow", tags=["items", "orders"])
+            for conn in self.conns))
+        await asyncio.sleep(0.05)
+        invalidate()
+        return await fetches
+
+    async def test_invalidate_in_flight(self):
+        first, second = await self.fetch_while(
+            lambda: self.cache.invalidate("items"))
+        self.assertEqual(self.queries(), 1)
+        # not stored, but the waiter gets the same immutable results
+        self.assertEqual(len(self.cache), 0)
+        self.assertIs(first, second)
+        self.assertIsInstance(first, tuple)
+        self.assertIsInstance(first[0].data, tuple)
+        await self.conns[0].execute_cached("slow", tags=["items", "orders"])
+        self.assertEqual(self.queries(), 2)
+
+    async def test_invalidate_other_tag_in_flight(self):
+        await self.fetch_while(lambda: self.cache.invalidate("customers"))
+        self.assertEqual(len(self.cache), 1)
+        await self.conns[0].execute_cached("slow", tags=["items", "orders"])
+        self.assertEqual(self.queries(), 1)
+
+    async def test_clear_in_flight(self):
+        first, _ = await self.fetch_while(self.cache.clear)
+        self.assertEqual(len(self.cache), 0)
+        self.assertIsInstance(first[0].data, tuple)
+
+    async def test_notification_in_flight(self):
+        await self.cache.listen(self.conns[1])
+        await self.fetch_while(
+            lambda: self.server.notify("poqaio_cache", "orders"))
+        self.assertEqual(len(self.cache), 0)
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,80 @@
+import asyncio
+import unittest
+
+import poqaio
+
+from bench.mockserver import MockServer, Response
+
+SESSION_QUERY = (
+    "SELECT pg_catalog.pg_is_in_recovery()::text, "
+    "pg_catalog.current_setting('transaction_read_only')")
+
+
+class MultiHostTest(unittest.IsolatedAsyncioTestCase):
+
+    async def asyncSetUp(self):
+        # an older server, that is asked for the session attributes and
+        # fails to answer
+        self.failing = await MockServer(
+            {SESSION_QUERY: Response(error=('57P03', 'shutting down'))},
+            parameters={'in_hot_standby': None}).start()
+        self.primary = await MockServer(
+            default=lambda query, params: Response(tag='primary')).start()
+        self.standby = await MockServer(
+            default=lambda query, params: Response(tag='standby'),
+            standby=True).start()
+
+    async def asyncTearDown(self):
+        for server in (self.failing, self.primary, self.standby):
+            await server.close()
+
+    async def connect(self, *servers, **kwargs):
+        return await poqaio.connect(
+            host=','.join(server.host for server in servers),
+            port=','.join(str(server.port) for server in servers), **kwargs)
+
+    async def wait_closed(self, server):
+        for _ in range(100):
+            if not server.connections:
+                return
+            await asyncio.sleep(0.01)
+        self.fail("Connection is not closed")
+
+    async def test_session_attrs_error(self):
+        conn = await self.connect(
+            self.failing, self.primary, target_session_attrs='read-write')
+        self.assertEqual((await conn.execute("x"))[0].tag, 'primary')
+        await conn.close()
+        await self.wait_closed(self.failing)
+
+    async def test_session_attrs_error_single_host(self):
+        with self.assertRaises(poqaio.ServerError):
+            await self.connect(self.failing, target_session_attrs='primary')
+        await self.wait_closed(self.failing)
+
+    async def test_session_attrs_error_all_hosts(self):
+        with self.assertRaises(ConnectionError):
+            await self.connect(
+                self.primary, self.failing, target_session_attrs='standby')
+        await self.wait_closed(self.failing)
+        await self.wait_closed(self.primary)
+
+    async def test_prefer_standby_fallback(self):
+        conn = await self.connect(
+            self.primary, self.failing, target_session_attrs='prefer-standby')
+        self.assertEqual((await conn.execute("x"))[0].tag, 'primary')
+        await conn.close()
+        await self.wait_closed(self.failing)
+
+    async def test_prefer_standby(self):
+        conn = await self.connect(
+            self.primary, self.failing, self.standby,
+            target_session_attrs='prefer-standby')
+        self.assertEqual((await conn.execute("x"))[0].tag, 'standby')
+        await conn.close()
+        await self.wait_closed(self.failing)
+        await self.wait_closed(self.primary)
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,48 @@
+import asyncio
+import concurrent.futures
+import threading
+import time
+import unittest
+
+import poqaio
+
+from bench.mockserver import MockServer, rows_response
+
+
+class DecodePoolTest(unittest.IsolatedAsyncioTestCase):
+
+    async def asyncSetUp(self):
+        self.server = await MockServer(
+            default=lambda query, params: rows_response(20000)).start()
+        self.conn = await poqaio.connect(
+            host=self.server.host, port=self.server.port)
+        self.executor = concurrent.futures.ThreadPoolExecutor(1)
+
+    async def asyncTearDown(self):
+        await self.conn.close()
+        await self.server.close()
+        self.executor.shutdown()
+
+    async def test_rows(self):
+        full = (await self.conn.execute("SELECT x"))[0].data
+        self.conn.set_decode_pool(self.executor, chunk_size=1 << 14)
+        self.assertEqual((await self.conn.execute("SELECT x"))[0].data, full)
+
+    async def test_busy_executor(self):
+        # the only worker is busy, the jobs are decoded in the loop thread
+        # instead of waiting for it
+        full = (await self.conn.execute("SELECT x"))[0].data
+        self.conn.set_decode_pool(self.executor, chunk_size=1 << 14)
+        release = threading.Event()
+        self.executor.submit(release.wait, 5)
+        try:
+            start = time.monotonic()
+            rows = (await self.conn.execute("SELECT x"))[0].data
+            self.assertLess(time.monotonic() - start, 2)
+        finally:
+            release.set()
+        self.assertEqual(rows, full)
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,135 @@
+import asyncio
+import unittest
+
+import poqaio
+from poqaio.common import TransactionStatus
+from poqaio.public_const import INT4OID
+
+from bench.mockserver import MockServer, Response, rows_response
+
+
+class PooledConnectionTest(unittest.IsolatedAsyncioTestCase):
+
+    async def asyncSetUp(self):
+        script = {
+            'SELECT $1::int4': Response(
+                [('a', INT4OID)], [('1',)], param_types=[INT4OID]),
+            'slow': Response(tag='slow', latency=0.2),
+            'fast': Response(tag='fast'),
+            'bad': Response(error=('42601', 'syntax error')),
+        }
+        self.server = MockServer(
+            script, default=lambda query, params: rows_response(2))
+        await self.server.__aenter__()
+        self.pool = await poqaio.create_pool(
+            2, 1, host=self.server.host, port=self.server.port)
+
+    async def asyncTearDown(self):
+        await self.pool.close()
+        await self.server.__aexit__(None, None, None)
+
+    async def test_transaction(self):
+        async with self.pool.acquire() as conn:
+            queries = len(self.server.queries)
+            async with conn.transaction(isolation='serializable') as tr:
+                await conn.execute("a")
+                self.assertEqual(
+                    conn.transaction_status, TransactionStatus.TRANSACTION)
+                results = await tr.commit("b")
+            self.assertEqual(len(results), 1)
+            self.assertEqual(conn.transaction_status, TransactionStatus.IDLE)
+            self.assertEqual(
+                [query for query, _ in self.server.queries[queries:]],
+                ["BEGIN ISOLATION LEVEL SERIALIZABLE", "a", "b", "COMMIT"])
+
+    async def test_transaction_rollback(self):
+        async with self.pool.acquire() as conn:
+            queries = len(self.server.queries)
+            with self.assertRaises(KeyError):
+                async with conn.transaction():
+                    await conn.execute("a")
+                    raise KeyError
+            self.assertEqual(conn.transaction_status, TransactionStatus.IDLE)
+            self.assertEqual(
+                [query for query, _ in self.server.queries[queries:]],
+                ["BEGIN", "a", "ROLLBACK"])
+
+    async def test_prepare(self):
+        async with self.pool.acquire() as conn:
+            statement = await conn.prepare("SELECT $1::int4")
+            self.assertEqual(statement.parameter_types, (INT4OID,))
+            results = await statement.execute([1])
+            self.assertEqual(results[0].data, [(1,)])
+            await statement.close()
+
+    async def test_prepared_start_error(self):
+        async with self.pool.acquire() as conn:
+            statement = await conn.prepare("SELECT $1::int4")
+            with self.assertRaises(ValueError):
+                await statement.fetch_into([], [1])
+            results = await statement.execute([1])
+            self.assertEqual(results[0].data, [(1,)])
+
+    async def test_released(self):
+        conn = await self.pool.acquire()
+        self.pool.release(conn)
+        with self.assertRaises(poqaio.ProtocolError):
+            await conn.execute("a")
+        with self.assertRaises(poqaio.ProtocolError):
+            conn.transaction()
+
+    async def test_status(self):
+        async with self.pool.acquire() as conn:
+            self.assertEqual(conn.server_version, "14.0")
+            self.assertGreater(conn.stats.bytes_sent, 0)
+            with self.assertRaises(AttributeError):
+                conn.set_row_factory
+
+    async def test_cancelled_query(self):
+        for _ in range(2):
+            task = asyncio.ensure_future(self.pool.execute("slow"))
+            await asyncio.sleep(0.05)
+            task.cancel()
+            with self.assertRaises(asyncio.CancelledError):
+                await task
+        # both connections are replaced, none returns the slow result
+        for _ in range(4):
+            self.assertEqual((await self.pool.execute("fast"))[0].tag, 'fast')
+        await asyncio.sleep(0.3)
+        for _ in range(4):
+            self.assertEqual((await self.pool.execute("fast"))[0].tag, 'fast')
+
+    async def test_server_error_keeps_connection(self):
+        async with self.pool.acquire() as conn:
+            with self.assertRaises(poqaio.ServerError):
+                await conn.execute("bad")
+            self.assertFalse(conn._broken)
+            self.assertEqual((await conn.execute("fast"))[0].tag, 'fast')
+
+    async def test_replace(self):
+        shard = self.pool._shards[0]
+        connect = shard._connect
+        failures = [poqaio.Error("refused"), OSError("unreachable")]
+
+        async def failing_connect():
+            if failures:
+                raise failures.pop(0)
+            return await connect()
+
+        shard._connect = failing_connect
+        with self.assertLogs('poqaio.pool', 'WARNING') as logs:
+            conns = [await self.pool.acquire() for _ in range(2)]
+            broken = next(conn for conn in conns if conn.shard == 0)
+            broken._broken = True
+            for conn in conns:
+                self.pool.release(conn)
+            conns = [await asyncio.wait_for(self.pool.acquire(), 5)
+                     for _ in range(2)]
+        self.assertEqual(len(logs.records), 2)
+        for conn in conns:
+            self.assertEqual(len(await conn.execute("a")), 1)
+            self.pool.release(conn)
+
+
+if __name__ == '__main__':
+    unittest.main()
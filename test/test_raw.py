@@ -0,0 +1,48 @@
+import unittest
+
+import poqaio
+
+from bench.mockserver import MockServer, rows_response
+
+
+class RawRowsStatsTest(unittest.IsolatedAsyncioTestCase):
+
+    async def asyncSetUp(self):
+        self.server = await MockServer(
+            default=lambda query, params: rows_response(100)).start()
+        self.conn = await poqaio.connect(
+            host=self.server.host, port=self.server.port)
+
+    async def asyncTearDown(self):
+        await self.conn.close()
+        await self.server.close()
+
+    async def test_fetch_raw_not_spilled(self):
+        full = (await self.conn.execute("SELECT x"))[0].data
+        rows = await self.conn.fetch_raw("SELECT x")
+        self.assertEqual(list(rows), full)
+        self.assertEqual(rows.spilled_rows, 0)
+        stats = self.conn.stats
+        self.assertEqual(stats.spilled_results, 0)
+        self.assertEqual(stats.spilled_bytes, 0)
+
+    async def test_fetch_raw_over_budget(self):
+        self.conn.set_memory_budget(0)
+        rows = await self.conn.fetch_raw("SELECT x")
+        self.assertEqual(len(rows), 100)
+        stats = self.conn.stats
+        self.assertEqual(stats.spilled_results, 0)
+        self.assertEqual(stats.spilled_bytes, 0)
+
+    async def test_spilled(self):
+        rows = (await self.conn.execute("SELECT x", memory_budget=0))[0].data
+        stats = self.conn.stats
+        self.assertEqual(stats.spilled_results, 1)
+        self.assertEqual(stats.spilled_bytes, rows.nbytes)
+        self.assertEqual(rows.spilled_rows, len(rows))
+        await self.conn.fetch_raw("SELECT x")
+        self.assertEqual(self.conn.stats.spilled_bytes, rows.nbytes)
+
+
+if __name__ == '__main__':
+    unittest.main()
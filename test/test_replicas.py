@@ -0,0 +1,50 @@
+import time
+import unittest
+
+import poqaio
+
+from bench.mockserver import MockServer, Response
+
+
+class ReplicaPoolTest(unittest.IsolatedAsyncioTestCase):
+
+    async def asyncSetUp(self):
+        self.primary = await MockServer(
+            default=lambda query, params: Response(tag='primary')).start()
+        self.standby = await MockServer(
+            default=lambda query, params: Response(tag='standby'),
+            standby=True).start()
+
+    async def asyncTearDown(self):
+        await self.primary.close()
+        await self.standby.close()
+
+    async def create_pool(self, **kwargs):
+        servers = (self.primary, self.standby)
+        return await poqaio.create_replica_pool(
+            host=','.join(server.host for server in servers),
+            port=','.join(str(server.port) for server in servers),
+            probe_interval=0, **kwargs)
+
+    async def test_connect_error_fails_over(self):
+        async with await self.create_pool() as pool:
+            # new connections to the standby fail with a server error
+            self.standby.auth = 'md5'
+            self.standby.password = 'secret'
+            results = await pool.execute("r", readonly=True)
+            self.assertEqual(results[0].tag, 'primary')
+            self.assertTrue(pool.servers[1]['down'])
+
+    async def test_probe_timeout(self):
+        self.standby.latency = 2
+        start = time.monotonic()
+        async with await self.create_pool(probe_timeout=0.1) as pool:
+            self.assertLess(time.monotonic() - start, 1)
+            self.assertEqual(
+                [server['down'] for server in pool.servers], [False, True])
+            results = await pool.execute("r", readonly=True)
+            self.assertEqual(results[0].tag, 'primary')
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,66 @@
+import unittest
+
+import poqaio
+from poqaio.public_const import INT4OID, TEXTOID
+
+from bench import wire
+from bench.mockserver import MockServer
+
+CHANGES = [
+    (100, wire.pgoutput_relation(
+        16384, 'public', 'items',
+        [('id', INT4OID, True), ('name', TEXTOID, False)])),
+    (100, wire.pgoutput_begin(400, 77, 1_000_000)),
+    (200, wire.pgoutput_insert(16384, ['1', 'a'])),
+    (400, wire.pgoutput_commit(400, 480, 1_000_000)),
+]
+# end of the WAL data received
+WAL_END = max(lsn + len(payload) for lsn, payload in CHANGES)
+
+
+class FeedbackTest(unittest.IsolatedAsyncioTestCase):
+
+    async def asyncSetUp(self):
+        self.server = await MockServer(replication=CHANGES).start()
+        self.server.keepalive = False
+        self.conn = await poqaio.connect(
+            host=self.server.host, port=self.server.port,
+            replication='database')
+
+    async def asyncTearDown(self):
+        await self.conn.close()
+        await self.server.close()
+
+    async def stream(self, lsn):
+        # receives the changes up to the commit, then acknowledges lsn and
+        # sends a standby status update
+        async with self.conn.start_replication(
+                'slot', ['pub'], feedback_interval=60) as stream:
+            async for changes in stream:
+                if any(change.kind == 'C' for change in changes):
+                    break
+            stream.acknowledge(lsn)
+            stream.send_feedback()
+        return self.server.feedback[-1]
+
+    async def test_received(self):
+        written, flushed, applied, _, _ = await self.stream(400)
+        self.assertEqual(written, WAL_END)
+        self.assertEqual(flushed, 400)
+        self.assertEqual(applied, 400)
+
+    async def test_flushed_not_after_received(self):
+        written, flushed, _, _, _ = await self.stream(1 << 40)
+        self.assertEqual(written, WAL_END)
+        self.assertEqual(flushed, WAL_END)
+
+    async def test_keepalive(self):
+        self.server.keepalive = True
+        self.server.replication.append((600, wire.pgoutput_begin(700, 78, 0)))
+        written, flushed, _, _, _ = await self.stream(400)
+        self.assertEqual(written, 600 + len(self.server.replication[-1][1]))
+        self.assertEqual(flushed, 400)
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,34 @@
+import unittest
+
+import poqaio
+
+from bench.mockserver import MockServer, rows_response
+
+
+class TimelineTest(unittest.IsolatedAsyncioTestCase):
+
+    async def asyncSetUp(self):
+        self.server = await MockServer(
+            default=lambda query, params: rows_response(2)).start()
+        self.conn = await poqaio.connect(
+            host=self.server.host, port=self.server.port)
+
+    async def asyncTearDown(self):
+        await self.conn.close()
+        await self.server.close()
+
+    async def test_ring(self):
+        self.conn.set_timeline_sink(4)
+        await self.conn.execute("SELECT x")
+        await self.conn.execute("SELECT x", [1])
+        self.assertEqual(len(self.conn.drain_timelines()), 2)
+        self.assertEqual(self.conn.drain_timelines(), [])
+
+    async def test_bool_sink(self):
+        for sink in (True, False):
+            with self.assertRaises(TypeError):
+                self.conn.set_timeline_sink(sink)
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,55 @@
+import unittest
+
+import poqaio
+from poqaio.common import TransactionStatus
+
+from bench.mockserver import MockServer, Response, rows_response
+
+
+class TransactionTest(unittest.IsolatedAsyncioTestCase):
+
+    async def asyncSetUp(self):
+        script = {
+            'bad syntax': Response(
+                error=('42601', 'syntax error'), syntax_error=True),
+            'bad value': Response(error=('22012', 'division by zero')),
+        }
+        self.server = await MockServer(
+            script, default=lambda query, params: rows_response(1)).start()
+        self.conn = await poqaio.connect(
+            host=self.server.host, port=self.server.port)
+
+    async def asyncTearDown(self):
+        await self.conn.close()
+        await self.server.close()
+
+    def queries(self, start):
+        return [query for query, _ in self.server.queries[start:]]
+
+    async def test_begin_not_run(self):
+        start = len(self.server.queries)
+        async with self.conn.transaction() as tr:
+            with self.assertRaises(poqaio.ServerError):
+                await self.conn.execute("bad syntax")
+            self.assertEqual(
+                self.conn.transaction_status, TransactionStatus.IDLE)
+            await self.conn.execute("a")
+            self.assertEqual(
+                self.conn.transaction_status, TransactionStatus.TRANSACTION)
+            await tr.commit("b")
+        self.assertEqual(self.queries(start), [
+            "BEGIN;\nbad syntax", "BEGIN", "a", "b", "COMMIT"])
+
+    async def test_failed_query(self):
+        with self.assertRaises(poqaio.Error):
+            async with self.conn.transaction():
+                await self.conn.execute("a")
+                with self.assertRaises(poqaio.ServerError):
+                    await self.conn.execute("bad value")
+                self.assertEqual(
+                    self.conn.transaction_status, TransactionStatus.ERROR)
+        self.assertEqual(self.conn.transaction_status, TransactionStatus.IDLE)
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,67 @@
+import asyncio
+import socket
+import unittest
+
+import poqaio
+from poqaio.protocol import PGProtocol
+from poqaio.transport import open_direct
+
+from bench.mockserver import MockServer, Response
+
+
+class DirectTransportTest(unittest.IsolatedAsyncioTestCase):
+
+    async def test_next_address(self):
+        # the first address refuses the connection
+        refused = await MockServer().start()
+        await refused.close()
+        loop = asyncio.get_running_loop()
+        resolved = []
+
+        async def getaddrinfo(host, port, **kwargs):
+            resolved.append(host)
+            return [
+                (socket.AF_INET, socket.SOCK_STREAM, socket.IPPROTO_TCP, '',
+                 ('127.0.0.1', address_port))
+                for address_port in (refused.port, port)]
+
+        loop.getaddrinfo = getaddrinfo
+        async with MockServer(
+                default=lambda query, params: Response(tag='OK')) as server:
+            conn = await poqaio.connect(
+                host='db.test', port=server.port, direct=True)
+            self.assertEqual((await conn.execute("x"))[0].tag, 'OK')
+            await conn.close()
+        self.assertEqual(resolved, ['db.test'])
+
+    async def test_all_addresses_refused(self):
+        refused = await MockServer().start()
+        await refused.close()
+        with self.assertRaises(ConnectionRefusedError):
+            await poqaio.connect(
+                host='127.0.0.1', port=refused.port, direct=True)
+
+    async def test_close_flushes(self):
+        received = asyncio.get_running_loop().create_future()
+
+        async def serve(reader, writer):
+            received.set_result(len(await reader.read()))
+            writer.close()
+
+        server = await asyncio.start_server(serve, '127.0.0.1', 0)
+        try:
+            transport, protocol = await open_direct(
+                asyncio.get_running_loop(), PGProtocol, '127.0.0.1',
+                server.sockets[0].getsockname()[1])
+            data = b'x' * (32 << 20)
+            transport.write(data)
+            self.assertGreater(transport.get_write_buffer_size(), 0)
+            transport.close()
+            self.assertEqual(await asyncio.wait_for(received, 10), len(data))
+        finally:
+            server.close()
+            await server.wait_closed()
+
+
+if __name__ == '__main__':
+    unittest.main()